@@ -0,0 +1,148 @@
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <vector>
+
+#include "../Runtime/EventLoop.hpp"
+
+// Async benchmark
+//
+// Parks N coroutines on N eventfds at once, spread over one event loop per core. The coroutines
+// have the shape the compiler gives `x = await readable(fd)` followed by a nested await. Once all
+// of them wait, every eventfd is signalled, and the benchmark reports resident memory per waiting
+// coroutine and how long waking all of them took. The coroutines call the runtime's xec_* entry
+// points, so link Runtime/EntryPoints.cpp in as well.
+//
+// Usage: AsyncBenchmark [waiters] [event loops]
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<size_t> waiting{0};
+static std::atomic<int64_t> total{0};
+
+// Returns its argument after yielding to the loop once
+struct Echo : xec::AsyncFrame {
+    int64_t value;
+
+    static void resume(xec::AsyncFrame* frame) {
+        auto* self = static_cast<Echo*>(frame);
+        switch (self->state) {
+            case 0:
+                self->state = 1;
+                xec_await_sleep(self, 0);
+                return;
+            case 1:
+                xec_async_return(self, self->value);
+                return;
+        }
+    }
+};
+
+struct Waiter : xec::AsyncFrame {
+    int fd;
+    xec::AsyncFrame* child;
+
+    static void resume(xec::AsyncFrame* frame) {
+        auto* self = static_cast<Waiter*>(frame);
+        switch (self->state) {
+            case 0:
+                self->state = 1;
+                waiting.fetch_add(1, std::memory_order_relaxed);
+                xec_await_readable(self, self->fd);
+                return;
+            case 1: {
+                uint64_t value = 0;
+                if (read(self->fd, &value, sizeof(value)) != sizeof(value)) {
+                    value = 0;
+                }
+                auto* echo = static_cast<Echo*>(xec_async_frame(sizeof(Echo), &Echo::resume));
+                echo->value = static_cast<int64_t>(value);
+                self->child = echo;
+                self->state = 2;
+                if (xec_await(self, echo)) {
+                    return;
+                }
+            }
+            // fallthrough
+            case 2:
+                total.fetch_add(xec_async_take(self->child), std::memory_order_relaxed);
+                close(self->fd);
+                xec_async_return(self, 0);
+                return;
+        }
+    }
+};
+
+size_t residentBytes() {
+    long pages = 0, resident = 0;
+    if (FILE* statm = std::fopen("/proc/self/statm", "r")) {
+        if (std::fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        std::fclose(statm);
+    }
+    return static_cast<size_t>(resident) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+int main(int argc, char* argv[]) {
+    size_t waiters = argc > 1 ? std::stoul(argv[1]) : 10000;
+    unsigned loops = argc > 2 ? static_cast<unsigned>(std::stoul(argv[2])) : std::max(1u, std::thread::hardware_concurrency());
+
+    rlimit files{};
+    getrlimit(RLIMIT_NOFILE, &files);
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+    if (waiters + 64 > files.rlim_cur) {
+        waiters = files.rlim_cur > 64 ? files.rlim_cur - 64 : 1;
+        std::cout << "File descriptor limit: using " << waiters << " waiters" << std::endl;
+    }
+
+    xec::Scheduler scheduler(loops);
+    std::vector<int> fds;
+    size_t before = residentBytes();
+    for (size_t i = 0; i < waiters; i++) {
+        int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (fd < 0) {
+            std::cerr << "eventfd failed after " << i << " waiters" << std::endl;
+            return 1;
+        }
+        fds.push_back(fd);
+        auto* waiter = static_cast<Waiter*>(xec_async_frame(sizeof(Waiter), &Waiter::resume));
+        waiter->fd = fd;
+        scheduler.spawn(waiter);
+    }
+
+    size_t parked = 0;
+    double wakeSeconds = 0;
+    std::thread signaller([&] {
+        while (waiting.load(std::memory_order_relaxed) < waiters) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20)); // Let the last epoll_ctl land
+        parked = residentBytes();
+        auto start = Clock::now();
+        for (int fd : fds) {
+            uint64_t one = 1;
+            if (write(fd, &one, sizeof(one)) != sizeof(one)) {
+                std::cerr << "eventfd write failed" << std::endl;
+            }
+        }
+        wakeSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    });
+    auto start = Clock::now();
+    scheduler.run();
+    double runSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+    signaller.join();
+
+    double perWaiter = parked > before ? static_cast<double>(parked - before) / waiters : 0.0;
+    std::cout << "Async benchmark: " << waiters << " waiters on " << scheduler.size() << " event loops" << std::endl;
+    std::cout << std::fixed << std::setprecision(1) << "  frame " << sizeof(Waiter) << " B, resident " << perWaiter
+              << " B per waiting coroutine (including the eventfd registration)" << std::endl;
+    std::cout << "  signalled in " << wakeSeconds * 1e3 << " ms, all finished after " << runSeconds * 1e3 << " ms ("
+              << (total.load() == static_cast<int64_t>(waiters) ? "ok" : "MISMATCH") << ")" << std::endl;
+    return total.load() == static_cast<int64_t>(waiters) ? 0 : 1;
+}
@@ -0,0 +1,164 @@
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../Runtime/Channel.hpp"
+
+// Channel benchmark
+//
+// Pushes messages through fan-out/fan-in shapes and reports millions of messages per second:
+// SPSC and MPMC channels one message at a time and in batches, against a mutex and condition
+// variable queue of the same capacity. Every shape checks that the sum received equals the sum
+// sent.
+//
+// Usage: ChannelBenchmark [messages per producer] [producers] [consumers] [capacity]
+
+using Clock = std::chrono::steady_clock;
+
+// The baseline: what stages used before channels
+class LockedQueue {
+public:
+    explicit LockedQueue(size_t capacity) : capacity(capacity) {}
+
+    void send(int64_t value) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [&] { return values.size() < capacity; });
+        values.push_back(value);
+        notEmpty.notify_one();
+    }
+
+    bool receive(int64_t& value) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [&] { return !values.empty() || closed; });
+        if (values.empty()) {
+            return false;
+        }
+        value = values.front();
+        values.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notEmpty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    std::deque<int64_t> values;
+    bool closed = false;
+};
+
+// Runs `producers` threads calling produce(index) and `consumers` threads whose consume() returns
+// the sum it received; close() runs once every producer finished
+template <typename Produce, typename Consume, typename Close>
+void measure(const std::string& name, size_t producers, size_t consumers, size_t messages, Produce produce,
+             Consume consume, Close close) {
+    std::atomic<int64_t> total{0};
+    auto start = Clock::now();
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < producers; i++) {
+        threads.emplace_back([&, i] { produce(i); });
+    }
+    for (size_t i = 0; i < consumers; i++) {
+        threads.emplace_back([&] { total.fetch_add(consume(), std::memory_order_relaxed); });
+    }
+    for (size_t i = 0; i < producers; i++) {
+        threads[i].join();
+    }
+    close();
+    for (size_t i = producers; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    int64_t expected = static_cast<int64_t>(producers * messages * (messages + 1) / 2);
+    std::cout << "  " << std::left << std::setw(24) << name << std::right << std::setw(8)
+              << producers * messages / seconds / 1e6 << " M msg/s (" << (total.load() == expected ? "ok" : "MISMATCH") << ")"
+              << std::endl;
+}
+
+template <typename ChannelType>
+void measureChannel(const std::string& name, size_t producers, size_t consumers, size_t messages, size_t capacity,
+                    size_t batch) {
+    ChannelType channel(capacity);
+    measure(name, producers, consumers, messages,
+            [&](size_t) {
+                std::vector<int64_t> values(batch);
+                for (size_t i = 1; i <= messages;) {
+                    size_t count = std::min(batch, messages + 1 - i);
+                    for (size_t k = 0; k < count; k++) {
+                        values[k] = static_cast<int64_t>(i + k);
+                    }
+                    if (count == 1) {
+                        channel.send(values[0]);
+                    } else {
+                        channel.sendBatch(values.data(), count);
+                    }
+                    i += count;
+                }
+            },
+            [&] {
+                std::vector<int64_t> values(batch);
+                int64_t sum = 0;
+                if (batch == 1) {
+                    int64_t value;
+                    while (channel.receive(value)) {
+                        sum += value;
+                    }
+                    return sum;
+                }
+                while (size_t count = channel.receiveBatch(values.data(), batch)) {
+                    for (size_t k = 0; k < count; k++) {
+                        sum += values[k];
+                    }
+                }
+                return sum;
+            },
+            [&] { channel.close(); });
+}
+
+int main(int argc, char* argv[]) {
+    size_t messages = argc > 1 ? std::stoul(argv[1]) : 2000000;
+    size_t producers = argc > 2 ? std::stoul(argv[2]) : 4;
+    size_t consumers = argc > 3 ? std::stoul(argv[3]) : 4;
+    size_t capacity = argc > 4 ? std::stoul(argv[4]) : 1024;
+    std::cout << "Channel benchmark: " << messages << " messages per producer, capacity " << capacity << ", "
+              << std::thread::hardware_concurrency() << " cores" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+
+    measureChannel<xec::SpscChannel<int64_t>>("spsc 1:1", 1, 1, messages, capacity, 1);
+    measureChannel<xec::SpscChannel<int64_t>>("spsc 1:1 batch 64", 1, 1, messages, capacity, 64);
+    measureChannel<xec::Channel<int64_t>>("mpmc 1:1", 1, 1, messages, capacity, 1);
+    measureChannel<xec::Channel<int64_t>>("mpmc " + std::to_string(producers) + ":" + std::to_string(consumers), producers,
+                                          consumers, messages, capacity, 1);
+    measureChannel<xec::Channel<int64_t>>("mpmc " + std::to_string(producers) + ":" + std::to_string(consumers) + " batch 64",
+                                          producers, consumers, messages, capacity, 64);
+
+    LockedQueue locked(capacity);
+    measure("mutex " + std::to_string(producers) + ":" + std::to_string(consumers), producers, consumers, messages,
+            [&](size_t) {
+                for (size_t i = 1; i <= messages; i++) {
+                    locked.send(static_cast<int64_t>(i));
+                }
+            },
+            [&] {
+                int64_t value, sum = 0;
+                while (locked.receive(value)) {
+                    sum += value;
+                }
+                return sum;
+            },
+            [&] { locked.close(); });
+    return 0;
+}
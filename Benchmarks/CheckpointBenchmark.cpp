@@ -0,0 +1,176 @@
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <vector>
+
+#include "../Runtime/Checkpoint.hpp"
+
+// Checkpoint benchmark
+//
+// Runs inputFile | mask() | tally() | writeTo(file), where tally is a stateful stage holding a
+// large table of counters of which only a few blocks change between checkpoints, and reports GB/s
+// with and without checkpoints, along with how many state bytes each checkpoint wrote against
+// how many it reused. Then it kills a checkpointed run halfway with SIGKILL, resumes it from the
+// checkpoint directory, and checks that the output file matches the uninterrupted run.
+//
+// Usage: CheckpointBenchmark [total MB] [interval ms] [state MB]
+
+using Clock = std::chrono::steady_clock;
+
+// Counts bytes per chunk into one slot of a large table, and a byte histogram
+class TallyStage : public xec::Stage, private xec::Checkpointable {
+public:
+    explicit TallyStage(size_t stateBytes) : counters(stateBytes / sizeof(uint64_t)) {}
+
+    std::string name() const override { return "tally"; }
+
+    void process(xec::Chunk chunk, xec::Emitter& out) override {
+        for (uint8_t byte : chunk) {
+            histogram[byte]++;
+        }
+        counters[(chunk.sequence * 2654435761u) % counters.size()] += chunk.size;
+        out.emit(std::move(chunk));
+    }
+
+    xec::Checkpointable* checkpointable() override { return this; }
+
+private:
+    std::vector<uint64_t> counters;
+    uint64_t histogram[256] = {};
+
+    void saveState(xec::StateWriter& out) override {
+        out.bytes(histogram, sizeof(histogram));
+        out.bytes(counters.data(), counters.size() * sizeof(uint64_t));
+    }
+
+    void loadState(xec::StateReader& in) override {
+        in.bytes(histogram, sizeof(histogram));
+        in.bytes(counters.data(), counters.size() * sizeof(uint64_t));
+    }
+};
+
+struct Settings {
+    std::string input;
+    size_t stateBytes;
+    std::chrono::milliseconds interval;
+};
+
+// With a checkpoint directory, resumes from it and keeps checkpointing into it
+double runPipeline(const Settings& settings, const std::string& output, const std::string& directory,
+                   xec::CheckpointStats* stats = nullptr) {
+    xec::FileSinkOptions sinkOptions;
+    sinkOptions.resume = !directory.empty();
+    xec::Pipeline pipeline;
+    pipeline.from(std::make_unique<xec::MappedFileSource>(settings.input));
+    pipeline.then(xec::makeMapStage("mask", [](xec::Chunk& chunk) {
+        for (uint8_t& byte : chunk) {
+            byte ^= 0x5a;
+        }
+    }));
+    pipeline.then(std::make_unique<TallyStage>(settings.stateBytes));
+    pipeline.to(std::make_unique<xec::FileSink>(output, sinkOptions));
+
+    std::unique_ptr<xec::DirectoryCheckpointStore> store;
+    if (!directory.empty()) {
+        xec::CheckpointOptions options;
+        options.interval = settings.interval;
+        store = std::make_unique<xec::DirectoryCheckpointStore>(directory, options);
+        pipeline.checkpointTo(*store);
+    }
+    auto start = Clock::now();
+    pipeline.run();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    if (store) {
+        store->wait();
+        if (stats) {
+            *stats = store->stats();
+        }
+    }
+    return seconds;
+}
+
+bool sameContents(const std::string& a, const std::string& b) {
+    xec::MappedFileSource first(a), second(b);
+    if (first.fileSize() != second.fileSize()) {
+        return false;
+    }
+    xec::Chunk x, y;
+    while (first.next(x) && second.next(y)) {
+        if (x.size != y.size || std::memcmp(x.begin(), y.begin(), x.size) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    size_t totalMB = argc > 1 ? std::stoul(argv[1]) : 1024;
+    Settings settings;
+    settings.interval = std::chrono::milliseconds(argc > 2 ? std::stoul(argv[2]) : 100);
+    settings.stateBytes = (argc > 3 ? std::stoul(argv[3]) : 64) << 20;
+    settings.input = "/tmp/xec-checkpoint-benchmark.in";
+    std::string reference = "/tmp/xec-checkpoint-benchmark.reference";
+    std::string output = "/tmp/xec-checkpoint-benchmark.out";
+    std::string directory = "/tmp/xec-checkpoint-benchmark.checkpoints";
+    auto removeCheckpoints = [&] {
+        std::remove(output.c_str());
+        std::system(("rm -rf " + directory).c_str());
+    };
+
+    {
+        std::vector<uint8_t> block(1 << 20);
+        std::mt19937_64 random(1);
+        for (auto& byte : block) {
+            byte = static_cast<uint8_t>(random() % 64 + 32);
+        }
+        FILE* file = std::fopen(settings.input.c_str(), "wb");
+        for (size_t i = 0; i < totalMB; i++) {
+            block[i % block.size()] ^= 1;
+            std::fwrite(block.data(), 1, block.size(), file);
+        }
+        std::fclose(file);
+    }
+    std::cout << "Checkpoint benchmark: " << totalMB << " MB, " << (settings.stateBytes >> 20) << " MB of stage state, checkpoint every "
+              << settings.interval.count() << " ms" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+
+    double bytes = static_cast<double>(totalMB) * (1 << 20);
+    double plain = runPipeline(settings, reference, "");
+    std::cout << "  no checkpoints   " << std::setw(8) << bytes / plain / 1e9 << " GB/s" << std::endl;
+
+    removeCheckpoints();
+    xec::CheckpointStats stats;
+    double checkpointed = runPipeline(settings, output, directory, &stats);
+    std::cout << "  checkpoints      " << std::setw(8) << bytes / checkpointed / 1e9 << " GB/s  " << stats.completed
+              << " checkpoints, " << stats.bytesWritten / double(1 << 20) << " MB written, " << stats.bytesReused / double(1 << 20)
+              << " MB reused, last took " << stats.lastWriteSeconds * 1e3 << " ms" << std::endl;
+
+    // Crash halfway through, then resume
+    removeCheckpoints();
+    pid_t child = fork();
+    if (child == 0) {
+        runPipeline(settings, output, directory);
+        _exit(0);
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(checkpointed / 2));
+    kill(child, SIGKILL);
+    waitpid(child, nullptr, 0);
+    xec::CheckpointStats resumed;
+    runPipeline(settings, output, directory, &resumed);
+    bool ok = sameContents(output, reference);
+    std::cout << "  killed and resumed from checkpoint " << resumed.lastId - resumed.completed << ": " << (ok ? "ok" : "MISMATCH")
+              << std::endl;
+
+    removeCheckpoints();
+    std::remove(reference.c_str());
+    std::remove(settings.input.c_str());
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+// Compiler benchmark
+//
+// Generates synthetic modules, compiles each with the driver built from Compiler/TieItAllTogether.cpp
+// under --time-trace, and reports milliseconds per phase (lexing, parsing, semantic analysis and
+// code generation), lines per second, source MB per second and the compiler's peak resident
+// memory. Each module is compiled three times; every phase counts its fastest run.
+//
+//   wide       a few functions with thousands of declarations each
+//   long       100k lines of small functions
+//   deep       functions holding one long pipeline each, one stage per line; the grammar has no
+//              nested blocks, so a long stage chain is the deepest tree it can build
+//   pipelines  thousands of README-style pipelines with named, string and size arguments
+//
+// The results are written as a flat JSON object of metrics. Given a baseline written by an
+// earlier run, every time and memory metric more than the tolerance above its baseline is
+// reported, and the exit status is 1 if any was.
+//
+// Usage: CompilerBenchmark <compiler> [scale] [results.json] [baseline.json] [tolerance %]
+
+using Clock = std::chrono::steady_clock;
+
+struct Workload {
+    std::string name;
+    std::string source;
+    size_t lines;
+};
+
+Workload makeWide(size_t scale) {
+    std::ostringstream out;
+    size_t lines = 0;
+    for (size_t f = 0; f < 20; f++) {
+        out << "function wide" << f << "() {\n";
+        for (size_t v = 0; v < 5000 * scale; v++) {
+            out << "    var v" << v << " = " << (v * 7919) % 100000 << ";\n";
+        }
+        out << "}\n";
+        lines += 5000 * scale + 2;
+    }
+    return {"wide", out.str(), lines};
+}
+
+Workload makeLong(size_t scale) {
+    std::ostringstream out;
+    size_t lines = 0;
+    for (size_t f = 0; lines < 100000 * scale; f++) {
+        out << "function f" << f << "() {\n";
+        for (size_t v = 0; v < 6; v++) {
+            out << "    var x" << v << " = " << f + v << ";\n";
+        }
+        out << "}\n";
+        lines += 8;
+    }
+    return {"long", out.str(), lines};
+}
+
+Workload makeDeep(size_t scale) {
+    std::ostringstream out;
+    size_t lines = 0;
+    for (size_t f = 0; f < 100; f++) {
+        out << "function chain" << f << "() {\n    pipeline {\n        input" << f << "\n";
+        for (size_t s = 0; s < 500 * scale; s++) {
+            out << "        | stage" << s % 97 << "(level=" << s << ")\n";
+        }
+        out << "        writeTo(\"chain" << f << ".dat\")\n    }\n}\n";
+        lines += 500 * scale + 6;
+    }
+    return {"deep", out.str(), lines};
+}
+
+Workload makePipelines(size_t scale) {
+    std::ostringstream out;
+    size_t lines = 0;
+    for (size_t f = 0; f < 5000 * scale; f++) {
+        out << "function handler" << f << "() {\n"
+            << "    var limit = " << (f + 1) * 4096 << ";\n"
+            << "    pipeline {\n"
+            << "        inputStream|parse()|splitChunks(size=256_KB)|truncate(limit=limit, policy=\"fifo\", maxChunks=20)\n"
+            << "        serialize(format=\"binary\")\n"
+            << "        encryptData(key=\"k" << f % 16 << "\")\n"
+            << "        writeTo(\"output" << f << ".dat\")\n"
+            << "    }\n"
+            << "}\n";
+        lines += 9;
+    }
+    return {"pipelines", out.str(), lines};
+}
+
+struct Measurement {
+    std::map<std::string, double> phases;  // Milliseconds per phase
+    double wallMs = 0;
+    long peakRssKB = 0;
+};
+
+// Durations per scope name, from the trace the driver wrote (one event per line)
+std::map<std::string, double> readTrace(const std::string& path) {
+    std::map<std::string, double> phases;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t name = line.find("\"name\":\"");
+        size_t duration = line.find("\"dur\":");
+        if (name == std::string::npos || duration == std::string::npos) {
+            continue;
+        }
+        name += 8;
+        phases[line.substr(name, line.find('"', name) - name)] += std::stod(line.substr(duration + 6)) / 1000.0;
+    }
+    return phases;
+}
+
+Measurement compile(const std::string& compiler, const std::string& input) {
+    std::string output = input + ".s";
+    std::string trace = input + ".trace.json";
+    auto start = Clock::now();
+    pid_t child = fork();
+    if (child == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        std::string traceFlag = "--time-trace=" + trace;
+        execl(compiler.c_str(), compiler.c_str(), input.c_str(), "-o", output.c_str(), traceFlag.c_str(), nullptr);
+        _exit(127);
+    }
+    int status = 0;
+    rusage usage{};
+    wait4(child, &status, 0, &usage);
+    Measurement measurement;
+    measurement.wallMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::cerr << "Compiling " << input << " with " << compiler << " failed" << std::endl;
+        std::exit(2);
+    }
+    measurement.phases = readTrace(trace);
+    measurement.peakRssKB = usage.ru_maxrss;
+    std::remove(output.c_str());
+    std::remove(trace.c_str());
+    return measurement;
+}
+
+// The "metrics" object of a results file
+std::map<std::string, double> readMetrics(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Cannot read baseline " << path << std::endl;
+        std::exit(2);
+    }
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string text = buffer.str();
+    std::map<std::string, double> metrics;
+    size_t begin = text.find('{', text.find("\"metrics\""));
+    size_t end = text.find('}', begin);
+    if (begin == std::string::npos || end == std::string::npos) {
+        return metrics;
+    }
+    std::string body = text.substr(begin + 1, end - begin - 1);
+    for (size_t open = body.find('"'); open != std::string::npos; open = body.find('"', body.find(',', open))) {
+        size_t close = body.find('"', open + 1);
+        metrics[body.substr(open + 1, close - open - 1)] = std::stod(body.substr(body.find(':', close) + 1));
+        if (body.find(',', close) == std::string::npos) {
+            break;
+        }
+    }
+    return metrics;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: CompilerBenchmark <compiler> [scale] [results.json] [baseline.json] [tolerance %]" << std::endl;
+        return 2;
+    }
+    std::string compiler = argv[1];
+    size_t scale = argc > 2 ? std::stoul(argv[2]) : 1;
+    std::string resultsPath = argc > 3 ? argv[3] : "compiler-benchmark.json";
+    std::string baselinePath = argc > 4 ? argv[4] : "";
+    double tolerance = (argc > 5 ? std::stod(argv[5]) : 10.0) / 100.0;
+
+    const char* phaseNames[][2] = {{"Lex", "lex"}, {"Parse", "parse"}, {"Semantic analysis", "analyze"}, {"Codegen", "codegen"}};
+    std::vector<std::pair<std::string, double>> metrics;
+
+    std::cout << "Compiler benchmark: " << compiler << ", scale " << scale << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "  " << std::left << std::setw(10) << "module" << std::right << std::setw(9) << "lines" << std::setw(9) << "MB"
+              << std::setw(10) << "lex ms" << std::setw(10) << "parse ms" << std::setw(10) << "sema ms" << std::setw(10)
+              << "cg ms" << std::setw(10) << "total ms" << std::setw(12) << "klines/s" << std::setw(8) << "MB/s" << std::setw(10)
+              << "RSS MB" << std::endl;
+    for (auto make : {makeWide, makeLong, makeDeep, makePipelines}) {
+        Workload workload = make(scale);
+        std::string input = "/tmp/xec-compiler-benchmark-" + workload.name + ".xec";
+        std::ofstream(input) << workload.source;
+
+        Measurement best;
+        for (int run = 0; run < 3; run++) {
+            Measurement measurement = compile(compiler, input);
+            for (const auto& [phase, ms] : measurement.phases) {
+                best.phases[phase] = run == 0 ? ms : std::min(best.phases[phase], ms);
+            }
+            best.wallMs = run == 0 ? measurement.wallMs : std::min(best.wallMs, measurement.wallMs);
+            best.peakRssKB = std::max(best.peakRssKB, measurement.peakRssKB);
+        }
+        std::remove(input.c_str());
+
+        double megabytes = workload.source.size() / 1e6;
+        double total = best.phases["Compile"];
+        std::cout << "  " << std::left << std::setw(10) << workload.name << std::right << std::setw(9) << workload.lines << std::setw(9)
+                  << megabytes;
+        for (const auto& phase : phaseNames) {
+            std::cout << std::setw(10) << best.phases[phase[0]];
+            metrics.push_back({workload.name + "." + phase[1] + "_ms", best.phases[phase[0]]});
+        }
+        std::cout << std::setw(10) << total << std::setw(12) << workload.lines / total << std::setw(8) << megabytes / (total / 1e3)
+                  << std::setw(10) << best.peakRssKB / 1024.0 << std::endl;
+        metrics.push_back({workload.name + ".total_ms", total});
+        metrics.push_back({workload.name + ".process_ms", best.wallMs});
+        metrics.push_back({workload.name + ".lines_per_second", workload.lines / (total / 1e3)});
+        metrics.push_back({workload.name + ".mb_per_second", megabytes / (total / 1e3)});
+        metrics.push_back({workload.name + ".peak_rss_kb", static_cast<double>(best.peakRssKB)});
+    }
+
+    {
+        std::ofstream out(resultsPath);
+        out << std::fixed << std::setprecision(3);
+        out << "{\n  \"compiler\": \"" << compiler << "\",\n  \"scale\": " << scale << ",\n  \"metrics\": {\n";
+        for (size_t i = 0; i < metrics.size(); i++) {
+            out << "    \"" << metrics[i].first << "\": " << metrics[i].second << (i + 1 < metrics.size() ? ",\n" : "\n");
+        }
+        out << "  }\n}\n";
+        if (!out) {
+            std::cerr << "Cannot write " << resultsPath << std::endl;
+            return 2;
+        }
+    }
+    std::cout << "  results written to " << resultsPath << std::endl;
+    if (baselinePath.empty()) {
+        return 0;
+    }
+
+    // Times under a millisecond are mostly noise, so they never count as regressions
+    std::map<std::string, double> baseline = readMetrics(baselinePath);
+    size_t regressions = 0;
+    for (const auto& [name, value] : metrics) {
+        bool time = name.size() > 3 && name.compare(name.size() - 3, 3, "_ms") == 0;
+        bool memory = name.size() > 3 && name.compare(name.size() - 3, 3, "_kb") == 0;
+        auto old = baseline.find(name);
+        if ((!time && !memory) || old == baseline.end() || old->second <= 0) {
+            continue;
+        }
+        double change = value / old->second - 1.0;
+        if (change > tolerance && (!time || value - old->second > 1.0)) {
+            std::cout << "  REGRESSION " << std::left << std::setw(28) << name << std::right << std::setw(12) << old->second
+                      << " -> " << std::setw(12) << value << " (+" << change * 100 << "%)" << std::endl;
+            regressions++;
+        }
+    }
+    std::cout << "  against " << baselinePath << ": " << (regressions == 0 ? "ok" : "REGRESSED") << std::endl;
+    return regressions == 0 ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../Runtime/Crypto.hpp"
+
+// Crypto and integrity kernel benchmark
+//
+// Checks each kernel against published answers (the GCM spec's test case 2, CRC32C and XXH3 of
+// "123456789"), then reports GB/s for AES-128/256-GCM, CRC32C and XXH3 per implementation over
+// chunk-sized buffers. Finally it runs source | mask() | sink, which touches every byte once,
+// against source | mask() | encryptData | decryptData | sink: what sealing every chunk costs
+// next to the rest of a pipeline.
+//
+// Usage: CryptoBenchmark [total MB] [chunk KB]
+
+using Clock = std::chrono::steady_clock;
+
+template <typename Fn>
+double gigabytesPerSecond(size_t bytesPerCall, size_t calls, Fn fn) {
+    auto start = Clock::now();
+    for (size_t i = 0; i < calls; i++) {
+        fn();
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return static_cast<double>(bytesPerCall) * calls / seconds / 1e9;
+}
+
+bool knownAnswers() {
+    uint8_t zeros[32] = {}, block[16] = {}, tag[16];
+    xec::AesGcm cipher(zeros, 16);
+    cipher.encrypt(zeros, nullptr, 0, block, 16, tag);
+    const uint8_t expectedBlock[16] = {0x03, 0x88, 0xda, 0xce, 0x60, 0xb6, 0xa3, 0x92,
+                                       0xf3, 0x28, 0xc2, 0xb9, 0x71, 0xb2, 0xfe, 0x78};
+    const uint8_t expectedTag[16] = {0xab, 0x6e, 0x47, 0xd4, 0x2c, 0xec, 0x13, 0xbd,
+                                     0xf5, 0x3a, 0x67, 0xb2, 0x12, 0x57, 0xbd, 0xdf};
+    return std::memcmp(block, expectedBlock, 16) == 0 && std::memcmp(tag, expectedTag, 16) == 0 &&
+           xec::crc32c("123456789", 9) == 0xe3069283 && xec::xxh3("123456789", 9) == 0x72dcb18b67a17dffULL;
+}
+
+// Slices of one preallocated buffer, as in PipelineBenchmark
+class BufferSource : public xec::Source {
+public:
+    BufferSource(xec::Chunk buffer, size_t chunkSize, uint64_t totalBytes)
+        : buffer(buffer), chunkSize(chunkSize), remaining(totalBytes) {}
+
+    bool next(xec::Chunk& chunk) override {
+        if (remaining == 0) {
+            return false;
+        }
+        size_t size = static_cast<size_t>(std::min<uint64_t>(chunkSize, remaining));
+        if (offset + size > buffer.size) {
+            offset = 0;
+        }
+        chunk = buffer.slice(offset, size);
+        chunk.sequence = sequence++;
+        offset += size;
+        remaining -= size;
+        return true;
+    }
+
+private:
+    xec::Chunk buffer;
+    size_t chunkSize;
+    uint64_t remaining;
+    size_t offset = 0;
+    uint64_t sequence = 0;
+};
+
+// Reads every word, so the plain pipeline pays for touching the data too
+class SummingSink : public xec::Sink {
+public:
+    void consume(xec::Chunk chunk) override {
+        for (size_t i = 0; i + 8 <= chunk.size; i += 8) {
+            uint64_t word;
+            std::memcpy(&word, chunk.begin() + i, 8);
+            sum += word;
+        }
+        bytes += chunk.size;
+    }
+
+    uint64_t bytes = 0;
+    uint64_t sum = 0;
+};
+
+double runPipeline(bool crypto, xec::Chunk buffer, size_t chunkSize, uint64_t totalBytes, const uint8_t* key) {
+    xec::Pipeline pipeline;
+    auto sink = std::make_unique<SummingSink>();
+    SummingSink* counter = sink.get();
+    pipeline.from(std::make_unique<BufferSource>(buffer, chunkSize, totalBytes));
+    pipeline.then(xec::makeMapStage("mask", [](xec::Chunk& chunk) {
+        for (uint8_t& byte : chunk) {
+            byte ^= 0x5a;
+        }
+    }));
+    if (crypto) {
+        pipeline.then(std::make_unique<xec::SealStage>(key, 16)).then(std::make_unique<xec::OpenStage>(key, 16));
+    }
+    pipeline.to(std::move(sink));
+    auto start = Clock::now();
+    pipeline.run();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return counter->bytes == totalBytes ? totalBytes / seconds / 1e9 : 0.0;
+}
+
+int main(int argc, char* argv[]) {
+    size_t totalMB = argc > 1 ? std::stoul(argv[1]) : 512;
+    size_t chunkSize = (argc > 2 ? std::stoul(argv[2]) : 256) << 10;
+    size_t calls = std::max<size_t>(1, (totalMB << 20) / chunkSize);
+    const xec::CpuFeatures detected = xec::cpuFeatures();
+    std::cout << "Crypto benchmark: " << totalMB << " MB in " << (chunkSize >> 10) << " KB chunks; aes " << detected.aes
+              << " pclmul " << detected.pclmul << " sse4.2 " << detected.sse42 << " avx2 " << detected.avx2 << std::endl;
+    bool ok = knownAnswers();
+    std::cout << "  known answers: " << (ok ? "ok" : "MISMATCH") << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+
+    std::vector<uint8_t> data(chunkSize);
+    std::mt19937_64 random(1);
+    for (auto& byte : data) {
+        byte = static_cast<uint8_t>(random());
+    }
+    uint8_t key[32], iv[12] = {}, tag[16];
+    for (auto& byte : key) {
+        byte = static_cast<uint8_t>(random());
+    }
+
+    // Accelerated kernels first, then with the CPU flags cleared
+    for (int portable = 0; portable < 2; portable++) {
+        if (portable) {
+            xec::cpuFeatures() = xec::CpuFeatures();
+        }
+        for (size_t keyLength : {size_t(16), size_t(32)}) {
+            xec::AesGcm cipher(key, keyLength);
+            size_t rounds = portable ? std::max<size_t>(1, calls / 64) : calls;
+            double rate = gigabytesPerSecond(chunkSize, rounds, [&] { cipher.encrypt(iv, nullptr, 0, data.data(), data.size(), tag); });
+            std::cout << "  aes-" << keyLength * 8 << "-gcm  " << std::setw(14) << cipher.implementation() << std::setw(8) << rate
+                      << " GB/s" << std::endl;
+        }
+        uint32_t crc = 0;
+        double crcRate = gigabytesPerSecond(chunkSize, calls, [&] { crc ^= xec::crc32c(data.data(), data.size()); });
+        std::cout << "  crc32c       " << std::setw(14) << (xec::cpuFeatures().sse42 ? "sse4.2+pclmul" : "slicing-by-8") << std::setw(8)
+                  << crcRate << " GB/s" << std::endl;
+    }
+    xec::cpuFeatures() = detected;
+
+    uint64_t hash = 0;
+    for (auto kernel : {xec::HashKernel::AVX2, xec::HashKernel::SSE2, xec::HashKernel::SCALAR}) {
+        const char* name = kernel == xec::HashKernel::AVX2 ? "avx2" : kernel == xec::HashKernel::SSE2 ? "sse2" : "scalar";
+        double rate = gigabytesPerSecond(chunkSize, calls, [&] { hash ^= xec::xxh3(data.data(), data.size(), 0, kernel); });
+        std::cout << "  xxh3         " << std::setw(14) << name << std::setw(8) << rate << " GB/s" << std::endl;
+    }
+
+    xec::Chunk buffer = xec::Chunk::allocate(chunkSize * 256);
+    std::memset(buffer.begin(), 0x5a, buffer.size);
+    uint64_t totalBytes = static_cast<uint64_t>(calls) * chunkSize;
+    double plain = runPipeline(false, buffer, chunkSize, totalBytes, key);
+    double sealed = runPipeline(true, buffer, chunkSize, totalBytes, key);
+    std::cout << "  pipeline     " << std::setw(14) << "mask" << std::setw(8) << plain << " GB/s" << std::endl;
+    std::cout << "  pipeline     " << std::setw(14) << "mask+seal+open" << std::setw(8) << sealed << " GB/s" << std::endl;
+    ok = ok && plain > 0 && sealed > 0;
+    return ok ? 0 : 1;
+}
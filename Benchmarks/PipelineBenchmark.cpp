@@ -0,0 +1,190 @@
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "../Runtime/Pipeline.hpp"
+
+// Pipeline throughput benchmark
+//
+// Pushes a large byte stream through a multi-stage chain shaped like the README example
+// (source | parseData() | mask() | checksum() | serialize() | sink) and reports GB/s with stage
+// fusion on and off, and with the fused {parseData, mask} group fanned out over several workers.
+// Only `checksum` is stateful, so with fusion the chain runs as three groups ({parseData, mask},
+// {checksum}, {serialize}) instead of four. The sink checks that chunks still arrive in source
+// order, which parallel groups must preserve, and digests the bytes it receives; every mode starts
+// from the same input, so all of them must produce the same digest and checksum. Exits with 1 on
+// a reordered chunk or a mismatch.
+//
+// Usage: PipelineBenchmark [total MB] [chunk KB] [workers]
+
+// Hands out slices of one preallocated buffer, so the source costs nothing per chunk
+class BufferSource : public xec::Source {
+public:
+    BufferSource(xec::Chunk buffer, size_t chunkSize, uint64_t totalBytes)
+        : buffer(buffer), chunkSize(chunkSize), remaining(totalBytes) {}
+
+    bool next(xec::Chunk& chunk) override {
+        if (remaining == 0) {
+            return false;
+        }
+        size_t size = static_cast<size_t>(std::min<uint64_t>(chunkSize, remaining));
+        if (offset + size > buffer.size) {
+            offset = 0;
+        }
+        chunk = buffer.slice(offset, size);
+        chunk.sequence = sequence++;
+        offset += size;
+        remaining -= size;
+        return true;
+    }
+
+private:
+    xec::Chunk buffer;
+    size_t chunkSize;
+    uint64_t remaining;
+    size_t offset = 0;
+    uint64_t sequence = 0;
+};
+
+// Running checksum across the stream; its state is why it cannot be fused
+class ChecksumStage : public xec::Stage {
+public:
+    std::string name() const override { return "checksum"; }
+
+    void process(xec::Chunk chunk, xec::Emitter& out) override {
+        for (uint8_t* p = chunk.begin(); p != chunk.end(); p++) {
+            sum += *p;
+        }
+        out.emit(std::move(chunk));
+    }
+
+    uint64_t sum = 0;
+};
+
+class CountingSink : public xec::Sink {
+public:
+    // The digest runs over the stream in arrival order, a word at a time to keep it cheap
+    // next to the stages being measured
+    void consume(xec::Chunk chunk) override {
+        if (chunk.sequence != chunks) {
+            outOfOrder++;
+        }
+        const uint8_t* p = chunk.begin();
+        const uint8_t* end = chunk.end();
+        for (; end - p >= 8; p += 8) {
+            uint64_t word;
+            std::memcpy(&word, p, sizeof(word));
+            digest = (digest ^ word) * 0x100000001b3ull;
+        }
+        for (; p != end; p++) {
+            digest = (digest ^ *p) * 0x100000001b3ull;
+        }
+        bytes += chunk.size;
+        chunks++;
+    }
+
+    uint64_t digest = 0xcbf29ce484222325ull;
+    uint64_t bytes = 0;
+    uint64_t chunks = 0;
+    uint64_t outOfOrder = 0;
+};
+
+struct ChainResult {
+    size_t groups = 0;
+    double gbps = 0;
+    bool ordered = true;
+    uint64_t bytes = 0;
+    uint64_t digest = 0;
+    uint64_t checksum = 0;
+};
+
+ChainResult runChain(xec::PipelineOptions options, xec::Chunk buffer, size_t chunkSize, uint64_t totalBytes) {
+    xec::Pipeline pipeline(options);
+
+    auto sink = std::make_unique<CountingSink>();
+    CountingSink* counts = sink.get();
+    auto checksumStage = std::make_unique<ChecksumStage>();
+    ChecksumStage* checksum = checksumStage.get();
+    pipeline.from(std::make_unique<BufferSource>(buffer, chunkSize, totalBytes))
+        .then(xec::makeMapStage("parseData", [](xec::Chunk& chunk) {
+            // ASCII lower-casing stands in for a per-byte parse step
+            for (uint8_t* p = chunk.begin(); p != chunk.end(); p++) {
+                *p |= static_cast<uint8_t>((static_cast<unsigned>(*p - 'A') < 26u) << 5);
+            }
+        }))
+        .then(xec::makeMapStage("mask", [](xec::Chunk& chunk) {
+            for (uint8_t* p = chunk.begin(); p != chunk.end(); p++) {
+                *p ^= 0x5a;
+            }
+        }))
+        .then(std::move(checksumStage))
+        .then(xec::makeMapStage("serialize", [](xec::Chunk& chunk) {
+            // Framing only touches the header bytes
+            uint32_t length = static_cast<uint32_t>(chunk.size);
+            std::memcpy(chunk.begin(), &length, std::min(chunk.size, sizeof(length)));
+        }))
+        .to(std::move(sink));
+    ChainResult result;
+    result.groups = pipeline.groups().size();
+
+    auto start = std::chrono::steady_clock::now();
+    pipeline.run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    if (counts->bytes != totalBytes) {
+        std::cerr << "Lost data: " << counts->bytes << " of " << totalBytes << " bytes" << std::endl;
+    }
+    result.gbps = static_cast<double>(totalBytes) / elapsed.count() / 1e9;
+    result.ordered = counts->outOfOrder == 0;
+    result.bytes = counts->bytes;
+    result.digest = counts->digest;
+    result.checksum = checksum->sum;
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t totalBytes = (argc > 1 ? std::stoull(argv[1]) : 4096) << 20;
+    size_t chunkSize = (argc > 2 ? std::stoul(argv[2]) : 256) << 10;
+    unsigned workers = argc > 3 ? static_cast<unsigned>(std::stoul(argv[3])) : std::max(2u, std::thread::hardware_concurrency() / 2);
+
+    // Large enough that the chunks in flight across all rings never overlap
+    size_t bufferSize = std::max<size_t>(chunkSize * 1024, 64u << 20);
+    xec::Chunk buffer = xec::Chunk::allocate(bufferSize);
+
+    std::cout << "Pipeline benchmark: " << (totalBytes >> 20) << " MB in " << (chunkSize >> 10) << " KB chunks" << std::endl;
+    xec::PipelineOptions fused, unfused, parallel;
+    unfused.fuseStages = false;
+    parallel.workers = workers;
+    struct Mode {
+        std::string label;
+        xec::PipelineOptions options;
+    };
+    ChainResult reference;
+    bool first = true;
+    bool ok = true;
+    for (const Mode& mode : {Mode{"fused", fused}, Mode{"unfused", unfused}, Mode{"parallel x" + std::to_string(workers), parallel}}) {
+        // The stages transform the buffer in place, so each mode gets a fresh copy of the input
+        for (size_t i = 0; i < bufferSize; i++) {
+            buffer.begin()[i] = static_cast<uint8_t>('A' + i % 52);
+        }
+        ChainResult result = runChain(mode.options, buffer, chunkSize, totalBytes);
+        if (first) {
+            reference = result;
+            first = false;
+        }
+        bool same = result.bytes == reference.bytes && result.digest == reference.digest &&
+                    result.checksum == reference.checksum;
+        std::cout << std::left << std::setw(12) << mode.label << std::right << std::setw(3) << result.groups
+                  << " groups  " << std::fixed << std::setprecision(2) << result.gbps << " GB/s  "
+                  << (same ? "ok" : "MISMATCH") << std::endl;
+        if (!result.ordered) {
+            std::cerr << "Chunks reordered in " << mode.label << " mode" << std::endl;
+            ok = false;
+        }
+        ok = ok && same;
+    }
+    return ok ? 0 : 1;
+}
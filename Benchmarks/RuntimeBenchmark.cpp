@@ -0,0 +1,603 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <linux/perf_event.h>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "../Runtime/Packet.hpp"
+#include "../Runtime/Pipeline.hpp"
+
+// Runtime benchmark
+//
+// Compiles the README's reference programs with the driver built from
+// Compiler/TieItAllTogether.cpp and runs the generated code:
+//
+//   serialization  inputData | splitChunks(size=256_KB) | truncate(maxChunks=20) | serialize() | writeTo(file)
+//   stream         inputStream | parse() | truncate(maxChunks=64, limit=4_MB) | serialize() | writeTo(file),
+//                  with the stateless groups spread over [workers] threads
+//   packets        replay(pcap, replays) | modifyHeader(flag="ACK") | modifyPayload(data="CustomData") | transmit(pcap)
+//
+// Each program is assembled and linked into a shared object with $CC (default cc), loaded, and
+// its function called. Its xec_* calls resolve to this executable, so build it with
+// Runtime/EntryPoints.cpp and -rdynamic -ldl. Host bindings (Pipeline.hpp, Packet.hpp) hand the
+// program a timed source and sink, or timed ports, in place of the files it names.
+//
+// Each workload reports MB/s and items per second, p50/p99/p99.9 latency and heap allocations per
+// item (malloc is counted). Throughput counts the bytes that reach the sink, so data shed by
+// truncate() is not counted. For chunk pipelines latency runs from the source handing a chunk out
+// to the sink receiving the data. For packets it runs from receiving a burst to transmitting it.
+// Where perf_event_open is permitted, it also reports cycles and instructions per item, IPC and
+// cache misses per item.
+//
+// Usage: RuntimeBenchmark <compiler> [total MB] [workers] [pcap file] [replays]
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<uint64_t> allocations{0};
+
+// Allocations are counted where operator new, the runtime and the loaded program all end up:
+// malloc and aligned_alloc, interposed here and forwarded to glibc. The global operators stay
+// the library's own.
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+
+extern "C" void* malloc(size_t size) noexcept {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size) noexcept {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+uint64_t nanoseconds() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count());
+}
+
+// Cycles, instructions and cache misses of this process and the threads it starts while counting
+class PerfCounters {
+public:
+    PerfCounters() {
+        const uint64_t events[] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES};
+        for (uint64_t event : events) {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = event;
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+            if (fd < 0) {
+                error = std::strerror(errno);
+                break;
+            }
+            fds.push_back(fd);
+        }
+        if (!error.empty()) {
+            close();
+        }
+    }
+
+    ~PerfCounters() { close(); }
+
+    bool available() const { return error.empty(); }
+
+    void start() {
+        for (int fd : fds) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    // {cycles, instructions, cache misses}
+    std::vector<uint64_t> stop() {
+        std::vector<uint64_t> values;
+        for (int fd : fds) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t value = 0;
+            values.push_back(::read(fd, &value, sizeof(value)) == sizeof(value) ? value : 0);
+        }
+        return values;
+    }
+
+    std::string error;
+
+private:
+    std::vector<int> fds;
+
+    void close() {
+        for (int fd : fds) {
+            ::close(fd);
+        }
+        fds.clear();
+    }
+};
+
+// Latencies of delivered items, kept in storage reserved up front so recording never allocates
+class LatencyRecorder {
+public:
+    explicit LatencyRecorder(size_t capacity) : samples(capacity) {}
+
+    void record(uint64_t nanoseconds) {
+        if (count < samples.size()) {
+            samples[count] = nanoseconds;
+        }
+        count++;
+    }
+
+    size_t items() const { return count; }
+
+    // Sorted samples; call once the run is over
+    std::vector<uint64_t> sorted() const {
+        std::vector<uint64_t> kept(samples.begin(), samples.begin() + static_cast<std::ptrdiff_t>(std::min(count, samples.size())));
+        std::sort(kept.begin(), kept.end());
+        return kept;
+    }
+
+private:
+    std::vector<uint64_t> samples;
+    size_t count = 0;
+};
+
+// Slices of one preallocated buffer, stamped with the time each one is handed out
+class TimedSource : public xec::Source {
+public:
+    TimedSource(xec::Chunk buffer, size_t chunkSize)
+        : buffer(buffer), chunkSize(chunkSize), stamps((buffer.size + chunkSize - 1) / chunkSize) {}
+
+    bool next(xec::Chunk& chunk) override {
+        if (offset >= buffer.size) {
+            return false;
+        }
+        size_t index = offset / chunkSize;
+        chunk = buffer.slice(offset, std::min(chunkSize, buffer.size - offset));
+        chunk.sequence = index;
+        stamps[index] = nanoseconds();
+        offset += chunk.size;
+        return true;
+    }
+
+    size_t produced() const { return offset; }
+
+    // When the data came out of this source; 0 for bytes it never produced (headers, copies)
+    uint64_t stampOf(const uint8_t* data) const {
+        if (data < buffer.begin() || data >= buffer.end()) {
+            return 0;
+        }
+        return stamps[static_cast<size_t>(data - buffer.begin()) / chunkSize];
+    }
+
+private:
+    xec::Chunk buffer;
+    size_t chunkSize;
+    std::vector<uint64_t> stamps;
+    size_t offset = 0;
+};
+
+// What the sink of a chunk pipeline saw
+struct Delivery {
+    LatencyRecorder latencies;
+    uint64_t bytes = 0;      // Everything written, record headers included
+    uint64_t payload = 0;    // Of that, bytes that came from the source
+
+    explicit Delivery(size_t capacity) : latencies(capacity) {}
+};
+
+// writeTo(file) that also measures how long the data it receives took to get there
+class TimedFileSink : public xec::Sink {
+public:
+    TimedFileSink(const std::string& path, const TimedSource& source, Delivery& delivery)
+        : file(path), source(source), delivery(delivery) {}
+
+    void consume(xec::Chunk chunk) override {
+        if (uint64_t stamp = source.stampOf(chunk.begin())) {
+            delivery.latencies.record(nanoseconds() - stamp);
+            delivery.payload += chunk.size;
+        }
+        delivery.bytes += chunk.size;
+        file.consume(std::move(chunk));
+    }
+
+    void finish() override { file.finish(); }
+
+private:
+    xec::FileSink file;
+    const TimedSource& source;
+    Delivery& delivery;
+};
+
+// What the ports of a packet program saw. The program receives, modifies and transmits one
+// burst at a time, so the last receive stamp belongs to the burst being transmitted.
+struct PacketTrip {
+    LatencyRecorder latencies{1 << 24};
+    uint64_t stamp = 0;
+    uint64_t received = 0;
+    uint64_t transmitted = 0;
+    uint64_t bytes = 0;      // Transmitted
+};
+
+// replay(): stamps each burst it hands out
+class TimedInputPort : public xec::PacketPort {
+public:
+    TimedInputPort(std::unique_ptr<xec::PacketPort> port, PacketTrip& trip) : port(std::move(port)), trip(trip) {}
+
+    std::string name() const override { return port->name(); }
+
+    size_t receiveBurst(xec::Packet** packets, size_t wanted) override {
+        size_t n = port->receiveBurst(packets, wanted);
+        trip.stamp = nanoseconds();
+        trip.received += n;
+        return n;
+    }
+
+    size_t transmitBurst(xec::Packet** packets, size_t n) override { return port->transmitBurst(packets, n); }
+
+    bool exhausted() const override { return port->exhausted(); }
+
+private:
+    std::unique_ptr<xec::PacketPort> port;
+    PacketTrip& trip;
+};
+
+// transmit(): times and counts what leaves. Lengths are read first, since sent packets go back
+// to their pool.
+class TimedOutputPort : public xec::PacketPort {
+public:
+    TimedOutputPort(std::unique_ptr<xec::PacketPort> port, PacketTrip& trip) : port(std::move(port)), trip(trip) {}
+
+    std::string name() const override { return port->name(); }
+
+    size_t receiveBurst(xec::Packet** packets, size_t wanted) override { return port->receiveBurst(packets, wanted); }
+
+    size_t transmitBurst(xec::Packet** packets, size_t n) override {
+        n = std::min(n, xec::MAX_BURST);
+        uint32_t lengths[xec::MAX_BURST];
+        for (size_t i = 0; i < n; i++) {
+            lengths[i] = packets[i]->length;
+        }
+        size_t sent = port->transmitBurst(packets, n);
+        uint64_t latency = nanoseconds() - trip.stamp;
+        for (size_t i = 0; i < sent; i++) {
+            trip.bytes += lengths[i];
+            trip.latencies.record(latency);
+        }
+        trip.transmitted += sent;
+        return sent;
+    }
+
+private:
+    std::unique_ptr<xec::PacketPort> port;
+    PacketTrip& trip;
+};
+
+// A compiled program, linked as a shared object and loaded into this process
+class Program {
+public:
+    Program(const std::string& library, const std::string& function) {
+        handle = dlopen(library.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (!handle) {
+            throw std::runtime_error(std::string("Cannot load ") + library + ": " + dlerror());
+        }
+        entry = reinterpret_cast<int (*)()>(dlsym(handle, function.c_str()));
+        if (!entry) {
+            dlclose(handle);
+            throw std::runtime_error("No function " + function + " in " + library);
+        }
+    }
+
+    ~Program() { dlclose(handle); }
+
+    Program(const Program&) = delete;
+    Program& operator=(const Program&) = delete;
+
+    void run() const { entry(); }
+
+private:
+    void* handle = nullptr;
+    int (*entry)() = nullptr;
+};
+
+struct Result {
+    std::string name;
+    double compileMs = 0;
+    double seconds = 0;
+    uint64_t bytes = 0;          // Reached the sink
+    uint64_t shed = 0;           // Source bytes that never reached the sink
+    uint64_t allocations = 0;
+    std::vector<uint64_t> latencies;
+    size_t items = 0;
+    std::vector<uint64_t> counters;
+    bool ok = true;
+};
+
+// Text records of 40-200 bytes, so newline framing has boundaries to find
+xec::Chunk makeInput(size_t bytes) {
+    xec::Chunk buffer = xec::Chunk::allocate(bytes);
+    std::mt19937_64 random(7);
+    uint8_t* data = buffer.begin();
+    size_t next = 40 + random() % 160;
+    for (size_t i = 0; i < bytes; i++) {
+        data[i] = i == next ? '\n' : static_cast<uint8_t>('a' + random() % 26);
+        if (i == next) {
+            next += 40 + random() % 160;
+        }
+    }
+    return buffer;
+}
+
+// The program's sources and its writeTo() are bound to a timed source and sink for the run
+Result runChunkPipeline(const Program& program, const std::string& output, const xec::Chunk& input, unsigned workers,
+                        PerfCounters& perf) {
+    TimedSource* source = nullptr;
+    Delivery delivery(input.size / 64);
+    auto timedSource = [&source, &input](const std::string&) {
+        auto timed = std::make_unique<TimedSource>(input, 1 << 20);
+        source = timed.get();
+        return timed;
+    };
+    xec::bindSource("inputData", timedSource);
+    xec::bindSource("inputStream", timedSource);
+    xec::bindSink(output, [&source, &delivery](const std::string& path) -> std::unique_ptr<xec::Sink> {
+        if (!source) {
+            throw std::runtime_error("writeTo() without a bound source");
+        }
+        return std::make_unique<TimedFileSink>(path, *source, delivery);
+    });
+    xec::programPipelineOptions().workers = workers;
+
+    Result result;
+    uint64_t allocated = allocations.load();
+    perf.start();
+    auto start = Clock::now();
+    program.run();
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    result.counters = perf.stop();
+    result.allocations = allocations.load() - allocated;
+    xec::bindSource("inputData", nullptr);
+    xec::bindSource("inputStream", nullptr);
+    xec::bindSink(output, nullptr);
+    if (!source) {
+        throw std::runtime_error("The program did not read its source");
+    }
+    result.bytes = delivery.bytes;
+    result.shed = source->produced() - delivery.payload;
+    result.items = delivery.latencies.items();
+    result.latencies = delivery.latencies.sorted();
+    return result;
+}
+
+// replay() and transmit() open timed wrappers of the ports they name
+Result runPacketProgram(const Program& program, const std::string& capture, const std::string& output, PerfCounters& perf) {
+    PacketTrip trip;
+    xec::bindPort(capture, [&trip](const std::string& spec) { return std::make_unique<TimedInputPort>(xec::openPort(spec), trip); });
+    xec::bindPort(output, [&trip](const std::string& spec) { return std::make_unique<TimedOutputPort>(xec::openPort(spec), trip); });
+
+    Result result;
+    uint64_t allocated = allocations.load();
+    perf.start();
+    auto start = Clock::now();
+    program.run();
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    result.counters = perf.stop();
+    result.allocations = allocations.load() - allocated;
+    xec::bindPort(capture, nullptr);
+    xec::bindPort(output, nullptr);
+    result.bytes = trip.bytes;
+    result.items = trip.latencies.items();
+    result.latencies = trip.latencies.sorted();
+    result.ok = trip.received == trip.transmitted && trip.received > 0;
+    return result;
+}
+
+// IPv4/TCP frames of 64 to 1500 bytes, for when no capture is given
+void writeCapture(const std::string& path, size_t count) {
+    static const size_t sizes[] = {64, 128, 256, 512, 1024, 1500};
+    xec::PacketPool pool(xec::MAX_BURST);
+    xec::PcapWriter writer(path);
+    for (size_t index = 0; index < count; index++) {
+        xec::Packet* packet = pool.allocate();
+        size_t size = sizes[index % (sizeof(sizes) / sizeof(sizes[0]))];
+        uint8_t* frame = packet->append(size);
+        std::memset(frame, 0, size);
+        xec::EthernetView(frame).setEtherType(xec::ETHER_TYPE_IPV4);
+        uint8_t* ip = frame + xec::EthernetView::SIZE;
+        ip[0] = 0x45;
+        xec::Ipv4View ipv4(ip);
+        ipv4.setTotalLength(static_cast<uint16_t>(size - xec::EthernetView::SIZE));
+        ipv4.setTtl(64);
+        ip[9] = xec::IP_PROTOCOL_TCP;
+        ipv4.setSource(0x0a000000u | static_cast<uint32_t>(index & 0xffff));
+        ipv4.setDestination(0x0a010001u);
+        ipv4.updateChecksum();
+        uint8_t* segment = ip + xec::Ipv4View::MIN_SIZE;
+        segment[12] = 5 << 4;
+        xec::TcpView tcp(segment);
+        tcp.setSourcePort(static_cast<uint16_t>(1024 + index % 50000));
+        tcp.setDestinationPort(443);
+        tcp.setFlags(xec::TCP_PSH);
+        packet->timestamp = 1700000000000000000ull + index * 1000;
+        packet->wireLength = packet->length;
+        writer.transmitBurst(&packet, 1);
+    }
+}
+
+// Runs the compiler on a source file; returns milliseconds
+double compile(const std::string& compiler, const std::string& input, const std::string& output) {
+    auto start = Clock::now();
+    pid_t child = fork();
+    if (child == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execl(compiler.c_str(), compiler.c_str(), input.c_str(), "-o", output.c_str(), nullptr);
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw std::runtime_error("Compiling " + input + " with " + compiler + " failed");
+    }
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// Assembles and links generated code into a shared object; $CC picks the compiler driver
+void link(const std::string& assembly, const std::string& library) {
+    const char* cc = std::getenv("CC") ? std::getenv("CC") : "cc";
+    pid_t child = fork();
+    if (child == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        execlp(cc, cc, "-shared", "-o", library.c_str(), assembly.c_str(), nullptr);
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw std::runtime_error("Linking " + assembly + " with " + cc + " failed");
+    }
+}
+
+void report(const Result& result, const PerfCounters& perf) {
+    auto percentile = [&result](double p) {
+        if (result.latencies.empty()) {
+            return 0.0;
+        }
+        size_t index = std::min(result.latencies.size() - 1, static_cast<size_t>(p * result.latencies.size()));
+        return result.latencies[index] / 1e3;
+    };
+    double items = static_cast<double>(std::max<size_t>(result.items, 1));
+    std::cout << "  " << std::left << std::setw(14) << result.name << std::right << std::setw(9) << result.compileMs << " ms"
+              << std::setw(10) << result.bytes / result.seconds / 1e6 << " MB/s" << std::setw(12) << result.items / result.seconds
+              << " items/s" << std::setw(10) << percentile(0.5) << std::setw(10) << percentile(0.99) << std::setw(10)
+              << percentile(0.999) << " us" << std::setw(9) << result.allocations / items << " allocs/item";
+    if (result.shed) {
+        std::cout << "  (" << result.shed / 1e6 << " MB shed)";
+    }
+    std::cout << "  " << (result.ok ? "ok" : "MISMATCH") << std::endl;
+    if (perf.available() && result.counters.size() == 3) {
+        std::cout << "  " << std::setw(14) << "" << std::setw(12) << result.counters[0] / items << " cycles/item" << std::setw(12)
+                  << result.counters[1] / items << " instructions/item  IPC " << double(result.counters[1]) / std::max<uint64_t>(result.counters[0], 1)
+                  << std::setw(10) << result.counters[2] / items << " cache misses/item" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "Usage: RuntimeBenchmark <compiler> [total MB] [workers] [pcap file] [replays]" << std::endl;
+        return 2;
+    }
+    std::string compiler = argv[1];
+    size_t totalMB = argc > 2 ? std::stoul(argv[2]) : 256;
+    unsigned workers = argc > 3 ? static_cast<unsigned>(std::stoul(argv[3])) : 4;
+    std::string capture = argc > 4 ? argv[4] : "";
+    size_t replays = argc > 5 ? std::stoul(argv[5]) : 20;
+    bool synthetic = capture.empty() || capture == "-";
+    if (synthetic) {
+        capture = "/tmp/xec-runtime-benchmark.pcap";
+        writeCapture(capture, 100000);
+    }
+
+    std::string prefix = "/tmp/xec-runtime-benchmark";
+    struct Workload {
+        std::string name;
+        std::string function;
+        std::string output;
+        bool packets;
+        std::string source;
+    };
+    std::vector<Workload> workloads = {
+        {"serialization", "byteChunkPipeline", prefix + ".serialized", false,
+         "function byteChunkPipeline() {\n"
+         "    pipeline {\n"
+         "        inputData|splitChunks(size=256_KB)\n"
+         "        truncate(maxChunks=20)\n"
+         "        serialize()\n"
+         "        writeTo(\"" + prefix + ".serialized\")\n"
+         "    }\n"
+         "}\n"},
+        {"stream", "multithreadedStreamHandler", prefix + ".multithreaded", false,
+         "function multithreadedStreamHandler() {\n"
+         "    pipeline {\n"
+         "        inputStream|parse()|truncate(maxChunks=64, limit=4_MB)\n"
+         "        serialize()\n"
+         "        writeTo(\"" + prefix + ".multithreaded\")\n"
+         "    }\n"
+         "}\n"},
+        {"packets", "osiPacketManipulator", prefix + ".modified.pcap", true,
+         "function osiPacketManipulator() {\n"
+         "    pipeline {\n"
+         "        replay(\"" + capture + "\", " + std::to_string(replays) + ")|modifyHeader(flag=\"ACK\")\n"
+         "        modifyPayload(data=\"CustomData\")\n"
+         "        transmit(\"" + prefix + ".modified.pcap\")\n"
+         "    }\n"
+         "}\n"},
+    };
+
+    PerfCounters perf;
+    xec::Chunk input = makeInput(totalMB << 20);
+    std::cout << "Runtime benchmark: " << compiler << ", " << totalMB << " MB per chunk pipeline, " << workers << " workers, "
+              << capture << " x" << replays << std::endl;
+    std::cout << "  perf counters: " << (perf.available() ? "cycles, instructions, cache misses" : "unavailable (" + perf.error + ")")
+              << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "  " << std::left << std::setw(14) << "workload" << std::right << std::setw(12) << "compile" << std::setw(15)
+              << "throughput" << std::setw(20) << "" << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "p99.9"
+              << std::endl;
+
+    bool ok = true;
+    for (const auto& workload : workloads) {
+        std::string sourcePath = prefix + "-" + workload.name + ".xec";
+        std::string assemblyPath = prefix + "-" + workload.name + ".s";
+        std::string libraryPath = prefix + "-" + workload.name + ".so";
+        std::ofstream(sourcePath) << workload.source;
+        Result result;
+        try {
+            double compileMs = compile(compiler, sourcePath, assemblyPath);
+            link(assemblyPath, libraryPath);
+            Program program(libraryPath, workload.function);
+            result = workload.packets ? runPacketProgram(program, capture, workload.output, perf)
+                                      : runChunkPipeline(program, workload.output, input, workers, perf);
+            result.compileMs = compileMs;
+        } catch (const std::exception& e) {
+            std::cout << "  " << std::left << std::setw(14) << workload.name << std::right << e.what() << "  MISMATCH" << std::endl;
+            result.ok = false;
+        }
+        result.name = workload.name;
+        if (result.seconds > 0) {
+            result.ok = result.ok && result.items > 0;
+            report(result, perf);
+        }
+        ok = ok && result.ok;
+        std::remove(sourcePath.c_str());
+        std::remove(assemblyPath.c_str());
+        std::remove(libraryPath.c_str());
+    }
+
+    for (const char* output : {".serialized", ".multithreaded", ".modified.pcap"}) {
+        std::remove((prefix + output).c_str());
+    }
+    if (synthetic) {
+        std::remove(capture.c_str());
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,87 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../Runtime/Serialization.hpp"
+
+// Serialization benchmark
+//
+// Writes and reads a stream of records shaped like a sensor reading, once with integer samples
+// stored aligned (readable in place) and once stored as varints, and reports size and MB/s for
+// each direction. Readers touch every field so in-place reads are not optimized away.
+//
+// Usage: SerializationBenchmark [records] [samples per record]
+
+using Clock = std::chrono::steady_clock;
+
+double seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    size_t records = argc > 1 ? std::stoul(argv[1]) : 200000;
+    size_t samplesPerRecord = argc > 2 ? std::stoul(argv[2]) : 64;
+
+    xec::Schema schema = xec::Schema::parse(
+        "struct Reading { int id; float value; string source; array[int] samples; tuple(int, bool) flags }");
+    xec::Field id = schema.field("id");
+    xec::Field value = schema.field("value");
+    xec::Field source = schema.field("source");
+    xec::Field samples = schema.field("samples");
+    xec::Field flags = schema.field("flags.0");
+
+    // Mostly small deltas with the occasional large value, like a sampled signal
+    std::vector<int64_t> signal(samplesPerRecord);
+    for (size_t i = 0; i < samplesPerRecord; i++) {
+        signal[i] = i % 16 == 0 ? static_cast<int64_t>(i) * 100003 : static_cast<int64_t>(i % 7) - 3;
+    }
+
+    std::cout << "Serialization benchmark: " << records << " records, " << samplesPerRecord << " samples each" << std::endl;
+    for (bool compact : {false, true}) {
+        std::vector<uint8_t> stream;
+        xec::RecordBuilder builder(schema);
+
+        auto start = Clock::now();
+        for (size_t r = 0; r < records; r++) {
+            builder.set<int64_t>(id, static_cast<int64_t>(r));
+            builder.set<double>(value, r * 0.5);
+            builder.setString(source, "sensor-a");
+            if (compact) {
+                builder.setCompactIntegers(samples, signal.data(), signal.size());
+            } else {
+                builder.setArray(samples, signal.data(), signal.size());
+            }
+            builder.set<int64_t>(flags, 1);
+            builder.appendTo(stream);
+        }
+        double writeSeconds = seconds(start);
+
+        start = Clock::now();
+        int64_t checksum = 0;
+        xec::RecordReader reader(schema, stream.data(), stream.size());
+        xec::RecordView record;
+        while (reader.next(record)) {
+            checksum += record.get<int64_t>(id) + static_cast<int64_t>(record.get<double>(value));
+            checksum += static_cast<int64_t>(record.string(source).size());
+            if (compact) {
+                for (int64_t sample : record.integers(samples)) {
+                    checksum += sample;
+                }
+            } else {
+                for (int64_t sample : record.array<int64_t>(samples)) {
+                    checksum += sample;
+                }
+            }
+        }
+        double readSeconds = seconds(start);
+
+        double megabytes = stream.size() / 1e6;
+        std::cout << std::left << std::setw(9) << (compact ? "varint" : "aligned") << std::right << std::fixed
+                  << std::setprecision(1) << std::setw(8) << megabytes << " MB  write " << std::setw(7)
+                  << megabytes / writeSeconds << " MB/s  read " << std::setw(7) << megabytes / readSeconds
+                  << " MB/s  (checksum " << checksum << ")" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../Runtime/TaskScheduler.hpp"
+
+// Task runtime benchmark
+//
+// Measures what a `thread` block costs: spawning and joining empty tasks on the work-stealing
+// pool against starting a std::thread per task, recursive fork/join (fib), and a parallel-for
+// reduction over an array against a serial loop. A placement (compact or spread) pins the workers
+// and makes thieves prefer their own node; XEC_TOPOLOGY=2x4 fakes a two-node machine.
+//
+// Usage: TaskBenchmark [tasks] [workers] [placement]
+
+using Clock = std::chrono::steady_clock;
+
+double seconds(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+long fib(xec::TaskScheduler& scheduler, int n) {
+    if (n < 20) {
+        return n < 2 ? n : fib(scheduler, n - 1) + fib(scheduler, n - 2);
+    }
+    long left = 0;
+    xec::TaskGroup group;
+    scheduler.spawn(group, [&] { left = fib(scheduler, n - 1); });
+    long right = fib(scheduler, n - 2);
+    scheduler.wait(group);
+    return left + right;
+}
+
+int main(int argc, char* argv[]) {
+    size_t tasks = argc > 1 ? std::stoul(argv[1]) : 1000000;
+    unsigned workers = argc > 2 ? static_cast<unsigned>(std::stoul(argv[2])) : std::max(1u, std::thread::hardware_concurrency());
+    xec::Placement placement = xec::parsePlacement(argc > 3 ? argv[3] : nullptr);
+    xec::TaskScheduler scheduler(workers, placement);
+    std::cout << "Task benchmark: " << workers << " workers" << (argc > 3 ? std::string(", ") + argv[3] : std::string()) << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+
+    // Spawn/join from inside the pool, as generated code does
+    std::atomic<size_t> ran{0};
+    auto start = Clock::now();
+    xec::TaskGroup outer;
+    scheduler.spawn(outer, [&] {
+        xec::TaskGroup group;
+        for (size_t i = 0; i < tasks; i++) {
+            scheduler.spawn(group, [&ran] { ran.fetch_add(1, std::memory_order_relaxed); });
+        }
+        scheduler.wait(group);
+    });
+    scheduler.wait(outer);
+    double pooled = seconds(start);
+    std::cout << "  spawn+join   " << std::setw(8) << pooled * 1e9 / tasks << " ns/task (" << ran.load() << " tasks)" << std::endl;
+
+    size_t threadCount = std::min<size_t>(tasks, 2000);
+    start = Clock::now();
+    for (size_t i = 0; i < threadCount; i++) {
+        std::thread([&ran] { ran.fetch_add(1, std::memory_order_relaxed); }).join();
+    }
+    double threaded = seconds(start);
+    std::cout << "  std::thread  " << std::setw(8) << threaded * 1e9 / threadCount << " ns/task (" << threadCount << " tasks)"
+              << std::endl;
+
+    start = Clock::now();
+    long result = fib(scheduler, 32);
+    std::cout << "  fib(32)      " << std::setw(8) << seconds(start) * 1e3 << " ms (" << result << ")" << std::endl;
+
+    std::vector<int64_t> values(tasks * 16);
+    for (size_t i = 0; i < values.size(); i++) {
+        values[i] = static_cast<int64_t>(i % 1000);
+    }
+    start = Clock::now();
+    int64_t serial = 0;
+    for (int64_t value : values) {
+        serial += value;
+    }
+    double serialSeconds = seconds(start);
+
+    std::atomic<int64_t> parallel{0};
+    start = Clock::now();
+    scheduler.parallelFor(0, values.size(), 0, [&](size_t lo, size_t hi) {
+        int64_t sum = 0;
+        for (size_t i = lo; i < hi; i++) {
+            sum += values[i];
+        }
+        parallel.fetch_add(sum, std::memory_order_relaxed);
+    });
+    double parallelSeconds = seconds(start);
+    std::cout << "  parallelFor  " << std::setw(8) << parallelSeconds * 1e3 << " ms vs serial " << serialSeconds * 1e3 << " ms ("
+              << (parallel.load() == serial ? "ok" : "MISMATCH") << ")" << std::endl;
+    return parallel.load() == serial ? 0 : 1;
+}
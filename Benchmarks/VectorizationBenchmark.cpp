@@ -0,0 +1,351 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dlfcn.h>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+// Only warnings from the backend; its pass log would drown the report
+#define XEC_LOG_LEVEL 3
+#include "../Compiler/CodeGenerator.cpp"
+
+// Vectorization benchmark
+//
+// Builds map, filter and reduction loops over byte, short and int arrays with the optimizing
+// backend in Compiler/CodeGenerator.cpp, for SSE and for AVX2 where the CPU has it, and runs the
+// generated loops:
+//
+//   map        dst[i] = (src[i] + key[i]) ^ 90
+//   filter     if (src[i] > key[i]) dst[i] = src[i] - key[i]
+//   checksum   sum = sum + src[i]
+//   difference sum = sum + (src[i] - key[i])
+//   parity     sum = sum ^ (src[i] + key[i])
+//
+// Every loop is first checked against a scalar reference at lengths around its vector width
+// (empty, one short of a vector, one vector, one past it, two vectors and a long run), and once
+// with a destination overlapping its source, which must take the scalar path. Element values
+// span the whole type, so sums overflow the element width: arithmetic inside an element wraps at
+// the element width, sums accumulate in 64 bits. Each loop is then timed and reports MB/s of
+// source data. The exit status is 1 if any loop was not vectorized or disagreed with its reference.
+//
+// The backend writes NASM-style operands (`qword [name]`), so each loop is rewritten for GAS
+// (`qword ptr [rip + name]`) and assembled and linked into a shared object with $CC (default cc).
+//
+// Usage: VectorizationBenchmark [MB per loop]
+
+using Clock = std::chrono::steady_clock;
+using Node = std::shared_ptr<ASTNode>;
+
+Node node(ASTNodeType type, const std::string& value, std::vector<Node> children = {}) {
+    auto result = std::make_shared<ASTNode>(type, value);
+    result->children = std::move(children);
+    return result;
+}
+
+Node element(const std::string& array) {
+    return node(ASTNodeType::ARRAY_ACCESS, array, {node(ASTNodeType::IDENTIFIER, "i")});
+}
+
+Node operation(const std::string& op, Node lhs, Node rhs) {
+    return node(ASTNodeType::OPERATION, op, {lhs, rhs});
+}
+
+Node literal(const std::string& value) {
+    return node(ASTNodeType::LITERAL, value);
+}
+
+Node storeTo(const std::string& array, Node value) {
+    return node(ASTNodeType::ASSIGNMENT, "", {element(array), value});
+}
+
+Node accumulate(const std::string& op, Node value) {
+    return node(ASTNodeType::ASSIGNMENT, "sum", {operation(op, node(ASTNodeType::IDENTIFIER, "sum"), value)});
+}
+
+// Reference semantics per element type T: bytes are unsigned, wider elements signed
+struct Kernel {
+    std::string name;
+    Node body;
+    bool reduction;
+    // Reference for one element: updates dst[i] (map/filter) or sum (reduction)
+    std::function<void(const int64_t* src, const int64_t* key, int64_t* dst, size_t i, int64_t& sum, int bytes)> reference;
+};
+
+int64_t narrow(int64_t value, int bytes) {
+    switch (bytes) {
+        case 1: return static_cast<uint8_t>(value);
+        case 2: return static_cast<int16_t>(value);
+        default: return static_cast<int32_t>(value);
+    }
+}
+
+std::vector<Kernel> kernels() {
+    return {
+        {"map", storeTo("dst", operation("^", operation("+", element("src"), element("key")), literal("90"))), false,
+         [](const int64_t* src, const int64_t* key, int64_t* dst, size_t i, int64_t&, int bytes) {
+             dst[i] = narrow((src[i] + key[i]) ^ 90, bytes);
+         }},
+        {"filter",
+         node(ASTNodeType::CONDITIONAL, "",
+              {operation(">", element("src"), element("key")), storeTo("dst", operation("-", element("src"), element("key")))}),
+         false,
+         [](const int64_t* src, const int64_t* key, int64_t* dst, size_t i, int64_t&, int bytes) {
+             if (src[i] > key[i]) {
+                 dst[i] = narrow(src[i] - key[i], bytes);
+             }
+         }},
+        {"checksum", accumulate("+", element("src")), true,
+         [](const int64_t* src, const int64_t*, int64_t*, size_t i, int64_t& sum, int) { sum += src[i]; }},
+        {"difference", accumulate("+", operation("-", element("src"), element("key"))), true,
+         [](const int64_t* src, const int64_t* key, int64_t*, size_t i, int64_t& sum, int bytes) {
+             sum += narrow(src[i] - key[i], bytes);
+         }},
+        {"parity", accumulate("^", operation("+", element("src"), element("key"))), true,
+         [](const int64_t* src, const int64_t* key, int64_t*, size_t i, int64_t& sum, int bytes) {
+             sum ^= narrow(src[i] + key[i], bytes);
+         }},
+    };
+}
+
+// The backend's code for the loop in `kernel`, or "" if it left the loop scalar
+std::string vectorLoop(const Kernel& kernel, const std::string& elementType, VectorISA isa) {
+    auto function = node(ASTNodeType::FUNCTION_DECLARATION, "kernel",
+                         {node(ASTNodeType::LOOP, "i", {node(ASTNodeType::IDENTIFIER, "n"), kernel.body})});
+    CodeGenOptions options;
+    options.isa = isa;
+    CodeGenerator generator(function, options);
+    for (const char* array : {"src", "key", "dst"}) {
+        generator.declareArray(array, elementType);
+    }
+    std::ostringstream text;
+    std::streambuf* previous = std::cout.rdbuf(text.rdbuf());
+    generator.generate();
+    std::cout.rdbuf(previous);
+
+    // From the loop header up to the store of the induction variable after .Ldone
+    std::istringstream lines(text.str());
+    std::ostringstream loop;
+    std::string line;
+    bool inside = false, done = false;
+    while (std::getline(lines, line)) {
+        if (line.rfind("; vectorized loop", 0) == 0) {
+            inside = true;
+        }
+        if (inside) {
+            loop << line << "\n";
+            if (done) {
+                return loop.str();
+            }
+            done = line.rfind(".Ldone", 0) == 0;
+        }
+    }
+    return "";
+}
+
+// NASM-style text to GAS intel syntax: comments start with #, size keywords take `ptr`, and symbols
+// are addressed relative to rip so the object can be linked into a shared library. Labels get a
+// per-loop suffix.
+std::string toGas(const std::string& loop, size_t index) {
+    static const std::regex comment("(^|\\n)( *);");
+    static const std::regex size("\\b(byte|word|dword|qword) \\[");
+    static const std::regex symbol("\\[([A-Za-z_][A-Za-z0-9_]*)\\]");
+    static const std::regex label("(\\.L[A-Za-z]+[0-9_A-Za-z]*)");
+    std::string result = std::regex_replace(loop, comment, "$1$2#");
+    result = std::regex_replace(result, size, "$1 ptr [");
+    result = std::regex_replace(result, symbol, "[rip + $1]");
+    return std::regex_replace(result, label, "$1_k" + std::to_string(index));
+}
+
+struct Loaded {
+    void* handle = nullptr;
+    std::vector<void (*)()> functions;
+    void** src;
+    void** key;
+    void** dst;
+    int64_t* n;
+    int64_t* sum;
+};
+
+bool build(const std::vector<std::string>& loops, const std::vector<bool>& avx, Loaded& loaded) {
+    std::string base = "/tmp/xec-vectorization-benchmark-" + std::to_string(getpid());
+    {
+        std::ofstream out(base + ".s");
+        out << "    .intel_syntax noprefix\n    .text\n";
+        for (size_t k = 0; k < loops.size(); k++) {
+            out << "    .globl kernel" << k << "\n    .type kernel" << k << ", @function\nkernel" << k << ":\n";
+            out << toGas(loops[k], k) << (avx[k] ? "    vzeroupper\n" : "") << "    ret\n";
+        }
+        out << "    .data\n";
+        for (const char* symbol : {"src", "key", "dst", "n", "i", "sum"}) {
+            out << "    .globl " << symbol << "\n    .protected " << symbol << "\n" << symbol << ":\n    .quad 0\n";
+        }
+        out << "    .section .note.GNU-stack,\"\",@progbits\n";
+    }
+    const char* cc = std::getenv("CC");
+    std::string command = std::string(cc ? cc : "cc") + " -shared -o " + base + ".so " + base + ".s";
+    int status = std::system(command.c_str());
+    std::remove((base + ".s").c_str());
+    if (status != 0) {
+        std::cerr << "Could not assemble the generated loops: " << command << std::endl;
+        return false;
+    }
+    loaded.handle = dlopen((base + ".so").c_str(), RTLD_NOW | RTLD_LOCAL);
+    std::remove((base + ".so").c_str());
+    if (!loaded.handle) {
+        std::cerr << "Could not load the generated loops: " << dlerror() << std::endl;
+        return false;
+    }
+    for (size_t k = 0; k < loops.size(); k++) {
+        loaded.functions.push_back(reinterpret_cast<void (*)()>(dlsym(loaded.handle, ("kernel" + std::to_string(k)).c_str())));
+    }
+    loaded.src = static_cast<void**>(dlsym(loaded.handle, "src"));
+    loaded.key = static_cast<void**>(dlsym(loaded.handle, "key"));
+    loaded.dst = static_cast<void**>(dlsym(loaded.handle, "dst"));
+    loaded.n = static_cast<int64_t*>(dlsym(loaded.handle, "n"));
+    loaded.sum = static_cast<int64_t*>(dlsym(loaded.handle, "sum"));
+    return true;
+}
+
+int64_t readElement(const uint8_t* data, size_t i, int bytes) {
+    int64_t value = 0;
+    std::memcpy(&value, data + i * bytes, bytes);
+    return narrow(value, bytes);
+}
+
+void writeElement(uint8_t* data, size_t i, int bytes, int64_t value) {
+    std::memcpy(data + i * bytes, &value, bytes);
+}
+
+// Runs the generated loop over `length` elements, with dst starting `overlap` elements into src
+// when overlap is nonzero, and compares the destination and sum with the reference
+bool check(const Kernel& kernel, void (*loop)(), Loaded& loaded, int bytes, size_t length, size_t overlap, uint64_t seed) {
+    std::vector<uint8_t> src((length + overlap + 1) * bytes), key((length + 1) * bytes), dst((length + 1) * bytes);
+    std::mt19937_64 random(seed);
+    for (auto& byte : src) byte = static_cast<uint8_t>(random());
+    for (auto& byte : key) byte = static_cast<uint8_t>(random());
+    for (auto& byte : dst) byte = static_cast<uint8_t>(random());
+    uint8_t* target = overlap ? src.data() + overlap * bytes : dst.data();
+
+    // The reference works on the same layout, so an overlapping destination feeds later elements
+    std::vector<int64_t> wideSrc(length + overlap + 1), wideKey(length + 1), wideDst(length + 1);
+    for (size_t i = 0; i < wideSrc.size(); i++) wideSrc[i] = readElement(src.data(), i, bytes);
+    for (size_t i = 0; i < wideKey.size(); i++) wideKey[i] = readElement(key.data(), i, bytes);
+    for (size_t i = 0; i < wideDst.size(); i++) wideDst[i] = readElement(target, i, bytes);
+    int64_t expectedSum = 0x1234567;
+    for (size_t i = 0; i < length; i++) {
+        kernel.reference(wideSrc.data(), wideKey.data(), wideDst.data(), i, expectedSum, bytes);
+        if (overlap) {
+            wideSrc[i + overlap] = wideDst[i];
+        }
+    }
+
+    *loaded.src = src.data();
+    *loaded.key = key.data();
+    *loaded.dst = target;
+    *loaded.n = static_cast<int64_t>(length);
+    *loaded.sum = 0x1234567;
+    loop();
+
+    if (kernel.reduction) {
+        return *loaded.sum == expectedSum;
+    }
+    for (size_t i = 0; i <= length; i++) {
+        if (readElement(target, i, bytes) != wideDst[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    size_t megabytes = argc > 1 ? std::stoul(argv[1]) : 64;
+    struct Target {
+        const char* name;
+        VectorISA isa;
+        int width;
+        bool available;
+    };
+    std::vector<Target> targets = {{"sse", VectorISA::SSE, 16, static_cast<bool>(__builtin_cpu_supports("sse4.1"))},
+                                   {"avx2", VectorISA::AVX2, 32, static_cast<bool>(__builtin_cpu_supports("avx2"))}};
+    std::vector<std::pair<const char*, int>> types = {{"byte", 1}, {"short", 2}, {"int", 4}};
+
+    struct Case {
+        const Kernel* kernel;
+        const Target* target;
+        const char* type;
+        int bytes;
+    };
+    std::vector<Kernel> all = kernels();
+    std::vector<Case> cases;
+    std::vector<std::string> loops;
+    std::vector<bool> avx;
+    bool failed = false;
+    for (const auto& target : targets) {
+        if (!target.available) {
+            std::cout << "  " << target.name << ": not supported by this CPU, skipped" << std::endl;
+            continue;
+        }
+        for (const auto& [type, bytes] : types) {
+            for (const auto& kernel : all) {
+                std::string loop = vectorLoop(kernel, type, target.isa);
+                if (loop.empty()) {
+                    std::cout << "  " << target.name << " " << type << " " << kernel.name << ": not vectorized" << std::endl;
+                    failed = true;
+                    continue;
+                }
+                cases.push_back({&kernel, &target, type, bytes});
+                loops.push_back(loop);
+                avx.push_back(target.isa == VectorISA::AVX2);
+            }
+        }
+    }
+    Loaded loaded;
+    if (cases.empty() || !build(loops, avx, loaded)) {
+        return 1;
+    }
+
+    std::cout << "Vectorization benchmark: " << megabytes << " MB per loop" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "  " << std::left << std::setw(6) << "isa" << std::setw(7) << "type" << std::setw(12) << "loop" << std::right
+              << std::setw(10) << "MB/s" << "  check" << std::endl;
+    for (size_t c = 0; c < cases.size(); c++) {
+        const Case& test = cases[c];
+        size_t lanes = test.target->width / test.bytes;
+        bool ok = true;
+        std::vector<size_t> lengths = {0, 1, lanes - 1, lanes, lanes + 1, 2 * lanes - 1, 2 * lanes, 2 * lanes + 1, 3 * lanes + 7, 4099};
+        for (size_t length : lengths) {
+            ok = ok && check(*test.kernel, loaded.functions[c], loaded, test.bytes, length, 0, length * 31 + c);
+        }
+        if (!test.kernel->reduction) {
+            ok = ok && check(*test.kernel, loaded.functions[c], loaded, test.bytes, 4 * lanes + 3, 1, c);
+        }
+
+        size_t length = (1 << 20) / test.bytes;
+        std::vector<uint8_t> src(length * test.bytes, 7), key(length * test.bytes, 3), dst(length * test.bytes);
+        *loaded.src = src.data();
+        *loaded.key = key.data();
+        *loaded.dst = dst.data();
+        *loaded.n = static_cast<int64_t>(length);
+        auto start = Clock::now();
+        for (size_t pass = 0; pass < megabytes; pass++) {
+            loaded.functions[c]();
+        }
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        double rate = megabytes * (1 << 20) / 1e6 / seconds;
+
+        std::cout << "  " << std::left << std::setw(6) << test.target->name << std::setw(7) << test.type << std::setw(12)
+                  << test.kernel->name << std::right << std::setw(10) << rate << "  " << (ok ? "ok" : "MISMATCH") << std::endl;
+        failed = failed || !ok;
+    }
+    return failed ? 1 : 0;
+}
@@ -11,6 +11,23 @@
 #include <mutex>
 #include <queue>
 #include <map>
+#include <optional>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <cstddef>
+#include <climits>
+#include <iterator>
+
+#include "../Runtime/EventLoop.hpp"
+#include "../Runtime/TaskScheduler.hpp"
+#include "../Runtime/Profile.hpp"
+#include "../Runtime/Log.hpp"
+#include "../Runtime/TimeTrace.hpp"
+
+using xec::Logger;
+using xec::TimeScope;
 
 // Define ASTNode and other components as needed.
 enum class ASTNodeType {
@@ -25,7 +42,14 @@ enum class ASTNodeType {
     ARRAY_ACCESS,
     OBJECT_MANIPULATION,
     FUNCTION_CALL,
-    // Other types can be added
+    MODULE,         // Translation unit or linked program; children are its functions
+    ALLOCATION,     // struct/tuple/array value; value is the type, children ASSIGNMENTs naming fields
+    RETAIN,         // Local `value` yielded with one more reference (inserted by reference counting)
+    RELEASE,        // Drop the reference held by local `value`; before a RETURN or a store to `value`, runs after
+                    // the value is computed. A null local is skipped.
+    AWAIT,          // Child is the awaited expression
+    THREAD,         // `thread` block: children are its statements, or one LOOP for `thread for`
+    // Other types can be added; IRSerializer::read rejects types after THREAD, so extend it too
 };
 
 // Define a basic ASTNode structure
@@ -44,20 +68,6 @@ public:
     }
 };
 
-// Logger Utility for Debugging
-class Logger {
-public:
-    static void log(const std::string& message) {
-        std::cout << "[LOG] " << message << std::endl;
-    }
-    static void logError(const std::string& message) {
-        std::cerr << "[ERROR] " << message << std::endl;
-    }
-    static void logWarning(const std::string& message) {
-        std::cerr << "[WARNING] " << message << std::endl;
-    }
-};
-
 // SymbolTable: Manages functions, variables, and scopes
 class SymbolTable {
 public:
@@ -77,6 +87,11 @@ public:
         return variables.find(name) != variables.end();
     }
 
+    std::string getVariableType(const std::string& name) const {
+        auto it = variables.find(name);
+        return it != variables.end() ? it->second : "";
+    }
+
     void clear() {
         functions.clear();
         variables.clear();
@@ -104,12 +119,248 @@ private:
     std::unordered_map<std::string, std::string> variables;
 };
 
+// Vector instruction sets the backend can target
+enum class VectorISA {
+    SCALAR, // No vectorization, every loop stays scalar
+    SSE,    // 128-bit xmm registers (SSE4.1 for pmulld/pblendvb)
+    AVX2    // 256-bit ymm registers
+};
+
+// Result of analysing a loop for vectorization
+struct VectorizationPlan {
+    enum class Kind { MAP, REDUCTION, FILTER };
+
+    Kind kind;
+    std::string inductionVar;
+    std::string tripCount;
+    bool constantTripCount = false;    // tripCount is a LITERAL rather than a variable
+    std::string destination;           // Stored array (MAP/FILTER) or accumulator (REDUCTION)
+    std::string reductionOp;
+    std::vector<std::string> sources;  // Arrays loaded inside the loop body
+    std::shared_ptr<ASTNode> expression;
+    std::shared_ptr<ASTNode> predicate; // FILTER only
+    int elementBytes = 4;
+    bool needsAliasCheck = false;
+};
+
+// Compact IR serialization used for link-time optimization.
+//
+// Layout: "XIR1", module name, string table, function count, then each node in pre-order as
+// (type, string index, line + 1, child count). All integers are LEB128 varints; node values are
+// interned, so repeated identifiers and operators cost one or two bytes per use.
+class IRSerializer {
+public:
+    static void write(std::ostream& out, const std::string& moduleName,
+                      const std::vector<std::shared_ptr<ASTNode>>& functions) {
+        std::vector<std::string> strings;
+        std::unordered_map<std::string, size_t> index;
+        std::function<void(const std::shared_ptr<ASTNode>&)> intern = [&](const std::shared_ptr<ASTNode>& node) {
+            if (index.emplace(node->value, strings.size()).second) {
+                strings.push_back(node->value);
+            }
+            for (auto& child : node->children) {
+                intern(child);
+            }
+        };
+        for (auto& function : functions) {
+            intern(function);
+        }
+
+        out.write("XIR1", 4);
+        writeString(out, moduleName);
+        writeVarint(out, strings.size());
+        for (const auto& str : strings) {
+            writeString(out, str);
+        }
+        writeVarint(out, functions.size());
+        std::function<void(const std::shared_ptr<ASTNode>&)> emit = [&](const std::shared_ptr<ASTNode>& node) {
+            writeVarint(out, static_cast<uint64_t>(node->type));
+            writeVarint(out, index[node->value]);
+            writeVarint(out, static_cast<uint64_t>(node->lineNumber + 1));
+            writeVarint(out, node->children.size());
+            for (auto& child : node->children) {
+                emit(child);
+            }
+        };
+        for (auto& function : functions) {
+            emit(function);
+        }
+    }
+
+    // Every count is checked against the bytes left before it sizes anything: a string needs one
+    // byte per character, a table entry at least its length byte and a node its four varints.
+    static std::vector<std::shared_ptr<ASTNode>> read(std::istream& in, std::string& moduleName) {
+        char magic[4];
+        if (!in.read(magic, 4) || std::string(magic, 4) != "XIR1") {
+            throw std::runtime_error("Not an XecLang IR file");
+        }
+        Input input{std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()), 0};
+        moduleName = readString(input);
+        std::vector<std::string> strings(readCount(input, 1));
+        for (auto& str : strings) {
+            str = readString(input);
+        }
+        std::function<std::shared_ptr<ASTNode>(int)> parse = [&](int depth) {
+            if (depth > maxDepth) {
+                throw std::runtime_error("Corrupt IR file: nesting too deep");
+            }
+            uint64_t type = readVarint(input);
+            if (type > static_cast<uint64_t>(ASTNodeType::THREAD)) {
+                throw std::runtime_error("Corrupt IR file: unknown node type " + std::to_string(type));
+            }
+            uint64_t value = readVarint(input);
+            if (value >= strings.size()) {
+                throw std::runtime_error("Corrupt IR file: bad string index");
+            }
+            auto node = std::make_shared<ASTNode>(static_cast<ASTNodeType>(type), strings[value]);
+            node->lineNumber = static_cast<int>(readVarint(input)) - 1;
+            uint64_t children = readCount(input, nodeBytes);
+            node->children.reserve(children);
+            for (uint64_t i = 0; i < children; i++) {
+                node->addChild(parse(depth + 1));
+            }
+            return node;
+        };
+        std::vector<std::shared_ptr<ASTNode>> functions(readCount(input, nodeBytes));
+        for (auto& function : functions) {
+            function = parse(0);
+        }
+        if (input.offset != input.data.size()) {
+            throw std::runtime_error("Corrupt IR file: trailing bytes");
+        }
+        return functions;
+    }
+
+private:
+    static void writeVarint(std::ostream& out, uint64_t value) {
+        while (value >= 0x80) {
+            out.put(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.put(static_cast<char>(value));
+    }
+
+    struct Input {
+        std::string data;
+        size_t offset;
+
+        size_t remaining() const { return data.size() - offset; }
+    };
+
+    static constexpr uint64_t nodeBytes = 4;  // type, string index, line and child count
+    static constexpr int maxDepth = 10000;    // Deeper trees would exhaust the recursive passes' stack
+
+    static uint64_t readVarint(Input& in) {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (in.remaining() == 0) {
+                throw std::runtime_error("Corrupt IR file: truncated");
+            }
+            uint8_t byte = static_cast<uint8_t>(in.data[in.offset++]);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        throw std::runtime_error("Corrupt IR file: varint too long");
+    }
+
+    static void writeString(std::ostream& out, const std::string& str) {
+        writeVarint(out, str.size());
+        out.write(str.data(), str.size());
+    }
+
+    // A count of items taking at least `bytes` bytes each, checked against the input left
+    static uint64_t readCount(Input& in, uint64_t bytes) {
+        uint64_t count = readVarint(in);
+        if (count > in.remaining() / bytes) {
+            throw std::runtime_error("Corrupt IR file: count " + std::to_string(count) + " exceeds the remaining input");
+        }
+        return count;
+    }
+
+    static std::string readString(Input& in) {
+        uint64_t size = readCount(in, 1);
+        std::string str = in.data.substr(in.offset, size);
+        in.offset += size;
+        return str;
+    }
+};
+
+// Options controlling code generation
+struct CodeGenOptions {
+    VectorISA isa = VectorISA::AVX2;
+    bool profileGenerate = false;                    // --profile-generate: insert entry/edge/call counters
+    std::string profileGeneratePath = "default.xecprof";
+    std::string profileUsePath;                      // --profile-use=<file>: optimize with collected counts
+    int inlineThreshold = 8;                         // Max callee expression size inlined without a profile
+    int hotInlineThreshold = 32;                     // Max callee size inlined at hot call edges
+    std::string emitIRPath;                          // Write optimized IR for link-time optimization instead of code
+    bool wholeProgram = false;                       // Root holds every module: enable global DCE and IPCP
+    std::vector<std::string> entryPoints = {"main"}; // Roots for whole-program reachability
+    int maxScalarFields = 8;                         // Larger non-escaping aggregates go on the stack
+    int maxStackBytes = 4096;                        // Larger ones stay on the heap even if they don't escape
+    bool elideRefCounts = true;                      // Move references at their last use instead of retain/release
+    int parallelGrain = 0;                           // Iterations per task in `thread for`; 0 lets the runtime choose
+};
+
+// Where escape analysis decided an aggregate lives
+enum class AllocationPlacement { HEAP, STACK, SCALARS };
+
+// Coroutine frame of a lowered async function: the runtime's AsyncFrame header, then a slot for
+// the awaited child frame, then the locals that live across a suspension
+struct AsyncLayout {
+    std::vector<size_t> suspendPoints;     // Body statements whose await can suspend
+    std::map<std::string, size_t> slots;   // Local -> frame offset
+    size_t childOffset = 0;
+    size_t frameBytes = 0;
+};
+
+// Code emitted as a whole rather than node by node: a coroutine's states or an outlined thread
+// task. Locals without an entry in `homes` live at their symbol.
+struct OutlinedContext {
+    std::string name;                             // Label prefix
+    std::string exit;                             // Where a RETURN jumps once its value is in rax
+    bool coroutine = false;                       // RETURN completes the frame in rbx
+    std::string frame = "rbp";                    // Enclosing function's frame; its task group is at [frame - 8]
+    std::map<std::string, std::string> homes;
+    int labels = 0;
+
+    OutlinedContext(std::string name, std::string exit, bool coroutine = false)
+        : name(std::move(name)), exit(std::move(exit)), coroutine(coroutine) {}
+
+    std::string local(const std::string& variable) const {
+        auto home = homes.find(variable);
+        return home != homes.end() ? home->second : "qword [" + variable + "]";
+    }
+
+    std::string label(const std::string& kind) {
+        return ".L" + name + "_" + kind + std::to_string(labels++);
+    }
+};
+
 // CodeGenerator for generating high-performance, multi-stage code
 class CodeGenerator {
 public:
-    CodeGenerator(std::shared_ptr<ASTNode> root) : root(root) {}
+    CodeGenerator(std::shared_ptr<ASTNode> root, CodeGenOptions options = {}) : root(root), options(options) {
+        if (!options.profileUsePath.empty() && !profile.load(options.profileUsePath)) {
+            Logger::logWarning("Could not read profile: ", options.profileUsePath);
+        }
+    }
+
+    // Record the element type of an array ("byte", "short", "int", "long", ...) for the vectorizer
+    void declareArray(const std::string& name, const std::string& elementType) {
+        arrayElementTypes[name] = elementType;
+    }
+
+    // Mark a function declared `async`; functions containing `await` are async anyway
+    void declareAsync(const std::string& name) {
+        asyncFunctions.insert(name);
+    }
 
     void generate() {
+        TimeScope scope("Codegen");
+
         // Initialize symbol table and other structures
         symbolTable.clear();
         Logger::log("Starting code generation...");
@@ -117,14 +368,57 @@ public:
         // Generate intermediate representation
         auto irNode = generateIntermediateRepresentation(root);
 
+        // Constants flowing into every call site of a function are only known for the whole program
+        if (options.wholeProgram) {
+            interproceduralConstantPropagation(irNode);
+        }
+
         // Apply optimizations on the IR
         optimizeIR(irNode);
 
-        // Perform function-level optimizations
-        functionInlining(irNode);
+        // Perform function-level optimizations; instrumented builds keep every call so each
+        // call edge gets counted
+        if (!options.profileGenerate) {
+            functionInlining(irNode);
+        }
+
+        // Inlining removes calls that objects would otherwise escape through
+        escapeAnalysis(irNode);
+
+        // Drop library functions nothing reachable calls any more
+        if (options.wholeProgram) {
+            globalDeadCodeElimination(irNode);
+        }
+
+        // Separate compilation for LTO stops here and leaves code generation to the link step
+        if (!options.emitIRPath.empty()) {
+            emitIR(irNode);
+            Logger::log("Code generation completed.");
+            return;
+        }
+
+        // Counts are only made explicit for final code, so linked IR is counted once at the link step
+        referenceCounting(irNode);
+
+        // Split async functions into resumable states once their bodies are final
+        asyncLowering(irNode);
+
+        // Outline `thread` blocks into tasks for the work-stealing runtime
+        threadLowering(irNode);
+
+        // Profile-guided layout, or counters for collecting a profile
+        if (!profile.empty()) {
+            applyProfileLayout(irNode);
+        }
+        if (options.profileGenerate) {
+            instrumentProfile(irNode);
+        }
         
         // Generate backend-specific code (e.g., assembly, machine code)
         generateBackendCode(irNode);
+        if (options.profileGenerate) {
+            generateProfileTableBackend();
+        }
 
         Logger::log("Code generation completed.");
     }
@@ -133,9 +427,30 @@ private:
     std::shared_ptr<ASTNode> root;
     SymbolTable symbolTable;
     std::mutex generationMutex;
+    CodeGenOptions options;
+    std::unordered_map<std::string, std::string> arrayElementTypes;
+    std::unordered_map<const ASTNode*, VectorizationPlan> vectorPlans;
+    std::unordered_map<const ASTNode*, AllocationPlacement> allocationPlacements;
+    std::unordered_map<const ASTNode*, std::vector<std::string>> branchReleases; // Owed by RETURNs and stores that are branches
+    std::set<std::string> asyncFunctions;
+    std::unordered_map<const ASTNode*, AsyncLayout> asyncLayouts;
+    std::set<const ASTNode*> awaitedCalls;                   // Emitted by their coroutine's state machine
+    std::set<const ASTNode*> outlinedNodes;                  // Bodies of coroutines and thread tasks, emitted by them
+    std::unordered_map<const ASTNode*, bool> spawnedCalls;   // Async calls not awaited -> caller is async
+    std::unordered_map<const ASTNode*, std::string> threadTasks; // THREAD block -> outlined task function
+    std::set<std::string> taskGroups;                        // Functions that fork and so own a task group
+    std::set<std::string> threadFrames;                      // Functions with thread blocks, which get an rbp frame
+    int labelCounter = 0;
+
+    // Profile-guided optimization state
+    xec::ProfileData profile;
+    std::vector<std::pair<std::string, std::string>> profileCounters; // (kind, key) in table order
+    std::unordered_map<const ASTNode*, size_t> counterIndex;         // First counter of an instrumented node
+    std::unordered_map<const ASTNode*, std::string> functionSections;
 
     // Step 1: Generate intermediate representation
     std::shared_ptr<ASTNode> generateIntermediateRepresentation(std::shared_ptr<ASTNode> node) {
+        TimeScope scope("IR generation");
         Logger::log("Generating Intermediate Representation...");
         std::shared_ptr<ASTNode> irNode = std::make_shared<ASTNode>(ASTNodeType::FUNCTION_DECLARATION);
 
@@ -160,6 +475,23 @@ private:
             case ASTNodeType::ARRAY_ACCESS:
                 handleArrayAccessForIR(node, irNode);
                 break;
+            case ASTNodeType::LOOP:
+                handleLoopForIR(node, irNode);
+                break;
+            case ASTNodeType::FUNCTION_CALL:
+                handleFunctionCallForIR(node, irNode);
+                break;
+            case ASTNodeType::CONDITIONAL:
+                handleConditionalForIR(node, irNode);
+                break;
+            case ASTNodeType::ALLOCATION:
+                // The allocation is emitted with its field initializers; only their values are visited
+                for (auto& field : node->children) {
+                    for (auto& value : field->children) {
+                        traverseASTForIR(value, irNode);
+                    }
+                }
+                return;
             default:
                 break;
         }
@@ -171,113 +503,2716 @@ private:
 
     // Handle function declaration during IR generation
     void handleFunctionDeclarationForIR(std::shared_ptr<ASTNode> node, std::shared_ptr<ASTNode> irNode) {
-        Logger::log("Handling function declaration: " + node->value);
+        Logger::debug("Handling function declaration: ", node->value);
         symbolTable.addFunction(node->value, {});
         irNode->addChild(node);
     }
 
     // Handle assignment during IR generation
     void handleAssignmentForIR(std::shared_ptr<ASTNode> node, std::shared_ptr<ASTNode> irNode) {
-        Logger::log("Handling assignment: " + node->value);
+        Logger::debug("Handling assignment: ", node->value);
         irNode->addChild(node);
     }
 
     // Handle operations (e.g., arithmetic) during IR generation
     void handleOperationForIR(std::shared_ptr<ASTNode> node, std::shared_ptr<ASTNode> irNode) {
-        Logger::log("Handling operation: " + node->value);
+        Logger::debug("Handling operation: ", node->value);
         irNode->addChild(node);
     }
 
     // Handle array access during IR generation
     void handleArrayAccessForIR(std::shared_ptr<ASTNode> node, std::shared_ptr<ASTNode> irNode) {
-        Logger::log("Handling array access: " + node->value);
+        Logger::debug("Handling array access: ", node->value);
+        irNode->addChild(node);
+    }
+
+    // Handle loops during IR generation
+    void handleLoopForIR(std::shared_ptr<ASTNode> node, std::shared_ptr<ASTNode> irNode) {
+        Logger::debug("Handling loop over: ", node->value);
+        irNode->addChild(node);
+    }
+
+    // Handle function calls during IR generation
+    void handleFunctionCallForIR(std::shared_ptr<ASTNode> node, std::shared_ptr<ASTNode> irNode) {
+        Logger::debug("Handling function call: ", node->value);
+        irNode->addChild(node);
+    }
+
+    // Handle conditionals during IR generation
+    void handleConditionalForIR(std::shared_ptr<ASTNode> node, std::shared_ptr<ASTNode> irNode) {
+        Logger::debug("Handling conditional");
         irNode->addChild(node);
     }
 
     // Step 2: Optimize the intermediate representation (IR)
     void optimizeIR(std::shared_ptr<ASTNode> irNode) {
+        TimeScope scope("Optimize IR");
         Logger::log("Optimizing Intermediate Representation...");
 
         // Advanced optimization techniques like constant folding, dead code elimination
         constantFolding(irNode);
+
+        // Vectorize element-wise loops once their bodies are folded
+        loopVectorization(irNode);
     }
 
-    // Perform constant folding optimization
+    // Perform constant folding optimization. The IR lists nested operations after their parents,
+    // so walking it backwards folds operands before the operations that use them.
     void constantFolding(std::shared_ptr<ASTNode> irNode) {
+        TimeScope scope("Constant folding");
         Logger::log("Performing constant folding...");
-        for (auto& child : irNode->children) {
+        for (auto it = irNode->children.rbegin(); it != irNode->children.rend(); ++it) {
+            auto& child = *it;
             if (child->type == ASTNodeType::OPERATION && child->children.size() == 2) {
                 auto left = child->children[0];
                 auto right = child->children[1];
                 
                 if (left->type == ASTNodeType::LITERAL && right->type == ASTNodeType::LITERAL) {
                     // Replace operation with a constant result
-                    int result = std::stoi(left->value) + std::stoi(right->value);
-                    child->value = std::to_string(result);
-                    child->children.clear();
+                    auto result = foldConstant(child->value, left->value, right->value);
+                    if (result) {
+                        child->type = ASTNodeType::LITERAL;
+                        child->value = std::to_string(*result);
+                        child->children.clear();
+                    }
                 }
             }
         }
     }
 
-    // Step 3: Perform function-level optimizations like function inlining
-    void functionInlining(std::shared_ptr<ASTNode> irNode) {
-        Logger::log("Performing function inlining optimization...");
-        // Implement function inlining here
+    // Literals are decimal; a result that would overflow is left for run time, where it wraps
+    std::optional<long long> foldConstant(const std::string& op, const std::string& lhs, const std::string& rhs) {
+        long long a, b, result;
+        try {
+            size_t usedA, usedB;
+            a = std::stoll(lhs, &usedA, 10);
+            b = std::stoll(rhs, &usedB, 10);
+            if (usedA != lhs.size() || usedB != rhs.size()) {
+                return std::nullopt; // Float or string literals
+            }
+        } catch (const std::exception&) {
+            return std::nullopt;
+        }
+        if (op == "+") return __builtin_add_overflow(a, b, &result) ? std::nullopt : std::optional<long long>(result);
+        if (op == "-") return __builtin_sub_overflow(a, b, &result) ? std::nullopt : std::optional<long long>(result);
+        if (op == "*") return __builtin_mul_overflow(a, b, &result) ? std::nullopt : std::optional<long long>(result);
+        if ((op == "/" || op == "%") && (b == 0 || (a == LLONG_MIN && b == -1))) return std::nullopt;
+        if (op == "/") return a / b;
+        if (op == "%") return a % b;
+        if (op == "&") return a & b;
+        if (op == "|") return a | b;
+        if (op == "^") return a ^ b;
+        return std::nullopt;
     }
 
-    // Step 4: Generate backend-specific code (e.g., assembly, bytecode)
-    void generateBackendCode(std::shared_ptr<ASTNode> irNode) {
-        Logger::log("Generating backend code...");
-
-        // Threaded backend generation for performance
-        std::vector<std::thread> threads;
+    // Loop vectorization
+    //
+    // Loops reach the IR as LOOP nodes: value is the induction variable, children[0] the trip
+    // count (LITERAL or loop-invariant IDENTIFIER) and the single remaining child the body:
+    //   map:        ASSIGNMENT(ARRAY_ACCESS dst[i], expr)
+    //   reduction:  ASSIGNMENT "acc" (OPERATION op (IDENTIFIER acc, expr))
+    //   filter:     CONDITIONAL(predicate, ASSIGNMENT(ARRAY_ACCESS dst[i], expr))
+    // where expr is built from OPERATION nodes over ARRAY_ACCESS x[i], LITERAL and loop-invariant
+    // IDENTIFIER leaves. Only integer element types are vectorized; float reductions would be
+    // reassociated, which changes results.
+    void loopVectorization(std::shared_ptr<ASTNode> irNode) {
+        TimeScope scope("Loop vectorization");
+        if (options.isa == VectorISA::SCALAR) {
+            return;
+        }
+        Logger::log("Performing loop vectorization...");
+        vectorPlans.clear();
         for (auto& child : irNode->children) {
-            threads.push_back(std::thread(&CodeGenerator::generateCodeForNode, this, child));
+            if (child->type != ASTNodeType::LOOP) {
+                continue;
+            }
+            auto plan = analyzeLoop(child);
+            if (plan) {
+                Logger::log("Vectorized loop over ", child->value, " (", vectorLanes(plan->elementBytes), " lanes)");
+                vectorPlans[child.get()] = *plan;
+            } else {
+                Logger::log("Loop over ", child->value, " left scalar");
+            }
         }
+    }
 
-        // Wait for all threads to finish
-        for (auto& t : threads) {
-            if (t.joinable()) {
-                t.join();
+    std::optional<VectorizationPlan> analyzeLoop(std::shared_ptr<ASTNode> loop) {
+        if (loop->children.size() != 2) {
+            return std::nullopt;
+        }
+        VectorizationPlan plan;
+        plan.inductionVar = loop->value;
+        auto bound = loop->children[0];
+        if (bound->type != ASTNodeType::LITERAL && bound->type != ASTNodeType::IDENTIFIER) {
+            return std::nullopt;
+        }
+        plan.tripCount = bound->value;
+        plan.constantTripCount = bound->type == ASTNodeType::LITERAL;
+
+        auto body = loop->children[1];
+        std::shared_ptr<ASTNode> store = body;
+        if (body->type == ASTNodeType::CONDITIONAL) {
+            if (body->children.size() != 2) {
+                return std::nullopt;
+            }
+            plan.kind = VectorizationPlan::Kind::FILTER;
+            plan.predicate = body->children[0];
+            store = body->children[1];
+            if (!isComparison(plan.predicate) || !isVectorizableExpression(plan.predicate->children[0], plan) ||
+                !isVectorizableExpression(plan.predicate->children[1], plan)) {
+                return std::nullopt;
+            }
+        } else {
+            plan.kind = VectorizationPlan::Kind::MAP;
+        }
+        if (store->type != ASTNodeType::ASSIGNMENT) {
+            return std::nullopt;
+        }
+
+        if (store->children.size() == 2) {
+            // Array store: dst[i] = expr
+            auto target = store->children[0];
+            if (!isUnitStrideAccess(target, plan.inductionVar)) {
+                return std::nullopt;
+            }
+            plan.destination = target->value;
+            plan.expression = store->children[1];
+        } else if (store->children.size() == 1 && plan.kind == VectorizationPlan::Kind::MAP) {
+            // Scalar accumulator: acc = acc op expr
+            auto update = store->children[0];
+            if (update->type != ASTNodeType::OPERATION || update->children.size() != 2 ||
+                !isReassociable(update->value) || update->children[0]->type != ASTNodeType::IDENTIFIER ||
+                update->children[0]->value != store->value) {
+                return std::nullopt;
+            }
+            plan.kind = VectorizationPlan::Kind::REDUCTION;
+            plan.destination = store->value;
+            plan.reductionOp = update->value;
+            plan.expression = update->children[1];
+        } else {
+            return std::nullopt;
+        }
+
+        if (!isVectorizableExpression(plan.expression, plan) || plan.sources.empty()) {
+            return std::nullopt;
+        }
+        // One register per expression node, plus accumulator/mask/old value; stay within 16
+        int registers = countNodes(plan.expression) + (plan.predicate ? countNodes(plan.predicate) + 1 : 0);
+        if (registers > 13) {
+            return std::nullopt;
+        }
+        if (plan.kind == VectorizationPlan::Kind::REDUCTION && plan.destination == plan.inductionVar) {
+            return std::nullopt;
+        }
+
+        // All arrays touched by the loop must share one integer element width
+        plan.elementBytes = 0;
+        std::vector<std::string> touched = plan.sources;
+        if (plan.kind != VectorizationPlan::Kind::REDUCTION) {
+            touched.push_back(plan.destination);
+        }
+        for (const auto& array : touched) {
+            int bytes = elementBytesOf(array);
+            if (bytes == 0 || (plan.elementBytes != 0 && bytes != plan.elementBytes)) {
+                return std::nullopt;
+            }
+            plan.elementBytes = bytes;
+        }
+        if (!supportsOperations(plan.expression, plan.elementBytes) ||
+            (plan.predicate && !supportsOperations(plan.predicate, plan.elementBytes)) ||
+            (plan.kind == VectorizationPlan::Kind::REDUCTION && vectorOpcode(plan.reductionOp, plan.elementBytes).empty())) {
+            return std::nullopt;
+        }
+
+        // Every access is dst[i]/src[i], so the only hazard is a source partially overlapping the
+        // destination. Reading the destination at the same index is in-place and safe; distinct
+        // names may still point into the same buffer, which only a runtime check can rule out.
+        if (plan.kind != VectorizationPlan::Kind::REDUCTION) {
+            for (const auto& source : plan.sources) {
+                if (source != plan.destination) {
+                    plan.needsAliasCheck = true;
+                }
             }
         }
+        return plan;
     }
 
-    // Generate backend code for a specific AST node
-    void generateCodeForNode(std::shared_ptr<ASTNode> node) {
+    bool isUnitStrideAccess(std::shared_ptr<ASTNode> node, const std::string& inductionVar) {
+        return node->type == ASTNodeType::ARRAY_ACCESS && node->children.size() == 1 &&
+               node->children[0]->type == ASTNodeType::IDENTIFIER && node->children[0]->value == inductionVar;
+    }
+
+    int countNodes(std::shared_ptr<ASTNode> node) {
+        int count = 1;
+        for (auto& child : node->children) {
+            count += countNodes(child);
+        }
+        return count;
+    }
+
+    bool isComparison(std::shared_ptr<ASTNode> node) {
+        return node->type == ASTNodeType::OPERATION && node->children.size() == 2 &&
+               (node->value == ">" || node->value == "<" || node->value == "==");
+    }
+
+    bool isReassociable(const std::string& op) {
+        return op == "+" || op == "&" || op == "|" || op == "^";
+    }
+
+    bool isVectorizableExpression(std::shared_ptr<ASTNode> node, VectorizationPlan& plan) {
         switch (node->type) {
-            case ASTNodeType::FUNCTION_DECLARATION:
-                generateFunctionDeclarationBackend(node);
-                break;
-            case ASTNodeType::ASSIGNMENT:
-                generateAssignmentBackend(node);
-                break;
+            case ASTNodeType::LITERAL:
+                return true;
+            case ASTNodeType::IDENTIFIER:
+                // Loop-invariant scalars are broadcast; the induction variable itself is not supported
+                return node->value != plan.inductionVar && node->value != plan.destination;
+            case ASTNodeType::ARRAY_ACCESS:
+                if (!isUnitStrideAccess(node, plan.inductionVar)) {
+                    return false;
+                }
+                if (std::find(plan.sources.begin(), plan.sources.end(), node->value) == plan.sources.end()) {
+                    plan.sources.push_back(node->value);
+                }
+                return true;
             case ASTNodeType::OPERATION:
-                generateOperationBackend(node);
-                break;
+                return node->children.size() == 2 && isVectorizableExpression(node->children[0], plan) &&
+                       isVectorizableExpression(node->children[1], plan);
+            default:
+                return false;
+        }
+    }
+
+    bool supportsOperations(std::shared_ptr<ASTNode> node, int elementBytes) {
+        if (node->type != ASTNodeType::OPERATION) {
+            return true;
+        }
+        if (!isComparison(node) && vectorOpcode(node->value, elementBytes).empty()) {
+            return false;
+        }
+        // There is no packed 64-bit signed compare before SSE4.2; keep it simple and reject
+        if (isComparison(node) && node->value != "==" && elementBytes == 8 && options.isa == VectorISA::SSE) {
+            return false;
+        }
+        return supportsOperations(node->children[0], elementBytes) && supportsOperations(node->children[1], elementBytes);
+    }
+
+    // Arrays never passed to declareArray have no known element type and stay scalar
+    int elementBytesOf(const std::string& array) {
+        auto it = arrayElementTypes.find(array);
+        if (it == arrayElementTypes.end()) {
+            return 0;
+        }
+        const std::string& type = it->second;
+        if (type == "byte" || type == "char" || type == "bool") return 1;
+        if (type == "short") return 2;
+        if (type == "int") return 4;
+        if (type == "long") return 8;
+        return 0; // float/double/struct elements stay scalar
+    }
+
+    int vectorLanes(int elementBytes) {
+        return (options.isa == VectorISA::AVX2 ? 32 : 16) / elementBytes;
+    }
+
+    static const char* widthSuffix(int elementBytes) {
+        switch (elementBytes) {
+            case 1: return "b";
+            case 2: return "w";
+            case 4: return "d";
+            default: return "q";
+        }
+    }
+
+    // Packed integer opcode for a binary operator, or "" when the ISA has none
+    std::string vectorOpcode(const std::string& op, int elementBytes) {
+        if (op == "&") return "pand";
+        if (op == "|") return "por";
+        if (op == "^") return "pxor";
+        if (op == "+") return std::string("padd") + widthSuffix(elementBytes);
+        if (op == "-") return std::string("psub") + widthSuffix(elementBytes);
+        if (op == "*" && elementBytes == 2) return "pmullw";
+        if (op == "*" && elementBytes == 4) return "pmulld";
+        return "";
+    }
+
+    std::string vectorRegister(int index) {
+        return (options.isa == VectorISA::AVX2 ? "ymm" : "xmm") + std::to_string(index);
+    }
+
+    // Two-operand SSE forms need a copy first; AVX2 has three-operand VEX encodings
+    void emitVectorBinary(std::ostringstream& out, const std::string& opcode, const std::string& dst,
+                          const std::string& lhs, const std::string& rhs) {
+        if (options.isa == VectorISA::AVX2) {
+            out << "    v" << opcode << " " << dst << ", " << lhs << ", " << rhs << "\n";
+        } else {
+            if (dst != lhs) {
+                out << "    movdqa " << dst << ", " << lhs << "\n";
+            }
+            out << "    " << opcode << " " << dst << ", " << rhs << "\n";
+        }
+    }
+
+    std::string vectorMove() {
+        return options.isa == VectorISA::AVX2 ? "vmovdqu" : "movdqu";
+    }
+
+    // Loops address locals as memory like the rest of the backend: scalars are `qword [name]` and
+    // arrays are locals holding the element pointer. The induction variable lives in rax for the
+    // duration of the loop, and each element access reloads its array base into r11.
+    static std::string variableOperand(const std::string& name) {
+        return "qword [" + name + "]";
+    }
+
+    static std::string scalarOperand(std::shared_ptr<ASTNode> node) {
+        return node->type == ASTNodeType::LITERAL ? node->value : variableOperand(node->value);
+    }
+
+    static std::string elementOperand(std::ostringstream& out, const std::string& array, int elementBytes) {
+        out << "    mov r11, " << variableOperand(array) << "\n";
+        return "[r11 + rax*" + std::to_string(elementBytes) + "]";
+    }
+
+    // Registers 1-13 hold expression nodes (see analyzeLoop); unsigned byte compares use the last two
+    static const int compareScratchRegister = 14;
+    static const int signBiasRegister = 15;
+
+    // Splat a literal or loop-invariant operand into every lane of reg, through r11
+    void emitBroadcast(std::ostringstream& out, const std::string& reg, const std::string& value, int elementBytes) {
+        std::string xmm = "xmm" + reg.substr(3);
+        out << "    mov r11, " << value << "\n";
+        if (options.isa == VectorISA::AVX2) {
+            out << (elementBytes == 8 ? "    vmovq " + xmm + ", r11\n" : "    vmovd " + xmm + ", r11d\n");
+            out << "    vpbroadcast" << widthSuffix(elementBytes) << " " << reg << ", " << xmm << "\n";
+            return;
+        }
+        if (elementBytes == 8) {
+            out << "    movq " << xmm << ", r11\n";
+            out << "    punpcklqdq " << xmm << ", " << xmm << "\n";
+            return;
+        }
+        // SSE has no narrow broadcast; replicate the value across the low dword and splat that
+        if (elementBytes == 1) {
+            out << "    movzx r11d, r11b\n";
+            out << "    imul r11d, r11d, 0x01010101\n";
+        } else if (elementBytes == 2) {
+            out << "    movzx r11d, r11w\n";
+            out << "    imul r11d, r11d, 0x00010001\n";
+        }
+        out << "    movd " << xmm << ", r11d\n";
+        out << "    pshufd " << xmm << ", " << xmm << ", 0\n";
+    }
+
+    bool hasOrderedComparison(std::shared_ptr<ASTNode> node) {
+        if (!node || node->type != ASTNodeType::OPERATION) {
+            return false;
+        }
+        if (isComparison(node) && node->value != "==") {
+            return true;
+        }
+        return hasOrderedComparison(node->children[0]) || hasOrderedComparison(node->children[1]);
+    }
+
+    // Emit vector code for an expression into `out`; returns the register holding the result.
+    // Literals and invariants are broadcast into `hoisted`, which runs once before the loop.
+    std::string emitVectorExpression(std::ostringstream& out, std::ostringstream& hoisted, std::shared_ptr<ASTNode> node,
+                                     const VectorizationPlan& plan, int& nextRegister) {
+        std::string reg = vectorRegister(nextRegister++);
+        switch (node->type) {
+            case ASTNodeType::ARRAY_ACCESS: {
+                std::string source = elementOperand(out, node->value, plan.elementBytes);
+                out << "    " << vectorMove() << " " << reg << ", " << source << "\n";
+                return reg;
+            }
+            case ASTNodeType::LITERAL:
+            case ASTNodeType::IDENTIFIER:
+                emitBroadcast(hoisted, reg, scalarOperand(node), plan.elementBytes);
+                return reg;
             default:
                 break;
         }
+
+        std::string lhs = emitVectorExpression(out, hoisted, node->children[0], plan, nextRegister);
+        std::string rhs = emitVectorExpression(out, hoisted, node->children[1], plan, nextRegister);
+        std::string suffix = widthSuffix(plan.elementBytes);
+        if (isComparison(node) && node->value != "==" && plan.elementBytes == 1) {
+            // Byte elements are unsigned and pcmpgtb is signed; flipping both sign bits maps one
+            // order onto the other. The operands may be hoisted invariants, so work on copies.
+            const std::string& greater = node->value == ">" ? lhs : rhs;
+            const std::string& smaller = node->value == ">" ? rhs : lhs;
+            std::string scratch = vectorRegister(compareScratchRegister);
+            std::string bias = vectorRegister(signBiasRegister);
+            emitVectorBinary(out, "pxor", scratch, smaller, bias);
+            emitVectorBinary(out, "pxor", reg, greater, bias);
+            emitVectorBinary(out, "pcmpgtb", reg, reg, scratch);
+        } else if (node->value == ">") {
+            emitVectorBinary(out, "pcmpgt" + suffix, reg, lhs, rhs);
+        } else if (node->value == "<") {
+            emitVectorBinary(out, "pcmpgt" + suffix, reg, rhs, lhs);
+        } else if (node->value == "==") {
+            emitVectorBinary(out, "pcmpeq" + suffix, reg, lhs, rhs);
+        } else {
+            emitVectorBinary(out, vectorOpcode(node->value, plan.elementBytes), reg, lhs, rhs);
+        }
+        return reg;
     }
 
-    // Generate assembly for function declaration
-    void generateFunctionDeclarationBackend(std::shared_ptr<ASTNode> node) {
-        Logger::log("Generating function declaration code for: " + node->value);
-        std::cout << "Generating function: " << node->value << "()" << std::endl;
+    std::string describeExpression(std::shared_ptr<ASTNode> node) {
+        switch (node->type) {
+            case ASTNodeType::ARRAY_ACCESS:
+                return node->value + "[" + (node->children.empty() ? "" : describeExpression(node->children[0])) + "]";
+            case ASTNodeType::OPERATION:
+                if (node->children.size() == 2) {
+                    return "(" + describeExpression(node->children[0]) + " " + node->value + " " +
+                           describeExpression(node->children[1]) + ")";
+                }
+                if (node->children.size() == 1) {
+                    return node->value + describeExpression(node->children[0]);
+                }
+                return node->value;
+            default:
+                return node->value;
+        }
     }
 
-    // Generate assembly for assignments
-    void generateAssignmentBackend(std::shared_ptr<ASTNode> node) {
-        Logger::log("Generating assignment code for: " + node->value);
-        std::cout << "Assigning value to variable: " << node->value << std::endl;
+    // Scalar register `index` of the epilogue, named for an operand of `bytes` bytes. The node
+    // limit in analyzeLoop keeps expressions within rcx..r10, leaving r11 for array bases.
+    static const char* scalarRegister(int index, int bytes) {
+        static const char* names[][4] = {{"cl", "cx", "ecx", "rcx"},     {"dl", "dx", "edx", "rdx"},
+                                         {"sil", "si", "esi", "rsi"},    {"dil", "di", "edi", "rdi"},
+                                         {"r8b", "r8w", "r8d", "r8"},    {"r9b", "r9w", "r9d", "r9"},
+                                         {"r10b", "r10w", "r10d", "r10"}, {"r11b", "r11w", "r11d", "r11"}};
+        return names[index][bytes == 1 ? 0 : bytes == 2 ? 1 : bytes == 4 ? 2 : 3];
     }
 
-    // Generate assembly for operations
-    void generateOperationBackend(std::shared_ptr<ASTNode> node) {
-        Logger::log("Generating operation code for: " + node->value);
-        std::cout << "Performing operation: " << node->value << std::endl;
+    static const char* sizeKeyword(int bytes) {
+        switch (bytes) {
+            case 1: return "byte";
+            case 2: return "word";
+            case 4: return "dword";
+            default: return "qword";
+        }
+    }
+
+    // Condition codes for a comparison of elements; bytes compare unsigned, wider elements signed
+    static std::string conditionCode(const std::string& op, int elementBytes, bool negate = false) {
+        if (op == "==") {
+            return negate ? "ne" : "e";
+        }
+        bool greater = (op == ">") != negate;
+        std::string code = elementBytes == 1 ? (greater ? "a" : "b") : (greater ? "g" : "l");
+        return negate ? code + "e" : code;
+    }
+
+    static std::string scalarOpcode(const std::string& op) {
+        if (op == "+") return "add";
+        if (op == "-") return "sub";
+        if (op == "*") return "imul";
+        if (op == "&") return "and";
+        if (op == "|") return "or";
+        return "xor";
+    }
+
+    // Scalar code for an expression, evaluated in 64-bit registers from `depth` on; returns the
+    // register holding the result. Comparisons yield all ones or zero, like the vector lanes.
+    std::string emitScalarExpression(std::ostringstream& out, std::shared_ptr<ASTNode> node,
+                                     const VectorizationPlan& plan, int depth) {
+        std::string reg = scalarRegister(depth, 8);
+        switch (node->type) {
+            case ASTNodeType::ARRAY_ACCESS: {
+                std::string source = elementOperand(out, node->value, plan.elementBytes);
+                switch (plan.elementBytes) {
+                    case 1: out << "    movzx " << scalarRegister(depth, 4) << ", byte " << source << "\n"; break;
+                    case 2: out << "    movsx " << reg << ", word " << source << "\n"; break;
+                    case 4: out << "    movsxd " << reg << ", dword " << source << "\n"; break;
+                    default: out << "    mov " << reg << ", qword " << source << "\n"; break;
+                }
+                return reg;
+            }
+            case ASTNodeType::LITERAL:
+            case ASTNodeType::IDENTIFIER:
+                out << "    mov " << reg << ", " << scalarOperand(node) << "\n";
+                return reg;
+            default:
+                break;
+        }
+
+        emitScalarExpression(out, node->children[0], plan, depth);
+        std::string rhs = emitScalarExpression(out, node->children[1], plan, depth + 1);
+        if (isComparison(node)) {
+            out << "    cmp " << reg << ", " << rhs << "\n";
+            out << "    set" << conditionCode(node->value, plan.elementBytes) << " " << scalarRegister(depth, 1) << "\n";
+            out << "    movzx " << scalarRegister(depth, 4) << ", " << scalarRegister(depth, 1) << "\n";
+            out << "    neg " << reg << "\n";
+        } else {
+            out << "    " << scalarOpcode(node->value) << " " << reg << ", " << rhs << "\n";
+        }
+        return reg;
+    }
+
+    // Sign-extend the low half of `source` into `low` and its high half in place
+    void emitSignExtendHalves(std::ostringstream& out, const std::string& opcode, const std::string& source,
+                              const std::string& low) {
+        std::string sourceXmm = "xmm" + source.substr(3);
+        if (options.isa == VectorISA::AVX2) {
+            out << "    v" << opcode << " " << low << ", " << sourceXmm << "\n";
+            out << "    vextracti128 " << sourceXmm << ", " << source << ", 1\n";
+            out << "    v" << opcode << " " << source << ", " << sourceXmm << "\n";
+        } else {
+            out << "    " << opcode << " " << low << ", " << source << "\n";
+            out << "    psrldq " << source << ", 8\n";
+            out << "    " << opcode << " " << source << ", " << source << "\n";
+        }
+    }
+
+    // Add the lanes of `value` into the qword lanes of the accumulator (register 0). Bytes are
+    // summed unsigned through psadbw; words and dwords are sign-extended, like the scalar loads.
+    void emitWidenedSum(std::ostringstream& out, const std::string& value, int elementBytes) {
+        std::string acc = vectorRegister(0);
+        std::string scratch = vectorRegister(compareScratchRegister);
+        if (elementBytes == 1) {
+            emitVectorBinary(out, "pxor", scratch, scratch, scratch);
+            emitVectorBinary(out, "psadbw", value, value, scratch);
+            emitVectorBinary(out, "paddq", acc, acc, value);
+            return;
+        }
+        std::string dwords = value;
+        std::string spare = scratch;
+        if (elementBytes == 2) {
+            // Pairwise sums of sign-extended words cannot overflow a dword
+            emitSignExtendHalves(out, "pmovsxwd", value, scratch);
+            emitVectorBinary(out, "paddd", scratch, scratch, value);
+            dwords = scratch;
+            spare = value;
+        }
+        emitSignExtendHalves(out, "pmovsxdq", dwords, spare);
+        emitVectorBinary(out, "paddq", acc, acc, spare);
+        emitVectorBinary(out, "paddq", acc, acc, dwords);
     }
+
+    // Vector loop with runtime alias check, main body and scalar epilogue
+    void generateVectorLoopBackend(std::shared_ptr<ASTNode> node, const VectorizationPlan& plan) {
+        std::ostringstream out;
+        std::string id;
+        {
+            std::lock_guard<std::mutex> lock(generationMutex);
+            id = std::to_string(labelCounter++);
+        }
+        const std::string& i = plan.inductionVar;
+        const std::string& n = plan.tripCount;
+        std::string tripCount = plan.constantTripCount ? n : variableOperand(n);
+        int lanes = vectorLanes(plan.elementBytes);
+        int bytes = plan.elementBytes;
+        // A sum over narrow elements would wrap at the element width in the vector body but at 64
+        // bits in the scalar epilogue, so it accumulates in qword lanes instead. Bitwise reductions
+        // commute with the zero/sign extension and can stay at the element width.
+        bool widen = plan.kind == VectorizationPlan::Kind::REDUCTION && plan.reductionOp == "+" && bytes < 8;
+
+        out << "; vectorized loop over " << i << " < " << n << " (" << lanes << " x " << bytes * 8 << "-bit lanes)\n";
+        out << "    xor eax, eax\n";
+        if (plan.needsAliasCheck) {
+            out << "    mov rdx, " << tripCount << "\n";
+            for (const auto& source : plan.sources) {
+                if (source == plan.destination) {
+                    continue;
+                }
+                out << "    ; alias check: " << plan.destination << "[0.." << n << ") vs " << source << "[0.." << n << ")\n";
+                out << "    mov r8, " << variableOperand(plan.destination) << "\n";
+                out << "    lea r9, [r8 + rdx*" << bytes << "]\n";
+                out << "    mov r10, " << variableOperand(source) << "\n";
+                out << "    lea r11, [r10 + rdx*" << bytes << "]\n";
+                out << "    cmp r10, r9\n";
+                out << "    jae .Lnoalias" << id << "_" << source << "\n";
+                out << "    cmp r8, r11\n";
+                out << "    jb .Lscalar" << id << "\n";
+                out << ".Lnoalias" << id << "_" << source << ":\n";
+            }
+        }
+
+        // The body is built first so its broadcasts land here, ahead of the loop
+        std::ostringstream body;
+        int nextRegister = 1;
+        if (plan.kind == VectorizationPlan::Kind::REDUCTION) {
+            std::string zero = vectorRegister(0);
+            emitVectorBinary(out, "pxor", zero, zero, zero);
+        }
+        if (bytes == 1 && (hasOrderedComparison(plan.expression) || hasOrderedComparison(plan.predicate))) {
+            emitBroadcast(out, vectorRegister(signBiasRegister), "0x80", 1);
+        }
+        std::string value = emitVectorExpression(body, out, plan.expression, plan, nextRegister);
+        switch (plan.kind) {
+            case VectorizationPlan::Kind::MAP: {
+                std::string target = elementOperand(body, plan.destination, bytes);
+                body << "    " << vectorMove() << " " << target << ", " << value << "\n";
+                break;
+            }
+            case VectorizationPlan::Kind::REDUCTION: {
+                std::string acc = vectorRegister(0);
+                if (widen) {
+                    emitWidenedSum(body, value, bytes);
+                } else {
+                    emitVectorBinary(body, vectorOpcode(plan.reductionOp, bytes), acc, acc, value);
+                }
+                break;
+            }
+            case VectorizationPlan::Kind::FILTER: {
+                // Masked update: lanes failing the predicate keep the old destination value
+                std::string mask = emitVectorExpression(body, out, plan.predicate, plan, nextRegister);
+                std::string old = vectorRegister(nextRegister++);
+                std::string target = elementOperand(body, plan.destination, bytes);
+                body << "    " << vectorMove() << " " << old << ", " << target << "\n";
+                if (options.isa == VectorISA::AVX2) {
+                    body << "    vpblendvb " << old << ", " << old << ", " << value << ", " << mask << "\n";
+                } else {
+                    // SSE4.1 pblendvb takes its mask implicitly in xmm0
+                    body << "    movdqa xmm0, " << mask << "\n";
+                    body << "    pblendvb " << old << ", " << value << "\n";
+                }
+                body << "    " << vectorMove() << " " << target << ", " << old << "\n";
+                break;
+            }
+        }
+        out << ".Lvector" << id << ":\n";
+        out << "    lea r11, [rax + " << lanes << "]\n";
+        out << "    cmp r11, " << tripCount << "\n";
+        out << "    ja " << (plan.kind == VectorizationPlan::Kind::REDUCTION ? ".Lhorizontal" : ".Lscalar") << id << "\n";
+        out << body.str();
+        out << "    add rax, " << lanes << "\n";
+        out << "    jmp .Lvector" << id << "\n";
+
+        if (plan.kind == VectorizationPlan::Kind::REDUCTION) {
+            // Fold the accumulator lanes into one element and combine it with the incoming scalar
+            std::string op = widen ? "paddq" : vectorOpcode(plan.reductionOp, bytes);
+            int laneBytes = widen ? 8 : bytes;
+            out << ".Lhorizontal" << id << ":\n";
+            bool vex = options.isa == VectorISA::AVX2;
+            if (vex) {
+                out << "    vextracti128 xmm1, ymm0, 1\n";
+                out << "    v" << op << " xmm0, xmm0, xmm1\n";
+            }
+            for (int width = 8; width >= laneBytes; width /= 2) {
+                if (vex) {
+                    out << "    vpsrldq xmm1, xmm0, " << width << "\n";
+                    out << "    v" << op << " xmm0, xmm0, xmm1\n";
+                } else {
+                    out << "    movdqa xmm1, xmm0\n";
+                    out << "    psrldq xmm1, " << width << "\n";
+                    out << "    " << op << " xmm0, xmm1\n";
+                }
+            }
+            switch (laneBytes) {
+                case 1: out << "    movd ecx, xmm0\n    movzx ecx, cl\n"; break;
+                case 2: out << "    movd ecx, xmm0\n    movsx rcx, cx\n"; break;
+                case 4: out << "    movd ecx, xmm0\n    movsxd rcx, ecx\n"; break;
+                default: out << "    movq rcx, xmm0\n"; break;
+            }
+            out << "    " << scalarOpcode(plan.reductionOp) << " " << variableOperand(plan.destination) << ", rcx\n";
+        }
+
+        // Remainder iterations, and the whole loop when the alias check fails
+        out << ".Lscalar" << id << ":\n";
+        out << "    cmp rax, " << tripCount << "\n";
+        out << "    jae .Ldone" << id << "\n";
+        if (plan.kind == VectorizationPlan::Kind::FILTER) {
+            std::string lhs = emitScalarExpression(out, plan.predicate->children[0], plan, 0);
+            std::string rhs = emitScalarExpression(out, plan.predicate->children[1], plan, 1);
+            out << "    cmp " << lhs << ", " << rhs << "\n";
+            out << "    j" << conditionCode(plan.predicate->value, bytes, true) << " .Lnext" << id << "\n";
+        }
+        std::string scalar = emitScalarExpression(out, plan.expression, plan, 0);
+        if (plan.kind == VectorizationPlan::Kind::REDUCTION) {
+            // Element expressions are evaluated at the element width, as in the vector lanes
+            switch (bytes) {
+                case 1: out << "    movzx ecx, cl\n"; break;
+                case 2: out << "    movsx rcx, cx\n"; break;
+                case 4: out << "    movsxd rcx, ecx\n"; break;
+                default: break;
+            }
+            out << "    " << scalarOpcode(plan.reductionOp) << " " << variableOperand(plan.destination) << ", " << scalar << "\n";
+        } else {
+            std::string target = elementOperand(out, plan.destination, bytes);
+            out << "    mov " << sizeKeyword(bytes) << " " << target << ", " << scalarRegister(0, bytes) << "\n";
+        }
+        if (plan.kind == VectorizationPlan::Kind::FILTER) {
+            out << ".Lnext" << id << ":\n";
+        }
+        out << "    inc rax\n";
+        out << "    jmp .Lscalar" << id << "\n";
+        out << ".Ldone" << id << ":\n";
+        out << "    mov " << variableOperand(i) << ", rax\n";
+
+        Logger::debug("Generating vector loop code for: ", node->value);
+        std::lock_guard<std::mutex> lock(generationMutex);
+        std::cout << out.str();
+    }
+
+    // Step 3: Perform function-level optimizations like function inlining
+    //
+    // A function is inlinable when its children are parameter IDENTIFIERs followed by a single
+    // RETURN of a call-free expression; the call is rewritten in place into that expression with
+    // the arguments substituted. With a profile, hot call edges get a larger size budget and
+    // never-executed edges are left alone.
+    void functionInlining(std::shared_ptr<ASTNode> irNode) {
+        TimeScope scope("Inlining");
+        Logger::log("Performing function inlining optimization...");
+        std::unordered_map<std::string, std::shared_ptr<ASTNode>> functions;
+        for (auto& child : irNode->children) {
+            if (child->type == ASTNodeType::FUNCTION_DECLARATION) {
+                functions[child->value] = child;
+            }
+        }
+        for (auto& child : irNode->children) {
+            if (child->type == ASTNodeType::FUNCTION_DECLARATION) {
+                inlineCalls(child, child->value, functions);
+            }
+        }
+    }
+
+    void inlineCalls(std::shared_ptr<ASTNode> node, const std::string& caller,
+                     const std::unordered_map<std::string, std::shared_ptr<ASTNode>>& functions) {
+        for (auto& child : node->children) {
+            inlineCalls(child, caller, functions);
+        }
+        if (node->type != ASTNodeType::FUNCTION_CALL || node->value == caller) {
+            return;
+        }
+        auto callee = functions.find(node->value);
+        if (callee == functions.end()) {
+            return;
+        }
+        auto body = inlinableBody(callee->second);
+        if (!body || callee->second->children.size() - 1 != node->children.size()) {
+            return;
+        }
+        for (auto& argument : node->children) {
+            if (containsCall(argument)) {
+                return; // Arguments may be duplicated by substitution, so they must be side-effect free
+            }
+        }
+
+        int budget = options.inlineThreshold;
+        if (!profile.empty()) {
+            std::string edge = caller + ">" + node->value;
+            if (profile.contains("call", edge) && profile.count("call", edge) == 0) {
+                return;
+            }
+            if (profile.isHot("call", edge)) {
+                budget = options.hotInlineThreshold;
+            }
+        }
+        if (countNodes(body) > budget) {
+            return;
+        }
+
+        std::unordered_map<std::string, std::shared_ptr<ASTNode>> arguments;
+        for (size_t i = 0; i < node->children.size(); i++) {
+            arguments[callee->second->children[i]->value] = node->children[i];
+        }
+        auto inlined = cloneWithSubstitution(body, arguments);
+        Logger::log("Inlined ", node->value, " into ", caller);
+        node->type = inlined->type;
+        node->value = inlined->value;
+        node->children = inlined->children;
+    }
+
+    std::shared_ptr<ASTNode> inlinableBody(std::shared_ptr<ASTNode> function) {
+        if (function->children.empty()) {
+            return nullptr;
+        }
+        for (size_t i = 0; i + 1 < function->children.size(); i++) {
+            if (function->children[i]->type != ASTNodeType::IDENTIFIER) {
+                return nullptr;
+            }
+        }
+        auto last = function->children.back();
+        if (last->type != ASTNodeType::RETURN || last->children.size() != 1 || containsCall(last->children[0])) {
+            return nullptr;
+        }
+        return last->children[0];
+    }
+
+    bool containsCall(std::shared_ptr<ASTNode> node) {
+        if (node->type == ASTNodeType::FUNCTION_CALL) {
+            return true;
+        }
+        for (auto& child : node->children) {
+            if (containsCall(child)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::shared_ptr<ASTNode> cloneWithSubstitution(std::shared_ptr<ASTNode> node,
+                                                   const std::unordered_map<std::string, std::shared_ptr<ASTNode>>& arguments) {
+        if (node->type == ASTNodeType::IDENTIFIER) {
+            auto argument = arguments.find(node->value);
+            if (argument != arguments.end()) {
+                return cloneWithSubstitution(argument->second, {});
+            }
+        }
+        auto copy = std::make_shared<ASTNode>(node->type, node->value);
+        copy->lineNumber = node->lineNumber;
+        for (auto& child : node->children) {
+            copy->addChild(cloneWithSubstitution(child, arguments));
+        }
+        return copy;
+    }
+
+    // Escape analysis and scalar replacement of aggregates
+    //
+    // Aggregates are created by ASSIGNMENT v (ALLOCATION type (ASSIGNMENT field (expr))...) and
+    // used through OBJECT_MANIPULATION field (IDENTIFIER v) for loads, OBJECT_MANIPULATION field
+    // (IDENTIFIER v, expr) for stores, and ARRAY_ACCESS v (index) for array elements. Any other
+    // appearance of v (call argument, RETURN, copy into another variable or object) lets the
+    // object escape. Per function, each allocation bound once to a local is then placed:
+    //   SCALARS  no escape and only constant indices: every field becomes a local "v.field"
+    //   STACK    no escape, but indexed dynamically or too many fields for scalars
+    //   HEAP     everything else, allocated from the runtime pools
+    void escapeAnalysis(std::shared_ptr<ASTNode> irNode) {
+        TimeScope scope("Escape analysis");
+        Logger::log("Performing escape analysis...");
+        int counts[3] = {0, 0, 0};
+        for (auto& function : irNode->children) {
+            if (function->type != ASTNodeType::FUNCTION_DECLARATION) {
+                continue;
+            }
+            std::map<std::string, AllocationCandidate> candidates;
+            std::map<std::string, int> assignments;
+            collectAllocations(function, candidates, assignments);
+            for (auto& [name, candidate] : candidates) {
+                if (assignments[name] > 1) {
+                    candidate.escapes = true; // Rebinding would need flow-sensitive analysis
+                }
+            }
+            findEscapes(function, nullptr, candidates);
+
+            for (auto& [name, candidate] : candidates) {
+                int fields = static_cast<int>(std::max(candidate.allocation->children.size(), candidate.constantIndices.size()));
+                int bytes = 8 * std::max(fields, 1);
+                AllocationPlacement placement = AllocationPlacement::HEAP;
+                if (!candidate.escapes && !candidate.dynamicIndex && fields <= options.maxScalarFields) {
+                    placement = AllocationPlacement::SCALARS;
+                    replaceWithScalars(function, name);
+                } else if (!candidate.escapes && bytes <= options.maxStackBytes && !isAsync(function)) {
+                    placement = AllocationPlacement::STACK; // A suspended coroutine has no stack frame
+                }
+                allocationPlacements[candidate.allocation.get()] = placement;
+                counts[static_cast<int>(placement)]++;
+                Logger::log("Escape analysis: ", name, " (", candidate.allocation->value, ") -> ",
+                            placementName(placement));
+            }
+            // Allocations not bound to a local escape by construction
+            markUnboundAllocations(function);
+        }
+        Logger::log("Escape analysis: ", counts[2], " scalar-replaced, ", counts[1],
+                    " on the stack, ", counts[0], " on the heap");
+    }
+
+    struct AllocationCandidate {
+        std::shared_ptr<ASTNode> allocation;
+        bool escapes = false;
+        bool dynamicIndex = false;
+        std::set<std::string> constantIndices;
+    };
+
+    static const char* placementName(AllocationPlacement placement) {
+        switch (placement) {
+            case AllocationPlacement::SCALARS: return "scalars";
+            case AllocationPlacement::STACK: return "stack";
+            default: return "heap";
+        }
+    }
+
+    static bool isBoundAllocation(const std::shared_ptr<ASTNode>& node) {
+        return node->type == ASTNodeType::ASSIGNMENT && node->children.size() == 1 &&
+               node->children[0]->type == ASTNodeType::ALLOCATION;
+    }
+
+    void collectAllocations(std::shared_ptr<ASTNode> node, std::map<std::string, AllocationCandidate>& candidates,
+                            std::map<std::string, int>& assignments) {
+        if (node->type == ASTNodeType::ALLOCATION) {
+            // Field initializers name fields, not locals
+            for (auto& field : node->children) {
+                for (auto& value : field->children) {
+                    collectAllocations(value, candidates, assignments);
+                }
+            }
+            return;
+        }
+        if (node->type == ASTNodeType::ASSIGNMENT && !node->value.empty()) {
+            assignments[node->value]++;
+            if (isBoundAllocation(node)) {
+                candidates[node->value].allocation = node->children[0];
+            }
+        }
+        for (auto& child : node->children) {
+            collectAllocations(child, candidates, assignments);
+        }
+    }
+
+    void findEscapes(std::shared_ptr<ASTNode> node, const ASTNode* parent, std::map<std::string, AllocationCandidate>& candidates) {
+        if (node->type == ASTNodeType::IDENTIFIER) {
+            auto candidate = candidates.find(node->value);
+            bool isBase = parent && parent->type == ASTNodeType::OBJECT_MANIPULATION && parent->children[0].get() == node.get();
+            if (candidate != candidates.end() && !isBase) {
+                candidate->second.escapes = true;
+            }
+        }
+        if (node->type == ASTNodeType::ARRAY_ACCESS) {
+            auto candidate = candidates.find(node->value);
+            if (candidate != candidates.end()) {
+                if (node->children.size() == 1 && node->children[0]->type == ASTNodeType::LITERAL) {
+                    candidate->second.constantIndices.insert(node->children[0]->value);
+                } else {
+                    candidate->second.dynamicIndex = true;
+                }
+            }
+        }
+        for (auto& child : node->children) {
+            findEscapes(child, node.get(), candidates);
+        }
+    }
+
+    // Rewrite every use of `name` in place: loads become IDENTIFIER "name.field" and stores become
+    // ASSIGNMENT "name.field". The allocation itself stays and is emitted as field initializers.
+    void replaceWithScalars(std::shared_ptr<ASTNode> node, const std::string& name) {
+        for (auto& child : node->children) {
+            replaceWithScalars(child, name);
+        }
+        // Array element store: ASSIGNMENT (ARRAY_ACCESS name[k], expr)
+        if (node->type == ASTNodeType::ASSIGNMENT && node->children.size() == 2 &&
+            node->children[0]->type == ASTNodeType::IDENTIFIER && node->children[0]->value.rfind(name + ".", 0) == 0) {
+            node->value = node->children[0]->value;
+            node->children.erase(node->children.begin());
+            return;
+        }
+        if (node->type == ASTNodeType::ARRAY_ACCESS && node->value == name) {
+            node->type = ASTNodeType::IDENTIFIER;
+            node->value = name + "." + node->children[0]->value;
+            node->children.clear();
+            return;
+        }
+        if (node->type == ASTNodeType::OBJECT_MANIPULATION && !node->children.empty() &&
+            node->children[0]->type == ASTNodeType::IDENTIFIER && node->children[0]->value == name) {
+            std::string scalar = name + "." + node->value;
+            if (node->children.size() == 2) {
+                node->type = ASTNodeType::ASSIGNMENT;
+                node->children.erase(node->children.begin());
+            } else {
+                node->type = ASTNodeType::IDENTIFIER;
+                node->children.clear();
+            }
+            node->value = scalar;
+        }
+    }
+
+    void markUnboundAllocations(std::shared_ptr<ASTNode> node) {
+        for (auto& child : node->children) {
+            if (child->type == ASTNodeType::ALLOCATION && !isBoundAllocation(node) &&
+                !allocationPlacements.count(child.get())) {
+                allocationPlacements[child.get()] = AllocationPlacement::HEAP;
+            }
+            markUnboundAllocations(child);
+        }
+    }
+
+    // Reference counting
+    //
+    // Heap aggregates carry a reference count (xec_rc_alloc, see Runtime/RefCount.hpp), and so do
+    // channels (xec_chan_new). A local whose every store is a heap allocation or a channel, or a
+    // copy of such a local, owns one reference.
+    // Field access, indexing and call arguments borrow (callees take parameters at +0); any other
+    // use consumes a reference, so the IDENTIFIER becomes a RETAIN: copies into other locals,
+    // RETURN, stores into objects.
+    //
+    // A local bound once by a statement of the function body releases its reference at every exit
+    // reached after that statement. Any other owned local (bound in a loop or a branch, or more
+    // than once) starts out null, releases its old reference before every store and releases at
+    // every exit. Exits and stores nested in loops get RELEASEs in the loop body in front of them;
+    // those that are a conditional's branch have their releases emitted with the branch.
+    //
+    // Elision: when a consuming use of a local bound once is its last use and its only use in a
+    // statement of the function body, the reference is moved instead. Its RETAIN and the RELEASEs
+    // at the exits after it would cancel, so neither is emitted. Uses inside loops and branches
+    // are never moved.
+    void referenceCounting(std::shared_ptr<ASTNode> irNode) {
+        TimeScope scope("Reference counting");
+        Logger::log("Inserting reference counting...");
+        int retains = 0, releases = 0, elided = 0;
+        auto functions = irNode->children; // RETAIN and RELEASE nodes are appended as they are made
+        for (auto& function : functions) {
+            if (function->type == ASTNodeType::FUNCTION_DECLARATION && containsAwait(function)) {
+                asyncFunctions.insert(function->value);
+            }
+        }
+        for (auto& function : functions) {
+            if (function->type != ASTNodeType::FUNCTION_DECLARATION) {
+                continue;
+            }
+            OwnedLocals owned = ownedReferences(function);
+            if (owned.empty()) {
+                continue;
+            }
+            std::map<std::string, size_t> lastUse;
+            for (size_t i = 0; i < function->children.size(); i++) {
+                for (auto& [name, _] : owned.once) {
+                    if (countUses(function->children[i], name) > 0) {
+                        lastUse[name] = i;
+                    }
+                }
+            }
+
+            auto release = [&](const std::string& name, std::vector<std::shared_ptr<ASTNode>>& into) {
+                auto node = std::make_shared<ASTNode>(ASTNodeType::RELEASE, name);
+                into.push_back(node);
+                irNode->addChild(node);
+                releases++;
+            };
+
+            std::set<std::string> moved;
+            std::vector<std::shared_ptr<ASTNode>> body;
+            size_t parameters = 0;
+            while (parameters < function->children.size() && function->children[parameters]->type == ASTNodeType::IDENTIFIER) {
+                body.push_back(function->children[parameters++]);
+            }
+            for (auto& name : owned.rebound) {
+                auto null = std::make_shared<ASTNode>(ASTNodeType::ASSIGNMENT, name);
+                null->addChild(std::make_shared<ASTNode>(ASTNodeType::LITERAL, "0"));
+                body.push_back(null);
+            }
+            for (size_t i = parameters; i < function->children.size(); i++) {
+                auto statement = function->children[i];
+                std::vector<std::shared_ptr<ASTNode>> retained;
+                retainConsumedUses(statement, nullptr, owned, retained);
+                bool straightLine = statement->type != ASTNodeType::LOOP && statement->type != ASTNodeType::CONDITIONAL;
+                for (auto& retain : retained) {
+                    auto last = lastUse.find(retain->value);
+                    if (options.elideRefCounts && straightLine && last != lastUse.end() && last->second == i &&
+                        countUses(statement, retain->value) == 1) {
+                        retain->type = ASTNodeType::IDENTIFIER;
+                        moved.insert(retain->value);
+                        elided++;
+                        continue;
+                    }
+                    irNode->addChild(retain);
+                    retains++;
+                }
+
+                // Releases due at exits in this statement: locals bound before it and still owned
+                std::vector<std::string> exit = liveAt(owned, i, moved);
+                if (statement->type == ASTNodeType::RETURN) {
+                    for (auto& name : exit) {
+                        release(name, body);
+                    }
+                } else {
+                    if (isStoreTo(statement, owned.rebound)) {
+                        release(statement->value, body);
+                    }
+                    releases += releaseNested(statement, exit, owned.rebound, irNode);
+                }
+                body.push_back(statement);
+            }
+
+            // Falling off the end is an exit too
+            if (function->children.empty() || function->children.back()->type != ASTNodeType::RETURN) {
+                for (auto& name : liveAt(owned, function->children.size(), moved)) {
+                    release(name, body);
+                }
+            }
+            function->children = std::move(body);
+        }
+        Logger::log("Reference counting: ", retains, " retains, ", releases,
+                    " releases, ", elided, " retain/release pairs elided");
+    }
+
+    struct OwnedLocals {
+        std::map<std::string, size_t> once;  // Bound once, by this statement of the function body
+        std::set<std::string> rebound;        // Bound in nested statements or more than once
+
+        bool empty() const { return once.empty() && rebound.empty(); }
+        bool count(const std::string& name) const { return once.count(name) || rebound.count(name); }
+    };
+
+    // Locals owning a reference: every store to them is a heap allocation, a new channel or a copy
+    // of another owned local. Parameters are borrowed, and locals stored by `thread` blocks are
+    // shared with running tasks, so neither is ever owned. Tasks borrow the locals they read too:
+    // that is safe for a local bound once at the top of the body, which is released only after the
+    // join, but not for one rebound while tasks may still hold its old value. A coroutine spawned
+    // by an async function can outlive it, so what it is passed is not owned by the caller either.
+    OwnedLocals ownedReferences(std::shared_ptr<ASTNode> function) {
+        std::map<std::string, std::vector<std::shared_ptr<ASTNode>>> stores;
+        std::set<std::string> excluded;
+        for (auto& child : function->children) {
+            if (child->type == ASTNodeType::IDENTIFIER) {
+                excluded.insert(child->value);
+            }
+        }
+        collectStores(function, false, stores, excluded);
+        std::set<std::string> sharedWithTasks;
+        collectThreadReads(function, false, sharedWithTasks);
+        for (auto& [name, assignments] : stores) {
+            bool topLevel = std::find(function->children.begin(), function->children.end(), assignments[0]) != function->children.end();
+            if (sharedWithTasks.count(name) && (assignments.size() > 1 || !topLevel)) {
+                excluded.insert(name);
+            }
+        }
+        if (asyncFunctions.count(function->value)) {
+            collectSpawnedArguments(function, nullptr, excluded);
+        }
+
+        auto ownedValue = [&](const std::shared_ptr<ASTNode>& store, const std::set<std::string>& owned) {
+            if (store->children.size() != 1) {
+                return false;
+            }
+            const auto& value = store->children[0];
+            if (isBoundAllocation(store)) {
+                auto placement = allocationPlacements.find(value.get());
+                return placement != allocationPlacements.end() && placement->second == AllocationPlacement::HEAP;
+            }
+            if (value->type == ASTNodeType::FUNCTION_CALL && (value->value == "channel" || value->value == "spsc_channel")) {
+                return isChannelOperation(value->value);
+            }
+            return value->type == ASTNodeType::IDENTIFIER && owned.count(value->value);
+        };
+        std::set<std::string> owned;
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (auto& [name, assignments] : stores) {
+                if (owned.count(name) || excluded.count(name)) {
+                    continue;
+                }
+                if (std::all_of(assignments.begin(), assignments.end(), [&](const auto& store) { return ownedValue(store, owned); })) {
+                    owned.insert(name);
+                    changed = true;
+                }
+            }
+        }
+
+        OwnedLocals locals;
+        for (auto& name : owned) {
+            const auto& assignments = stores[name];
+            auto top = std::find(function->children.begin(), function->children.end(), assignments[0]);
+            if (assignments.size() == 1 && top != function->children.end()) {
+                locals.once[name] = static_cast<size_t>(top - function->children.begin());
+            } else {
+                locals.rebound.insert(name);
+            }
+        }
+        return locals;
+    }
+
+    // Every ASSIGNMENT to a named local, outside field initializers
+    void collectStores(std::shared_ptr<ASTNode> node, bool inThread, std::map<std::string, std::vector<std::shared_ptr<ASTNode>>>& stores,
+                       std::set<std::string>& excluded) {
+        if (node->type == ASTNodeType::ALLOCATION) {
+            return;
+        }
+        if (node->type == ASTNodeType::ASSIGNMENT && !node->value.empty()) {
+            stores[node->value].push_back(node);
+            if (inThread) {
+                excluded.insert(node->value);
+            }
+        }
+        for (auto& child : node->children) {
+            collectStores(child, inThread || node->type == ASTNodeType::THREAD, stores, excluded);
+        }
+    }
+
+    void collectThreadReads(const std::shared_ptr<ASTNode>& node, bool inThread, std::set<std::string>& names) {
+        if (inThread && node->type == ASTNodeType::IDENTIFIER) {
+            names.insert(node->value);
+        }
+        for (auto& child : node->children) {
+            collectThreadReads(child, inThread || node->type == ASTNodeType::THREAD, names);
+        }
+    }
+
+    // Locals passed to async calls that are not awaited, which spawn the callee
+    void collectSpawnedArguments(const std::shared_ptr<ASTNode>& node, const ASTNode* parent, std::set<std::string>& names) {
+        if (node->type == ASTNodeType::FUNCTION_CALL && asyncFunctions.count(node->value) &&
+            !(parent && parent->type == ASTNodeType::AWAIT)) {
+            for (auto& argument : node->children) {
+                if (argument->type == ASTNodeType::IDENTIFIER) {
+                    names.insert(argument->value);
+                }
+            }
+        }
+        for (auto& child : node->children) {
+            collectSpawnedArguments(child, node.get(), names);
+        }
+    }
+
+    // Owned locals to release at an exit in statement `index` of the body: those bound once before
+    // it and not moved, and all rebound ones
+    static std::vector<std::string> liveAt(const OwnedLocals& owned, size_t index, const std::set<std::string>& moved) {
+        std::vector<std::string> live;
+        for (auto& [name, bound] : owned.once) {
+            if (bound < index && !moved.count(name)) {
+                live.push_back(name);
+            }
+        }
+        live.insert(live.end(), owned.rebound.begin(), owned.rebound.end());
+        return live;
+    }
+
+    static bool isStoreTo(const std::shared_ptr<ASTNode>& node, const std::set<std::string>& locals) {
+        return node->type == ASTNodeType::ASSIGNMENT && !node->value.empty() && locals.count(node->value);
+    }
+
+    static int countUses(const std::shared_ptr<ASTNode>& node, const std::string& name) {
+        int uses = (node->type == ASTNodeType::IDENTIFIER || node->type == ASTNodeType::ARRAY_ACCESS ||
+                    node->type == ASTNodeType::RETAIN) && node->value == name;
+        if (node->type == ASTNodeType::ALLOCATION) {
+            for (auto& field : node->children) {
+                for (auto& value : field->children) {
+                    uses += countUses(value, name);
+                }
+            }
+            return uses;
+        }
+        for (auto& child : node->children) {
+            uses += countUses(child, name);
+        }
+        return uses;
+    }
+
+    // Turn every consuming use of an owned local into a RETAIN
+    void retainConsumedUses(std::shared_ptr<ASTNode> node, const ASTNode* parent, const OwnedLocals& owned,
+                            std::vector<std::shared_ptr<ASTNode>>& retained) {
+        if (node->type == ASTNodeType::IDENTIFIER && owned.count(node->value)) {
+            bool borrowed = parent && (parent->type == ASTNodeType::FUNCTION_CALL ||
+                                       (parent->type == ASTNodeType::OBJECT_MANIPULATION && parent->children[0].get() == node.get()));
+            if (!borrowed) {
+                node->type = ASTNodeType::RETAIN;
+                retained.push_back(node);
+            }
+            return;
+        }
+        for (auto& child : node->children) {
+            retainConsumedUses(child, node.get(), owned, retained);
+        }
+    }
+
+    // RETURNs and stores to rebound locals below the function body. In a loop body they get
+    // RELEASEs in front of them; a conditional's branch has no statement list, so the conditional
+    // emits the branch's releases with it. `thread` blocks return from their task, not the function.
+    int releaseNested(std::shared_ptr<ASTNode> node, const std::vector<std::string>& exit, const std::set<std::string>& rebound,
+                      std::shared_ptr<ASTNode> irNode) {
+        if (node->type == ASTNodeType::THREAD || node->type == ASTNodeType::ALLOCATION) {
+            return 0;
+        }
+        int releases = 0;
+        std::vector<std::shared_ptr<ASTNode>> children;
+        for (size_t c = 0; c < node->children.size(); c++) {
+            auto child = node->children[c];
+            std::vector<std::string> due;
+            if (child->type == ASTNodeType::RETURN) {
+                due = exit;
+            } else {
+                if (isStoreTo(child, rebound)) {
+                    due.push_back(child->value);
+                }
+                releases += releaseNested(child, exit, rebound, irNode);
+            }
+            if (!due.empty() && c > 0 && node->type == ASTNodeType::LOOP) {
+                for (auto& name : due) {
+                    auto release = std::make_shared<ASTNode>(ASTNodeType::RELEASE, name);
+                    children.push_back(release);
+                    irNode->addChild(release);
+                }
+                releases += static_cast<int>(due.size());
+            } else if (!due.empty() && c > 0 && node->type == ASTNodeType::CONDITIONAL) {
+                branchReleases[child.get()] = due;
+                releases += static_cast<int>(due.size());
+            }
+            children.push_back(child);
+        }
+        node->children = std::move(children);
+        return releases;
+    }
+
+    // Async lowering
+    //
+    // An async function becomes a stackless coroutine (Runtime/EventLoop.hpp): a ramp that
+    // allocates the frame, stores the parameters and returns the frame, and a resume function that
+    // jumps on the frame's state. Every await that can suspend ends a state; locals defined before
+    // it and used after it live in the frame, as do all parameters the body uses, since the body
+    // only runs once the frame is resumed. Everything else keeps its home.
+    //
+    // Awaits are lowered where they form a whole statement: `await e`, `x = await e` and
+    // `return await e`. They suspend on calls to async functions, on the runtime waits
+    // readable(fd), writable(fd) and sleep(ns), and on the channel operations send, receive and
+    // select, which repeat their call when resumed; awaiting anything else just evaluates it. An async
+    // call that is not awaited is spawned on the scheduler, and a synchronous caller then runs the
+    // scheduler until it finishes.
+    //
+    // This is an unwired prototype: the xecc driver (TieItAllTogether.cpp) neither parses nor
+    // lowers async and await, and this generator's output interleaves its text log with the
+    // instructions, so it is read, not assembled.
+    void asyncLowering(std::shared_ptr<ASTNode> irNode) {
+        TimeScope scope("Async lowering");
+        for (auto& function : irNode->children) {
+            if (function->type == ASTNodeType::FUNCTION_DECLARATION && containsAwait(function)) {
+                asyncFunctions.insert(function->value);
+            }
+        }
+        if (asyncFunctions.empty()) {
+            return;
+        }
+        Logger::log("Lowering async functions...");
+
+        for (auto& function : irNode->children) {
+            if (function->type != ASTNodeType::FUNCTION_DECLARATION) {
+                continue;
+            }
+            bool async = isAsync(function);
+            recordSpawnedCalls(function, nullptr, async);
+            if (!async) {
+                continue;
+            }
+
+            AsyncLayout layout;
+            std::set<std::string> parameters;
+            std::map<std::string, size_t> definedAt;
+            const auto& body = function->children;
+            size_t first = 0;
+            for (; first < body.size() && body[first]->type == ASTNodeType::IDENTIFIER; first++) {
+                parameters.insert(body[first]->value);
+            }
+            for (size_t i = first; i < body.size(); i++) {
+                const auto& statement = body[i];
+                auto await = statementAwait(statement);
+                if (!await && containsAwait(statement)) {
+                    Logger::logError("await must be a whole statement, assignment or return in ", function->value);
+                    throw std::runtime_error("Unsupported await in " + function->value);
+                }
+                if (containsType(statement, ASTNodeType::THREAD)) {
+                    Logger::logError("thread blocks are not supported in async function ", function->value);
+                    throw std::runtime_error("Unsupported thread block in " + function->value);
+                }
+                if (await && awaitSuspends(await)) {
+                    layout.suspendPoints.push_back(i);
+                    awaitedCalls.insert(await->children[0].get());
+                }
+                if (statement->type == ASTNodeType::ASSIGNMENT && !statement->value.empty() && !definedAt.count(statement->value)) {
+                    definedAt[statement->value] = i;
+                }
+            }
+
+            // Live across suspension point k: defined before the await completes, used after it.
+            // A channel wait re-evaluates its own arguments when resumed.
+            std::set<std::string> live;
+            for (auto& name : parameters) {
+                for (size_t j = first; j < body.size() && !live.count(name); j++) {
+                    if (usesName(body[j], name)) {
+                        live.insert(name);
+                    }
+                }
+            }
+            for (size_t point : layout.suspendPoints) {
+                bool repeats = isChannelWait(statementAwait(body[point])->children[0]->value);
+                auto crosses = [&](const std::string& name) {
+                    for (size_t j = repeats ? point : point + 1; j < body.size(); j++) {
+                        if (usesName(body[j], name)) {
+                            return true;
+                        }
+                    }
+                    return false;
+                };
+                for (auto& [name, at] : definedAt) {
+                    if (at < point && crosses(name)) {
+                        live.insert(name);
+                    }
+                }
+            }
+
+            size_t offset = (sizeof(xec::AsyncFrame) + 7) & ~size_t(7);
+            layout.childOffset = offset;
+            offset += 8;
+            for (auto& name : live) {
+                layout.slots[name] = offset;
+                offset += 8;
+            }
+            layout.frameBytes = offset;
+            for (size_t i = first; i < body.size(); i++) {
+                markOutlinedNodes(body[i]);
+            }
+            Logger::log("Async lowering: ", function->value, " -> ", layout.suspendPoints.size() + 1,
+                        " states, ", layout.frameBytes, "-byte frame");
+            asyncLayouts[function.get()] = std::move(layout);
+        }
+    }
+
+    bool isAsync(const std::shared_ptr<ASTNode>& function) {
+        return asyncFunctions.count(function->value) || containsAwait(function);
+    }
+
+    // The flattened IR lists every body node on its own; a coroutine's are emitted by its states
+    void markOutlinedNodes(const std::shared_ptr<ASTNode>& node) {
+        outlinedNodes.insert(node.get());
+        for (auto& child : node->children) {
+            markOutlinedNodes(child);
+        }
+    }
+
+    static bool containsType(const std::shared_ptr<ASTNode>& node, ASTNodeType type) {
+        if (node->type == type) {
+            return true;
+        }
+        for (auto& child : node->children) {
+            if (containsType(child, type)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool containsAwait(const std::shared_ptr<ASTNode>& node) {
+        if (node->type == ASTNodeType::AWAIT) {
+            return true;
+        }
+        for (auto& child : node->children) {
+            if (containsAwait(child)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // The AWAIT a statement consists of: `await e`, `x = await e` or `return await e`
+    static std::shared_ptr<ASTNode> statementAwait(const std::shared_ptr<ASTNode>& statement) {
+        if (statement->type == ASTNodeType::AWAIT) {
+            return statement;
+        }
+        if ((statement->type == ASTNodeType::ASSIGNMENT || statement->type == ASTNodeType::RETURN) &&
+            statement->children.size() == 1 && statement->children[0]->type == ASTNodeType::AWAIT) {
+            return statement->children[0];
+        }
+        return nullptr;
+    }
+
+    static bool isRuntimeWait(const std::string& name) {
+        return name == "readable" || name == "writable" || name == "sleep";
+    }
+
+    // Channel builtins (Runtime/Channel.hpp), unless the program defines a function of that name
+    bool isChannelOperation(const std::string& name) {
+        return (name == "channel" || name == "spsc_channel" || name == "send" || name == "receive" ||
+                name == "select" || name == "close") && !symbolTable.functionExists(name);
+    }
+
+    bool isChannelWait(const std::string& name) {
+        return (name == "send" || name == "receive" || name == "select") && isChannelOperation(name);
+    }
+
+    bool awaitSuspends(const std::shared_ptr<ASTNode>& await) {
+        if (await->children.size() != 1 || await->children[0]->type != ASTNodeType::FUNCTION_CALL) {
+            return false;
+        }
+        const std::string& callee = await->children[0]->value;
+        return asyncFunctions.count(callee) || isRuntimeWait(callee) || isChannelWait(callee);
+    }
+
+    static bool usesName(const std::shared_ptr<ASTNode>& node, const std::string& name) {
+        if ((node->type == ASTNodeType::IDENTIFIER || node->type == ASTNodeType::ARRAY_ACCESS ||
+             node->type == ASTNodeType::RETAIN || node->type == ASTNodeType::RELEASE) && node->value == name) {
+            return true;
+        }
+        for (auto& child : node->children) {
+            if (usesName(child, name)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void recordSpawnedCalls(const std::shared_ptr<ASTNode>& node, const ASTNode* parent, bool callerAsync) {
+        if (node->type == ASTNodeType::FUNCTION_CALL && asyncFunctions.count(node->value) &&
+            !(parent && parent->type == ASTNodeType::AWAIT)) {
+            spawnedCalls[node.get()] = callerAsync;
+        }
+        for (auto& child : node->children) {
+            recordSpawnedCalls(child, node.get(), callerAsync);
+        }
+    }
+
+    // Thread lowering
+    //
+    // A `thread { ... }` block is outlined into a task function taking the enclosing frame and
+    // spawned into the function's task group (Runtime/TaskScheduler.hpp); `thread for i in n`
+    // becomes a parallel-for over [0, n) whose subranges run the outlined loop. The group is joined
+    // and the frame popped before the function returns, which is what lets tasks use the frame.
+    // Like async lowering this is a prototype only this generator runs; xecc has no `thread` yet.
+    void threadLowering(std::shared_ptr<ASTNode> irNode) {
+        TimeScope scope("Thread lowering");
+        auto functions = irNode->children; // THREAD nodes are appended for the backend
+        for (auto& function : functions) {
+            if (function->type != ASTNodeType::FUNCTION_DECLARATION) {
+                continue;
+            }
+            std::vector<std::shared_ptr<ASTNode>> blocks;
+            collectThreadBlocks(function, blocks);
+            if (blocks.empty()) {
+                continue;
+            }
+            for (size_t i = 0; i < blocks.size(); i++) {
+                threadTasks[blocks[i].get()] = function->value + ".task" + std::to_string(i);
+                irNode->addChild(blocks[i]);
+                if (!(blocks[i]->children.size() == 1 && blocks[i]->children[0]->type == ASTNodeType::LOOP)) {
+                    taskGroups.insert(function->value);
+                }
+                for (auto& statement : blocks[i]->children) {
+                    markOutlinedNodes(statement);
+                }
+            }
+            threadFrames.insert(function->value);
+            auto join = std::make_shared<ASTNode>(ASTNodeType::THREAD, "join " + function->value);
+            // Before the return and the releases of the objects tasks may still be using
+            auto& body = function->children;
+            auto exit = body.end();
+            while (exit != body.begin() && ((*(exit - 1))->type == ASTNodeType::RETURN || (*(exit - 1))->type == ASTNodeType::RELEASE)) {
+                --exit;
+            }
+            body.insert(exit, join);
+            irNode->addChild(join);
+            Logger::log("Thread lowering: ", function->value, " -> ", blocks.size(), " tasks");
+        }
+    }
+
+    void collectThreadBlocks(const std::shared_ptr<ASTNode>& node, std::vector<std::shared_ptr<ASTNode>>& blocks) {
+        for (auto& child : node->children) {
+            if (child->type == ASTNodeType::THREAD) {
+                blocks.push_back(child);
+            }
+            collectThreadBlocks(child, blocks);
+        }
+    }
+
+    // Whole-program optimizations (LTO)
+
+    std::vector<std::shared_ptr<ASTNode>> collectFunctions(std::shared_ptr<ASTNode> irNode) {
+        std::vector<std::shared_ptr<ASTNode>> functions;
+        for (auto& child : irNode->children) {
+            if (child->type == ASTNodeType::FUNCTION_DECLARATION) {
+                functions.push_back(child);
+            }
+        }
+        return functions;
+    }
+
+    void collectCalls(std::shared_ptr<ASTNode> node, std::vector<std::shared_ptr<ASTNode>>& calls) {
+        for (auto& child : node->children) {
+            if (child->type == ASTNodeType::FUNCTION_CALL) {
+                calls.push_back(child);
+            }
+            collectCalls(child, calls);
+        }
+    }
+
+    // When every call site of a non-entry function passes the same literal for a parameter, the
+    // parameter is replaced by that literal inside the body. The signature is left alone.
+    void interproceduralConstantPropagation(std::shared_ptr<ASTNode> irNode) {
+        TimeScope scope("Interprocedural constant propagation");
+        Logger::log("Performing interprocedural constant propagation...");
+        auto functions = collectFunctions(irNode);
+        std::unordered_map<std::string, std::vector<std::shared_ptr<ASTNode>>> callSites;
+        for (auto& function : functions) {
+            std::vector<std::shared_ptr<ASTNode>> calls;
+            collectCalls(function, calls);
+            for (auto& call : calls) {
+                callSites[call->value].push_back(call);
+            }
+        }
+
+        for (auto& function : functions) {
+            if (isEntryPoint(function->value) || callSites[function->value].empty()) {
+                continue;
+            }
+            size_t parameters = 0;
+            while (parameters < function->children.size() &&
+                   function->children[parameters]->type == ASTNodeType::IDENTIFIER) {
+                parameters++;
+            }
+            if (parameters == function->children.size()) {
+                continue; // Only parameters, no body
+            }
+            for (size_t p = 0; p < parameters; p++) {
+                std::optional<std::string> constant;
+                for (auto& call : callSites[function->value]) {
+                    if (call->children.size() != parameters || call->children[p]->type != ASTNodeType::LITERAL ||
+                        (constant && *constant != call->children[p]->value)) {
+                        constant.reset();
+                        break;
+                    }
+                    constant = call->children[p]->value;
+                }
+                const std::string& name = function->children[p]->value;
+                // A parameter the body assigns is only constant up to that store; without flow
+                // analysis, leave it alone
+                if (!constant || assigns(function, name)) {
+                    continue;
+                }
+                for (size_t i = parameters; i < function->children.size(); i++) {
+                    replaceIdentifier(function->children[i], name, *constant);
+                }
+                Logger::log("Propagated ", name, " = ", *constant, " into ", function->value);
+            }
+        }
+    }
+
+    void replaceIdentifier(std::shared_ptr<ASTNode> node, const std::string& name, const std::string& literal) {
+        if (node->type == ASTNodeType::IDENTIFIER && node->value == name) {
+            node->type = ASTNodeType::LITERAL;
+            node->value = literal;
+            return;
+        }
+        for (auto& child : node->children) {
+            replaceIdentifier(child, name, literal);
+        }
+    }
+
+    bool assigns(const std::shared_ptr<ASTNode>& node, const std::string& name) {
+        if (node->type == ASTNodeType::ASSIGNMENT && node->value == name) {
+            return true;
+        }
+        for (auto& child : node->children) {
+            if (assigns(child, name)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool isEntryPoint(const std::string& name) {
+        return std::find(options.entryPoints.begin(), options.entryPoints.end(), name) != options.entryPoints.end();
+    }
+
+    // Remove every function not reachable from an entry point, together with the IR nodes that
+    // were flattened out of its body
+    void globalDeadCodeElimination(std::shared_ptr<ASTNode> irNode) {
+        TimeScope scope("Global dead code elimination");
+        Logger::log("Performing global dead code elimination...");
+        std::unordered_map<std::string, std::shared_ptr<ASTNode>> functions;
+        for (auto& function : collectFunctions(irNode)) {
+            functions[function->value] = function;
+        }
+
+        std::set<std::string> live;
+        std::vector<std::string> worklist(options.entryPoints.begin(), options.entryPoints.end());
+        while (!worklist.empty()) {
+            std::string name = worklist.back();
+            worklist.pop_back();
+            auto function = functions.find(name);
+            if (function == functions.end() || !live.insert(name).second) {
+                continue;
+            }
+            std::vector<std::shared_ptr<ASTNode>> calls;
+            collectCalls(function->second, calls);
+            for (auto& call : calls) {
+                worklist.push_back(call->value);
+            }
+        }
+
+        std::set<const ASTNode*> dead;
+        std::function<void(const std::shared_ptr<ASTNode>&)> markDead = [&](const std::shared_ptr<ASTNode>& node) {
+            dead.insert(node.get());
+            for (auto& child : node->children) {
+                markDead(child);
+            }
+        };
+        for (auto& [name, function] : functions) {
+            if (!live.count(name)) {
+                Logger::log("Removing unreachable function: ", name);
+                markDead(function);
+            }
+        }
+        auto& children = irNode->children;
+        children.erase(std::remove_if(children.begin(), children.end(),
+                                      [&](const auto& node) { return dead.count(node.get()) > 0; }),
+                       children.end());
+    }
+
+    void emitIR(std::shared_ptr<ASTNode> irNode) {
+        TimeScope scope("Emit IR");
+        Logger::log("Writing IR to ", options.emitIRPath);
+        std::ofstream out(options.emitIRPath, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Cannot write IR file: " + options.emitIRPath);
+        }
+        IRSerializer::write(out, root ? root->value : "", collectFunctions(irNode));
+    }
+
+    // Profile-guided layout: order profiled functions by entry count, move never-executed functions
+    // to the cold section, leave functions the profile does not know in .text, and invert conditionals whose else-edge is hotter so the hot path falls through
+    void applyProfileLayout(std::shared_ptr<ASTNode> irNode) {
+        TimeScope scope("Profile layout");
+        Logger::log("Applying profile-guided layout...");
+        std::vector<std::shared_ptr<ASTNode>> functions;
+        for (auto& child : irNode->children) {
+            if (child->type == ASTNodeType::FUNCTION_DECLARATION) {
+                functions.push_back(child);
+            }
+        }
+        std::stable_sort(functions.begin(), functions.end(), [this](const auto& a, const auto& b) {
+            return profile.count("function", a->value) > profile.count("function", b->value);
+        });
+
+        int rank = 0;
+        for (auto& function : functions) {
+            // Functions the profile does not know get no section and stay in plain .text
+            if (!profile.contains("function", function->value)) {
+                layoutBranches(function);
+                continue;
+            }
+            if (profile.count("function", function->value) == 0) {
+                functionSections[function.get()] = ".text.unlikely." + function->value;
+            } else {
+                char order[16];
+                std::snprintf(order, sizeof(order), "%04d", rank++);
+                functionSections[function.get()] = std::string(".text.hot.") + order + "." + function->value;
+            }
+            layoutBranches(function);
+        }
+
+        // Functions first, in profile order, so the backend emits hot code together
+        std::stable_partition(irNode->children.begin(), irNode->children.end(), [](const auto& node) {
+            return node->type == ASTNodeType::FUNCTION_DECLARATION;
+        });
+        std::copy(functions.begin(), functions.end(), irNode->children.begin());
+    }
+
+    // Keys follow the same pre-order numbering as instrumentNode, so they are all taken before
+    // any inversion reorders the subtrees
+    void layoutBranches(std::shared_ptr<ASTNode> function) {
+        std::vector<std::pair<std::shared_ptr<ASTNode>, std::string>> conditionals;
+        int branch = 0;
+        collectConditionals(function, function->value, branch, conditionals);
+        for (auto& [node, key] : conditionals) {
+            uint64_t taken = profile.count("taken", key);
+            uint64_t fallthrough = profile.count("fallthrough", key);
+            if (node->children.size() == 3 && fallthrough > taken) {
+                // if (c) A else B  ->  if (!c) B else A
+                auto negated = std::make_shared<ASTNode>(ASTNodeType::OPERATION, "!");
+                negated->addChild(node->children[0]);
+                node->children[0] = negated;
+                std::swap(node->children[1], node->children[2]);
+                Logger::log("Inverted branch ", key, " so the hot edge falls through");
+            }
+        }
+    }
+
+    void collectConditionals(std::shared_ptr<ASTNode> node, const std::string& function, int& branch,
+                             std::vector<std::pair<std::shared_ptr<ASTNode>, std::string>>& conditionals) {
+        for (auto& child : node->children) {
+            if (child->type == ASTNodeType::CONDITIONAL) {
+                conditionals.emplace_back(child, function + "#" + std::to_string(branch++));
+            }
+            collectConditionals(child, function, branch, conditionals);
+        }
+    }
+
+    // --profile-generate: number entry, call and branch counters in a stable pre-order walk
+    void instrumentProfile(std::shared_ptr<ASTNode> irNode) {
+        TimeScope scope("Profile instrumentation");
+        Logger::log("Inserting profile counters...");
+        profileCounters.clear();
+        counterIndex.clear();
+        for (auto& child : irNode->children) {
+            if (child->type != ASTNodeType::FUNCTION_DECLARATION) {
+                continue;
+            }
+            counterIndex[child.get()] = profileCounters.size();
+            profileCounters.emplace_back("function", child->value);
+            int branch = 0;
+            instrumentNode(child, child->value, branch);
+        }
+    }
+
+    void instrumentNode(std::shared_ptr<ASTNode> node, const std::string& function, int& branch) {
+        for (auto& child : node->children) {
+            if (child->type == ASTNodeType::FUNCTION_CALL && !counterIndex.count(child.get())) {
+                counterIndex[child.get()] = profileCounters.size();
+                profileCounters.emplace_back("call", function + ">" + child->value);
+            } else if (child->type == ASTNodeType::CONDITIONAL && !counterIndex.count(child.get())) {
+                std::string key = function + "#" + std::to_string(branch++);
+                counterIndex[child.get()] = profileCounters.size();
+                profileCounters.emplace_back("taken", key);
+                profileCounters.emplace_back("fallthrough", key);
+            }
+            instrumentNode(child, function, branch);
+        }
+    }
+
+    // Counters are xec::ProfileCounter records: two pointers followed by the 64-bit count
+    std::string counterOperand(size_t index) {
+        return "qword [rip + .Lxecprof_counters + " + std::to_string(index * 24 + 16) + "]";
+    }
+
+    void generateProfileTableBackend() {
+        TimeScope scope("Profile table emission");
+        std::ostringstream out;
+        out << "    .section .data.xecprof\n";
+        out << "    .p2align 3\n";
+        out << ".Lxecprof_counters:\n";
+        for (size_t i = 0; i < profileCounters.size(); i++) {
+            out << "    .quad .Lxecprof_kind" << i << ", .Lxecprof_key" << i << ", 0\n";
+        }
+        out << ".Lxecprof_module:\n";
+        out << "    .quad .Lxecprof_name, .Lxecprof_counters, " << profileCounters.size() << ", .Lxecprof_path, 0\n";
+        out << "    .section .rodata.xecprof\n";
+        for (size_t i = 0; i < profileCounters.size(); i++) {
+            out << ".Lxecprof_kind" << i << ": .asciz \"" << profileCounters[i].first << "\"\n";
+            out << ".Lxecprof_key" << i << ": .asciz \"" << profileCounters[i].second << "\"\n";
+        }
+        out << ".Lxecprof_name: .asciz \"" << (root ? root->value : "") << "\"\n";
+        out << ".Lxecprof_path: .asciz \"" << options.profileGeneratePath << "\"\n";
+        out << "    .text\n";
+        out << ".Lxecprof_init:\n";
+        out << "    lea rdi, [rip + .Lxecprof_module]\n";
+        out << "    jmp xec_profile_register\n";
+        out << "    .section .init_array\n";
+        out << "    .quad .Lxecprof_init\n";
+
+        Logger::log("Generating profile counter table (", profileCounters.size(), " counters)");
+        std::lock_guard<std::mutex> lock(generationMutex);
+        std::cout << out.str();
+    }
+
+    // Step 4: Generate backend-specific code (e.g., assembly, bytecode)
+    void generateBackendCode(std::shared_ptr<ASTNode> irNode) {
+        TimeScope scope("Backend emission");
+        Logger::log("Generating backend code...");
+
+        // Threaded backend generation for performance
+        std::vector<std::thread> threads;
+        for (auto& child : irNode->children) {
+            threads.push_back(std::thread(&CodeGenerator::generateCodeForNode, this, child));
+        }
+
+        // Wait for all threads to finish
+        for (auto& t : threads) {
+            if (t.joinable()) {
+                t.join();
+            }
+        }
+    }
+
+    // Generate backend code for a specific AST node
+    void generateCodeForNode(std::shared_ptr<ASTNode> node) {
+        // Runs on a thread of its own, so each function is a separate row of the trace
+        TimeScope scope(node->type == ASTNodeType::FUNCTION_DECLARATION ? "Backend function" : "Backend statement", node->value);
+        if (outlinedNodes.count(node.get()) && node->type != ASTNodeType::THREAD) {
+            return;
+        }
+        switch (node->type) {
+            case ASTNodeType::FUNCTION_DECLARATION:
+                generateFunctionDeclarationBackend(node);
+                break;
+            case ASTNodeType::ASSIGNMENT:
+                generateAssignmentBackend(node);
+                break;
+            case ASTNodeType::OPERATION:
+                generateOperationBackend(node);
+                break;
+            case ASTNodeType::LOOP:
+                generateLoopBackend(node);
+                break;
+            case ASTNodeType::FUNCTION_CALL:
+                generateFunctionCallBackend(node);
+                break;
+            case ASTNodeType::CONDITIONAL:
+                generateConditionalBackend(node);
+                break;
+            case ASTNodeType::RETAIN:
+            case ASTNodeType::RELEASE:
+                generateRefCountBackend(node);
+                break;
+            case ASTNodeType::THREAD:
+                generateThreadBackend(node);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Generate assembly for function declaration
+    void generateFunctionDeclarationBackend(std::shared_ptr<ASTNode> node) {
+        Logger::debug("Generating function declaration code for: ", node->value);
+        std::ostringstream out;
+        auto section = functionSections.find(node.get());
+        if (section != functionSections.end()) {
+            out << "    .section " << section->second << ",\"ax\",@progbits\n";
+        } else if (!functionSections.empty()) {
+            out << "    .text\n";
+        }
+        out << "Generating function: " << node->value << "()\n";
+        out << "    .globl " << node->value << "\n";
+        out << node->value << ":\n";
+        auto counter = counterIndex.find(node.get());
+        if (counter != counterIndex.end()) {
+            out << "    inc " << counterOperand(counter->second) << "\n";
+        }
+        if (threadFrames.count(node->value)) {
+            // Tasks reach the locals through rbp; the group lives in the frame's first slot
+            out << "    push rbp\n";
+            out << "    mov rbp, rsp\n";
+            out << "    sub rsp, 16\n";
+            if (taskGroups.count(node->value)) {
+                out << "    call xec_task_group\n";
+                out << "    mov qword [rbp - 8], rax\n";
+            }
+        }
+        auto layout = asyncLayouts.find(node.get());
+        if (layout != asyncLayouts.end()) {
+            generateCoroutineBackend(out, node, layout->second);
+        }
+        std::lock_guard<std::mutex> lock(generationMutex);
+        std::cout << out.str();
+    }
+
+    // Ramp and resume function of a lowered async function. rbx holds the frame while it runs.
+    void generateCoroutineBackend(std::ostringstream& out, std::shared_ptr<ASTNode> function, const AsyncLayout& layout) {
+        static const char* argumentRegisters[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+        const std::string& name = function->value;
+        const auto& body = function->children;
+        OutlinedContext context(name, ".L" + name + "_suspend", true);
+        for (auto& [variable, offset] : layout.slots) {
+            context.homes[variable] = "qword [rbx + " + std::to_string(offset) + "]";
+        }
+
+        // Ramp: the argument registers are spilled to the stack across the frame allocation, then
+        // the parameters move into the frame, which is returned unstarted. The spill area is an
+        // odd number of slots, so rsp is 16-byte aligned at the call.
+        out << "    ; async, " << layout.frameBytes << "-byte frame\n";
+        size_t first = 0;
+        while (first < body.size() && body[first]->type == ASTNodeType::IDENTIFIER) {
+            first++;
+        }
+        size_t parameters = std::min<size_t>(first, 6);
+        size_t spill = 8 * (parameters % 2 == 0 ? parameters + 1 : parameters);
+        out << "    sub rsp, " << spill << "\n";
+        for (size_t i = 0; i < parameters; i++) {
+            out << "    mov qword [rsp + " << 8 * i << "], " << argumentRegisters[i] << "\n";
+        }
+        out << "    mov edi, " << layout.frameBytes << "\n";
+        out << "    lea rsi, [rip + " << name << ".resume]\n";
+        out << "    call xec_async_frame\n";
+        for (size_t i = 0; i < parameters; i++) {
+            auto slot = layout.slots.find(body[i]->value);
+            if (slot != layout.slots.end()) {
+                out << "    mov rcx, qword [rsp + " << 8 * i << "]\n";
+                out << "    mov qword [rax + " << slot->second << "], rcx\n";
+            }
+        }
+        out << "    add rsp, " << spill << "\n";
+        out << "    ret\n";
+
+        // Resume: pushing rbx leaves rsp 16-byte aligned for the calls the states make
+        std::string state = "dword [rbx + " + std::to_string(offsetof(xec::AsyncFrame, state)) + "]";
+        std::string child = "qword [rbx + " + std::to_string(layout.childOffset) + "]";
+        out << name << ".resume:\n";
+        out << "    push rbx\n";
+        out << "    mov rbx, rdi\n";
+        out << "    mov eax, " << state << "\n";
+        out << "    jmp qword [.L" << name << "_states + rax*8]\n";
+        out << ".L" << name << "_state0:\n";
+        size_t next = first;
+        for (size_t k = 0; k < layout.suspendPoints.size(); k++) {
+            size_t point = layout.suspendPoints[k];
+            const auto& statement = body[point];
+            auto call = statementAwait(statement)->children[0];
+            std::string resumed = ".L" + name + "_state" + std::to_string(k + 1);
+
+            // RELEASEs right before the await run once its value is in hand
+            size_t releases = point;
+            while (releases > next && body[releases - 1]->type == ASTNodeType::RELEASE) {
+                releases--;
+            }
+            std::vector<std::string> deferred;
+            for (size_t i = releases; i < point; i++) {
+                deferred.push_back(body[i]->value);
+            }
+            emitOutlinedStatements(out, context, body, next, releases);
+            next = point + 1;
+
+            if (isRuntimeWait(call->value)) {
+                if (call->children.empty()) {
+                    out << "    xor eax, eax\n";
+                } else {
+                    emitOutlinedValue(out, context, call->children[0]);
+                }
+                out << "    mov " << state << ", " << k + 1 << "\n";
+                out << "    mov rdi, rbx\n";
+                out << "    mov rsi, rax\n";
+                out << "    call xec_await_" << call->value << "\n";
+                out << "    jmp .L" << name << "_suspend\n";
+                out << resumed << ":\n";
+                out << "    mov eax, dword [rbx + " << offsetof(xec::AsyncFrame, events) << "]\n";
+            } else if (isChannelWait(call->value)) {
+                // Resuming repeats the call, which then finds the value or space it waited for
+                out << "    mov " << state << ", " << k + 1 << "\n";
+                out << resumed << ":\n";
+                size_t area = emitOutlinedArguments(out, context, call);
+                out << "    mov rdi, rbx\n";
+                if (call->value == "select") {
+                    out << "    mov rsi, rsp\n";
+                    out << "    mov edx, " << call->children.size() << "\n";
+                } else {
+                    for (size_t i = 0; i < call->children.size() && i < 2; i++) {
+                        out << "    mov " << argumentRegisters[i + 1] << ", qword [rsp + " << 8 * i << "]\n";
+                    }
+                }
+                out << "    call xec_chan_" << call->value << "_async\n";
+                if (area) {
+                    out << "    add rsp, " << area << "\n";
+                }
+                out << "    test eax, eax\n";
+                out << "    jnz .L" << name << "_suspend\n";
+                out << "    mov rax, qword [rbx + " << offsetof(xec::AsyncFrame, result) << "]\n";
+            } else {
+                size_t area = emitOutlinedArguments(out, context, call);
+                for (size_t i = 0; i < call->children.size() && i < 6; i++) {
+                    out << "    mov " << argumentRegisters[i] << ", qword [rsp + " << 8 * i << "]\n";
+                }
+                out << "    call " << call->value << "\n";
+                if (area) {
+                    out << "    add rsp, " << area << "\n";
+                }
+                out << "    mov " << child << ", rax\n";
+                out << "    mov " << state << ", " << k + 1 << "\n";
+                out << "    mov rdi, rbx\n";
+                out << "    mov rsi, rax\n";
+                out << "    call xec_await\n";
+                out << "    test eax, eax\n";
+                out << "    jnz .L" << name << "_suspend\n";
+                out << resumed << ":\n";
+                out << "    mov rdi, " << child << "\n";
+                out << "    call xec_async_take\n";
+            }
+            emitDeferredReleases(out, context, deferred);
+            if (statement->type == ASTNodeType::ASSIGNMENT && !statement->value.empty()) {
+                out << "    mov " << context.local(statement->value) << ", rax\n";
+            } else if (statement->type == ASTNodeType::RETURN) {
+                out << "    mov rdi, rbx\n";
+                out << "    mov rsi, rax\n";
+                out << "    call xec_async_return\n";
+                out << "    jmp .L" << name << "_suspend\n";
+            }
+        }
+        emitOutlinedStatements(out, context, body, next, body.size());
+        if (body.size() == first || body.back()->type != ASTNodeType::RETURN) {
+            out << "    mov rdi, rbx\n";
+            out << "    xor esi, esi\n";
+            out << "    call xec_async_return\n";
+        }
+        out << ".L" << name << "_suspend:\n";
+        out << "    pop rbx\n";
+        out << "    ret\n";
+        out << ".L" << name << "_states:\n";
+        for (size_t k = 0; k <= layout.suspendPoints.size(); k++) {
+            out << "    .quad .L" << name << "_state" << k << "\n";
+        }
+    }
+
+    // Statements [begin, end) of a coroutine state. A run of RELEASEs in front of a RETURN or a
+    // store is emitted after the statement's value is computed, as the IR specifies.
+    void emitOutlinedStatements(std::ostringstream& out, OutlinedContext& context,
+                                 const std::vector<std::shared_ptr<ASTNode>>& statements, size_t begin, size_t end) {
+        for (size_t i = begin; i < end;) {
+            size_t run = i;
+            while (run < end && statements[run]->type == ASTNodeType::RELEASE) {
+                run++;
+            }
+            if (run > i && run < end && defersReleases(statements[run])) {
+                std::vector<std::string> deferred;
+                for (size_t r = i; r < run; r++) {
+                    deferred.push_back(statements[r]->value);
+                }
+                emitOutlinedStatement(out, context, statements[run], deferred);
+                i = run + 1;
+                continue;
+            }
+            emitOutlinedStatement(out, context, statements[i], {});
+            i++;
+        }
+    }
+
+    static bool defersReleases(const std::shared_ptr<ASTNode>& statement) {
+        return statement->type == ASTNodeType::RETURN || (statement->type == ASTNodeType::ASSIGNMENT && !statement->value.empty());
+    }
+
+    void emitOutlinedStatement(std::ostringstream& out, OutlinedContext& context, const std::shared_ptr<ASTNode>& statement,
+                                const std::vector<std::string>& deferred) {
+        switch (statement->type) {
+            case ASTNodeType::ASSIGNMENT:
+                if (!statement->value.empty() && statement->children.size() == 1) {
+                    emitOutlinedValue(out, context, statement->children[0]);
+                    emitDeferredReleases(out, context, deferred);
+                    out << "    mov " << context.local(statement->value) << ", rax\n";
+                } else if (statement->children.size() == 2 && statement->children[0]->type == ASTNodeType::ARRAY_ACCESS) {
+                    auto target = statement->children[0];
+                    emitOutlinedValue(out, context, target->children.empty() ? nullptr : target->children[0]);
+                    out << "    sub rsp, 16\n";
+                    out << "    mov qword [rsp], rax\n";
+                    emitOutlinedValue(out, context, statement->children[1]);
+                    out << "    mov rcx, qword [rsp]\n";
+                    out << "    add rsp, 16\n";
+                    out << "    mov r11, " << context.local(target->value) << "\n";
+                    out << "    mov qword [r11 + rcx*8], rax\n";
+                }
+                return;
+            case ASTNodeType::RETURN:
+                emitOutlinedValue(out, context, statement->children.empty() ? nullptr : statement->children[0]);
+                emitDeferredReleases(out, context, deferred);
+                if (context.coroutine) {
+                    out << "    mov rdi, rbx\n";
+                    out << "    mov rsi, rax\n";
+                    out << "    call xec_async_return\n";
+                }
+                out << "    jmp " << context.exit << "\n";
+                return;
+            case ASTNodeType::RETAIN:
+            case ASTNodeType::RELEASE:
+                out << "    mov rdi, " << context.local(statement->value) << "\n";
+                out << "    call " << (statement->type == ASTNodeType::RETAIN ? "xec_rc_retain" : "xec_rc_release") << "\n";
+                return;
+            case ASTNodeType::OBJECT_MANIPULATION:
+                // Field stores address the field by name; the layout resolves it
+                if (statement->children.size() == 2) {
+                    emitOutlinedValue(out, context, statement->children[1]);
+                    out << "    mov rcx, " << context.local(statement->children[0]->value) << "\n";
+                    out << "    mov qword [rcx + " << statement->value << "], rax\n";
+                }
+                return;
+            case ASTNodeType::CONDITIONAL: {
+                if (statement->children.empty()) {
+                    return;
+                }
+                std::string otherwise = context.label("else");
+                std::string done = context.label("endif");
+                emitOutlinedValue(out, context, statement->children[0]);
+                out << "    test rax, rax\n";
+                out << "    jz " << otherwise << "\n";
+                for (size_t branch = 1; branch < statement->children.size() && branch < 3; branch++) {
+                    if (branch == 2) {
+                        out << "    jmp " << done << "\n";
+                        out << otherwise << ":\n";
+                    }
+                    auto owed = branchReleases.find(statement->children[branch].get());
+                    emitOutlinedStatement(out, context, statement->children[branch],
+                                           owed != branchReleases.end() ? owed->second : std::vector<std::string>());
+                }
+                if (statement->children.size() < 3) {
+                    out << otherwise << ":\n";
+                }
+                out << done << ":\n";
+                return;
+            }
+            case ASTNodeType::THREAD:
+                emitThreadSpawn(out, context, statement);
+                return;
+            case ASTNodeType::LOOP: {
+                if (statement->children.empty()) {
+                    return;
+                }
+                std::string top = context.label("loop");
+                std::string done = context.label("done");
+                out << "    mov " << context.local(statement->value) << ", 0\n";
+                out << top << ":\n";
+                emitOutlinedValue(out, context, statement->children[0]);
+                out << "    cmp " << context.local(statement->value) << ", rax\n";
+                out << "    jge " << done << "\n";
+                emitOutlinedStatements(out, context, statement->children, 1, statement->children.size());
+                out << "    inc " << context.local(statement->value) << "\n";
+                out << "    jmp " << top << "\n";
+                out << done << ":\n";
+                return;
+            }
+            default:
+                emitOutlinedValue(out, context, statement);
+                emitDeferredReleases(out, context, deferred);
+                return;
+        }
+    }
+
+    // Releases that wait for a value: rax is kept across them
+    void emitDeferredReleases(std::ostringstream& out, OutlinedContext& context, const std::vector<std::string>& names) {
+        if (names.empty()) {
+            return;
+        }
+        out << "    sub rsp, 16\n";
+        out << "    mov qword [rsp], rax\n";
+        for (auto& name : names) {
+            out << "    mov rdi, " << context.local(name) << "\n";
+            out << "    call xec_rc_release\n";
+        }
+        out << "    mov rax, qword [rsp]\n";
+        out << "    add rsp, 16\n";
+    }
+
+    // Evaluates an expression into rax. Intermediate values go to 16-byte stack slots, so rsp
+    // stays aligned for any call inside the expression. Comparisons yield 0 or 1.
+    void emitOutlinedValue(std::ostringstream& out, OutlinedContext& context, const std::shared_ptr<ASTNode>& node) {
+        if (!node) {
+            out << "    xor eax, eax\n";
+            return;
+        }
+        switch (node->type) {
+            case ASTNodeType::LITERAL:
+                out << "    mov rax, " << node->value << "\n";
+                return;
+            case ASTNodeType::IDENTIFIER:
+                out << "    mov rax, " << context.local(node->value) << "\n";
+                return;
+            case ASTNodeType::RETAIN:
+                out << "    mov rdi, " << context.local(node->value) << "\n";
+                out << "    call xec_rc_retain\n";
+                out << "    mov rax, " << context.local(node->value) << "\n";
+                return;
+            case ASTNodeType::ARRAY_ACCESS:
+                emitOutlinedValue(out, context, node->children.empty() ? nullptr : node->children[0]);
+                out << "    mov r11, " << context.local(node->value) << "\n";
+                out << "    mov rax, qword [r11 + rax*8]\n";
+                return;
+            case ASTNodeType::AWAIT:
+                emitOutlinedValue(out, context, node->children.empty() ? nullptr : node->children[0]);
+                return;
+            case ASTNodeType::FUNCTION_CALL:
+                emitOutlinedCall(out, context, node);
+                return;
+            case ASTNodeType::ALLOCATION: {
+                // A frame outlives the stack it was resumed on, so aggregates always go on the heap
+                out << "    mov edi, " << 8 * std::max<size_t>(node->children.size(), 1) << "\n";
+                out << "    call xec_rc_alloc\n";
+                out << "    sub rsp, 16\n";
+                out << "    mov qword [rsp], rax\n";
+                for (size_t i = 0; i < node->children.size(); i++) {
+                    const auto& field = node->children[i];
+                    emitOutlinedValue(out, context, field->children.empty() ? nullptr : field->children[0]);
+                    out << "    mov rcx, qword [rsp]\n";
+                    out << "    mov qword [rcx + " << 8 * i << "], rax\n";
+                }
+                out << "    mov rax, qword [rsp]\n";
+                out << "    add rsp, 16\n";
+                return;
+            }
+            case ASTNodeType::OPERATION:
+                break;
+            default:
+                out << "    mov rax, " << node->value << "\n";
+                return;
+        }
+
+        const std::string& op = node->value;
+        if (node->children.size() == 1) {
+            emitOutlinedValue(out, context, node->children[0]);
+            if (op == "-") {
+                out << "    neg rax\n";
+            } else if (op == "~") {
+                out << "    not rax\n";
+            } else if (op == "!") {
+                out << "    test rax, rax\n";
+                out << "    sete al\n";
+                out << "    movzx eax, al\n";
+            }
+            return;
+        }
+        if (node->children.size() != 2) {
+            out << "    xor eax, eax\n";
+            return;
+        }
+        emitOutlinedValue(out, context, node->children[0]);
+        out << "    sub rsp, 16\n";
+        out << "    mov qword [rsp], rax\n";
+        emitOutlinedValue(out, context, node->children[1]);
+        out << "    mov rcx, rax\n";
+        out << "    mov rax, qword [rsp]\n";
+        out << "    add rsp, 16\n";
+        static const std::map<std::string, std::string> conditions = {{"==", "e"}, {"!=", "ne"}, {"<", "l"},
+                                                                      {"<=", "le"}, {">", "g"}, {">=", "ge"}};
+        auto condition = conditions.find(op);
+        if (condition != conditions.end()) {
+            out << "    cmp rax, rcx\n";
+            out << "    set" << condition->second << " al\n";
+            out << "    movzx eax, al\n";
+        } else if (op == "/" || op == "%") {
+            out << "    cqo\n";
+            out << "    idiv rcx\n";
+            if (op == "%") {
+                out << "    mov rax, rdx\n";
+            }
+        } else if (op == "<<" || op == ">>") {
+            out << "    " << (op == "<<" ? "shl" : "sar") << " rax, cl\n";
+        } else {
+            out << "    " << scalarOpcode(op) << " rax, rcx\n";
+        }
+    }
+
+    // Evaluates a call's arguments into a stack area, [rsp + 8 * i] for argument i; returns the
+    // area's size (a multiple of 16) for the caller to pop after the call
+    size_t emitOutlinedArguments(std::ostringstream& out, OutlinedContext& context, const std::shared_ptr<ASTNode>& call) {
+        size_t count = call->children.size();
+        if (count == 0) {
+            return 0;
+        }
+        size_t area = 8 * (count % 2 == 0 ? count : count + 1);
+        out << "    sub rsp, " << area << "\n";
+        for (size_t i = 0; i < count; i++) {
+            emitOutlinedValue(out, context, call->children[i]);
+            out << "    mov qword [rsp + " << 8 * i << "], rax\n";
+        }
+        return area;
+    }
+
+    // A call from a coroutine state, with the channel builtins and spawning of unawaited async
+    // calls as generateFunctionCallBackend lowers them
+    void emitOutlinedCall(std::ostringstream& out, OutlinedContext& context, const std::shared_ptr<ASTNode>& call) {
+        static const char* argumentRegisters[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+        const std::string& name = call->value;
+        size_t area = emitOutlinedArguments(out, context, call);
+        if (isChannelOperation(name) && name == "select") {
+            out << "    mov rdi, rsp\n";
+            out << "    mov esi, " << call->children.size() << "\n";
+            out << "    call xec_chan_select\n";
+        } else if (isChannelOperation(name) && (name == "channel" || name == "spsc_channel")) {
+            if (call->children.empty()) {
+                out << "    mov edi, 1024\n";
+            } else {
+                out << "    mov rdi, qword [rsp]\n";
+            }
+            out << "    mov esi, " << (name == "spsc_channel" ? 1 : 0) << "\n";
+            out << "    call xec_chan_new\n";
+        } else {
+            size_t registers = isChannelOperation(name) ? 2 : 6;
+            for (size_t i = 0; i < call->children.size() && i < registers; i++) {
+                out << "    mov " << argumentRegisters[i] << ", qword [rsp + " << 8 * i << "]\n";
+            }
+            out << "    call " << (isChannelOperation(name) ? "xec_chan_" + name : name) << "\n";
+        }
+        if (area) {
+            out << "    add rsp, " << area << "\n";
+        }
+        auto spawned = spawnedCalls.find(call.get());
+        if (spawned != spawnedCalls.end()) {
+            out << "    mov rdi, rax\n";
+            out << "    call xec_async_spawn\n";
+            if (!spawned->second) {
+                out << "    call xec_async_run\n";
+            }
+        }
+    }
+
+    // Generate assembly for function calls
+    void generateFunctionCallBackend(std::shared_ptr<ASTNode> node) {
+        if (awaitedCalls.count(node.get())) {
+            return;
+        }
+        Logger::debug("Generating call code for: ", node->value);
+        std::ostringstream out;
+        auto counter = counterIndex.find(node.get());
+        if (counter != counterIndex.end()) {
+            out << "    inc " << counterOperand(counter->second) << "\n";
+        }
+        out << "Calling function: " << node->value << "()\n";
+        if (isChannelOperation(node->value)) {
+            generateChannelCallBackend(out, node);
+        }
+        auto spawned = spawnedCalls.find(node.get());
+        if (spawned != spawnedCalls.end()) {
+            out << "    mov rdi, rax\n";
+            out << "    call xec_async_spawn\n";
+            if (!spawned->second) {
+                out << "    call xec_async_run\n";
+            }
+        }
+        std::lock_guard<std::mutex> lock(generationMutex);
+        std::cout << out.str();
+    }
+
+    // Channels are reference counted; the local holding one is released by referenceCounting.
+    // receive and select return the value in rax and the channel's index in rdx (-1 once closed
+    // and drained). Prototype: the xecc driver does not parse channel(n) or the operations yet.
+    void generateChannelCallBackend(std::ostringstream& out, std::shared_ptr<ASTNode> node) {
+        static const char* argumentRegisters[] = {"rdi", "rsi"};
+        const std::string& name = node->value;
+        if (name == "select") {
+            size_t bytes = (node->children.size() * 8 + 15) & ~size_t(15);
+            out << "    sub rsp, " << bytes << "\n";
+            for (size_t i = 0; i < node->children.size(); i++) {
+                out << "    mov rax, " << describeExpression(node->children[i]) << "\n";
+                out << "    mov qword [rsp + " << i * 8 << "], rax\n";
+            }
+            out << "    mov rdi, rsp\n";
+            out << "    mov esi, " << node->children.size() << "\n";
+            out << "    call xec_chan_select\n";
+            out << "    add rsp, " << bytes << "\n";
+            return;
+        }
+        for (size_t i = 0; i < node->children.size() && i < 2; i++) {
+            out << "    mov " << argumentRegisters[i] << ", " << describeExpression(node->children[i]) << "\n";
+        }
+        if (name == "channel" || name == "spsc_channel") {
+            if (node->children.empty()) {
+                out << "    mov edi, 1024\n";
+            }
+            out << "    mov esi, " << (name == "spsc_channel" ? 1 : 0) << "\n";
+            out << "    call xec_chan_new\n";
+        } else {
+            out << "    call xec_chan_" << name << "\n";
+        }
+    }
+
+    // Generate assembly for conditionals; the then-block is laid out as the fall-through path
+    void generateConditionalBackend(std::shared_ptr<ASTNode> node) {
+        if (node->children.empty()) {
+            return;
+        }
+        Logger::debug("Generating conditional code");
+        std::ostringstream out;
+        std::string id;
+        {
+            std::lock_guard<std::mutex> lock(generationMutex);
+            id = std::to_string(labelCounter++);
+        }
+        auto counter = counterIndex.find(node.get());
+        out << "Branching on: " << describeExpression(node->children[0]) << "\n";
+        out << "    jz .Lelse" << id << "\n";
+        if (counter != counterIndex.end()) {
+            out << "    inc " << counterOperand(counter->second) << "\n";
+        }
+        out << "    ; then-block\n";
+        generateExitReleases(out, node->children.size() > 1 ? node->children[1].get() : nullptr);
+        out << "    jmp .Lendif" << id << "\n";
+        out << ".Lelse" << id << ":\n";
+        if (counter != counterIndex.end()) {
+            out << "    inc " << counterOperand(counter->second + 1) << "\n";
+        }
+        if (node->children.size() == 3) {
+            out << "    ; else-block\n";
+            generateExitReleases(out, node->children[2].get());
+        }
+        out << ".Lendif" << id << ":\n";
+        std::lock_guard<std::mutex> lock(generationMutex);
+        std::cout << out.str();
+    }
+
+    // Generate assembly for assignments
+    void generateAssignmentBackend(std::shared_ptr<ASTNode> node) {
+        if (isBoundAllocation(node)) {
+            generateAllocationBackend(node->value, node->children[0]);
+            return;
+        }
+        Logger::debug("Generating assignment code for: ", node->value);
+        std::lock_guard<std::mutex> lock(generationMutex);
+        std::cout << "Assigning value to variable: " << node->value << "\n";
+    }
+
+    // Scalar-replaced aggregates are only their field initializers; stack aggregates get a frame
+    // slot; the rest are reference counted objects from the runtime pools (xec_rc_alloc, see
+    // Runtime/RefCount.hpp)
+    void generateAllocationBackend(const std::string& name, std::shared_ptr<ASTNode> allocation) {
+        auto found = allocationPlacements.find(allocation.get());
+        AllocationPlacement placement = found != allocationPlacements.end() ? found->second : AllocationPlacement::HEAP;
+        size_t bytes = 8 * std::max<size_t>(allocation->children.size(), 1);
+        std::ostringstream out;
+        out << "Allocating " << allocation->value << " " << name << " (" << placementName(placement) << ", " << bytes << " bytes)\n";
+        if (placement == AllocationPlacement::HEAP) {
+            out << "    mov edi, " << bytes << "\n";
+            out << "    call xec_rc_alloc\n";
+            out << "    mov qword [" << name << "], rax\n";
+        } else if (placement == AllocationPlacement::STACK) {
+            out << "    lea rax, [rsp + .Lframe_" << name << "]\n";
+            out << "    mov qword [" << name << "], rax\n";
+        }
+        if (placement != AllocationPlacement::SCALARS) {
+            out << "    mov rcx, rax\n";
+        }
+        for (size_t i = 0; i < allocation->children.size(); i++) {
+            const auto& field = allocation->children[i];
+            std::string value = field->children.empty() ? "0" : describeExpression(field->children[0]);
+            if (placement == AllocationPlacement::SCALARS) {
+                out << "    mov qword [" << name << "." << field->value << "], " << value << "\n";
+            } else {
+                out << "    mov qword [rcx + " << 8 * i << "], " << value << "\n";
+            }
+        }
+        std::lock_guard<std::mutex> lock(generationMutex);
+        std::cout << out.str();
+    }
+
+    // Owner-thread counts are plain increments inside the runtime; the calls stay out of line
+    void generateRefCountBackend(std::shared_ptr<ASTNode> node) {
+        bool retain = node->type == ASTNodeType::RETAIN;
+        std::ostringstream out;
+        out << (retain ? "Retaining: " : "Releasing: ") << node->value << "\n";
+        out << "    mov rdi, qword [" << node->value << "]\n";
+        out << "    call " << (retain ? "xec_rc_retain" : "xec_rc_release") << "\n";
+        std::lock_guard<std::mutex> lock(generationMutex);
+        std::cout << out.str();
+    }
+
+    // Releases owed by a RETURN or a store that is a branch of a conditional
+    void generateExitReleases(std::ostringstream& out, const ASTNode* branch) {
+        auto releases = branchReleases.find(branch);
+        if (releases == branchReleases.end()) {
+            return;
+        }
+        for (auto& name : releases->second) {
+            out << "    mov rdi, qword [" << name << "]\n";
+            out << "    call xec_rc_release\n";
+        }
+    }
+
+    // Forks spawn the outlined block with the enclosing frame as its argument; `thread for` hands
+    // the loop body to xec_parallel_for, which calls it with subranges (frame, lo, hi). Each task
+    // is a function of its own, placed out of line in .text.xec.tasks.
+    void generateThreadBackend(std::shared_ptr<ASTNode> node) {
+        std::ostringstream out;
+        if (node->value.rfind("join ", 0) == 0) {
+            std::string function = node->value.substr(5);
+            out << "Joining tasks of: " << function << "\n";
+            if (taskGroups.count(function)) {
+                out << "    mov rdi, qword [rbp - 8]\n";
+                out << "    call xec_task_wait\n";
+            }
+            out << "    leave\n";
+        } else {
+            auto task = threadTasks.find(node.get());
+            if (task == threadTasks.end()) {
+                return;
+            }
+            // Blocks nested in a task are spawned by that task's code
+            if (!outlinedNodes.count(node.get())) {
+                OutlinedContext context(task->second, "");
+                emitThreadSpawn(out, context, node);
+            }
+            generateTaskFunction(out, node, task->second);
+        }
+        std::lock_guard<std::mutex> lock(generationMutex);
+        std::cout << out.str();
+    }
+
+    // The spawn of a thread block from code whose enclosing frame is `context.frame`
+    void emitThreadSpawn(std::ostringstream& out, OutlinedContext& context, const std::shared_ptr<ASTNode>& node) {
+        auto task = threadTasks.find(node.get());
+        if (task == threadTasks.end()) {
+            return;
+        }
+        const std::string& label = task->second;
+        if (node->children.size() == 1 && node->children[0]->type == ASTNodeType::LOOP) {
+            auto range = node->children[0];
+            out << "Parallel for over: " << range->value << "\n";
+            emitOutlinedValue(out, context, range->children.empty() ? nullptr : range->children[0]);
+            out << "    mov rsi, rax\n";
+            out << "    xor edi, edi\n";
+            out << "    mov edx, " << options.parallelGrain << "\n";
+            out << "    lea rcx, [rip + " << label << "]\n";
+            out << "    mov r8, " << context.frame << "\n";
+            out << "    call xec_parallel_for\n";
+        } else {
+            out << "Spawning task: " << label << "\n";
+            out << "    mov rdi, qword [" << context.frame << " - 8]\n";
+            out << "    lea rsi, [rip + " << label << "]\n";
+            out << "    mov rdx, " << context.frame << "\n";
+            out << "    call xec_task_spawn\n";
+        }
+    }
+
+    // task(frame) or body(frame, lo, hi): rbx holds the enclosing frame, and a parallel-for's
+    // induction variable lives in the task's own frame, since subranges run concurrently
+    void generateTaskFunction(std::ostringstream& out, const std::shared_ptr<ASTNode>& node, const std::string& label) {
+        OutlinedContext context(label, ".L" + label + "_exit");
+        context.frame = "rbx";
+        bool loop = node->children.size() == 1 && node->children[0]->type == ASTNodeType::LOOP;
+        out << "    .pushsection .text.xec.tasks,\"ax\",@progbits\n";
+        out << label << ":\n";
+        out << "    push rbp\n";
+        out << "    mov rbp, rsp\n";
+        out << "    push rbx\n";
+        out << "    push r12\n";
+        out << "    sub rsp, 16\n";
+        out << "    mov rbx, rdi\n";
+        if (loop) {
+            auto range = node->children[0];
+            std::string top = ".L" + label + "_loop";
+            context.homes[range->value] = "qword [rbp - 24]";
+            out << "    mov qword [rbp - 24], rsi\n";
+            out << "    mov r12, rdx\n";
+            out << top << ":\n";
+            out << "    cmp qword [rbp - 24], r12\n";
+            out << "    jge " << context.exit << "\n";
+            emitOutlinedStatements(out, context, range->children, 1, range->children.size());
+            out << "    inc qword [rbp - 24]\n";
+            out << "    jmp " << top << "\n";
+        } else {
+            emitOutlinedStatements(out, context, node->children, 0, node->children.size());
+        }
+        out << context.exit << ":\n";
+        out << "    mov r12, qword [rbp - 16]\n";
+        out << "    mov rbx, qword [rbp - 8]\n";
+        out << "    leave\n";
+        out << "    ret\n";
+        out << "    .popsection\n";
+    }
+
+    // Generate assembly for operations
+    void generateOperationBackend(std::shared_ptr<ASTNode> node) {
+        Logger::debug("Generating operation code for: ", node->value);
+        std::lock_guard<std::mutex> lock(generationMutex);
+        std::cout << "Performing operation: " << node->value << "\n";
+    }
+
+    // Generate assembly for loops, using the vector plan when one was found
+    void generateLoopBackend(std::shared_ptr<ASTNode> node) {
+        auto plan = vectorPlans.find(node.get());
+        if (plan != vectorPlans.end()) {
+            generateVectorLoopBackend(node, plan->second);
+            return;
+        }
+        Logger::debug("Generating loop code for: ", node->value);
+        std::lock_guard<std::mutex> lock(generationMutex);
+        std::cout << "Looping over: " << node->value << "\n";
+    }
+};
+
+// Link step for whole-program optimization: merges the IR files written with emitIRPath and runs
+// code generation once over the combined program, so inlining, DCE and constant propagation see
+// across module boundaries. Like the rest of this generator it is not wired into the xecc driver
+// (TieItAllTogether.cpp), which has no IR of its own; only programs that embed this file can use it.
+class LinkTimeOptimizer {
+public:
+    explicit LinkTimeOptimizer(CodeGenOptions options = {}) : options(options) {
+        this->options.wholeProgram = true;
+        this->options.emitIRPath.clear();
+    }
+
+    void addModule(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Cannot read IR file: " + path);
+        }
+        std::string moduleName;
+        for (auto& function : IRSerializer::read(in, moduleName)) {
+            auto existing = definitions.find(function->value);
+            if (existing != definitions.end()) {
+                throw std::runtime_error("Function " + function->value + " defined in both " + existing->second +
+                                         " and " + path);
+            }
+            definitions[function->value] = path;
+            program->addChild(function);
+        }
+        Logger::log("Linked module ", moduleName, " from ", path);
+    }
+
+    void link() {
+        CodeGenerator generator(program, options);
+        generator.generate();
+    }
+
+private:
+    CodeGenOptions options;
+    std::shared_ptr<ASTNode> program = std::make_shared<ASTNode>(ASTNodeType::MODULE, "program");
+    std::unordered_map<std::string, std::string> definitions;
 };
 
 // Sample
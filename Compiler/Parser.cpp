@@ -83,6 +83,15 @@ private:
             column++;
         }
         std::string value = source.substr(start, position - start);
+        if (value == "async") {
+            return {TokenType::ASYNC, value, line, column};
+        }
+        if (value == "await") {
+            return {TokenType::AWAIT, value, line, column};
+        }
+        if (value == "thread") {
+            return {TokenType::THREAD, value, line, column};
+        }
         return {TokenType::IDENTIFIER, value, line, column};
     }
 
@@ -181,6 +190,11 @@ class Parser {
 public:
     Parser(std::vector<Token>& tokens) : tokens(tokens), position(0) {}
 
+    // Functions declared `async`, for CodeGenerator::declareAsync
+    const std::set<std::string>& asyncFunctions() const {
+        return asyncNames;
+    }
+
     void parse() {
         while (position < tokens.size()) {
             Token& token = tokens[position];
@@ -217,6 +231,18 @@ public:
                     handleAsync();
                     break;
                 }
+                case TokenType::AWAIT: {
+                    handleAwait();
+                    break;
+                }
+                case TokenType::THREAD: {
+                    handleThread();
+                    break;
+                }
+                case TokenType::EOF_TOKEN: {
+                    position++;
+                    break;
+                }
                 default:
                     handleError();
                     break;
@@ -227,6 +253,9 @@ public:
 private:
     std::vector<Token>& tokens;
     int position;
+    std::set<std::string> asyncNames;
+    int asyncDepth = -1;   // Brace depth of the async function being parsed, or -1
+    int braceDepth = 0;
 
     void handleKeyword() {
         Token& token = tokens[position];
@@ -261,6 +290,11 @@ private:
     void handleSymbol() {
         Token& token = tokens[position];
         // Handle symbols (e.g., braces, parentheses)
+        if (token.value == "{") {
+            braceDepth++;
+        } else if (token.value == "}" && --braceDepth == asyncDepth) {
+            asyncDepth = -1;
+        }
         position++;
     }
 
@@ -270,10 +304,33 @@ private:
         position++;
     }
 
+    // async function name(...) { ... }: lowered to a coroutine by the code generator
     void handleAsync() {
+        position++;
+        if (tokens[position].value != "function" || tokens[position + 1].type != TokenType::IDENTIFIER) {
+            std::cerr << "Expected 'function name' after 'async' at line " << tokens[position].line << std::endl;
+            return;
+        }
+        asyncNames.insert(tokens[position + 1].value);
+        asyncDepth = braceDepth;
+        position += 2;
+    }
+
+    void handleAwait() {
+        Token& token = tokens[position];
+        if (asyncDepth < 0) {
+            std::cerr << "'await' outside an async function at line " << token.line << std::endl;
+        }
+        position++;
+    }
+
+    // thread { ... } or thread for i in n { ... }: outlined into a task by the code generator
+    void handleThread() {
         Token& token = tokens[position];
-        // Handle async/await processing
         position++;
+        if (tokens[position].value != "{" && tokens[position].value != "for") {
+            std::cerr << "Expected '{' or 'for' after 'thread' at line " << token.line << std::endl;
+        }
     }
 
     void handleError() {
@@ -399,24 +456,28 @@ public:
 #include <thread>
 #include <future>
 
+#include "../Runtime/TaskScheduler.hpp"
+
 // Parallel execution of tasks
 void parallelTask(int id) {
     std::cout << "Task " << id << " is running on thread " << std::this_thread::get_id() << std::endl;
 }
 
+// Tasks go to the work-stealing pool; no thread is created per task
 void runParallelTasks(int numTasks) {
-    std::vector<std::thread> threads;
+    xec::TaskScheduler& scheduler = xec::TaskScheduler::instance();
+    xec::TaskGroup group;
     for (int i = 0; i < numTasks; i++) {
-        threads.push_back(std::thread(parallelTask, i));
-    }
-    for (auto& th : threads) {
-        th.join();
+        scheduler.spawn(group, [i] { parallelTask(i); });
     }
+    scheduler.wait(group);
 }
 
-// Async / Await-like mechanism (using std::future)
+// Async / Await-like mechanism (using std::future). Deferred: the thread calling get() computes
+// the sum, so no thread is started per call. Compiled `async function`s run as coroutines on the
+// runtime event loops instead (Runtime/EventLoop.hpp).
 std::future<int> asyncAdd(int a, int b) {
-    return std::async(std::launch::async, [a, b]() {
+    return std::async(std::launch::deferred, [a, b]() {
         return a + b;
     });
 }
@@ -19,30 +19,27 @@
 #include <atomic>
 #include <exception>
 #include <atomic>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <filesystem>
+#include <optional>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 
-// Logger Utility for Debugging and Profiling
-class Logger {
-public:
-    static void log(const std::string& message) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        std::cout << "[LOG] " << message << std::endl;
-    }
-
-    static void logError(const std::string& message) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        std::cerr << "[ERROR] " << message << std::endl;
-    }
-
-    static void logProfile(const std::string& message) {
-        std::lock_guard<std::mutex> lock(mutex_);
-        std::cout << "[PROFILE] " << message << std::endl;
-    }
+#include "../Runtime/Profile.hpp"
+#include "../Runtime/Log.hpp"
+#include "../Runtime/TimeTrace.hpp"
 
-private:
-    static std::mutex mutex_;
-};
-
-std::mutex Logger::mutex_;
+using xec::Logger;
+using xec::TimeScope;
+using xec::TimeTrace;
 
 // Token Representation
 class Token {
@@ -58,6 +55,10 @@ public:
         RIGHT_PARENTHESIS,
         CURLY_OPEN,
         CURLY_CLOSE,
+        PIPE,
+        OPERATOR,
+        COMMA,
+        STRING,
         END_OF_FILE
     };
 
@@ -67,7 +68,8 @@ public:
     std::string value;
 };
 
-// Lexer responsible for tokenizing the input source code
+// Lexer responsible for tokenizing the input source code. '|' is a PIPE only directly inside a
+// `pipeline { }` block; anywhere else it is the bitwise-or OPERATOR, as is '||' everywhere.
 class Lexer {
 public:
     explicit Lexer(const std::string& sourceCode) : source(sourceCode), index(0) {}
@@ -83,7 +85,14 @@ public:
 
             if (isalpha(currentChar)) {
                 std::string identifier = parseIdentifier();
-                tokens.push_back(Token(Token::Type::IDENTIFIER, identifier));
+                if (identifier == "function") {
+                    tokens.push_back(Token(Token::Type::FUNCTION, identifier));
+                } else if (identifier == "var") {
+                    tokens.push_back(Token(Token::Type::VAR, identifier));
+                } else {
+                    tokens.push_back(Token(Token::Type::IDENTIFIER, identifier));
+                    pipelineOpening = identifier == "pipeline" && nextNonSpace() == '{';
+                }
                 continue;
             }
 
@@ -113,10 +122,40 @@ public:
                 case '{':
                     tokens.push_back(Token(Token::Type::CURLY_OPEN, "{"));
                     index++;
+                    braceDepth++;
+                    if (pipelineOpening) {
+                        pipelineDepth = braceDepth;
+                        pipelineOpening = false;
+                    }
                     break;
                 case '}':
                     tokens.push_back(Token(Token::Type::CURLY_CLOSE, "}"));
                     index++;
+                    if (braceDepth == pipelineDepth) {
+                        pipelineDepth = 0;
+                    }
+                    if (braceDepth > 0) {
+                        braceDepth--;
+                    }
+                    break;
+                case '|':
+                    if (index + 1 < source.size() && source[index + 1] == '|') {
+                        tokens.push_back(Token(Token::Type::OPERATOR, "||"));
+                        index += 2;
+                    } else if (pipelineDepth != 0 && braceDepth == pipelineDepth) {
+                        tokens.push_back(Token(Token::Type::PIPE, "|"));
+                        index++;
+                    } else {
+                        tokens.push_back(Token(Token::Type::OPERATOR, "|"));
+                        index++;
+                    }
+                    break;
+                case ',':
+                    tokens.push_back(Token(Token::Type::COMMA, ","));
+                    index++;
+                    break;
+                case '"':
+                    tokens.push_back(Token(Token::Type::STRING, parseString()));
                     break;
                 default:
                     throw std::runtime_error("Unexpected character: " + std::string(1, currentChar));
@@ -130,6 +169,17 @@ public:
 private:
     std::string source;
     size_t index;
+    size_t braceDepth = 0;
+    size_t pipelineDepth = 0;      // Depth of the innermost open pipeline block; 0 outside one
+    bool pipelineOpening = false;  // Just lexed `pipeline` followed by '{'
+
+    char nextNonSpace() const {
+        size_t i = index;
+        while (i < source.size() && isspace(source[i])) {
+            i++;
+        }
+        return i < source.size() ? source[i] : '\0';
+    }
 
     std::string parseIdentifier() {
         std::string result;
@@ -139,11 +189,31 @@ private:
         return result;
     }
 
+    // Digits with an optional size suffix: 256_KB, 2_MB, 1_GB
     std::string parseNumber() {
         std::string result;
         while (index < source.size() && isdigit(source[index])) {
             result += source[index++];
         }
+        if (index + 2 < source.size() && source[index] == '_' && isalpha(source[index + 1])) {
+            result += source[index++];
+            while (index < source.size() && isalpha(source[index])) {
+                result += source[index++];
+            }
+        }
+        return result;
+    }
+
+    std::string parseString() {
+        std::string result;
+        index++; // Skip the opening quote
+        while (index < source.size() && source[index] != '"') {
+            result += source[index++];
+        }
+        if (index >= source.size()) {
+            throw std::runtime_error("Unterminated string literal");
+        }
+        index++; // Skip the closing quote
         return result;
     }
 };
@@ -152,11 +222,15 @@ private:
 class ASTNode {
 public:
     enum class Type {
+        PROGRAM,
         FUNCTION_DECLARATION,
         VAR_DECLARATION,
         ASSIGNMENT,
-        LITERAL,
-        IDENTIFIER
+        LITERAL,        // Number, optionally with a size suffix (256_KB)
+        STRING,         // Quoted text
+        IDENTIFIER,
+        PIPELINE,       // Children: source IDENTIFIER, then one STAGE per '|' link
+        STAGE,          // Value: stage name; children: ASSIGNMENT per named argument
     };
 
     ASTNode(Type type, std::string value = "") : type(type), value(std::move(value)) {}
@@ -172,7 +246,11 @@ public:
     explicit Parser(const std::vector<Token>& tokens) : tokens(tokens), currentIndex(0) {}
 
     std::shared_ptr<ASTNode> parse() {
-        return parseFunctionDeclaration();
+        auto program = std::make_shared<ASTNode>(ASTNode::Type::PROGRAM);
+        while (tokens[currentIndex].type != Token::Type::END_OF_FILE) {
+            program->children.push_back(parseFunctionDeclaration());
+        }
+        return program;
     }
 
 private:
@@ -180,8 +258,11 @@ private:
     size_t currentIndex;
 
     std::shared_ptr<ASTNode> parseFunctionDeclaration() {
+        if (tokens[currentIndex].type == Token::Type::FUNCTION) {
+            currentIndex++; // Skip 'function'
+        }
         if (tokens[currentIndex].type != Token::Type::IDENTIFIER) {
-            Logger::logError("Expected function name, found: " + tokens[currentIndex].value);
+            Logger::logError("Expected function name, found: ", tokens[currentIndex].value);
             throw std::runtime_error("Expected function name");
         }
 
@@ -192,6 +273,12 @@ private:
         }
 
         currentIndex++; // Skip '('
+        if (tokens[currentIndex].type != Token::Type::RIGHT_PARENTHESIS) {
+            Logger::logError("Expected ')' after '('");
+            throw std::runtime_error("Expected ')' after '('");
+        }
+
+        currentIndex++; // Skip ')'
         if (tokens[currentIndex].type != Token::Type::CURLY_OPEN) {
             Logger::logError("Expected '{' for function body");
             throw std::runtime_error("Expected '{' for function body");
@@ -201,16 +288,103 @@ private:
         auto functionNode = std::make_shared<ASTNode>(ASTNode::Type::FUNCTION_DECLARATION, functionName);
 
         while (tokens[currentIndex].type != Token::Type::CURLY_CLOSE) {
-            functionNode->children.push_back(parseVariableDeclaration());
+            functionNode->children.push_back(parseStatement());
         }
 
         currentIndex++; // Skip '}'
         return functionNode;
     }
 
+    std::shared_ptr<ASTNode> parseStatement() {
+        if (tokens[currentIndex].type == Token::Type::IDENTIFIER && tokens[currentIndex].value == "pipeline" &&
+            tokens[currentIndex + 1].type == Token::Type::CURLY_OPEN) {
+            return parsePipeline();
+        }
+        return parseVariableDeclaration();
+    }
+
+    // pipeline { source | stage(arg=value, ...) | stage() ... }
+    // A stage starting a new line without '|' continues the chain, as in the README examples.
+    std::shared_ptr<ASTNode> parsePipeline() {
+        currentIndex += 2; // Skip 'pipeline' '{'
+        auto pipelineNode = std::make_shared<ASTNode>(ASTNode::Type::PIPELINE);
+
+        if (tokens[currentIndex].type != Token::Type::IDENTIFIER) {
+            Logger::logError("Expected pipeline source, found: ", tokens[currentIndex].value);
+            throw std::runtime_error("Expected pipeline source");
+        }
+        if (tokens[currentIndex + 1].type == Token::Type::LEFT_PARENTHESIS) {
+            pipelineNode->children.push_back(parseStage());
+        } else {
+            pipelineNode->children.push_back(std::make_shared<ASTNode>(ASTNode::Type::IDENTIFIER, tokens[currentIndex++].value));
+        }
+
+        while (tokens[currentIndex].type != Token::Type::CURLY_CLOSE) {
+            if (tokens[currentIndex].type == Token::Type::PIPE) {
+                currentIndex++; // Skip '|'
+            }
+            pipelineNode->children.push_back(parseStage());
+        }
+
+        currentIndex++; // Skip '}'
+        return pipelineNode;
+    }
+
+    std::shared_ptr<ASTNode> parseStage() {
+        if (tokens[currentIndex].type != Token::Type::IDENTIFIER) {
+            Logger::logError("Expected pipeline stage, found: ", tokens[currentIndex].value);
+            throw std::runtime_error("Expected pipeline stage");
+        }
+        auto stageNode = std::make_shared<ASTNode>(ASTNode::Type::STAGE, tokens[currentIndex++].value);
+        if (tokens[currentIndex].type != Token::Type::LEFT_PARENTHESIS) {
+            Logger::logError("Expected '(' after stage ", stageNode->value);
+            throw std::runtime_error("Expected '(' after pipeline stage");
+        }
+
+        currentIndex++; // Skip '('
+        while (tokens[currentIndex].type != Token::Type::RIGHT_PARENTHESIS) {
+            stageNode->children.push_back(parseStageArgument());
+            if (tokens[currentIndex].type == Token::Type::COMMA) {
+                currentIndex++; // Skip ','
+            } else if (tokens[currentIndex].type != Token::Type::RIGHT_PARENTHESIS) {
+                Logger::logError("Expected ',' or ')' in arguments of ", stageNode->value);
+                throw std::runtime_error("Expected ',' or ')' in stage arguments");
+            }
+        }
+
+        currentIndex++; // Skip ')'
+        return stageNode;
+    }
+
+    // name=value, or a bare value passed positionally (e.g. writeTo("output.dat"))
+    std::shared_ptr<ASTNode> parseStageArgument() {
+        std::string name;
+        if (tokens[currentIndex].type == Token::Type::IDENTIFIER &&
+            tokens[currentIndex + 1].type == Token::Type::ASSIGNMENT) {
+            name = tokens[currentIndex].value;
+            currentIndex += 2; // Skip name '='
+        }
+        const Token& value = tokens[currentIndex];
+        if (value.type != Token::Type::NUMBER && value.type != Token::Type::STRING &&
+            value.type != Token::Type::IDENTIFIER) {
+            Logger::logError("Expected stage argument value, found: ", value.value);
+            throw std::runtime_error("Expected stage argument value");
+        }
+        currentIndex++;
+        auto argument = std::make_shared<ASTNode>(ASTNode::Type::ASSIGNMENT, name);
+        ASTNode::Type type = value.type == Token::Type::IDENTIFIER ? ASTNode::Type::IDENTIFIER
+                             : value.type == Token::Type::STRING ? ASTNode::Type::STRING
+                                                                 : ASTNode::Type::LITERAL;
+        argument->children.push_back(std::make_shared<ASTNode>(type, value.value));
+        return argument;
+    }
+
     std::shared_ptr<ASTNode> parseVariableDeclaration() {
+        if (tokens[currentIndex].type == Token::Type::VAR) {
+            currentIndex++; // Skip 'var'
+        }
         if (tokens[currentIndex].type != Token::Type::IDENTIFIER) {
-            Logger::logError("Expected variable name, found: " + tokens[currentIndex].value);
+            Logger::logError("Expected variable name, found: ", tokens[currentIndex].value);
             throw std::runtime_error("Expected variable name");
         }
 
@@ -240,6 +414,41 @@ private:
     }
 };
 
+// Parameters of the runtime's pipeline entry points (Runtime/EntryPoints.cpp), in calling order.
+// Arguments to these are checked and placed by name; any other source or stage is an external
+// function and takes its arguments in the order written. A missing argument is passed as 0, which
+// the runtime reads as "use the default".
+struct StageParameter {
+    const char* name;
+    bool text;  // A string, passed as a pointer; otherwise a number
+};
+
+using StageSignatures = std::map<std::string, std::vector<StageParameter>>;
+
+// Sources called as xec_source_<name>(arguments...)
+const StageSignatures& sourceSignatures() {
+    static const StageSignatures signatures = {
+        {"replay", {{"path", true}, {"replays", false}}},
+    };
+    return signatures;
+}
+
+// Stages called as xec_stage_<name>(handle, arguments...)
+const StageSignatures& stageSignatures() {
+    static const StageSignatures signatures = {
+        {"splitChunks", {{"size", false}}},
+        {"parse", {}},
+        {"truncate", {{"maxChunks", false}, {"limit", false}, {"policy", true}}},
+        {"serialize", {{"format", true}}},
+        {"encryptData", {{"key", true}}},
+        {"writeTo", {{"path", true}}},
+        {"modifyHeader", {{"flag", true}}},
+        {"modifyPayload", {{"data", true}}},
+        {"transmit", {{"path", true}}},
+    };
+    return signatures;
+}
+
 // Semantic Analyzer to ensure logical consistency and correctness
 class SemanticAnalyzer {
 public:
@@ -261,78 +470,1209 @@ private:
             checkVariableDeclaration(node);
         }
 
+        if (node->type == ASTNode::Type::PIPELINE) {
+            checkPipeline(node);
+        }
+
         for (auto& child : node->children) {
             analyzeNode(child);
         }
     }
 
+    void checkPipeline(std::shared_ptr<ASTNode> node) {
+        Logger::log("Analyzing pipeline with ", node->children.size(), " links");
+        for (size_t i = 0; i < node->children.size(); i++) {
+            auto stage = node->children[i];
+            std::set<std::string> named;
+            for (auto& argument : stage->children) {
+                if (!argument->value.empty() && !named.insert(argument->value).second) {
+                    throw std::runtime_error("Duplicate argument " + argument->value + " to stage " + stage->value);
+                }
+            }
+            const StageSignatures& signatures = i == 0 ? sourceSignatures() : stageSignatures();
+            auto signature = signatures.find(stage->value);
+            if (stage->type == ASTNode::Type::STAGE && signature != signatures.end()) {
+                checkStageArguments(stage, signature->second);
+            }
+        }
+    }
+
+    // Every argument must name (or by position, be) a parameter of the stage and have its type;
+    // variables hold numbers
+    void checkStageArguments(std::shared_ptr<ASTNode> stage, const std::vector<StageParameter>& parameters) {
+        for (size_t a = 0; a < stage->children.size(); a++) {
+            auto argument = stage->children[a];
+            auto parameter = parameters.end();
+            if (argument->value.empty()) {
+                parameter = a < parameters.size() ? parameters.begin() + a : parameters.end();
+            } else {
+                parameter = std::find_if(parameters.begin(), parameters.end(),
+                                         [&](const StageParameter& p) { return p.name == argument->value; });
+            }
+            if (parameter == parameters.end()) {
+                throw std::runtime_error(argument->value.empty()
+                                             ? "Too many arguments to stage " + stage->value
+                                             : "Unknown argument " + argument->value + " to stage " + stage->value);
+            }
+            auto value = argument->children[0];
+            bool text = value->type == ASTNode::Type::STRING;
+            if (text != parameter->text) {
+                throw std::runtime_error(std::string("Argument ") + parameter->name + " to stage " + stage->value +
+                                         (parameter->text ? " must be a string" : " must be a number"));
+            }
+        }
+    }
+
     void checkFunctionDeclaration(std::shared_ptr<ASTNode> node) {
-        Logger::log("Analyzing function: " + node->value);
+        Logger::debug("Analyzing function: ", node->value);
     }
 
     void checkVariableDeclaration(std::shared_ptr<ASTNode> node) {
-        Logger::log("Analyzing variable: " + node->value);
+        Logger::debug("Analyzing variable: ", node->value);
+    }
+};
+
+// Version baked into every cache key; bump whenever generated output changes
+const char* const XEC_COMPILER_VERSION = "0.2.2";
+
+// Version of the cached artifact encodings (token and AST type numbering included); bump whenever
+// encodeTokens or encodeAST would write something an older decoder reads differently
+const char* const XEC_CACHE_FORMAT = "2";
+
+// Command-line options for the compiler driver
+struct CompilerOptions {
+    std::string inputFile;
+    std::string outputFile;
+    bool profileGenerate = false;
+    std::string profileGeneratePath = "default.xecprof";
+    std::string profileUsePath;
+    std::string cacheDirectory;                       // Empty disables the artifact cache
+    uint64_t cacheMaxBytes = 512ull * 1024 * 1024;
+    std::vector<std::string> dependencyInterfaces;    // Interface hashes of imported modules
+    std::vector<std::string> imports;                 // Module files this unit depends on
+    std::string serveSocket;                          // Run as a compile server on this Unix socket
+    std::string connectSocket;                        // Forward this compile to a running server
+    unsigned serverWorkers = std::max(1u, std::thread::hardware_concurrency());
+    bool shutdownServer = false;
+    bool timeTrace = false;
+    std::string timeTracePath;                        // Empty: next to the output, else the input
+};
+
+uint64_t parseSize(const std::string& text) {
+    size_t used = 0;
+    uint64_t value = std::stoull(text, &used);
+    std::string unit = text.substr(used);
+    if (unit == "K" || unit == "KB") return value << 10;
+    if (unit == "M" || unit == "MB") return value << 20;
+    if (unit == "G" || unit == "GB") return value << 30;
+    if (!unit.empty()) {
+        throw std::runtime_error("Invalid size: " + text);
     }
+    return value;
+}
+
+// Parse driver flags:
+//   -o <file>                    write generated code to <file>
+//   --profile-generate[=<file>]  instrument generated code; counters are appended to <file> at exit
+//   --profile-use=<file>         place functions by a collected profile: entered ones in .text.hot,
+//                                never-entered ones in .text.unlikely, unprofiled ones in .text. The
+//                                profile-guided inlining and block layout in CodeGenerator.cpp are
+//                                not part of this driver
+//   --cache-dir=<dir>            reuse lexed/parsed/analyzed/generated artifacts stored under <dir>
+//   --cache-size=<n>[K|M|G]      evict least recently used artifacts beyond this size (default 512M)
+//   --dep-interface=<hash>       interface hash of an imported module; part of the cache key
+//   --import=<file>              module this unit depends on; analyzed first, its interface joins the key
+//   --serve=<socket>             run as a long-lived compile server listening on a Unix socket
+//   --workers=<n>                concurrent compiles served (default: hardware threads)
+//   --connect=<socket>           send this command line to a compile server instead of compiling here
+//   --shutdown                   with --connect, stop the server
+//   --time-trace[=<file>]        time each phase and function; write a Chrome trace and log a summary.
+//                                The optimization passes in CodeGenerator.cpp are not part of this
+//                                driver, so their timers only show up in programs that run that
+//                                generator directly
+CompilerOptions parseArguments(const std::vector<std::string>& args) {
+    CompilerOptions options;
+    for (size_t i = 0; i < args.size(); i++) {
+        const std::string& arg = args[i];
+        if (arg == "-o" && i + 1 < args.size()) {
+            options.outputFile = args[++i];
+        } else if (arg == "--profile-generate") {
+            options.profileGenerate = true;
+        } else if (arg.rfind("--profile-generate=", 0) == 0) {
+            options.profileGenerate = true;
+            options.profileGeneratePath = arg.substr(std::strlen("--profile-generate="));
+        } else if (arg.rfind("--profile-use=", 0) == 0) {
+            options.profileUsePath = arg.substr(std::strlen("--profile-use="));
+        } else if (arg.rfind("--cache-dir=", 0) == 0) {
+            options.cacheDirectory = arg.substr(std::strlen("--cache-dir="));
+        } else if (arg.rfind("--cache-size=", 0) == 0) {
+            options.cacheMaxBytes = parseSize(arg.substr(std::strlen("--cache-size=")));
+        } else if (arg.rfind("--dep-interface=", 0) == 0) {
+            options.dependencyInterfaces.push_back(arg.substr(std::strlen("--dep-interface=")));
+        } else if (arg.rfind("--import=", 0) == 0) {
+            options.imports.push_back(arg.substr(std::strlen("--import=")));
+        } else if (arg.rfind("--serve=", 0) == 0) {
+            options.serveSocket = arg.substr(std::strlen("--serve="));
+        } else if (arg.rfind("--workers=", 0) == 0) {
+            options.serverWorkers = std::max(1, std::stoi(arg.substr(std::strlen("--workers="))));
+        } else if (arg.rfind("--connect=", 0) == 0) {
+            options.connectSocket = arg.substr(std::strlen("--connect="));
+        } else if (arg == "--shutdown") {
+            options.shutdownServer = true;
+        } else if (arg == "--time-trace") {
+            options.timeTrace = true;
+        } else if (arg.rfind("--time-trace=", 0) == 0) {
+            options.timeTrace = true;
+            options.timeTracePath = arg.substr(std::strlen("--time-trace="));
+        } else if (!arg.empty() && arg[0] == '-') {
+            throw std::runtime_error("Unknown option: " + arg);
+        } else {
+            options.inputFile = arg;
+        }
+    }
+    if (options.profileGenerate && !options.profileUsePath.empty()) {
+        throw std::runtime_error("--profile-generate and --profile-use are mutually exclusive");
+    }
+    return options;
+}
+
+// Content-addressed, on-disk store for compilation artifacts.
+//
+// Each artifact lives at <dir>/<stage>/<key>, where key is a 128-bit FNV-1a hash of everything
+// that determines it (compiler version, flags, input). Writes go through a temporary file and a
+// rename so concurrent compiles never observe a partial entry. A hit refreshes the file's mtime,
+// and eviction removes the oldest files until the total fits the size cap. An entry that fails to
+// decode is dropped and rebuilt rather than reported as a compile error.
+class CompilationCache {
+public:
+    CompilationCache(const std::string& directory, uint64_t maxBytes) : directory(directory), maxBytes(maxBytes) {}
+
+    static std::string hashKey(const std::vector<std::string>& parts) {
+        unsigned __int128 hash = (static_cast<unsigned __int128>(0x6c62272e07bb0142ull) << 64) | 0x62b821756295c58dull;
+        const unsigned __int128 prime = (static_cast<unsigned __int128>(1) << 88) | 0x13b;
+        for (const auto& part : parts) {
+            // Length-prefix each part so ("ab", "c") and ("a", "bc") differ
+            std::string framed = std::to_string(part.size()) + ":" + part;
+            for (unsigned char c : framed) {
+                hash ^= c;
+                hash *= prime;
+            }
+        }
+        static const char digits[] = "0123456789abcdef";
+        std::string hex(32, '0');
+        for (int i = 31; i >= 0; i--) {
+            hex[i] = digits[static_cast<unsigned>(hash & 0xf)];
+            hash >>= 4;
+        }
+        return hex;
+    }
+
+    std::optional<std::string> load(const std::string& stage, const std::string& key) {
+        std::filesystem::path path = std::filesystem::path(directory) / stage / key;
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            misses++;
+            return std::nullopt;
+        }
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        std::error_code ignored;
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ignored);
+        hits++;
+        return buffer.str();
+    }
+
+    // Remove an entry that failed to decode so the rebuilt artifact replaces it
+    void drop(const std::string& stage, const std::string& key) {
+        std::error_code ignored;
+        std::filesystem::remove(std::filesystem::path(directory) / stage / key, ignored);
+        Logger::logWarning("Cache: dropped corrupt ", stage, " entry ", key);
+    }
+
+    void store(const std::string& stage, const std::string& key, const std::string& data) {
+        std::filesystem::path dir = std::filesystem::path(directory) / stage;
+        std::error_code error;
+        std::filesystem::create_directories(dir, error);
+        // mkstemp picks a name no other thread or process is writing, so the rename publishes
+        // exactly one complete entry
+        std::string temporary = (dir / (key + ".tmpXXXXXX")).string();
+        int fd = ::mkstemp(&temporary[0]);
+        if (fd < 0) {
+            Logger::logError("Cannot create cache entry in ", dir.string());
+            return;
+        }
+        ::fchmod(fd, 0644);
+        size_t written = 0;
+        while (written < data.size()) {
+            ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+            if (n <= 0) {
+                break;
+            }
+            written += static_cast<size_t>(n);
+        }
+        ::close(fd);
+        if (written < data.size()) {
+            Logger::logError("Cannot write cache entry: ", temporary);
+            std::filesystem::remove(temporary, error);
+            return;
+        }
+        std::filesystem::rename(temporary, dir / key, error);
+        if (error) {
+            std::filesystem::remove(temporary, error);
+        }
+        storedBytes += data.size();
+    }
+
+    // Enforce the size cap; called once per compile rather than per store
+    void evict() {
+        if (storedBytes == 0) {
+            return;
+        }
+        std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> entries;
+        uint64_t total = 0;
+        std::error_code error;
+        // A <key>.tmpXXXXXX file may be another compile's store in flight; only one untouched for
+        // an hour is treated as left behind by a crashed writer
+        auto staleBefore = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+        for (auto it = std::filesystem::recursive_directory_iterator(directory, error);
+             !error && it != std::filesystem::recursive_directory_iterator(); it.increment(error)) {
+            if (!it->is_regular_file(error)) {
+                continue;
+            }
+            auto mtime = it->last_write_time(error);
+            if (it->path().filename().string().find(".tmp") != std::string::npos) {
+                if (!error && mtime < staleBefore) {
+                    std::filesystem::remove(it->path(), error);
+                }
+                continue;
+            }
+            total += it->file_size(error);
+            entries.emplace_back(mtime, it->path());
+        }
+        if (total <= maxBytes) {
+            return;
+        }
+        std::sort(entries.begin(), entries.end());
+        for (const auto& entry : entries) {
+            if (total <= maxBytes) {
+                break;
+            }
+            uint64_t size = std::filesystem::file_size(entry.second, error);
+            if (std::filesystem::remove(entry.second, error)) {
+                total -= size;
+            }
+        }
+    }
+
+    uint64_t hitCount() const { return hits; }
+    uint64_t missCount() const { return misses; }
+
+    // Artifact encodings: text records with length-prefixed values, since string literals may
+    // contain whitespace
+    static std::string encodeTokens(const std::vector<Token>& tokens) {
+        std::ostringstream out;
+        for (const auto& token : tokens) {
+            out << static_cast<int>(token.type) << " " << token.value.size() << ":" << token.value << "\n";
+        }
+        return out.str();
+    }
+
+    static std::vector<Token> decodeTokens(const std::string& data) {
+        std::istringstream in(data);
+        std::vector<Token> tokens;
+        int type;
+        while (in >> type) {
+            if (type < 0 || type > static_cast<int>(Token::Type::END_OF_FILE)) {
+                throw std::runtime_error("Corrupt cache entry");
+            }
+            tokens.emplace_back(static_cast<Token::Type>(type), readValue(in));
+        }
+        if (!in.eof()) {
+            throw std::runtime_error("Corrupt cache entry");
+        }
+        return tokens;
+    }
+
+    static void encodeAST(std::ostream& out, const std::shared_ptr<ASTNode>& node) {
+        out << static_cast<int>(node->type) << " " << node->value.size() << ":" << node->value << " "
+            << node->children.size() << "\n";
+        for (const auto& child : node->children) {
+            encodeAST(out, child);
+        }
+    }
+
+    static std::string encodeAST(const std::shared_ptr<ASTNode>& node) {
+        std::ostringstream out;
+        encodeAST(out, node);
+        return out.str();
+    }
+
+    static std::shared_ptr<ASTNode> decodeAST(std::istream& in) {
+        int type;
+        size_t children;
+        if (!(in >> type) || type < 0 || type > static_cast<int>(ASTNode::Type::STAGE)) {
+            throw std::runtime_error("Corrupt cached AST");
+        }
+        std::string value = readValue(in);
+        // Every child takes at least a few bytes, so a count past the remaining input is corrupt
+        if (!(in >> children) || children > static_cast<size_t>(in.rdbuf()->in_avail())) {
+            throw std::runtime_error("Corrupt cached AST");
+        }
+        auto node = std::make_shared<ASTNode>(static_cast<ASTNode::Type>(type), value);
+        for (size_t i = 0; i < children; i++) {
+            node->children.push_back(decodeAST(in));
+        }
+        return node;
+    }
+
+private:
+    std::string directory;
+    uint64_t maxBytes;
+
+    static std::string readValue(std::istream& in) {
+        size_t length;
+        char colon;
+        if (!(in >> length) || !in.get(colon) || colon != ':') {
+            throw std::runtime_error("Corrupt cache entry");
+        }
+        if (length > static_cast<size_t>(in.rdbuf()->in_avail())) {
+            throw std::runtime_error("Corrupt cache entry");
+        }
+        std::string value(length, '\0');
+        in.read(&value[0], length);
+        return value;
+    }
+
+    uint64_t storedBytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
 };
 
 // Optimized Code Generator supporting various backends
 class CodeGenerator {
 public:
-    explicit CodeGenerator(std::shared_ptr<ASTNode> root) : root(root) {}
+    explicit CodeGenerator(std::shared_ptr<ASTNode> root, const CompilerOptions& options = {})
+        : root(root), options(options) {
+        if (!options.profileUsePath.empty() && !profile.load(options.profileUsePath)) {
+            Logger::logError("Could not read profile: ", options.profileUsePath);
+        }
+    }
 
-    void generate() {
-        generateNode(root);
+    std::string generate() {
+        std::string output = modulePrologue();
+        for (auto& child : root->children) {
+            output += generateFunction(child);
+        }
+        return output + moduleEpilogue();
+    }
+
+    // Wrapped around the concatenated functions; each function's code is independent of both
+    static std::string modulePrologue() {
+        return "    .intel_syntax noprefix\n    .text\n";
+    }
+
+    static std::string moduleEpilogue() {
+        return "    .section .note.GNU-stack,\"\",@progbits\n";
+    }
+
+    // Code for one function, independent of the rest of the module so it can be cached alone
+    std::string generateFunction(std::shared_ptr<ASTNode> function) {
+        std::ostringstream out;
+        generateNode(function, out);
+        return out.str();
+    }
+
+    // --profile-generate: one xec::ProfileCounter per function, labelled .Lxecprof_<name> at its
+    // count, and a constructor registering the table with the runtime (Runtime/Profile.hpp)
+    std::string generateProfileTable() {
+        std::vector<std::string> functions;
+        for (auto& child : root->children) {
+            if (child->type == ASTNode::Type::FUNCTION_DECLARATION) {
+                functions.push_back(child->value);
+            }
+        }
+        Logger::log("Generating profile counter table (", functions.size(), " counters)");
+        std::ostringstream out;
+        out << "    .section .data.xecprof\n";
+        out << "    .p2align 3\n";
+        out << ".Lxecprof_counters:\n";
+        for (size_t i = 0; i < functions.size(); i++) {
+            out << "    .quad .Lxecprof_kind, .Lxecprof_key" << i << "\n";
+            out << ".Lxecprof_" << functions[i] << ":\n";
+            out << "    .quad 0\n";
+        }
+        out << ".Lxecprof_module:\n";
+        out << "    .quad .Lxecprof_name, .Lxecprof_counters, " << functions.size() << ", .Lxecprof_path, 0\n";
+        out << "    .section .rodata.xecprof\n";
+        out << ".Lxecprof_kind: .asciz \"function\"\n";
+        for (size_t i = 0; i < functions.size(); i++) {
+            out << ".Lxecprof_key" << i << ": .asciz \"" << functions[i] << "\"\n";
+        }
+        out << ".Lxecprof_name: .asciz \"" << escape(options.inputFile) << "\"\n";
+        out << ".Lxecprof_path: .asciz \"" << escape(options.profileGeneratePath) << "\"\n";
+        out << "    .text\n";
+        out << ".Lxecprof_init:\n";
+        out << "    lea rdi, [rip + .Lxecprof_module]\n";
+        out << "    jmp xec_profile_register\n";
+        out << "    .section .init_array\n";
+        out << "    .quad .Lxecprof_init\n";
+        out << "    .text\n";
+        return out.str();
     }
 
 private:
     std::shared_ptr<ASTNode> root;
+    CompilerOptions options;
+    xec::ProfileData profile;
 
-    void generateNode(std::shared_ptr<ASTNode> node) {
+    // Per function being generated
+    std::string function;
+    std::map<std::string, size_t> variables;  // Name -> offset below rbp
+    std::set<std::string> strings;            // Literals used, emitted once after the body
+
+    void generateNode(std::shared_ptr<ASTNode> node, std::ostringstream& out) {
         if (node->type == ASTNode::Type::FUNCTION_DECLARATION) {
-            generateFunctionDeclaration(node);
+            generateFunctionDeclaration(node, out);
         }
 
         if (node->type == ASTNode::Type::VAR_DECLARATION) {
-            generateVariableDeclaration(node);
+            generateVariableDeclaration(node, out);
+        }
+
+        if (node->type == ASTNode::Type::PIPELINE) {
+            generatePipeline(node, out);
+            return;
         }
 
         for (auto& child : node->children) {
-            generateNode(child);
+            generateNode(child, out);
+        }
+
+        if (node->type == ASTNode::Type::FUNCTION_DECLARATION) {
+            out << "    xor eax, eax\n";
+            out << "    mov rbx, qword ptr [rbp - 8]\n";
+            out << "    leave\n";
+            out << "    ret\n";
+            generateStrings(out);
         }
     }
 
-    void generateFunctionDeclaration(std::shared_ptr<ASTNode> node) {
-        Logger::log("Generating function: " + node->value + "()");
+    void generateFunctionDeclaration(std::shared_ptr<ASTNode> node, std::ostringstream& out) {
+        if (!profile.empty()) {
+            if (!profile.contains("function", node->value)) {
+                Logger::log("Placing ", node->value, " in .text (not in the profile)");
+                out << "    .text\n";
+            } else {
+                bool cold = profile.count("function", node->value) == 0;
+                Logger::log("Placing ", node->value, " in ", (cold ? ".text.unlikely" : ".text.hot"), " (",
+                            profile.count("function", node->value), " entries)");
+                out << "    .section " << (cold ? ".text.unlikely." : ".text.hot.") << node->value << "\n";
+            }
+        }
+        Logger::debug("Generating function: ", node->value, "()");
+        function = node->value;
+        variables.clear();
+        strings.clear();
+        for (auto& child : node->children) {
+            if (child->type == ASTNode::Type::VAR_DECLARATION && !variables.count(child->value)) {
+                variables[child->value] = 16 + 8 * variables.size();
+            }
+        }
+        // rbp, then the caller's rbx (pipelines keep their handle in it), then the variables; after
+        // the two pushes rsp is 8 off 16-byte alignment, so the frame is an odd number of slots
+        size_t frame = 8 * (variables.size() % 2 == 0 ? variables.size() + 1 : variables.size());
+
+        out << "    .globl " << node->value << "\n";
+        out << node->value << ":\n";
+        if (options.profileGenerate) {
+            Logger::log("Inserting entry counter for: ", node->value, " -> ", options.profileGeneratePath);
+            out << "    inc qword ptr [rip + .Lxecprof_" << node->value << "]\n";
+        }
+        out << "    push rbp\n";
+        out << "    mov rbp, rsp\n";
+        out << "    push rbx\n";
+        out << "    sub rsp, " << frame << "\n";
+    }
+
+    // Lower a pipeline to calls into the runtime (Runtime/EntryPoints.cpp). The handle returned by
+    // the source call stays in rbx; stage calls take it in rdi and their arguments in rsi, rdx,
+    // rcx, ... and the runtime fuses stateless neighbours when xec_pipeline_run builds the chain.
+    void generatePipeline(std::shared_ptr<ASTNode> node, std::ostringstream& out) {
+        static const std::vector<const char*> sourceRegisters = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+        static const std::vector<const char*> stageRegisters = {"rsi", "rdx", "rcx", "r8", "r9"};
+        Logger::log("Generating pipeline with ", node->children.size(), " links");
+
+        auto source = node->children[0];
+        if (source->type == ASTNode::Type::STAGE) {
+            generateStageArguments(source, sourceSignatures(), sourceRegisters, out);
+            out << "    call xec_source_" << source->value << "\n";
+        } else {
+            out << "    lea rdi, [rip + " << stringLabel(source->value) << "]\n";
+            out << "    call xec_pipeline_from\n";
+        }
+        out << "    mov rbx, rax\n";
+        for (size_t i = 1; i < node->children.size(); i++) {
+            auto stage = node->children[i];
+            generateStageArguments(stage, stageSignatures(), stageRegisters, out);
+            out << "    mov rdi, rbx\n";
+            out << "    call xec_stage_" << stage->value << "\n";
+        }
+        out << "    mov rdi, rbx\n";
+        out << "    call xec_pipeline_run\n";
+    }
+
+    // Runtime stages take their parameters in signature order, so named arguments are placed by
+    // name and missing ones passed as 0; external stages get their arguments as written
+    void generateStageArguments(std::shared_ptr<ASTNode> stage, const StageSignatures& signatures,
+                                const std::vector<const char*>& registers, std::ostringstream& out) {
+        std::vector<std::shared_ptr<ASTNode>> values;
+        auto signature = signatures.find(stage->value);
+        if (signature == signatures.end()) {
+            for (auto& argument : stage->children) {
+                values.push_back(argument->children[0]);
+            }
+        } else {
+            const auto& parameters = signature->second;
+            values.resize(parameters.size());
+            for (size_t a = 0; a < stage->children.size(); a++) {
+                auto argument = stage->children[a];
+                size_t slot = a;
+                if (!argument->value.empty()) {
+                    slot = std::find_if(parameters.begin(), parameters.end(),
+                                        [&](const StageParameter& p) { return p.name == argument->value; }) -
+                           parameters.begin();
+                }
+                if (slot >= parameters.size()) {
+                    throw std::runtime_error("Unknown argument " + argument->value + " to stage " + stage->value);
+                }
+                values[slot] = argument->children[0];
+            }
+        }
+        if (values.size() > registers.size()) {
+            throw std::runtime_error("Too many arguments to stage " + stage->value);
+        }
+        for (size_t a = 0; a < values.size(); a++) {
+            auto value = values[a];
+            if (!value) {
+                out << "    mov " << registers[a] << ", 0\n";
+            } else if (value->type == ASTNode::Type::STRING) {
+                out << "    lea " << registers[a] << ", [rip + " << stringLabel(value->value) << "]\n";
+            } else {
+                out << "    mov " << registers[a] << ", " << operandFor(value) << "\n";
+            }
+        }
+    }
+
+    // Each distinct literal once per function; the label includes the function so functions
+    // generated (and cached) separately never define the same one
+    std::string stringLabel(const std::string& str) {
+        strings.insert(str);
+        return ".Lstr_" + function + "_" + CompilationCache::hashKey({str}).substr(0, 12);
+    }
+
+    void generateStrings(std::ostringstream& out) {
+        if (strings.empty()) {
+            return;
+        }
+        std::set<std::string> used;
+        used.swap(strings);
+        out << "    .section .rodata\n";
+        for (const auto& str : used) {
+            out << stringLabel(str) << ": .asciz \"" << escape(str) << "\"\n";
+        }
+        out << "    .text\n";
+        strings.clear();
+    }
+
+    // Text for a GAS string directive: backslash, quote and control characters as escapes
+    static std::string escape(const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            unsigned char byte = static_cast<unsigned char>(c);
+            if (c == '\\' || c == '"') {
+                escaped += '\\';
+                escaped += c;
+            } else if (byte < 0x20 || byte == 0x7f) {
+                char octal[5];
+                std::snprintf(octal, sizeof(octal), "\\%03o", byte);
+                escaped += octal;
+            } else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    // Identifiers load the variable; size literals become byte counts
+    std::string operandFor(std::shared_ptr<ASTNode> value) const {
+        if (value->type == ASTNode::Type::IDENTIFIER) {
+            auto variable = variables.find(value->value);
+            if (variable == variables.end()) {
+                throw std::runtime_error("Unknown variable " + value->value + " in " + function);
+            }
+            return "qword ptr [rbp - " + std::to_string(variable->second) + "]";
+        }
+        size_t underscore = value->value.find('_');
+        uint64_t number = std::stoull(value->value.substr(0, underscore));
+        if (underscore != std::string::npos) {
+            std::string unit = value->value.substr(underscore + 1);
+            int shift = unit == "KB" ? 10 : unit == "MB" ? 20 : unit == "GB" ? 30 : -1;
+            if (shift < 0) {
+                throw std::runtime_error("Unknown size suffix: " + value->value);
+            }
+            number <<= shift;
+        }
+        return std::to_string(number);
     }
 
-    void generateVariableDeclaration(std::shared_ptr<ASTNode> node) {
-        Logger::log("Generating variable: " + node->value);
+    void generateVariableDeclaration(std::shared_ptr<ASTNode> node, std::ostringstream& out) {
+        Logger::debug("Generating variable: ", node->value);
+        out << "    mov rax, " << (node->children.empty() ? "0" : operandFor(node->children[0])) << "\n";
+        out << "    mov qword ptr [rbp - " << variables.at(node->value) << "], rax\n";
     }
 };
 
-// Main Compiler Driver - Orchestrates the compilation process
-int main() {
-    try {
-        std::string sourceCode = "function main() { var x = 10; }";
+std::string readFile(const std::string& path) {
+    std::ifstream input(path);
+    if (!input) {
+        throw std::runtime_error("Cannot open input file: " + path);
+    }
+    std::stringstream buffer;
+    buffer << input.rdbuf();
+    return buffer.str();
+}
+
+// Parsed and analyzed modules kept warm across compiles by the compile server. An entry is reused
+// while the file's mtime and size are unchanged; if they changed but the content hash did not
+// (touch, checkout), the entry is revalidated without re-analysis.
+class ModuleStore {
+public:
+    using Analyzer = std::function<std::shared_ptr<ASTNode>(const std::string& source)>;
+
+    std::shared_ptr<ASTNode> load(const std::string& path, const Analyzer& analyze) {
+        std::error_code error;
+        auto mtime = std::filesystem::last_write_time(path, error);
+        auto size = std::filesystem::file_size(path, error);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = modules.find(path);
+            if (!error && it != modules.end() && it->second.mtime == mtime && it->second.size == size) {
+                return it->second.ast;
+            }
+        }
+
+        std::string source = readFile(path);
+        std::string contentHash = CompilationCache::hashKey({source});
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = modules.find(path);
+            if (it != modules.end() && it->second.contentHash == contentHash) {
+                it->second.mtime = mtime;
+                it->second.size = size;
+                return it->second.ast;
+            }
+        }
+
+        // Analyze outside the lock so other modules keep being served; a concurrent request for
+        // the same file may analyze it twice, and the last result wins
+        auto ast = analyze(source);
+        std::lock_guard<std::mutex> lock(mutex);
+        modules[path] = {mtime, size, contentHash, ast};
+        Logger::log("Warmed module: ", path);
+        return ast;
+    }
+
+private:
+    struct Entry {
+        std::filesystem::file_time_type mtime;
+        uintmax_t size;
+        std::string contentHash;
+        std::shared_ptr<ASTNode> ast; // Shared read-only between concurrent compiles
+    };
+
+    std::mutex mutex;
+    std::unordered_map<std::string, Entry> modules;
+};
+
+// Runs the phases for one translation unit, consulting the artifact cache when enabled
+class CompilerDriver {
+public:
+    explicit CompilerDriver(const CompilerOptions& options, ModuleStore* modules = nullptr)
+        : options(options), modules(modules) {
+        if (!options.cacheDirectory.empty()) {
+            cache = std::make_unique<CompilationCache>(options.cacheDirectory, options.cacheMaxBytes);
+        }
+    }
+
+    std::string compile(const std::string& sourceCode) {
+        loadImports();
+        return generate(analyzeSource(sourceCode));
+    }
+
+    std::string compileFile(const std::string& path) {
+        loadImports();
+        return generate(loadModule(path));
+    }
+
+    // Phases 1-3: tokens, AST and semantic checks
+    std::shared_ptr<ASTNode> analyzeSource(const std::string& sourceCode) {
+        std::vector<std::string> flags = keyFlags();
 
         // 1. Tokenize the source code
-        Lexer lexer(sourceCode);
-        std::vector<Token> tokens = lexer.tokenize();
+        std::vector<Token> tokens;
+        {
+            TimeScope scope("Lex");
+            std::string lexKey = cacheKey(flags, {"lex", sourceCode});
+            if (auto cached = cacheLoad("lex", lexKey)) {
+                tokens = decodeCached("lex", lexKey, [&] { return CompilationCache::decodeTokens(*cached); });
+            }
+            if (tokens.empty()) {
+                Lexer lexer(sourceCode);
+                tokens = lexer.tokenize();
+                cacheStore("lex", lexKey, CompilationCache::encodeTokens(tokens));
+            }
+        }
+
+        // The token stream is the normalized source: whitespace and formatting edits do not change it
+        std::string normalized = CompilationCache::encodeTokens(tokens);
 
         // 2. Parse the tokens into an AST
-        Parser parser(tokens);
-        std::shared_ptr<ASTNode> ast = parser.parse();
+        std::shared_ptr<ASTNode> ast;
+        {
+            TimeScope scope("Parse");
+            std::string parseKey = cacheKey(flags, {"parse", normalized});
+            if (auto cached = cacheLoad("parse", parseKey)) {
+                ast = decodeCached("parse", parseKey, [&] {
+                    std::istringstream in(*cached);
+                    auto decoded = CompilationCache::decodeAST(in);
+                    if (!(in >> std::ws).eof()) {
+                        throw std::runtime_error("Corrupt cached AST");
+                    }
+                    return decoded;
+                });
+            }
+            if (!ast) {
+                Parser parser(tokens);
+                ast = parser.parse();
+                cacheStore("parse", parseKey, CompilationCache::encodeAST(ast));
+            }
+        }
 
-        // 3. Perform semantic analysis
-        SemanticAnalyzer semanticAnalyzer(ast);
-        semanticAnalyzer.analyze();
+        // 3. Perform semantic analysis; a hit means this exact module already passed against these
+        //    dependency interfaces, so only a marker is stored
+        std::vector<std::string> analyzeParts = {"analyze", normalized};
+        analyzeParts.insert(analyzeParts.end(), options.dependencyInterfaces.begin(), options.dependencyInterfaces.end());
+        TimeScope scope("Semantic analysis");
+        std::string analyzeKey = cacheKey(flags, analyzeParts);
+        if (!cacheLoad("analyze", analyzeKey)) {
+            SemanticAnalyzer semanticAnalyzer(ast);
+            semanticAnalyzer.analyze();
+            cacheStore("analyze", analyzeKey, interfaceHash(ast));
+        }
+        return ast;
+    }
 
-        // 4. Generate code
-        CodeGenerator codeGenerator(ast);
-        codeGenerator.generate();
+    // Phase 4: generate code per function, so editing one function regenerates only that function
+    std::string generate(std::shared_ptr<ASTNode> ast) {
+        std::vector<std::string> flags = keyFlags();
+        TimeScope scope("Codegen");
+        CodeGenerator codeGenerator(ast, options);
+        std::string output = CodeGenerator::modulePrologue();
+        for (auto& function : ast->children) {
+            TimeScope functionScope("Codegen function", function->value);
+            std::string functionKey = cacheKey(flags, {"codegen", CompilationCache::encodeAST(function)});
+            if (auto cached = cacheLoad("codegen", functionKey)) {
+                output += *cached;
+            } else {
+                std::string code = codeGenerator.generateFunction(function);
+                cacheStore("codegen", functionKey, code);
+                output += code;
+            }
+        }
+        // The table spans every function, so it is rebuilt rather than cached
+        if (options.profileGenerate) {
+            output += codeGenerator.generateProfileTable();
+        }
+        output += CodeGenerator::moduleEpilogue();
+
+        if (cache) {
+            TimeScope evictScope("Cache eviction");
+            cache->evict();
+            Logger::log("Cache: ", cache->hitCount(), " hits, ",
+                        cache->missCount(), " misses");
+        }
+        return output;
+    }
+
+    // Hash of the module's externally visible surface (function names), for dependents' keys
+    static std::string interfaceHash(const std::shared_ptr<ASTNode>& ast) {
+        std::vector<std::string> names;
+        for (const auto& child : ast->children) {
+            if (child->type == ASTNode::Type::FUNCTION_DECLARATION) {
+                names.push_back(child->value);
+            }
+        }
+        return CompilationCache::hashKey(names);
+    }
+
+private:
+    CompilerOptions options;
+    ModuleStore* modules;
+    std::unique_ptr<CompilationCache> cache;
+
+    // Imported modules are analyzed first; only their interfaces reach this unit's cache keys
+    void loadImports() {
+        for (const auto& path : options.imports) {
+            options.dependencyInterfaces.push_back(interfaceHash(loadModule(path)));
+        }
+        options.imports.clear();
+    }
+
+    std::shared_ptr<ASTNode> loadModule(const std::string& path) {
+        TimeScope scope("Module", path);
+        if (!modules) {
+            return analyzeSource(readFile(path));
+        }
+        return modules->load(path, [this](const std::string& source) { return analyzeSource(source); });
+    }
+
+    // Everything besides the input that changes the output
+    std::vector<std::string> keyFlags() {
+        return {
+            XEC_COMPILER_VERSION,
+            XEC_CACHE_FORMAT,
+            options.profileGenerate ? "profile-generate=" + options.profileGeneratePath : "",
+            options.profileUsePath.empty() ? "" : "profile-use=" + fileHash(options.profileUsePath),
+        };
+    }
+
+    std::string cacheKey(const std::vector<std::string>& flags, const std::vector<std::string>& parts) {
+        if (!cache) {
+            return "";
+        }
+        std::vector<std::string> all = flags;
+        all.insert(all.end(), parts.begin(), parts.end());
+        return CompilationCache::hashKey(all);
+    }
+
+    std::optional<std::string> cacheLoad(const std::string& stage, const std::string& key) {
+        return cache ? cache->load(stage, key) : std::nullopt;
+    }
+
+    // Decode a cache hit; a corrupt entry is dropped and an empty result returned, so the caller
+    // falls through to rebuilding the artifact
+    template <typename Decode>
+    auto decodeCached(const std::string& stage, const std::string& key, Decode decode) -> decltype(decode()) {
+        try {
+            return decode();
+        } catch (const std::runtime_error&) {
+            cache->drop(stage, key);
+            return {};
+        }
+    }
+
+    void cacheStore(const std::string& stage, const std::string& key, const std::string& data) {
+        if (cache) {
+            cache->store(stage, key, data);
+        }
+    }
+
+    static std::string fileHash(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        return CompilationCache::hashKey({buffer.str()});
+    }
+};
+
+// Compile one unit as described by the options; throws on any compile error
+void runCompilation(const CompilerOptions& options, ModuleStore* modules = nullptr) {
+    TimeScope scope("Compile", options.inputFile);
+    CompilerDriver driver(options, modules);
+    std::string output = options.inputFile.empty()
+        ? driver.compile("function main() { var x = 10; }")
+        : driver.compileFile(options.inputFile);
+
+    if (!options.outputFile.empty()) {
+        TimeScope writeScope("Write output", options.outputFile);
+        std::ofstream out(options.outputFile);
+        if (!out) {
+            throw std::runtime_error("Cannot write output file: " + options.outputFile);
+        }
+        out << output;
+    }
+}
+
+// Write the --time-trace file and log where the time went
+void finishTimeTrace(const CompilerOptions& options) {
+    std::string path = options.timeTracePath;
+    if (path.empty()) {
+        path = (options.outputFile.empty() ? (options.inputFile.empty() ? "xec" : options.inputFile) : options.outputFile) +
+               ".time-trace.json";
+    }
+    TimeTrace::writeChromeTrace(path);
+    TimeTrace::logSummary();
+    Logger::logProfile("Time trace written to ", path);
+}
+
+// Framing shared by the compile server and client: a 32-bit length followed by the bytes
+bool writeFrame(int fd, const std::string& data) {
+    uint32_t length = static_cast<uint32_t>(data.size());
+    std::string frame(reinterpret_cast<const char*>(&length), sizeof(length));
+    frame += data;
+    size_t sent = 0;
+    while (sent < frame.size()) {
+        ssize_t n = ::write(fd, frame.data() + sent, frame.size() - sent);
+        if (n <= 0) {
+            return false;
+        }
+        sent += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool readExactly(int fd, char* buffer, size_t size) {
+    size_t received = 0;
+    while (received < size) {
+        ssize_t n = ::read(fd, buffer + received, size - received);
+        if (n <= 0) {
+            return false;
+        }
+        received += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool readFrame(int fd, std::string& data) {
+    uint32_t length;
+    if (!readExactly(fd, reinterpret_cast<char*>(&length), sizeof(length)) || length > (64u << 20)) {
+        return false;
+    }
+    data.assign(length, '\0');
+    return readExactly(fd, &data[0], length);
+}
+
+sockaddr_un socketAddress(const std::string& path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw std::runtime_error("Socket path too long: " + path);
+    }
+    std::strcpy(address.sun_path, path.c_str());
+    return address;
+}
+
+// Long-lived compiler process. A request is the client's working directory and command line; the
+// reply is an exit status and diagnostics. Connections are served by a fixed set of workers, all
+// sharing one ModuleStore so imported modules stay parsed and analyzed between requests.
+class CompileServer {
+public:
+    CompileServer(const std::string& socketPath, unsigned workers) : socketPath(socketPath), workerCount(workers) {}
+
+    int run() {
+        std::signal(SIGPIPE, SIG_IGN);
+        listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address = socketAddress(socketPath);
+        ::unlink(socketPath.c_str());
+        if (listenFd < 0 || ::bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+            ::chmod(socketPath.c_str(), 0600) < 0 || ::listen(listenFd, 128) < 0) {
+            throw std::runtime_error("Cannot listen on " + socketPath + ": " + std::strerror(errno));
+        }
+        Logger::log("Compile server listening on ", socketPath, " with ", workerCount, " workers");
+
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < workerCount; i++) {
+            workers.emplace_back(&CompileServer::workerLoop, this);
+        }
+        while (!stopping) {
+            int client = ::accept(listenFd, nullptr, nullptr);
+            if (client < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            std::lock_guard<std::mutex> lock(queueMutex);
+            pending.push(client);
+            queueReady.notify_one();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+            queueReady.notify_all();
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        ::unlink(socketPath.c_str());
+        return 0;
+    }
+
+private:
+    std::string socketPath;
+    unsigned workerCount;
+    int listenFd = -1;
+    std::atomic<bool> stopping{false};
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    std::queue<int> pending;
+    ModuleStore modules;
+
+    static const size_t maxArguments = 4096;
+
+    void workerLoop() {
+        while (true) {
+            int client;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                queueReady.wait(lock, [this] { return stopping || !pending.empty(); });
+                if (pending.empty()) {
+                    return;
+                }
+                client = pending.front();
+                pending.pop();
+            }
+            handle(client);
+            ::close(client);
+        }
+    }
+
+    void handle(int client) {
+        // A request reads and writes any path the server can, so only its own user may send one;
+        // the socket's 0600 mode already says so, and this also covers a socket opened before it
+        ucred peer{};
+        socklen_t peerLength = sizeof(peer);
+        if (::getsockopt(client, SOL_SOCKET, SO_PEERCRED, &peer, &peerLength) < 0 || peer.uid != ::getuid()) {
+            Logger::logWarning("Compile server: rejected connection from uid ", peer.uid);
+            return;
+        }
+        std::string cwd, countText;
+        if (!readFrame(client, cwd) || !readFrame(client, countText)) {
+            return;
+        }
+
+        int status = 0;
+        std::string diagnostics;
+        try {
+            size_t used = 0;
+            unsigned long count = std::stoul(countText, &used);
+            if (used != countText.size() || count > maxArguments) {
+                throw std::runtime_error("Malformed request: bad argument count " + countText);
+            }
+            std::vector<std::string> args(count);
+            for (auto& arg : args) {
+                if (!readFrame(client, arg)) {
+                    return;
+                }
+            }
+            CompilerOptions options = parseArguments(args);
+            if (options.shutdownServer) {
+                stopping = true;
+                ::shutdown(listenFd, SHUT_RDWR);
+            } else {
+                resolvePaths(options, cwd);
+                runCompilation(options, &modules);
+            }
+        } catch (const std::exception& e) {
+            status = 1;
+            diagnostics = e.what();
+        }
+        writeFrame(client, std::to_string(status));
+        writeFrame(client, diagnostics);
+    }
+
+    // Paths on the client's command line are relative to the client, not the server
+    static void resolvePaths(CompilerOptions& options, const std::string& cwd) {
+        auto resolve = [&cwd](std::string& path) {
+            if (!path.empty() && std::filesystem::path(path).is_relative()) {
+                path = (std::filesystem::path(cwd) / path).lexically_normal().string();
+            }
+        };
+        resolve(options.inputFile);
+        resolve(options.outputFile);
+        resolve(options.profileUsePath);
+        resolve(options.profileGeneratePath);
+        resolve(options.cacheDirectory);
+        for (auto& path : options.imports) {
+            resolve(path);
+        }
+    }
+};
+
+// Thin client: forward the command line to a compile server. Returns -1 when no server answers so
+// the caller can compile in-process instead.
+int runClient(const std::string& socketPath, const std::vector<std::string>& args) {
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = socketAddress(socketPath);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return -1;
+    }
+
+    bool sent = writeFrame(fd, std::filesystem::current_path().string()) && writeFrame(fd, std::to_string(args.size()));
+    for (const auto& arg : args) {
+        sent = sent && writeFrame(fd, arg);
+    }
+    std::string status, diagnostics;
+    bool received = sent && readFrame(fd, status) && readFrame(fd, diagnostics);
+    ::close(fd);
+    if (!received) {
+        return -1;
+    }
+    if (!diagnostics.empty()) {
+        Logger::logError(diagnostics);
+    }
+    return std::stoi(status);
+}
+
+// Main Compiler Driver - Orchestrates the compilation process
+int main(int argc, char* argv[]) {
+    try {
+        std::vector<std::string> args(argv + 1, argv + argc);
+        CompilerOptions options = parseArguments(args);
+
+        if (options.timeTrace) {
+            TimeTrace::enable();
+        }
+
+        // A traced server records every compile it serves and writes the trace when it stops
+        if (!options.serveSocket.empty()) {
+            int status = CompileServer(options.serveSocket, options.serverWorkers).run();
+            if (options.timeTrace) {
+                finishTimeTrace(options);
+            }
+            return status;
+        }
+
+        // Tracing measures this process, so a traced compile is never forwarded
+        if (!options.connectSocket.empty() && !options.timeTrace) {
+            std::vector<std::string> forwarded;
+            for (const auto& arg : args) {
+                if (arg.rfind("--connect=", 0) != 0) {
+                    forwarded.push_back(arg);
+                }
+            }
+            int status = runClient(options.connectSocket, forwarded);
+            if (status >= 0) {
+                return status;
+            }
+            if (options.shutdownServer) {
+                return 0;
+            }
+            Logger::log("No compile server at ", options.connectSocket, ", compiling in-process");
+        }
+
+        runCompilation(options);
+        if (options.timeTrace) {
+            finishTimeTrace(options);
+        }
 
     } catch (const std::exception& e) {
         Logger::logError(e.what());
+        return 1;
     }
 
     return 0;
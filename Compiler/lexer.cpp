@@ -26,7 +26,8 @@ enum class TokenType {
     BINARY_NUMBER,
     EOF_TOKEN,
     ERROR,
-    PREPROCESSOR_DIRECTIVE
+    PREPROCESSOR_DIRECTIVE,
+    PIPE
 };
 
 struct Token {
@@ -78,15 +79,17 @@ private:
     int position;
     int line, column;
 
-    const std::map<std::string, TokenType> keywords = {
+    // Shared by every Lexer so a long-lived compiler process builds them once
+    static inline const std::map<std::string, TokenType> keywords = {
         {"if", TokenType::KEYWORD}, {"else", TokenType::KEYWORD}, {"while", TokenType::KEYWORD},
+        {"pipeline", TokenType::KEYWORD},
         {"return", TokenType::KEYWORD}, {"int", TokenType::KEYWORD}, {"float", TokenType::KEYWORD},
         {"bool", TokenType::KEYWORD}, {"char", TokenType::KEYWORD}, {"void", TokenType::KEYWORD},
         {"struct", TokenType::STRUCT}, {"enum", TokenType::ENUM}, {"tuple", TokenType::TUPLE}, {"array", TokenType::ARRAY},
         {"true", TokenType::BOOLEAN}, {"false", TokenType::BOOLEAN}
     };
 
-    const std::map<std::string, TokenType> types = {
+    static inline const std::map<std::string, TokenType> types = {
         {"int", TokenType::TYPE}, {"float", TokenType::TYPE}, {"double", TokenType::TYPE}, 
         {"char", TokenType::TYPE}, {"bool", TokenType::TYPE}
     };
@@ -246,6 +249,10 @@ private:
             position++;
             column++;
         }
+        // A lone '|' chains pipeline stages; '||' stays logical or
+        if (op == "|") {
+            return {TokenType::PIPE, op, line, column};
+        }
         return {TokenType::OPERATOR, op, line, column};
     }
 
@@ -316,6 +323,7 @@ int main() {
             case TokenType::ENUM: tokenType = "ENUM"; break;
             case TokenType::TUPLE: tokenType = "TUPLE"; break;
             case TokenType::ARRAY: tokenType = "ARRAY"; break;
+            case TokenType::PIPE: tokenType = "PIPE"; break;
             default: tokenType = "UNKNOWN"; break;
         }
         std::cout << "Type: " << tokenType << ", Value: '" << token.value << "' at line " << token.line << ", column " << token.column << std::endl;
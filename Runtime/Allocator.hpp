@@ -0,0 +1,469 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Pipeline.hpp"
+
+// Allocation runtime for generated code.
+//
+// Arena          per-thread bump allocator. Generated code opens an ArenaScope around a pipeline
+//                invocation or request and everything allocated inside is released in one step
+//                when the scope closes. Blocks are kept for the next scope. A thread pinned to a
+//                NUMA node (Topology.hpp) gets its arena blocks on that node.
+// Pools          size-classed free lists for fixed-size objects such as packets and chunks. Each
+//                thread allocates and frees through its own cache; only full batches of objects
+//                move through a shared depot, so an object freed on another thread (the usual case
+//                at the end of a pipeline) costs one lock per batch, not per object.
+//
+// Statistics are counted per thread without atomic read-modify-writes and summed on demand.
+// Memory taken from the system is only ever reused, never returned, while the process runs.
+
+namespace xec {
+
+struct AllocatorStats {
+    uint64_t allocations = 0;
+    uint64_t frees = 0;
+    int64_t bytesInUse = 0;          // Pool and large allocations not yet freed
+    uint64_t reservedBytes = 0;      // Slabs and arena blocks taken from the system
+    uint64_t peakReservedBytes = 0;
+    uint64_t arenaPeakBytes = 0;     // Largest high-water mark of any thread's arena
+};
+
+namespace detail {
+
+// Counters owned by one thread; other threads only read them
+struct ThreadCounters {
+    std::atomic<uint64_t> allocations{0};
+    std::atomic<uint64_t> frees{0};
+    std::atomic<int64_t> bytes{0};
+    std::atomic<uint64_t> arenaPeak{0};
+
+    void add(std::atomic<uint64_t>& counter, uint64_t amount) {
+        counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    void allocated(size_t size) {
+        add(allocations, 1);
+        bytes.store(bytes.load(std::memory_order_relaxed) + static_cast<int64_t>(size), std::memory_order_relaxed);
+    }
+
+    void freed(size_t size) {
+        add(frees, 1);
+        bytes.store(bytes.load(std::memory_order_relaxed) - static_cast<int64_t>(size), std::memory_order_relaxed);
+    }
+};
+
+class StatsRegistry {
+public:
+    static StatsRegistry& instance() {
+        static StatsRegistry* registry = new StatsRegistry();  // Outlives thread-local destructors
+        return *registry;
+    }
+
+    ThreadCounters* attach() {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.push_back(std::make_unique<ThreadCounters>());
+        return threads.back().get();
+    }
+
+    void reserve(size_t bytes) {
+        uint64_t now = reserved.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        uint64_t peak = peakReserved.load(std::memory_order_relaxed);
+        while (now > peak && !peakReserved.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {
+        }
+    }
+
+    void release(size_t bytes) {
+        reserved.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    AllocatorStats snapshot() {
+        std::lock_guard<std::mutex> lock(mutex);
+        AllocatorStats stats;
+        for (const auto& counters : threads) {
+            stats.allocations += counters->allocations.load(std::memory_order_relaxed);
+            stats.frees += counters->frees.load(std::memory_order_relaxed);
+            stats.bytesInUse += counters->bytes.load(std::memory_order_relaxed);
+            stats.arenaPeakBytes = std::max(stats.arenaPeakBytes, counters->arenaPeak.load(std::memory_order_relaxed));
+        }
+        stats.reservedBytes = reserved.load(std::memory_order_relaxed);
+        stats.peakReservedBytes = peakReserved.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    std::mutex mutex;
+    // Counters of exited threads stay here so their totals are not lost
+    std::vector<std::unique_ptr<ThreadCounters>> threads;
+    std::atomic<uint64_t> reserved{0};
+    std::atomic<uint64_t> peakReserved{0};
+};
+
+inline ThreadCounters& counters() {
+    thread_local ThreadCounters* local = StatsRegistry::instance().attach();
+    return *local;
+}
+
+} // namespace detail
+
+inline AllocatorStats allocatorStats() {
+    return detail::StatsRegistry::instance().snapshot();
+}
+
+// Arenas
+
+class Arena {
+public:
+    // node >= 0 places blocks on that NUMA node (Topology.hpp)
+    explicit Arena(size_t blockSize = 64 << 10, int node = -1) : blockSize(blockSize), node(node) {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() {
+        for (Block& block : blocks) {
+            detail::StatsRegistry::instance().release(block.size);
+            if (node >= 0) {
+                freeOnNode(block.memory, block.size);
+            } else {
+                std::free(block.memory);
+            }
+        }
+    }
+
+    struct Mark {
+        size_t block = 0;
+        size_t offset = 0;
+    };
+
+    void* allocate(size_t size, size_t align = alignof(std::max_align_t)) {
+        for (;;) {
+            if (current < blocks.size()) {
+                Block& block = blocks[current];
+                uintptr_t base = reinterpret_cast<uintptr_t>(block.memory);
+                size_t start = ((base + offset + align - 1) & ~(uintptr_t(align) - 1)) - base;
+                if (start + size <= block.size) {
+                    offset = start + size;
+                    size_t used = spanBefore + offset;
+                    if (used > highWater) {
+                        highWater = used;
+                        auto& peak = detail::counters().arenaPeak;
+                        if (highWater > peak.load(std::memory_order_relaxed)) {
+                            peak.store(highWater, std::memory_order_relaxed);
+                        }
+                    }
+                    return block.memory + start;
+                }
+                // Move on to a retained block that is large enough, if any
+                if (current + 1 < blocks.size() && blocks[current + 1].size >= size + align) {
+                    spanBefore += blocks[current].size;
+                    current++;
+                    offset = 0;
+                    continue;
+                }
+            }
+            size_t bytes = std::max(blockSize, size + align);
+            auto* memory = static_cast<uint8_t*>(node >= 0 ? allocateOnNode(bytes, node) : std::malloc(bytes));
+            if (!memory) {
+                throw std::bad_alloc();
+            }
+            detail::StatsRegistry::instance().reserve(bytes);
+            // New blocks go right after the current one so rewinding stays a pair of indices
+            size_t position = blocks.empty() ? 0 : current + 1;
+            if (!blocks.empty()) {
+                spanBefore += blocks[current].size;
+            }
+            blocks.insert(blocks.begin() + static_cast<std::ptrdiff_t>(position), Block{memory, bytes});
+            current = position;
+            offset = 0;
+        }
+    }
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "Arena objects are released without destructors");
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    Mark mark() const {
+        return {current, offset};
+    }
+
+    // Release everything allocated since `mark`; the blocks stay for reuse
+    void rewind(Mark mark) {
+        current = mark.block;
+        offset = mark.offset;
+        spanBefore = 0;
+        for (size_t i = 0; i < current && i < blocks.size(); i++) {
+            spanBefore += blocks[i].size;
+        }
+    }
+
+    void reset() {
+        rewind({});
+    }
+
+    size_t bytesReserved() const {
+        size_t total = 0;
+        for (const Block& block : blocks) {
+            total += block.size;
+        }
+        return total;
+    }
+
+private:
+    struct Block {
+        uint8_t* memory;
+        size_t size;
+    };
+
+    size_t blockSize;
+    int node;
+    std::vector<Block> blocks;
+    size_t current = 0;
+    size_t offset = 0;
+    size_t spanBefore = 0;  // Bytes of the blocks before `current`, for the high-water mark
+    size_t highWater = 0;
+};
+
+// Created on first use, so a thread pinned before then gets node-local blocks
+inline Arena& threadArena() {
+    thread_local Arena arena(64 << 10, currentNode());
+    return arena;
+}
+
+// Everything allocated from the thread's arena while the scope is open is released when it closes
+class ArenaScope {
+public:
+    ArenaScope() : arena(threadArena()), start(arena.mark()) {}
+    explicit ArenaScope(Arena& arena) : arena(arena), start(arena.mark()) {}
+    ~ArenaScope() { arena.rewind(start); }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+
+private:
+    Arena& arena;
+    Arena::Mark start;
+};
+
+// Pools
+
+class PoolAllocator {
+public:
+    // Roughly 1.5x apart: 16, 24, 32, 48, ... 65536
+    static constexpr size_t CLASS_COUNT = 25;
+    static constexpr size_t MAX_POOLED = 65536;
+
+    static const std::array<size_t, CLASS_COUNT>& classSizes() {
+        static const std::array<size_t, CLASS_COUNT> sizes = [] {
+            std::array<size_t, CLASS_COUNT> table{};
+            for (size_t i = 0; i < CLASS_COUNT; i++) {
+                size_t power = size_t(16) << (i / 2);
+                table[i] = i % 2 ? power + power / 2 : power;
+            }
+            table[CLASS_COUNT - 1] = MAX_POOLED;
+            return table;
+        }();
+        return sizes;
+    }
+
+    // Sizes in (16 << m, 24 << m] map to class 2m + 1 and (24 << m, 32 << m] to 2m + 2
+    static size_t classOf(size_t size) {
+        if (size <= 16) {
+            return 0;
+        }
+        size_t bits = size - 1;
+        unsigned log = 63 - static_cast<unsigned>(__builtin_clzll(bits));
+        size_t power = size_t(1) << log;
+        return 2 * (log - 4) + (bits < power + power / 2 ? 1 : 2);
+    }
+
+    // Sized: callers pass the same size to free() that they passed to allocate()
+    static void* allocate(size_t size) {
+        ThreadCache& local = cache();
+        local.counters->allocated(size);
+        if (size > MAX_POOLED) {
+            return ::operator new(size);
+        }
+        return local.pop(classOf(size));
+    }
+
+    static void free(void* pointer, size_t size) {
+        if (!pointer) {
+            return;
+        }
+        ThreadCache& local = cache();
+        local.counters->freed(size);
+        if (size > MAX_POOLED) {
+            ::operator delete(pointer);
+            return;
+        }
+        local.push(classOf(size), pointer);
+    }
+
+private:
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    struct Batch {
+        FreeNode* head;
+        size_t count;
+    };
+
+    // Shared between threads; touched once per batch
+    struct Depot {
+        std::mutex mutex;
+        std::vector<Batch> batches[CLASS_COUNT];
+    };
+
+    static Depot& depot() {
+        static Depot* instance = new Depot();
+        return *instance;
+    }
+
+    static size_t batchSize(size_t sizeClass) {
+        return std::max<size_t>(4, (32 << 10) / classSizes()[sizeClass]);
+    }
+
+    class ThreadCache {
+    public:
+        detail::ThreadCounters* counters = detail::StatsRegistry::instance().attach();
+
+        ThreadCache() {
+            for (size_t c = 0; c < CLASS_COUNT; c++) {
+                batchLimit[c] = batchSize(c);
+            }
+        }
+
+        ~ThreadCache() {
+            for (size_t c = 0; c < CLASS_COUNT; c++) {
+                if (lists[c].head) {
+                    std::lock_guard<std::mutex> lock(depot().mutex);
+                    depot().batches[c].push_back(lists[c]);
+                }
+            }
+        }
+
+        void* pop(size_t sizeClass) {
+            Batch& list = lists[sizeClass];
+            if (!list.head && !refill(sizeClass)) {
+                return carve(sizeClass);
+            }
+            FreeNode* node = list.head;
+            list.head = node->next;
+            list.count--;
+            return node;
+        }
+
+        void push(size_t sizeClass, void* pointer) {
+            Batch& list = lists[sizeClass];
+            auto* node = static_cast<FreeNode*>(pointer);
+            node->next = list.head;
+            list.head = node;
+            // Hand a full batch to the depot once the cache holds two
+            if (++list.count >= 2 * batchLimit[sizeClass]) {
+                Batch spill{list.head, batchLimit[sizeClass]};
+                FreeNode* last = list.head;
+                for (size_t i = 1; i < spill.count; i++) {
+                    last = last->next;
+                }
+                list.head = last->next;
+                last->next = nullptr;
+                list.count -= spill.count;
+                std::lock_guard<std::mutex> lock(depot().mutex);
+                depot().batches[sizeClass].push_back(spill);
+            }
+        }
+
+    private:
+        Batch lists[CLASS_COUNT] = {};
+        size_t batchLimit[CLASS_COUNT];
+        uint8_t* slabCursor[CLASS_COUNT] = {};
+        uint8_t* slabEnd[CLASS_COUNT] = {};
+
+        bool refill(size_t sizeClass) {
+            std::lock_guard<std::mutex> lock(depot().mutex);
+            auto& batches = depot().batches[sizeClass];
+            if (batches.empty()) {
+                return false;
+            }
+            lists[sizeClass] = batches.back();
+            batches.pop_back();
+            return true;
+        }
+
+        void* carve(size_t sizeClass) {
+            size_t size = classSizes()[sizeClass];
+            if (slabCursor[sizeClass] + size > slabEnd[sizeClass] || !slabCursor[sizeClass]) {
+                size_t bytes = std::max<size_t>(64 << 10, size * 4);
+                auto* slab = static_cast<uint8_t*>(std::aligned_alloc(64, bytes));
+                if (!slab) {
+                    throw std::bad_alloc();
+                }
+                detail::StatsRegistry::instance().reserve(bytes);
+                slabCursor[sizeClass] = slab;
+                slabEnd[sizeClass] = slab + bytes;
+            }
+            void* object = slabCursor[sizeClass];
+            slabCursor[sizeClass] += size;
+            return object;
+        }
+    };
+
+    static ThreadCache& cache() {
+        thread_local ThreadCache instance;
+        return instance;
+    }
+};
+
+// Typed front end for one kind of object
+template <typename T>
+class ObjectPool {
+public:
+    template <typename... Args>
+    static T* acquire(Args&&... args) {
+        void* memory = PoolAllocator::allocate(sizeof(T));
+        try {
+            return new (memory) T(std::forward<Args>(args)...);
+        } catch (...) {
+            PoolAllocator::free(memory, sizeof(T));
+            throw;
+        }
+    }
+
+    static void release(T* object) {
+        if (object) {
+            object->~T();
+            PoolAllocator::free(object, sizeof(T));
+        }
+    }
+};
+
+// A pipeline chunk whose buffer comes from the pools and goes back to them when the last slice
+// of it is dropped
+inline Chunk allocatePooledChunk(size_t size, uint64_t sequence = 0) {
+    auto* memory = static_cast<uint8_t*>(PoolAllocator::allocate(size));
+    return {std::shared_ptr<uint8_t>(memory, [size](uint8_t* buffer) { PoolAllocator::free(buffer, size); }), size, sequence};
+}
+
+} // namespace xec
+
+// Entry points for generated code, defined in EntryPoints.cpp
+extern "C" void* xec_arena_alloc(size_t size, size_t align);
+extern "C" void xec_arena_enter(size_t* mark);
+extern "C" void xec_arena_exit(const size_t* mark);
+extern "C" void* xec_pool_alloc(size_t size);
+extern "C" void xec_pool_free(void* pointer, size_t size);
@@ -0,0 +1,461 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "EventLoop.hpp"
+#include "TaskScheduler.hpp"
+
+// Channels: bounded queues between threads, `thread` tasks and coroutines (`channel(n)`,
+// `send`, `receive`, `select`).
+//
+// Values move only through a lock-free ring: MpmcRing for Channel, SpscRing for SpscChannel,
+// which is cheaper but allows exactly one sending and one receiving thread. The wait lists are
+// only touched by a side that has to wait. A receiver facing an empty channel, or a sender facing
+// a full one, spins briefly, then registers a WaitSignal and looks again. After every successful
+// operation the other side checks its opposite list and wakes a waiter if there is one; while
+// nobody waits, that check is a fence and a load. Threads sleep on a futex. Coroutines suspend and
+// are resumed by their event loop, so a waiting coroutine never blocks the loop. A woken waiter
+// retries its operation rather than being handed a value, which is what lets select wait on
+// several channels with a single signal.
+//
+// A blocking send or receive inside a `thread` task holds its worker for as long as it waits.
+
+namespace xec {
+
+// Operation results besides "done" (0, or the selected channel's index)
+constexpr int CHANNEL_CLOSED = -1;     // Send: channel closed. Receive: closed and drained.
+constexpr int CHANNEL_WAIT = -2;       // Would have to wait; for the await forms, the frame suspended
+
+constexpr size_t MAX_SELECT = 64;
+
+// A waiting thread (sleeping on `fired`) or a suspended coroutine. A select registers one signal
+// with every channel it waits on. The first channel to fire it wins; the others skip it and wake
+// their next waiter instead.
+struct WaitSignal {
+    std::atomic<uint32_t> fired{0};
+    AsyncFrame* frame = nullptr;
+};
+
+class WaitList {
+public:
+    void add(WaitSignal* signal) {
+        std::lock_guard<std::mutex> lock(mutex);
+        waiters.push_back(signal);
+        count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // False when the signal was already taken off by a wake-up
+    bool remove(WaitSignal* signal) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = std::find(waiters.begin(), waiters.end(), signal);
+        if (found == waiters.end()) {
+            return false;
+        }
+        waiters.erase(found);
+        count.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // After a successful operation: wake up to `limit` waiters. The fence orders the ring update
+    // before the check, pairing with the fence a registering waiter issues before looking again.
+    void notify(size_t limit = 1) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (count.load(std::memory_order_relaxed) != 0) {
+            wake(limit);
+        }
+    }
+
+    void wakeOne() {
+        wake(1);
+    }
+
+    void wakeAll() {
+        wake(SIZE_MAX);
+    }
+
+private:
+    std::mutex mutex;
+    std::deque<WaitSignal*> waiters;
+    std::atomic<size_t> count{0};
+
+    // Signals are fired under the lock, so a thread cannot drop its signal between being fired and
+    // woken. The futex wake comes after the unlock and at worst wakes a dead address's new owner
+    // spuriously, which every wait loop tolerates.
+    void wake(size_t limit) {
+        while (limit) {
+            struct Woken {
+                AsyncFrame* frame;
+                std::atomic<uint32_t>* word;
+            } woken[16];
+            size_t n = 0;
+            bool drained;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                while (n < 16 && n < limit && !waiters.empty()) {
+                    WaitSignal* signal = waiters.front();
+                    waiters.pop_front();
+                    count.fetch_sub(1, std::memory_order_relaxed);
+                    if (signal->fired.exchange(1, std::memory_order_acq_rel) == 0) {
+                        woken[n++] = {signal->frame, &signal->fired};
+                    }
+                }
+                drained = waiters.empty();
+            }
+            for (size_t i = 0; i < n; i++) {
+                if (woken[i].frame) {
+                    woken[i].frame->loop->wakeFrame(woken[i].frame);
+                } else {
+                    detail::futexWake(woken[i].word, 1);
+                }
+            }
+            limit -= n;
+            if (drained) {
+                return;
+            }
+        }
+    }
+};
+
+namespace detail {
+
+// Register with every list, then look again: a channel that became ready in between may have
+// checked for waiters before we were listed, so wake someone (possibly us) on its behalf
+template <typename Ready>
+void registerWaiter(WaitList* const* lists, size_t count, WaitSignal* signal, Ready ready) {
+    for (size_t i = 0; i < count; i++) {
+        lists[i]->add(signal);
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (size_t i = 0; i < count; i++) {
+        if (ready(i)) {
+            lists[i]->wakeOne();
+        }
+    }
+}
+
+// Take the signal off every list. A list that no longer holds it has fired it; if the retry took
+// from some other channel, that wake-up is passed on so the list's other waiters don't miss it.
+inline void cancelWaiter(WaitList* const* lists, size_t count, WaitSignal* signal, int taken) {
+    for (size_t i = 0; i < count; i++) {
+        if (!lists[i]->remove(signal) && taken >= 0 && static_cast<size_t>(taken) != i) {
+            lists[i]->wakeOne();
+        }
+    }
+}
+
+// `attempt` returns 0 or an index when done, CHANNEL_CLOSED, or CHANNEL_WAIT to keep waiting
+template <typename Attempt, typename Ready>
+int blockOn(WaitList* const* lists, size_t count, Attempt attempt, Ready ready) {
+    for (unsigned spins = 0;; spins++) {
+        int result = attempt();
+        if (result != CHANNEL_WAIT) {
+            return result;
+        }
+        if (spins < 64) {
+            cpuRelax();
+            continue;
+        }
+        WaitSignal signal;
+        registerWaiter(lists, count, &signal, ready);
+        while (signal.fired.load(std::memory_order_acquire) == 0) {
+            futexWait(&signal.fired, 0);
+        }
+        result = attempt();
+        cancelWaiter(lists, count, &signal, result);
+        if (result != CHANNEL_WAIT) {
+            return result;
+        }
+    }
+}
+
+// Coroutine form: returns CHANNEL_WAIT after suspending `frame`, which must call again with the
+// same channels once resumed. frame->waitSignal holds the signal in between.
+template <typename Attempt, typename Ready>
+int awaitOn(AsyncFrame* frame, WaitList* const* lists, size_t count, Attempt attempt, Ready ready) {
+    int result = attempt();
+    if (auto* signal = static_cast<WaitSignal*>(frame->waitSignal)) {
+        cancelWaiter(lists, count, signal, result);
+        signal->~WaitSignal();
+        PoolAllocator::free(signal, sizeof(WaitSignal));
+        frame->waitSignal = nullptr;
+    }
+    if (result != CHANNEL_WAIT) {
+        return result;
+    }
+    auto* signal = new (PoolAllocator::allocate(sizeof(WaitSignal))) WaitSignal();
+    signal->frame = frame;
+    frame->waitSignal = signal;
+    registerWaiter(lists, count, signal, ready);
+    return CHANNEL_WAIT;
+}
+
+// Receive from the first of `count` channels with a value, starting at a rotating index so a busy
+// channel cannot starve the rest
+template <typename ReceiveAt>
+int selectAttempt(size_t count, ReceiveAt receiveAt) {
+    static thread_local size_t rotation = 0;
+    size_t start = rotation++ % count;
+    bool allClosed = true;
+    for (size_t k = 0; k < count; k++) {
+        size_t i = start + k < count ? start + k : start + k - count;
+        int result = receiveAt(i);
+        if (result == 0) {
+            return static_cast<int>(i);
+        }
+        allClosed = allClosed && result == CHANNEL_CLOSED;
+    }
+    return allClosed ? CHANNEL_CLOSED : CHANNEL_WAIT;
+}
+
+inline void checkSelectCount(size_t count) {
+    if (count == 0 || count > MAX_SELECT) {
+        throw std::runtime_error("select needs between 1 and " + std::to_string(MAX_SELECT) + " channels");
+    }
+}
+
+} // namespace detail
+
+class ChannelBase {
+public:
+    enum Kind : uint8_t { MPMC, SPSC };
+
+    const Kind kind;
+    WaitList receivers;   // Waiting for a value
+    WaitList senders;     // Waiting for space
+
+    ChannelBase(const ChannelBase&) = delete;
+    ChannelBase& operator=(const ChannelBase&) = delete;
+
+    // Fails further sends; receivers drain what is left and then see CHANNEL_CLOSED
+    void close() {
+        closed.store(true, std::memory_order_seq_cst);
+        receivers.wakeAll();
+        senders.wakeAll();
+    }
+
+    bool isClosed() const {
+        return closed.load(std::memory_order_acquire);
+    }
+
+protected:
+    explicit ChannelBase(Kind kind) : kind(kind) {}
+
+    std::atomic<bool> closed{false};
+};
+
+template <typename T, typename Ring>
+class BasicChannel : public ChannelBase {
+public:
+    explicit BasicChannel(size_t capacity)
+        : ChannelBase(std::is_same<Ring, SpscRing<T>>::value ? SPSC : MPMC), ring(capacity) {}
+
+    // Non-blocking; `value` is left untouched unless it was sent
+    bool trySend(T& value) {
+        return attemptSend(value) == 0;
+    }
+
+    bool tryReceive(T& value) {
+        return attemptReceive(value) == 0;
+    }
+
+    // Waits for space; false if the channel is closed
+    bool send(T value) {
+        WaitList* lists[] = {&senders};
+        return detail::blockOn(lists, 1, [&] { return attemptSend(value); }, [this](size_t) { return sendReady(); }) == 0;
+    }
+
+    // Waits for a value; false once the channel is closed and drained
+    bool receive(T& value) {
+        WaitList* lists[] = {&receivers};
+        return detail::blockOn(lists, 1, [&] { return attemptReceive(value); }, [this](size_t) { return receiveReady(); }) == 0;
+    }
+
+    // Sends all of `values`, moving runs of them with one ring claim; fewer only if closed
+    size_t sendBatch(T* values, size_t count) {
+        WaitList* lists[] = {&senders};
+        size_t sent = 0;
+        while (sent < count) {
+            int result = detail::blockOn(lists, 1, [&] {
+                if (closed.load(std::memory_order_acquire)) {
+                    return CHANNEL_CLOSED;
+                }
+                size_t moved = ring.tryPushBatch(values + sent, count - sent);
+                if (moved == 0) {
+                    return CHANNEL_WAIT;
+                }
+                sent += moved;
+                receivers.notify(moved);
+                return 0;
+            }, [this](size_t) { return sendReady(); });
+            if (result == CHANNEL_CLOSED) {
+                break;
+            }
+        }
+        return sent;
+    }
+
+    // Waits for at least one value and takes up to `max`; 0 once closed and drained
+    size_t receiveBatch(T* values, size_t max) {
+        WaitList* lists[] = {&receivers};
+        size_t received = 0;
+        detail::blockOn(lists, 1, [&] {
+            bool wasClosed = closed.load(std::memory_order_acquire);
+            received = ring.tryPopBatch(values, max);
+            if (received == 0) {
+                return wasClosed ? CHANNEL_CLOSED : CHANNEL_WAIT;
+            }
+            senders.notify(received);
+            return 0;
+        }, [this](size_t) { return receiveReady(); });
+        return received;
+    }
+
+    // Await forms: 0, CHANNEL_CLOSED, or CHANNEL_WAIT with `frame` suspended (call again once resumed)
+    int awaitSend(AsyncFrame* frame, T& value) {
+        WaitList* lists[] = {&senders};
+        return detail::awaitOn(frame, lists, 1, [&] { return attemptSend(value); }, [this](size_t) { return sendReady(); });
+    }
+
+    int awaitReceive(AsyncFrame* frame, T& value) {
+        WaitList* lists[] = {&receivers};
+        return detail::awaitOn(frame, lists, 1, [&] { return attemptReceive(value); }, [this](size_t) { return receiveReady(); });
+    }
+
+    int attemptSend(T& value) {
+        if (closed.load(std::memory_order_acquire)) {
+            return CHANNEL_CLOSED;
+        }
+        if (!ring.tryPush(std::move(value))) {
+            return CHANNEL_WAIT;
+        }
+        receivers.notify();
+        return 0;
+    }
+
+    int attemptReceive(T& value) {
+        // Closed before an empty pop means drained; only a send racing with close() can land later
+        bool wasClosed = closed.load(std::memory_order_acquire);
+        if (!ring.tryPop(value)) {
+            return wasClosed ? CHANNEL_CLOSED : CHANNEL_WAIT;
+        }
+        senders.notify();
+        return 0;
+    }
+
+    bool sendReady() const {
+        return !ring.full() || isClosed();
+    }
+
+    bool receiveReady() const {
+        return !ring.empty() || isClosed();
+    }
+
+    size_t capacity() const {
+        return ring.capacity();
+    }
+
+private:
+    Ring ring;
+};
+
+template <typename T>
+using Channel = BasicChannel<T, MpmcRing<T>>;
+
+// One sending and one receiving thread (or coroutine loop) only
+template <typename T>
+using SpscChannel = BasicChannel<T, SpscRing<T>>;
+
+// Receive from whichever channel has a value first. Returns its index, or CHANNEL_CLOSED once all
+// of them are closed and drained.
+template <typename T, typename Ring>
+int select(BasicChannel<T, Ring>* const* channels, size_t count, T& value) {
+    detail::checkSelectCount(count);
+    WaitList* lists[MAX_SELECT];
+    for (size_t i = 0; i < count; i++) {
+        lists[i] = &channels[i]->receivers;
+    }
+    return detail::blockOn(lists, count, [&] {
+        return detail::selectAttempt(count, [&](size_t i) { return channels[i]->attemptReceive(value); });
+    }, [&](size_t i) { return channels[i]->receiveReady(); });
+}
+
+template <typename T, typename Ring>
+int awaitSelect(AsyncFrame* frame, BasicChannel<T, Ring>* const* channels, size_t count, T& value) {
+    detail::checkSelectCount(count);
+    WaitList* lists[MAX_SELECT];
+    for (size_t i = 0; i < count; i++) {
+        lists[i] = &channels[i]->receivers;
+    }
+    return detail::awaitOn(frame, lists, count, [&] {
+        return detail::selectAttempt(count, [&](size_t i) { return channels[i]->attemptReceive(value); });
+    }, [&](size_t i) { return channels[i]->receiveReady(); });
+}
+
+// Value and the index of the channel it came from (CHANNEL_CLOSED when there is none), returned
+// in rax:rdx to generated code
+struct ChannelReceive {
+    int64_t value;
+    int64_t index;
+};
+
+namespace detail {
+
+// Language channels carry int64 values and are either kind
+template <typename Function>
+auto withChannel(void* channel, Function&& function) {
+    auto* base = static_cast<ChannelBase*>(channel);
+    if (base->kind == ChannelBase::SPSC) {
+        return function(*static_cast<SpscChannel<int64_t>*>(base));
+    }
+    return function(*static_cast<Channel<int64_t>*>(base));
+}
+
+template <typename Wait>
+int selectAny(void* const* channels, size_t count, int64_t& value, Wait wait) {
+    checkSelectCount(count);
+    WaitList* lists[MAX_SELECT];
+    for (size_t i = 0; i < count; i++) {
+        lists[i] = &static_cast<ChannelBase*>(channels[i])->receivers;
+    }
+    return wait(lists, count, [&] {
+        return selectAttempt(count, [&](size_t i) {
+            return withChannel(channels[i], [&](auto& channel) { return channel.attemptReceive(value); });
+        });
+    }, [&](size_t i) {
+        return withChannel(channels[i], [](auto& channel) { return channel.receiveReady(); });
+    });
+}
+
+} // namespace detail
+
+} // namespace xec
+
+// Entry points for generated code, defined in EntryPoints.cpp. Channels from xec_chan_new are
+// reference counted like other heap objects of generated code (xec_rc_retain/xec_rc_release);
+// the compiler releases a `channel(n)` local once its function has joined the tasks it started.
+// xec_chan_free drops the creating reference, for hosts that never retain.
+extern "C" void* xec_chan_new(int64_t capacity, int singleProducer);
+extern "C" void xec_chan_free(void* channel);
+extern "C" void xec_chan_close(void* channel);
+
+// 0 when sent, CHANNEL_CLOSED otherwise
+extern "C" int xec_chan_send(void* channel, int64_t value);
+extern "C" xec::ChannelReceive xec_chan_receive(void* channel);
+extern "C" xec::ChannelReceive xec_chan_select(void* const* channels, int64_t count);
+extern "C" int64_t xec_chan_send_batch(void* channel, int64_t* values, int64_t count);
+extern "C" int64_t xec_chan_receive_batch(void* channel, int64_t* values, int64_t max);
+
+// Await forms: 1 when the frame suspended, in which case the resumed frame calls again with the
+// same arguments. 0 when done: frame->result holds a received value and frame->events the channel
+// index, or ~0 when closed.
+extern "C" int xec_chan_send_async(xec::AsyncFrame* frame, void* channel, int64_t value);
+extern "C" int xec_chan_receive_async(xec::AsyncFrame* frame, void* channel);
+extern "C" int xec_chan_select_async(xec::AsyncFrame* frame, void* const* channels, int64_t count);
@@ -0,0 +1,412 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fcntl.h>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Crypto.hpp"
+#include "FileIO.hpp"
+
+// Checkpoints for long-running pipelines: `pipeline.checkpointTo(store)` (see Pipeline.hpp for
+// how the barrier collects a consistent state without stopping the pipeline).
+//
+// DirectoryCheckpointStore keeps them in a directory:
+//
+//   data-<generation>   state blocks, appended
+//   manifest            the last complete checkpoint: every part's blocks, in order
+//
+// Each part's state is cut into fixed-size blocks, and a block is known by its XXH3 hash and
+// length. A block the previous checkpoint already holds is referenced instead of written again,
+// so a large state that mostly stays put (an aggregation table, a join's build side) costs only
+// its dirty blocks. Pipeline threads only copy their state out; hashing, writing and syncing
+// happen on the store's writer thread. A checkpoint takes effect when its manifest is renamed
+// over the previous one, after the data it references has been synced, so a crash at any point
+// leaves the last complete checkpoint to resume from.
+//
+// Blocks no longer referenced stay in the data file until they outweigh the live ones; the next
+// checkpoint then writes everything it needs to a new generation and the old file is removed.
+// Every block carries a CRC32C and the manifest one over itself: resuming from a damaged
+// checkpoint throws instead of handing a pipeline corrupt state. A checkpoint that cannot be
+// written does not stop the pipeline, but no further ones are started and wait() reports it.
+
+namespace xec {
+
+struct CheckpointOptions {
+    std::chrono::milliseconds interval{10000};  // From the start of one checkpoint to the next
+    size_t blockSize = 64 << 10;                // Granularity of change detection
+    double maxGarbage = 1.0;                    // Stale bytes per live byte before a new generation
+};
+
+struct CheckpointStats {
+    uint64_t completed = 0;       // Checkpoints made durable by this store
+    uint64_t lastId = 0;          // Number of the latest checkpoint in the directory
+    uint64_t bytesWritten = 0;    // New blocks
+    uint64_t bytesReused = 0;     // Blocks referenced from an earlier checkpoint
+    uint64_t generation = 0;
+    double lastWriteSeconds = 0;  // Hashing, writing and syncing the latest checkpoint
+};
+
+class DirectoryCheckpointStore : public CheckpointStore {
+public:
+    explicit DirectoryCheckpointStore(std::string directory, CheckpointOptions options = {})
+        : directory(std::move(directory)), options(options) {
+        if (this->options.blockSize == 0) {
+            throw std::runtime_error("Checkpoint blocks need a non-zero size");
+        }
+        if (mkdir(this->directory.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw systemError("Cannot create " + this->directory);
+        }
+        readManifest();
+        if (generation == 0) {
+            generation = 1;
+            dataFd = openData(generation, O_TRUNC);
+        }
+        lastStart = std::chrono::steady_clock::now();
+        writer = std::thread([this] { run(); });
+    }
+
+    ~DirectoryCheckpointStore() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        writer.join();
+        if (dataFd >= 0) {
+            close(dataFd);
+        }
+    }
+
+    // One checkpoint at a time: the next is not due until the last one is on disk
+    bool due() override {
+        if (busy.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastStart < options.interval) {
+            return false;
+        }
+        lastStart = now;
+        busy.store(true, std::memory_order_relaxed);
+        return true;
+    }
+
+    void save(uint64_t id, const std::string& part, std::vector<uint8_t> state) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        collecting[id].emplace_back(part, std::move(state));
+    }
+
+    void complete(uint64_t id) override {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto parts = collecting.find(id);
+        queue.push_back(std::move(parts->second));
+        collecting.erase(parts);
+        changed.notify_all();
+    }
+
+    std::vector<std::pair<std::string, std::vector<uint8_t>>> latest() override {
+        return std::move(resumeState);
+    }
+
+    // Until every completed checkpoint is on disk; throws if writing one failed
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return (queue.empty() && !writing) || !error.empty(); });
+        if (!error.empty()) {
+            throw std::runtime_error(error);
+        }
+    }
+
+    CheckpointStats stats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return statistics;
+    }
+
+private:
+    static constexpr uint64_t MANIFEST_MAGIC = 0x3154504b43434558ULL;  // "XECCKPT1"
+
+    struct BlockRef {
+        uint64_t offset = 0;
+        uint64_t length = 0;
+        uint64_t hash = 0;
+        uint64_t crc = 0;
+    };
+
+    using Parts = std::vector<std::pair<std::string, std::vector<uint8_t>>>;
+
+    std::string directory;
+    CheckpointOptions options;
+    std::chrono::steady_clock::time_point lastStart;
+    std::atomic<bool> busy{false};
+
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    std::map<uint64_t, Parts> collecting;
+    std::deque<Parts> queue;
+    bool writing = false;
+    bool stopping = false;
+    std::string error;
+    CheckpointStats statistics;
+    Parts resumeState;
+
+    // Writer thread only, apart from the constructor
+    int dataFd = -1;
+    uint64_t generation = 0;
+    uint64_t dataSize = 0;
+    uint64_t liveBytes = 0;
+    uint64_t lastId = 0;
+    std::unordered_map<uint64_t, BlockRef> blocks;  // By hash: what the current manifest references
+    std::thread writer;
+
+    std::string dataPath(uint64_t number) const {
+        return directory + "/data-" + std::to_string(number);
+    }
+
+    int openData(uint64_t number, int flags) const {
+        int fd = open(dataPath(number).c_str(), O_RDWR | O_CREAT | O_CLOEXEC | flags, 0644);
+        if (fd < 0) {
+            throw systemError("Cannot open " + dataPath(number));
+        }
+        return fd;
+    }
+
+    static void syncOrThrow(int fd, const std::string& what) {
+        if (fsync(fd) != 0) {
+            throw systemError("Cannot sync " + what);
+        }
+    }
+
+    static std::vector<uint8_t> readFile(int fd, const std::string& path) {
+        struct stat info {};
+        if (fstat(fd, &info) != 0) {
+            throw systemError("Cannot stat " + path);
+        }
+        std::vector<uint8_t> bytes(static_cast<size_t>(info.st_size));
+        readFully(fd, bytes.data(), bytes.size(), 0, path);
+        return bytes;
+    }
+
+    static void readFully(int fd, uint8_t* data, size_t size, uint64_t offset, const std::string& path) {
+        while (size > 0) {
+            ssize_t n = pread(fd, data, size, static_cast<off_t>(offset));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                throw std::runtime_error("Cannot read checkpoint data from " + path);
+            }
+            data += n;
+            size -= static_cast<size_t>(n);
+            offset += static_cast<uint64_t>(n);
+        }
+    }
+
+    // Load the last complete checkpoint, and index its blocks so the next one only adds changes
+    void readManifest() {
+        std::string path = directory + "/manifest";
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            if (errno == ENOENT) {
+                return;
+            }
+            throw systemError("Cannot open " + path);
+        }
+        std::vector<uint8_t> manifest;
+        try {
+            manifest = readFile(fd, path);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);
+
+        uint32_t crc;
+        if (manifest.size() < sizeof(crc) + 8) {
+            throw std::runtime_error("Corrupt checkpoint manifest " + path);
+        }
+        std::memcpy(&crc, manifest.data() + manifest.size() - sizeof(crc), sizeof(crc));
+        manifest.resize(manifest.size() - sizeof(crc));
+        StateReader in(manifest.data(), manifest.size());
+        if (crc32c(manifest.data(), manifest.size()) != crc || in.u64() != MANIFEST_MAGIC) {
+            throw std::runtime_error("Corrupt checkpoint manifest " + path);
+        }
+        lastId = in.u64();
+        generation = in.u64();
+        dataFd = openData(generation, 0);
+        dataSize = static_cast<uint64_t>(lseek(dataFd, 0, SEEK_END));
+
+        for (uint64_t parts = in.u64(); parts > 0; parts--) {
+            std::vector<uint8_t> name = in.bytes();
+            std::vector<uint8_t> state(static_cast<size_t>(in.u64()));
+            size_t filled = 0;
+            for (uint64_t count = in.u64(); count > 0; count--) {
+                BlockRef block;
+                block.offset = in.u64();
+                block.length = in.u64();
+                block.hash = in.u64();
+                block.crc = in.u64();
+                if (block.length > state.size() - filled || block.offset + block.length > dataSize) {
+                    throw std::runtime_error("Corrupt checkpoint manifest " + path);
+                }
+                readFully(dataFd, state.data() + filled, block.length, block.offset, dataPath(generation));
+                if (crc32c(state.data() + filled, block.length) != block.crc) {
+                    throw std::runtime_error("Checkpoint block at " + std::to_string(block.offset) + " in " +
+                                             dataPath(generation) + " is corrupt");
+                }
+                filled += block.length;
+                if (blocks.emplace(block.hash, block).second) {
+                    liveBytes += block.length;
+                }
+            }
+            if (filled != state.size()) {
+                throw std::runtime_error("Corrupt checkpoint manifest " + path);
+            }
+            resumeState.emplace_back(std::string(name.begin(), name.end()), std::move(state));
+        }
+        statistics.lastId = lastId;
+        statistics.generation = generation;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            changed.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) {
+                return;
+            }
+            Parts parts = std::move(queue.front());
+            queue.pop_front();
+            writing = true;
+            lock.unlock();
+            std::string failure;
+            CheckpointStats delta;
+            auto start = std::chrono::steady_clock::now();
+            try {
+                write(parts, delta);
+            } catch (const std::exception& e) {
+                failure = e.what();
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            lock.lock();
+            writing = false;
+            if (!failure.empty()) {
+                // Leave busy set: no further checkpoint starts after a failed one
+                error = "Checkpoint failed: " + failure;
+            } else {
+                statistics.completed++;
+                statistics.lastId = lastId;
+                statistics.generation = generation;
+                statistics.bytesWritten += delta.bytesWritten;
+                statistics.bytesReused += delta.bytesReused;
+                statistics.lastWriteSeconds = seconds;
+                busy.store(false, std::memory_order_relaxed);
+            }
+            changed.notify_all();
+        }
+    }
+
+    void write(const Parts& parts, CheckpointStats& delta) {
+        // Past the garbage limit, start a generation that holds only live blocks
+        int previousFd = -1;
+        uint64_t previousGeneration = generation;
+        if (static_cast<double>(dataSize - liveBytes) > options.maxGarbage * static_cast<double>(liveBytes) &&
+            dataSize > options.blockSize) {
+            previousFd = dataFd;
+            dataFd = openData(generation + 1, O_TRUNC);
+            dataSize = 0;
+            blocks.clear();
+        }
+        uint64_t writingGeneration = previousFd >= 0 ? generation + 1 : generation;
+
+        std::vector<uint8_t> manifest;
+        StateWriter out(manifest);
+        out.u64(MANIFEST_MAGIC);
+        out.u64(lastId + 1);
+        out.u64(writingGeneration);
+        out.u64(parts.size());
+        std::unordered_map<uint64_t, BlockRef> referenced;
+        uint64_t referencedBytes = 0;
+        for (const auto& [name, state] : parts) {
+            out.bytes(name.data(), name.size());
+            out.u64(state.size());
+            out.u64((state.size() + options.blockSize - 1) / options.blockSize);
+            for (size_t offset = 0; offset < state.size(); offset += options.blockSize) {
+                size_t length = std::min(options.blockSize, state.size() - offset);
+                const uint8_t* data = state.data() + offset;
+                uint64_t hash = xxh3(data, length);
+                BlockRef block;
+                auto known = blocks.find(hash);
+                if (known != blocks.end() && known->second.length == length) {
+                    block = known->second;
+                    delta.bytesReused += length;
+                } else {
+                    block = {dataSize, length, hash, crc32c(data, length)};
+                    writeFully(dataFd, data, length, dataSize);
+                    dataSize += length;
+                    delta.bytesWritten += length;
+                    blocks[hash] = block;
+                }
+                if (referenced.emplace(hash, block).second) {
+                    referencedBytes += length;
+                }
+                out.u64(block.offset);
+                out.u64(block.length);
+                out.u64(block.hash);
+                out.u64(block.crc);
+            }
+        }
+        uint32_t crc = crc32c(manifest.data(), manifest.size());
+        const uint8_t* crcBytes = reinterpret_cast<const uint8_t*>(&crc);
+        manifest.insert(manifest.end(), crcBytes, crcBytes + sizeof(crc));
+
+        // Data first, then the manifest that points at it
+        syncOrThrow(dataFd, dataPath(writingGeneration));
+        std::string path = directory + "/manifest";
+        std::string temporary = path + ".tmp";
+        int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw systemError("Cannot create " + temporary);
+        }
+        try {
+            writeFully(fd, manifest.data(), manifest.size(), 0);
+            syncOrThrow(fd, temporary);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);
+        if (rename(temporary.c_str(), path.c_str()) != 0) {
+            throw systemError("Cannot replace " + path);
+        }
+        int directoryFd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (directoryFd >= 0) {
+            fsync(directoryFd);
+            close(directoryFd);
+        }
+
+        lastId++;
+        generation = writingGeneration;
+        blocks = std::move(referenced);
+        liveBytes = referencedBytes;
+        if (previousFd >= 0) {
+            close(previousFd);
+            unlink(dataPath(previousGeneration).c_str());
+        }
+    }
+};
+
+} // namespace xec
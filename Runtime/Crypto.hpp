@@ -0,0 +1,1145 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define XEC_CRYPTO_X86 1
+#include <immintrin.h>
+#endif
+
+#include "Pipeline.hpp"
+
+// Encryption and integrity kernels for pipeline buffers: `encryptData`/`decryptData` and the
+// README's "matrix ciphering".
+//
+//   AesGcm   AES-128/256-GCM, in place. With AES-NI and PCLMULQDQ it runs CTR eight blocks at a
+//            time and folds eight ciphertext blocks into GHASH with a single reduction (using
+//            H^1..H^8). The portable fallback is a byte-oriented AES with a 4-bit GHASH table.
+//   crc32c   SSE4.2 crc32 over three interleaved streams that are recombined with a carry-less
+//            multiply; slicing-by-8 tables otherwise. crc32cCombine() joins per-chunk CRCs.
+//   xxh3     XXH3-64 (bit-compatible with xxHash 0.8); long inputs use AVX2 or SSE2 stripes.
+//
+// Kernels are picked at run time from CPUID. XEC_CRYPTO=portable forces the fallbacks, and
+// tests can clear flags in cpuFeatures() before the first AesGcm is built.
+//
+// SealStage encrypts each chunk in place and emits a small frame header in front of it, the same
+// way SerializeStage does; ChecksumStage frames chunks with a CRC32C or XXH3 digest instead.
+// OpenStage reassembles frames from chunks of any size, checks them and emits the payloads. It
+// decrypts in place when a payload arrives in one chunk, which is the usual case.
+
+namespace xec {
+
+struct CpuFeatures {
+    bool aes = false;
+    bool pclmul = false;
+    bool sse42 = false;
+    bool avx2 = false;
+};
+
+inline CpuFeatures& cpuFeatures() {
+    static CpuFeatures features = [] {
+        CpuFeatures detected;
+#ifdef XEC_CRYPTO_X86
+        const char* mode = std::getenv("XEC_CRYPTO");
+        if (!mode || std::strcmp(mode, "portable") != 0) {
+            __builtin_cpu_init();
+            detected.aes = __builtin_cpu_supports("aes") && __builtin_cpu_supports("ssse3") && __builtin_cpu_supports("sse4.1");
+            detected.pclmul = __builtin_cpu_supports("pclmul");
+            detected.sse42 = __builtin_cpu_supports("sse4.2");
+            detected.avx2 = __builtin_cpu_supports("avx2");
+        }
+#endif
+        return detected;
+    }();
+    return features;
+}
+
+namespace detail {
+
+inline uint32_t loadLe32(const uint8_t* bytes) {
+    uint32_t value;
+    std::memcpy(&value, bytes, 4);
+    return value;
+}
+
+inline uint64_t loadLe64(const uint8_t* bytes) {
+    uint64_t value;
+    std::memcpy(&value, bytes, 8);
+    return value;
+}
+
+inline void storeBe32(uint8_t* bytes, uint32_t value) {
+    bytes[0] = static_cast<uint8_t>(value >> 24);
+    bytes[1] = static_cast<uint8_t>(value >> 16);
+    bytes[2] = static_cast<uint8_t>(value >> 8);
+    bytes[3] = static_cast<uint8_t>(value);
+}
+
+inline void storeBe64(uint8_t* bytes, uint64_t value) {
+    storeBe32(bytes, static_cast<uint32_t>(value >> 32));
+    storeBe32(bytes + 4, static_cast<uint32_t>(value));
+}
+
+inline uint64_t loadBe64(const uint8_t* bytes) {
+    return __builtin_bswap64(loadLe64(bytes));
+}
+
+// ---- CRC32C ----
+
+constexpr uint32_t CRC32C_POLYNOMIAL = 0x82f63b78;   // Reflected
+
+// a * b modulo the CRC polynomial, both reflected (zlib's multmodp)
+inline uint32_t crcMultiply(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t bit = 1u << 31; bit; bit >>= 1) {
+        if (a & bit) {
+            product ^= b;
+        }
+        b = b & 1 ? (b >> 1) ^ CRC32C_POLYNOMIAL : b >> 1;
+    }
+    return product;
+}
+
+// x^n modulo the polynomial
+inline uint32_t crcPowerOfX(uint64_t n) {
+    uint32_t result = 1u << 31;   // x^0
+    uint32_t square = 1u << 30;   // x^1, then x^2, x^4, ...
+    for (; n; n >>= 1) {
+        if (n & 1) {
+            result = crcMultiply(result, square);
+        }
+        square = crcMultiply(square, square);
+    }
+    return result;
+}
+
+struct Crc32cTables {
+    uint32_t table[8][256];
+
+    Crc32cTables() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) {
+                crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+            }
+            table[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int slice = 1; slice < 8; slice++) {
+                table[slice][i] = (table[slice - 1][i] >> 8) ^ table[0][table[slice - 1][i] & 0xff];
+            }
+        }
+    }
+};
+
+inline const Crc32cTables& crc32cTables() {
+    static const Crc32cTables tables;
+    return tables;
+}
+
+// Raw register update, no pre/post inversion
+inline uint32_t crc32cPortable(uint32_t crc, const uint8_t* data, size_t length) {
+    const auto& t = crc32cTables().table;
+    for (; length >= 8; data += 8, length -= 8) {
+        uint64_t word = loadLe64(data) ^ crc;
+        crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^ t[5][(word >> 16) & 0xff] ^ t[4][(word >> 24) & 0xff] ^
+              t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff] ^ t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+    }
+    for (; length; data++, length--) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xff];
+    }
+    return crc;
+}
+
+#ifdef XEC_CRYPTO_X86
+constexpr size_t CRC_STREAM_BYTES = 4096;
+
+// Multipliers that shift a CRC register past CRC_STREAM_BYTES and 2 * CRC_STREAM_BYTES of data
+// when applied with pclmul + crc32 (which together contribute x^33)
+inline const std::array<uint64_t, 2>& crcStreamShifts() {
+    static const std::array<uint64_t, 2> shifts = {crcPowerOfX(CRC_STREAM_BYTES * 8 - 33),
+                                                   crcPowerOfX(2 * CRC_STREAM_BYTES * 8 - 33)};
+    return shifts;
+}
+
+__attribute__((target("sse4.2,pclmul"))) inline uint32_t crcShift(uint32_t crc, uint64_t multiplier) {
+    __m128i product = _mm_clmulepi64_si128(_mm_cvtsi32_si128(static_cast<int>(crc)), _mm_cvtsi64_si128(static_cast<long long>(multiplier)), 0);
+    return static_cast<uint32_t>(_mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(product))));
+}
+
+// Three independent crc32 chains hide the instruction's 3-cycle latency
+__attribute__((target("sse4.2,pclmul"))) inline uint32_t crc32cHardware(uint32_t crc, const uint8_t* data, size_t length) {
+    if (cpuFeatures().pclmul) {
+        const auto& shifts = crcStreamShifts();
+        for (; length >= 3 * CRC_STREAM_BYTES; data += 3 * CRC_STREAM_BYTES, length -= 3 * CRC_STREAM_BYTES) {
+            uint64_t a = crc, b = 0, c = 0;
+            for (size_t i = 0; i < CRC_STREAM_BYTES; i += 8) {
+                a = _mm_crc32_u64(a, loadLe64(data + i));
+                b = _mm_crc32_u64(b, loadLe64(data + CRC_STREAM_BYTES + i));
+                c = _mm_crc32_u64(c, loadLe64(data + 2 * CRC_STREAM_BYTES + i));
+            }
+            crc = crcShift(static_cast<uint32_t>(a), shifts[1]) ^ crcShift(static_cast<uint32_t>(b), shifts[0]) ^ static_cast<uint32_t>(c);
+        }
+    }
+    uint64_t wide = crc;
+    for (; length >= 8; data += 8, length -= 8) {
+        wide = _mm_crc32_u64(wide, loadLe64(data));
+    }
+    crc = static_cast<uint32_t>(wide);
+    for (; length; data++, length--) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+#endif
+
+} // namespace detail
+
+// CRC32C (Castagnoli) of `data`, continuing from `crc` (0 to start)
+inline uint32_t crc32c(const void* data, size_t length, uint32_t crc = 0) {
+    const auto* bytes = static_cast<const uint8_t*>(data);
+#ifdef XEC_CRYPTO_X86
+    if (cpuFeatures().sse42) {
+        return ~detail::crc32cHardware(~crc, bytes, length);
+    }
+#endif
+    return ~detail::crc32cPortable(~crc, bytes, length);
+}
+
+// CRC of A followed by B, from crc32c(A), crc32c(B) and B's length
+inline uint32_t crc32cCombine(uint32_t first, uint32_t second, uint64_t secondLength) {
+    return detail::crcMultiply(detail::crcPowerOfX(secondLength * 8), first) ^ second;
+}
+
+// ---- XXH3-64 ----
+
+namespace detail {
+
+constexpr uint64_t XXH_PRIME32_1 = 0x9E3779B1U;
+constexpr uint64_t XXH_PRIME32_2 = 0x85EBCA77U;
+constexpr uint64_t XXH_PRIME32_3 = 0xC2B2AE3DU;
+constexpr uint64_t XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+constexpr uint64_t XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+constexpr uint64_t XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+constexpr uint64_t XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+constexpr uint64_t XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+constexpr uint64_t XXH_PRIME_MX1 = 0x165667919E3779F9ULL;
+constexpr uint64_t XXH_PRIME_MX2 = 0x9FB21C651E98DF25ULL;
+constexpr size_t XXH_SECRET_SIZE = 192;
+constexpr size_t XXH_STRIPE = 64;
+constexpr size_t XXH_STRIPES_PER_BLOCK = (XXH_SECRET_SIZE - XXH_STRIPE) / 8;
+
+alignas(64) constexpr uint8_t XXH_SECRET[XXH_SECRET_SIZE] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+inline uint64_t rotateLeft(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t multiplyFold(uint64_t a, uint64_t b) {
+    unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+inline uint64_t xxh64Avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    return h ^ (h >> 32);
+}
+
+inline uint64_t xxh3Avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= XXH_PRIME_MX1;
+    return h ^ (h >> 32);
+}
+
+inline uint64_t xxhMix16(const uint8_t* input, const uint8_t* secret, uint64_t seed) {
+    return multiplyFold(loadLe64(input) ^ (loadLe64(secret) + seed), loadLe64(input + 8) ^ (loadLe64(secret + 8) - seed));
+}
+
+inline uint64_t xxh3Short(const uint8_t* input, size_t length, const uint8_t* secret, uint64_t seed) {
+    if (length > 8) {
+        uint64_t low = loadLe64(input) ^ ((loadLe64(secret + 24) ^ loadLe64(secret + 32)) + seed);
+        uint64_t high = loadLe64(input + length - 8) ^ ((loadLe64(secret + 40) ^ loadLe64(secret + 48)) - seed);
+        return xxh3Avalanche(length + __builtin_bswap64(low) + high + multiplyFold(low, high));
+    }
+    if (length >= 4) {
+        seed ^= static_cast<uint64_t>(__builtin_bswap32(static_cast<uint32_t>(seed))) << 32;
+        uint64_t combined = loadLe32(input + length - 4) + (static_cast<uint64_t>(loadLe32(input)) << 32);
+        uint64_t h = combined ^ ((loadLe64(secret + 8) ^ loadLe64(secret + 16)) - seed);
+        h ^= rotateLeft(h, 49) ^ rotateLeft(h, 24);
+        h *= XXH_PRIME_MX2;
+        h ^= (h >> 35) + length;
+        h *= XXH_PRIME_MX2;
+        return h ^ (h >> 28);
+    }
+    if (length > 0) {
+        uint32_t combined = static_cast<uint32_t>(input[0]) << 16 | static_cast<uint32_t>(input[length >> 1]) << 24 |
+                            input[length - 1] | static_cast<uint32_t>(length) << 8;
+        uint64_t flip = (loadLe32(secret) ^ loadLe32(secret + 4)) + seed;
+        return xxh64Avalanche(combined ^ flip);
+    }
+    return xxh64Avalanche(seed ^ loadLe64(secret + 56) ^ loadLe64(secret + 64));
+}
+
+inline uint64_t xxh3Medium(const uint8_t* input, size_t length, const uint8_t* secret, uint64_t seed) {
+    uint64_t acc = length * XXH_PRIME64_1;
+    if (length <= 128) {
+        if (length > 32) {
+            if (length > 64) {
+                if (length > 96) {
+                    acc += xxhMix16(input + 48, secret + 96, seed);
+                    acc += xxhMix16(input + length - 64, secret + 112, seed);
+                }
+                acc += xxhMix16(input + 32, secret + 64, seed);
+                acc += xxhMix16(input + length - 48, secret + 80, seed);
+            }
+            acc += xxhMix16(input + 16, secret + 32, seed);
+            acc += xxhMix16(input + length - 32, secret + 48, seed);
+        }
+        acc += xxhMix16(input, secret, seed);
+        acc += xxhMix16(input + length - 16, secret + 16, seed);
+        return xxh3Avalanche(acc);
+    }
+    for (size_t i = 0; i < 8; i++) {
+        acc += xxhMix16(input + 16 * i, secret + 16 * i, seed);
+    }
+    acc = xxh3Avalanche(acc);
+    for (size_t i = 8; i < length / 16; i++) {
+        acc += xxhMix16(input + 16 * i, secret + 16 * (i - 8) + 3, seed);
+    }
+    acc += xxhMix16(input + length - 16, secret + 136 - 17, seed);
+    return xxh3Avalanche(acc);
+}
+
+// Long-input kernels: fold `stripes` 64-byte stripes into the eight accumulators, and scramble
+// them between blocks
+inline void xxhAccumulateScalar(uint64_t* acc, const uint8_t* input, const uint8_t* secret, size_t stripes) {
+    for (size_t s = 0; s < stripes; s++) {
+        const uint8_t* stripe = input + s * XXH_STRIPE;
+        const uint8_t* key = secret + s * 8;
+        for (size_t i = 0; i < 8; i++) {
+            uint64_t value = loadLe64(stripe + 8 * i);
+            uint64_t keyed = value ^ loadLe64(key + 8 * i);
+            acc[i ^ 1] += value;
+            acc[i] += (keyed & 0xffffffff) * (keyed >> 32);
+        }
+    }
+}
+
+inline void xxhScrambleScalar(uint64_t* acc, const uint8_t* secret) {
+    for (size_t i = 0; i < 8; i++) {
+        uint64_t value = acc[i];
+        value ^= value >> 47;
+        value ^= loadLe64(secret + 8 * i);
+        acc[i] = value * XXH_PRIME32_1;
+    }
+}
+
+#ifdef __SSE2__
+inline void xxhAccumulateSse2(uint64_t* acc, const uint8_t* input, const uint8_t* secret, size_t stripes) {
+    __m128i lanes[4];
+    for (size_t i = 0; i < 4; i++) {
+        lanes[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc) + i);
+    }
+    for (size_t s = 0; s < stripes; s++) {
+        for (size_t i = 0; i < 4; i++) {
+            __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + s * XXH_STRIPE) + i);
+            __m128i keyed = _mm_xor_si128(value, _mm_loadu_si128(reinterpret_cast<const __m128i*>(secret + s * 8) + i));
+            __m128i product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+            __m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+            lanes[i] = _mm_add_epi64(lanes[i], _mm_add_epi64(product, swapped));
+        }
+    }
+    for (size_t i = 0; i < 4; i++) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc) + i, lanes[i]);
+    }
+}
+
+inline void xxhScrambleSse2(uint64_t* acc, const uint8_t* secret) {
+    const __m128i prime = _mm_set1_epi32(static_cast<int>(XXH_PRIME32_1));
+    for (size_t i = 0; i < 4; i++) {
+        __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(acc) + i);
+        value = _mm_xor_si128(value, _mm_srli_epi64(value, 47));
+        value = _mm_xor_si128(value, _mm_loadu_si128(reinterpret_cast<const __m128i*>(secret) + i));
+        __m128i low = _mm_mul_epu32(value, prime);
+        __m128i high = _mm_mul_epu32(_mm_srli_epi64(value, 32), prime);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(acc) + i, _mm_add_epi64(low, _mm_slli_epi64(high, 32)));
+    }
+}
+#endif
+
+#ifdef XEC_CRYPTO_X86
+__attribute__((target("avx2"))) inline void xxhAccumulateAvx2(uint64_t* acc, const uint8_t* input, const uint8_t* secret,
+                                                                size_t stripes) {
+    __m256i lanes[2];
+    for (size_t i = 0; i < 2; i++) {
+        lanes[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc) + i);
+    }
+    for (size_t s = 0; s < stripes; s++) {
+        for (size_t i = 0; i < 2; i++) {
+            __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + s * XXH_STRIPE) + i);
+            __m256i keyed = _mm256_xor_si256(value, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret + s * 8) + i));
+            __m256i product = _mm256_mul_epu32(keyed, _mm256_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+            __m256i swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+            lanes[i] = _mm256_add_epi64(lanes[i], _mm256_add_epi64(product, swapped));
+        }
+    }
+    for (size_t i = 0; i < 2; i++) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc) + i, lanes[i]);
+    }
+}
+
+__attribute__((target("avx2"))) inline void xxhScrambleAvx2(uint64_t* acc, const uint8_t* secret) {
+    const __m256i prime = _mm256_set1_epi32(static_cast<int>(XXH_PRIME32_1));
+    for (size_t i = 0; i < 2; i++) {
+        __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc) + i);
+        value = _mm256_xor_si256(value, _mm256_srli_epi64(value, 47));
+        value = _mm256_xor_si256(value, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret) + i));
+        __m256i low = _mm256_mul_epu32(value, prime);
+        __m256i high = _mm256_mul_epu32(_mm256_srli_epi64(value, 32), prime);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc) + i, _mm256_add_epi64(low, _mm256_slli_epi64(high, 32)));
+    }
+}
+#endif
+
+using XxhAccumulate = void (*)(uint64_t*, const uint8_t*, const uint8_t*, size_t);
+using XxhScramble = void (*)(uint64_t*, const uint8_t*);
+
+inline uint64_t xxh3Long(const uint8_t* input, size_t length, const uint8_t* secret, XxhAccumulate accumulate,
+                         XxhScramble scramble) {
+    alignas(32) uint64_t acc[8] = {XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+                                   XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1};
+    constexpr size_t blockBytes = XXH_STRIPE * XXH_STRIPES_PER_BLOCK;
+    size_t blocks = (length - 1) / blockBytes;
+    for (size_t n = 0; n < blocks; n++) {
+        accumulate(acc, input + n * blockBytes, secret, XXH_STRIPES_PER_BLOCK);
+        scramble(acc, secret + XXH_SECRET_SIZE - XXH_STRIPE);
+    }
+    size_t stripes = ((length - 1) - blocks * blockBytes) / XXH_STRIPE;
+    accumulate(acc, input + blocks * blockBytes, secret, stripes);
+    accumulate(acc, input + length - XXH_STRIPE, secret + XXH_SECRET_SIZE - XXH_STRIPE - 7, 1);
+
+    uint64_t result = length * XXH_PRIME64_1;
+    for (size_t i = 0; i < 4; i++) {
+        result += multiplyFold(acc[2 * i] ^ loadLe64(secret + 11 + 16 * i), acc[2 * i + 1] ^ loadLe64(secret + 11 + 16 * i + 8));
+    }
+    return xxh3Avalanche(result);
+}
+
+} // namespace detail
+
+enum class HashKernel { AUTO, SCALAR, SSE2, AVX2 };
+
+// XXH3 64-bit hash. `kernel` pins the long-input implementation (for benchmarks); an unsupported
+// choice falls back to AUTO.
+inline uint64_t xxh3(const void* data, size_t length, uint64_t seed = 0, HashKernel kernel = HashKernel::AUTO) {
+    const auto* input = static_cast<const uint8_t*>(data);
+    if (length <= 16) {
+        return detail::xxh3Short(input, length, detail::XXH_SECRET, seed);
+    }
+    if (length <= 240) {
+        return detail::xxh3Medium(input, length, detail::XXH_SECRET, seed);
+    }
+    alignas(64) uint8_t derived[detail::XXH_SECRET_SIZE];
+    const uint8_t* secret = detail::XXH_SECRET;
+    if (seed != 0) {
+        for (size_t i = 0; i < detail::XXH_SECRET_SIZE; i += 16) {
+            uint64_t low = detail::loadLe64(detail::XXH_SECRET + i) + seed;
+            uint64_t high = detail::loadLe64(detail::XXH_SECRET + i + 8) - seed;
+            std::memcpy(derived + i, &low, 8);
+            std::memcpy(derived + i + 8, &high, 8);
+        }
+        secret = derived;
+    }
+#ifdef XEC_CRYPTO_X86
+    if ((kernel == HashKernel::AUTO || kernel == HashKernel::AVX2) && cpuFeatures().avx2) {
+        return detail::xxh3Long(input, length, secret, detail::xxhAccumulateAvx2, detail::xxhScrambleAvx2);
+    }
+#endif
+#ifdef __SSE2__
+    if (kernel != HashKernel::SCALAR) {
+        return detail::xxh3Long(input, length, secret, detail::xxhAccumulateSse2, detail::xxhScrambleSse2);
+    }
+#endif
+    return detail::xxh3Long(input, length, secret, detail::xxhAccumulateScalar, detail::xxhScrambleScalar);
+}
+
+// ---- AES-GCM ----
+
+namespace detail {
+
+struct AesTables {
+    uint8_t sbox[256];
+
+    AesTables() {
+        // Walk the multiplicative group with generator 3 and its inverse, applying the affine map
+        uint8_t p = 1, q = 1;
+        do {
+            p = static_cast<uint8_t>(p ^ (p << 1) ^ (p & 0x80 ? 0x1b : 0));
+            q ^= static_cast<uint8_t>(q << 1);
+            q ^= static_cast<uint8_t>(q << 2);
+            q ^= static_cast<uint8_t>(q << 4);
+            q ^= q & 0x80 ? 0x09 : 0;
+            auto rotate = [](uint8_t value, int bits) { return static_cast<uint8_t>(value << bits | value >> (8 - bits)); };
+            sbox[p] = static_cast<uint8_t>(q ^ rotate(q, 1) ^ rotate(q, 2) ^ rotate(q, 3) ^ rotate(q, 4) ^ 0x63);
+        } while (p != 1);
+        sbox[0] = 0x63;
+    }
+};
+
+inline const AesTables& aesTables() {
+    static const AesTables tables;
+    return tables;
+}
+
+inline uint8_t xtime(uint8_t value) {
+    return static_cast<uint8_t>(value << 1 ^ (value & 0x80 ? 0x1b : 0));
+}
+
+inline void aesEncryptPortable(const uint8_t (*roundKeys)[16], int rounds, const uint8_t* in, uint8_t* out) {
+    const uint8_t* sbox = aesTables().sbox;
+    uint8_t state[16];
+    for (int i = 0; i < 16; i++) {
+        state[i] = in[i] ^ roundKeys[0][i];
+    }
+    for (int round = 1; round <= rounds; round++) {
+        uint8_t shifted[16];
+        // SubBytes and ShiftRows: row r of column c comes from column c + r
+        for (int c = 0; c < 4; c++) {
+            for (int r = 0; r < 4; r++) {
+                shifted[c * 4 + r] = sbox[state[((c + r) % 4) * 4 + r]];
+            }
+        }
+        if (round != rounds) {
+            for (int c = 0; c < 4; c++) {
+                uint8_t* column = shifted + c * 4;
+                uint8_t all = column[0] ^ column[1] ^ column[2] ^ column[3];
+                uint8_t first = column[0];
+                column[0] ^= all ^ xtime(column[0] ^ column[1]);
+                column[1] ^= all ^ xtime(column[1] ^ column[2]);
+                column[2] ^= all ^ xtime(column[2] ^ column[3]);
+                column[3] ^= all ^ xtime(column[3] ^ first);
+            }
+        }
+        for (int i = 0; i < 16; i++) {
+            state[i] = shifted[i] ^ roundKeys[round][i];
+        }
+    }
+    std::memcpy(out, state, 16);
+}
+
+// Shoup's 4-bit table method: 16 multiples of H, one table step per nibble
+class GhashTable {
+public:
+    explicit GhashTable(const uint8_t* h = nullptr) {
+        if (!h) {
+            return;
+        }
+        uint64_t high = loadBe64(h), low = loadBe64(h + 8);
+        highs[8] = high;
+        lows[8] = low;
+        for (int i = 4; i > 0; i >>= 1) {
+            uint64_t carry = (low & 1) * 0xe100000000000000ULL;
+            low = (high << 63) | (low >> 1);
+            high = (high >> 1) ^ carry;
+            highs[i] = high;
+            lows[i] = low;
+        }
+        for (int i = 2; i <= 8; i *= 2) {
+            for (int j = 1; j < i; j++) {
+                highs[i + j] = highs[i] ^ highs[j];
+                lows[i + j] = lows[i] ^ lows[j];
+            }
+        }
+    }
+
+    // x = x * H
+    void multiply(uint8_t* x) const {
+        static const uint64_t reduction[16] = {0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+                                               0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0};
+        uint64_t high = highs[x[15] & 0xf], low = lows[x[15] & 0xf];
+        for (int i = 15; i >= 0; i--) {
+            for (int half = (i == 15 ? 1 : 0); half < 2; half++) {
+                int nibble = half == 0 ? x[i] & 0xf : x[i] >> 4;
+                uint8_t remainder = low & 0xf;
+                low = (high << 60) | (low >> 4);
+                high = (high >> 4) ^ (reduction[remainder] << 48);
+                high ^= highs[nibble];
+                low ^= lows[nibble];
+            }
+        }
+        storeBe64(x, high);
+        storeBe64(x + 8, low);
+    }
+
+private:
+    uint64_t highs[16] = {};
+    uint64_t lows[16] = {};
+};
+
+#ifdef XEC_CRYPTO_X86
+#define XEC_GCM_TARGET __attribute__((target("aes,pclmul,ssse3,sse4.1")))
+
+XEC_GCM_TARGET inline __m128i byteSwap(__m128i value) {
+    return _mm_shuffle_epi8(value, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+// Carry-less a * b, left unreduced as three 128-bit parts so several products can be summed
+// before one reduction
+struct ClmulSum {
+    __m128i low, middle, high;
+};
+
+XEC_GCM_TARGET inline void clmulAdd(ClmulSum& sum, __m128i a, __m128i b) {
+    sum.low = _mm_xor_si128(sum.low, _mm_clmulepi64_si128(a, b, 0x00));
+    sum.high = _mm_xor_si128(sum.high, _mm_clmulepi64_si128(a, b, 0x11));
+    sum.middle = _mm_xor_si128(sum.middle, _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01)));
+}
+
+// Reduce modulo the GHASH polynomial in the bit-reflected representation (Gueron & Kounavis)
+XEC_GCM_TARGET inline __m128i clmulReduce(const ClmulSum& sum) {
+    __m128i low = _mm_xor_si128(sum.low, _mm_slli_si128(sum.middle, 8));
+    __m128i high = _mm_xor_si128(sum.high, _mm_srli_si128(sum.middle, 8));
+    // Shift the 256-bit product left by one
+    __m128i lowCarry = _mm_srli_epi32(low, 31);
+    __m128i highCarry = _mm_srli_epi32(high, 31);
+    low = _mm_slli_epi32(low, 1);
+    high = _mm_slli_epi32(high, 1);
+    __m128i across = _mm_srli_si128(lowCarry, 12);
+    highCarry = _mm_slli_si128(highCarry, 4);
+    lowCarry = _mm_slli_si128(lowCarry, 4);
+    low = _mm_or_si128(low, lowCarry);
+    high = _mm_or_si128(_mm_or_si128(high, highCarry), across);
+    // First phase
+    __m128i a = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(low, 31), _mm_slli_epi32(low, 30)), _mm_slli_epi32(low, 25));
+    __m128i carry = _mm_srli_si128(a, 4);
+    low = _mm_xor_si128(low, _mm_slli_si128(a, 12));
+    // Second phase
+    __m128i b = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(low, 1), _mm_srli_epi32(low, 2)), _mm_srli_epi32(low, 7));
+    b = _mm_xor_si128(b, carry);
+    low = _mm_xor_si128(low, b);
+    return _mm_xor_si128(high, low);
+}
+
+// J0 with its 32-bit counter set to n
+XEC_GCM_TARGET inline __m128i counterBlock(__m128i base, uint32_t n) {
+    return _mm_insert_epi32(base, static_cast<int>(__builtin_bswap32(n)), 3);
+}
+
+XEC_GCM_TARGET inline __m128i gfMultiply(__m128i a, __m128i b) {
+    ClmulSum sum{_mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128()};
+    clmulAdd(sum, a, b);
+    return clmulReduce(sum);
+}
+#endif
+
+} // namespace detail
+
+constexpr size_t GCM_IV_BYTES = 12;
+constexpr size_t GCM_TAG_BYTES = 16;
+
+// AES-GCM with a 96-bit IV and a full 128-bit tag. Encryption and decryption work in place and
+// are const, so one instance can serve every worker of a parallel stage. Never reuse an IV with
+// the same key.
+class AesGcm {
+public:
+    AesGcm(const uint8_t* key, size_t keyLength) {
+        if (keyLength != 16 && keyLength != 32) {
+            throw std::runtime_error("AES-GCM needs a 16- or 32-byte key, got " + std::to_string(keyLength));
+        }
+        expandKey(key, keyLength);
+        accelerated = cpuFeatures().aes && cpuFeatures().pclmul;
+        uint8_t h[16] = {};
+        encryptBlock(h, h);
+        ghash = detail::GhashTable(h);
+#ifdef XEC_CRYPTO_X86
+        if (accelerated) {
+            preparePowers(h);
+        }
+#endif
+        std::memset(h, 0, sizeof(h));
+    }
+
+    ~AesGcm() {
+        volatile uint8_t* keys = &roundKeys[0][0];
+        for (size_t i = 0; i < sizeof(roundKeys); i++) {
+            keys[i] = 0;
+        }
+    }
+
+    const char* implementation() const {
+        return accelerated ? "aes-ni+pclmul" : "portable";
+    }
+
+    void encrypt(const uint8_t* iv, const uint8_t* aad, size_t aadLength, uint8_t* data, size_t length, uint8_t* tag) const {
+        crypt(iv, aad, aadLength, data, length, tag, true);
+    }
+
+    // False, with `data` zeroed, when the tag does not match
+    bool decrypt(const uint8_t* iv, const uint8_t* aad, size_t aadLength, uint8_t* data, size_t length, const uint8_t* tag) const {
+        uint8_t expected[GCM_TAG_BYTES];
+        crypt(iv, aad, aadLength, data, length, expected, false);
+        uint8_t difference = 0;
+        for (size_t i = 0; i < GCM_TAG_BYTES; i++) {
+            difference |= expected[i] ^ tag[i];
+        }
+        if (difference) {
+            std::memset(data, 0, length);
+            return false;
+        }
+        return true;
+    }
+
+private:
+    void expandKey(const uint8_t* key, size_t keyLength) {
+        const uint8_t* sbox = detail::aesTables().sbox;
+        size_t words = keyLength / 4;
+        rounds = static_cast<int>(words) + 6;
+        uint8_t* w = &roundKeys[0][0];
+        std::memcpy(w, key, keyLength);
+        uint8_t rcon = 1;
+        for (size_t i = words; i < 4 * static_cast<size_t>(rounds + 1); i++) {
+            uint8_t temp[4];
+            std::memcpy(temp, w + (i - 1) * 4, 4);
+            if (i % words == 0) {
+                uint8_t first = temp[0];
+                temp[0] = static_cast<uint8_t>(sbox[temp[1]] ^ rcon);
+                temp[1] = sbox[temp[2]];
+                temp[2] = sbox[temp[3]];
+                temp[3] = sbox[first];
+                rcon = detail::xtime(rcon);
+            } else if (words > 6 && i % words == 4) {
+                for (uint8_t& byte : temp) {
+                    byte = sbox[byte];
+                }
+            }
+            for (int b = 0; b < 4; b++) {
+                w[i * 4 + b] = w[(i - words) * 4 + b] ^ temp[b];
+            }
+        }
+    }
+
+    void encryptBlock(const uint8_t* in, uint8_t* out) const {
+#ifdef XEC_CRYPTO_X86
+        if (accelerated) {
+            encryptBlockNi(in, out);
+            return;
+        }
+#endif
+        detail::aesEncryptPortable(roundKeys, rounds, in, out);
+    }
+
+    void crypt(const uint8_t* iv, const uint8_t* aad, size_t aadLength, uint8_t* data, size_t length, uint8_t* tag,
+               bool encrypting) const {
+#ifdef XEC_CRYPTO_X86
+        if (accelerated) {
+            cryptNi(iv, aad, aadLength, data, length, tag, encrypting);
+            return;
+        }
+#endif
+        cryptPortable(iv, aad, aadLength, data, length, tag, encrypting);
+    }
+
+    void ghashBytes(uint8_t* x, const uint8_t* bytes, size_t length) const {
+        for (size_t offset = 0; offset < length; offset += 16) {
+            size_t n = std::min<size_t>(16, length - offset);
+            for (size_t i = 0; i < n; i++) {
+                x[i] ^= bytes[offset + i];
+            }
+            ghash.multiply(x);
+        }
+    }
+
+    void cryptPortable(const uint8_t* iv, const uint8_t* aad, size_t aadLength, uint8_t* data, size_t length, uint8_t* tag,
+                       bool encrypting) const {
+        uint8_t counter[16], keystream[16], x[16] = {};
+        std::memcpy(counter, iv, GCM_IV_BYTES);
+        detail::storeBe32(counter + 12, 1);
+        uint8_t tagMask[16];
+        encryptBlock(counter, tagMask);
+        ghashBytes(x, aad, aadLength);
+        for (size_t offset = 0, block = 2; offset < length; offset += 16, block++) {
+            size_t n = std::min<size_t>(16, length - offset);
+            detail::storeBe32(counter + 12, static_cast<uint32_t>(block));
+            encryptBlock(counter, keystream);
+            if (!encrypting) {
+                ghashBytes(x, data + offset, n);
+            }
+            for (size_t i = 0; i < n; i++) {
+                data[offset + i] ^= keystream[i];
+            }
+            if (encrypting) {
+                ghashBytes(x, data + offset, n);
+            }
+        }
+        finish(x, aadLength, length);
+        for (size_t i = 0; i < 16; i++) {
+            tag[i] = x[i] ^ tagMask[i];
+        }
+    }
+
+    void finish(uint8_t* x, size_t aadLength, size_t length) const {
+        uint8_t lengths[16];
+        detail::storeBe64(lengths, static_cast<uint64_t>(aadLength) * 8);
+        detail::storeBe64(lengths + 8, static_cast<uint64_t>(length) * 8);
+        ghashBytes(x, lengths, 16);
+    }
+
+#ifdef XEC_CRYPTO_X86
+    static constexpr size_t LANES = 8;
+
+    XEC_GCM_TARGET void preparePowers(const uint8_t* h) {
+        __m128i power = detail::byteSwap(_mm_loadu_si128(reinterpret_cast<const __m128i*>(h)));
+        __m128i base = power;
+        for (size_t i = 0; i < LANES; i++) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(powers[i]), power);
+            power = detail::gfMultiply(power, base);
+        }
+    }
+
+    XEC_GCM_TARGET __m128i encryptNi(__m128i block) const {
+        block = _mm_xor_si128(block, _mm_loadu_si128(reinterpret_cast<const __m128i*>(roundKeys[0])));
+        for (int round = 1; round < rounds; round++) {
+            block = _mm_aesenc_si128(block, _mm_loadu_si128(reinterpret_cast<const __m128i*>(roundKeys[round])));
+        }
+        return _mm_aesenclast_si128(block, _mm_loadu_si128(reinterpret_cast<const __m128i*>(roundKeys[rounds])));
+    }
+
+    XEC_GCM_TARGET void encryptBlockNi(const uint8_t* in, uint8_t* out) const {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), encryptNi(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in))));
+    }
+
+    // Hash up to 16 bytes, zero padded, into the byte-swapped accumulator
+    XEC_GCM_TARGET __m128i ghashPartial(__m128i x, const uint8_t* bytes, size_t n) const {
+        uint8_t padded[16] = {};
+        std::memcpy(padded, bytes, n);
+        x = _mm_xor_si128(x, detail::byteSwap(_mm_loadu_si128(reinterpret_cast<const __m128i*>(padded))));
+        return detail::gfMultiply(x, _mm_loadu_si128(reinterpret_cast<const __m128i*>(powers[0])));
+    }
+
+    // x = (x ^ b0) * H^8 ^ b1 * H^7 ^ ... ^ b7 * H, with one reduction
+    XEC_GCM_TARGET __m128i ghashEight(__m128i x, const __m128i* blocks) const {
+        detail::ClmulSum sum{_mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128()};
+#pragma GCC unroll 8
+        for (size_t i = 0; i < LANES; i++) {
+            __m128i block = detail::byteSwap(blocks[i]);
+            if (i == 0) {
+                block = _mm_xor_si128(block, x);
+            }
+            detail::clmulAdd(sum, block, _mm_loadu_si128(reinterpret_cast<const __m128i*>(powers[LANES - 1 - i])));
+        }
+        return detail::clmulReduce(sum);
+    }
+
+    XEC_GCM_TARGET void cryptNi(const uint8_t* iv, const uint8_t* aad, size_t aadLength, uint8_t* data, size_t length,
+                                uint8_t* tag, bool encrypting) const {
+        uint8_t initial[16] = {};
+        std::memcpy(initial, iv, GCM_IV_BYTES);
+        __m128i counterBase = _mm_loadu_si128(reinterpret_cast<const __m128i*>(initial));
+
+        __m128i x = _mm_setzero_si128();
+        for (size_t offset = 0; offset < aadLength; offset += 16) {
+            x = ghashPartial(x, aad + offset, std::min<size_t>(16, aadLength - offset));
+        }
+
+        __m128i keys[15];
+        for (int round = 0; round <= rounds; round++) {
+            keys[round] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(roundKeys[round]));
+        }
+        uint32_t counter = 2;
+        size_t offset = 0;
+        for (; offset + 16 * LANES <= length; offset += 16 * LANES, counter += LANES) {
+            auto* blocks = reinterpret_cast<__m128i*>(data + offset);
+            __m128i stream[LANES], text[LANES];
+#pragma GCC unroll 8
+            for (size_t i = 0; i < LANES; i++) {
+                stream[i] = _mm_xor_si128(detail::counterBlock(counterBase, counter + static_cast<uint32_t>(i)), keys[0]);
+                text[i] = _mm_loadu_si128(blocks + i);
+            }
+            if (!encrypting) {
+                x = ghashEight(x, text);
+            }
+            for (int round = 1; round < rounds; round++) {
+#pragma GCC unroll 8
+                for (size_t i = 0; i < LANES; i++) {
+                    stream[i] = _mm_aesenc_si128(stream[i], keys[round]);
+                }
+            }
+#pragma GCC unroll 8
+            for (size_t i = 0; i < LANES; i++) {
+                text[i] = _mm_xor_si128(text[i], _mm_aesenclast_si128(stream[i], keys[rounds]));
+                _mm_storeu_si128(blocks + i, text[i]);
+            }
+            if (encrypting) {
+                x = ghashEight(x, text);
+            }
+        }
+        for (; offset < length; offset += 16, counter++) {
+            size_t n = std::min<size_t>(16, length - offset);
+            uint8_t keystream[16];
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(keystream), encryptNi(detail::counterBlock(counterBase, counter)));
+            if (!encrypting) {
+                x = ghashPartial(x, data + offset, n);
+            }
+            for (size_t i = 0; i < n; i++) {
+                data[offset + i] ^= keystream[i];
+            }
+            if (encrypting) {
+                x = ghashPartial(x, data + offset, n);
+            }
+        }
+        uint8_t lengths[16];
+        detail::storeBe64(lengths, static_cast<uint64_t>(aadLength) * 8);
+        detail::storeBe64(lengths + 8, static_cast<uint64_t>(length) * 8);
+        x = ghashPartial(x, lengths, 16);
+        __m128i result = _mm_xor_si128(detail::byteSwap(x), encryptNi(detail::counterBlock(counterBase, 1)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(tag), result);
+    }
+
+    alignas(16) uint8_t powers[LANES][16] = {};   // H^1..H^8, byte-swapped
+#endif
+
+    uint8_t roundKeys[15][16] = {};
+    int rounds = 0;
+    bool accelerated = false;
+    detail::GhashTable ghash;
+};
+
+// ---- Pipeline stages ----
+
+// Frame header in front of every sealed or checksummed payload. The first 8 bytes are the
+// additional authenticated data of a sealed frame, so its length cannot be altered either.
+struct FrameHeader {
+    uint32_t magic;
+    uint32_t length;               // Payload bytes that follow
+    uint8_t iv[GCM_IV_BYTES];      // Salt, then the chunk sequence as a big-endian u64
+    uint8_t tag[GCM_TAG_BYTES];    // GCM tag, or the digest zero-padded
+};
+
+constexpr uint32_t FRAME_SEALED = 0x4d434758;     // "XGCM"
+constexpr uint32_t FRAME_CRC32C = 0x43524358;     // "XCRC"
+constexpr uint32_t FRAME_XXH3 = 0x33485858;       // "XXH3"
+
+enum class ChecksumKind { CRC32C, XXH3 };
+
+namespace detail {
+
+inline Chunk frameHeader(uint32_t magic, const Chunk& payload, const uint8_t* salt) {
+    Chunk header = Chunk::allocate(sizeof(FrameHeader), payload.sequence);
+    FrameHeader frame{};
+    frame.magic = magic;
+    frame.length = static_cast<uint32_t>(payload.size);
+    std::memcpy(frame.iv, salt, 4);
+    storeBe64(frame.iv + 4, payload.sequence);
+    std::memcpy(header.begin(), &frame, sizeof(frame));
+    return header;
+}
+
+inline std::array<uint8_t, 4> randomSalt() {
+    std::random_device random;
+    uint32_t value = random();
+    std::array<uint8_t, 4> salt;
+    std::memcpy(salt.data(), &value, 4);
+    return salt;
+}
+
+} // namespace detail
+
+// `encryptData`: AES-GCM over each chunk in place, behind a FrameHeader. The IV is a random
+// per-stage salt plus the chunk sequence, so chunk sequences must be unique for the key's
+// lifetime of this stage.
+class SealStage : public Stage {
+public:
+    SealStage(const uint8_t* key, size_t keyLength) : cipher(key, keyLength), salt(detail::randomSalt()) {}
+
+    bool stateless() const override { return true; }
+    std::string name() const override { return "encryptData"; }
+
+    void process(Chunk chunk, Emitter& out) override {
+        if (chunk.size > UINT32_MAX) {
+            throw std::runtime_error("Chunk too large to seal: " + std::to_string(chunk.size) + " bytes");
+        }
+        Chunk header = detail::frameHeader(FRAME_SEALED, chunk, salt.data());
+        auto* frame = reinterpret_cast<FrameHeader*>(header.begin());
+        cipher.encrypt(frame->iv, header.begin(), 8, chunk.begin(), chunk.size, frame->tag);
+        out.emit(std::move(header));
+        out.emit(std::move(chunk));
+    }
+
+private:
+    AesGcm cipher;
+    std::array<uint8_t, 4> salt;
+};
+
+// Frames each chunk with its CRC32C or XXH3 digest; the payload passes through untouched
+class ChecksumStage : public Stage {
+public:
+    explicit ChecksumStage(ChecksumKind kind = ChecksumKind::CRC32C) : kind(kind) {}
+
+    bool stateless() const override { return true; }
+    std::string name() const override { return "checksum"; }
+
+    void process(Chunk chunk, Emitter& out) override {
+        uint8_t zeros[4] = {};
+        Chunk header = detail::frameHeader(kind == ChecksumKind::CRC32C ? FRAME_CRC32C : FRAME_XXH3, chunk, zeros);
+        uint64_t digest = kind == ChecksumKind::CRC32C ? crc32c(chunk.begin(), chunk.size) : xxh3(chunk.begin(), chunk.size);
+        std::memcpy(reinterpret_cast<FrameHeader*>(header.begin())->tag, &digest, 8);
+        out.emit(std::move(header));
+        out.emit(std::move(chunk));
+    }
+
+private:
+    ChecksumKind kind;
+};
+
+// `decryptData` and checksum verification: reassembles frames however the stream was chunked,
+// verifies each, and emits its payload with the original chunk sequence. A sealed frame needs
+// the key; a frame that fails verification throws.
+class OpenStage : public Stage, private Checkpointable {
+public:
+    OpenStage() = default;
+    OpenStage(const uint8_t* key, size_t keyLength) : cipher(std::make_unique<AesGcm>(key, keyLength)) {}
+
+    std::string name() const override { return "decryptData"; }
+
+    void process(Chunk chunk, Emitter& out) override {
+        size_t offset = 0;
+        while (offset < chunk.size) {
+            if (headerBytes < sizeof(FrameHeader)) {
+                size_t n = std::min(sizeof(FrameHeader) - headerBytes, chunk.size - offset);
+                std::memcpy(reinterpret_cast<uint8_t*>(&header) + headerBytes, chunk.begin() + offset, n);
+                headerBytes += n;
+                offset += n;
+                if (headerBytes == sizeof(FrameHeader)) {
+                    startFrame();
+                    if (header.length == 0) {
+                        completeFrame(Chunk::allocate(0), out);
+                    }
+                }
+                continue;
+            }
+            size_t remaining = header.length - gathered;
+            size_t n = std::min(remaining, chunk.size - offset);
+            if (gathered == 0 && n == remaining) {
+                // The whole payload is in this chunk: work on it where it is
+                completeFrame(chunk.slice(offset, n), out);
+            } else {
+                // Grows with the data that actually arrives, so a corrupt length cannot reserve
+                // gigabytes up front
+                pending.insert(pending.end(), chunk.begin() + offset, chunk.begin() + offset + n);
+                gathered += n;
+                if (gathered == header.length) {
+                    auto bytes = std::make_shared<std::vector<uint8_t>>(std::move(pending));
+                    completeFrame({std::shared_ptr<uint8_t>(bytes, bytes->data()), bytes->size(), 0}, out);
+                }
+            }
+            offset += n;
+        }
+    }
+
+    void finish(Emitter& out) override {
+        (void)out;
+        if (headerBytes != 0) {
+            throw std::runtime_error("Stream ended inside a frame");
+        }
+    }
+
+    uint64_t framesOpened() const { return frames; }
+
+    // The frame being reassembled
+    Checkpointable* checkpointable() override { return this; }
+
+private:
+    void saveState(StateWriter& out) override {
+        out.bytes(&header, headerBytes);
+        out.bytes(pending.data(), pending.size());
+        out.u64(frames);
+    }
+
+    void loadState(StateReader& in) override {
+        std::vector<uint8_t> headerState = in.bytes();
+        if (headerState.size() > sizeof(FrameHeader)) {
+            throw std::runtime_error("Checkpoint state does not match this stage");
+        }
+        std::memcpy(&header, headerState.data(), headerState.size());
+        headerBytes = headerState.size();
+        if (headerBytes == sizeof(FrameHeader)) {
+            startFrame();
+        }
+        pending = in.bytes();
+        gathered = pending.size();
+        frames = in.u64();
+    }
+
+    void startFrame() {
+        if (header.magic != FRAME_SEALED && header.magic != FRAME_CRC32C && header.magic != FRAME_XXH3) {
+            throw std::runtime_error("Not a sealed or checksummed frame (magic " + std::to_string(header.magic) + ")");
+        }
+        if (header.magic == FRAME_SEALED && !cipher) {
+            throw std::runtime_error("Sealed frame but no key was given");
+        }
+        gathered = 0;
+    }
+
+    void completeFrame(Chunk payload, Emitter& out) {
+        uint64_t sequence = detail::loadBe64(header.iv + 4);
+        bool valid;
+        if (header.magic == FRAME_SEALED) {
+            valid = cipher->decrypt(header.iv, reinterpret_cast<const uint8_t*>(&header), 8, payload.begin(), payload.size, header.tag);
+        } else {
+            uint64_t digest = header.magic == FRAME_CRC32C ? crc32c(payload.begin(), payload.size) : xxh3(payload.begin(), payload.size);
+            valid = std::memcmp(&digest, header.tag, 8) == 0;
+        }
+        if (!valid) {
+            throw std::runtime_error("Frame for chunk " + std::to_string(sequence) + " failed verification");
+        }
+        headerBytes = 0;
+        gathered = 0;
+        pending = std::vector<uint8_t>();
+        frames++;
+        payload.sequence = sequence;
+        out.emit(std::move(payload));
+    }
+
+    std::unique_ptr<AesGcm> cipher;
+    FrameHeader header{};
+    size_t headerBytes = 0;
+    std::vector<uint8_t> pending;
+    size_t gathered = 0;
+    uint64_t frames = 0;
+};
+
+} // namespace xec
+
+// Entry points for generated code, defined in EntryPoints.cpp
+extern "C" uint32_t xec_crc32c(const uint8_t* data, size_t length, uint32_t crc);
+extern "C" uint64_t xec_xxh3(const uint8_t* data, size_t length, uint64_t seed);
+extern "C" void* xec_aes_gcm_new(const uint8_t* key, size_t keyLength);
+extern "C" void xec_aes_gcm_free(void* cipher);
+extern "C" void xec_aes_gcm_encrypt(void* cipher, const uint8_t* iv, uint8_t* data, size_t length, uint8_t* tag);
+extern "C" int xec_aes_gcm_decrypt(void* cipher, const uint8_t* iv, uint8_t* data, size_t length, const uint8_t* tag);
@@ -0,0 +1,596 @@
+#include "Allocator.hpp"
+#include "Channel.hpp"
+#include "Crypto.hpp"
+#include "EventLoop.hpp"
+#include "Packet.hpp"
+#include "Pipeline.hpp"
+#include "Profile.hpp"
+#include "RefCount.hpp"
+#include "Serialization.hpp"
+#include "Splitter.hpp"
+#include "TaskScheduler.hpp"
+#include "Truncation.hpp"
+
+#include <map>
+#include <mutex>
+
+// C entry points called by generated code.
+//
+// The runtime is header-only, but generated assembly needs real symbols to call, so every entry
+// point is defined here, once, out of line. Link this file into every program built from the
+// compiler's output (and into any benchmark that calls the entry points directly).
+
+// Allocator.hpp
+extern "C" void* xec_arena_alloc(size_t size, size_t align) {
+    return xec::threadArena().allocate(size, align);
+}
+
+extern "C" void xec_arena_enter(size_t* mark) {
+    xec::Arena::Mark current = xec::threadArena().mark();
+    mark[0] = current.block;
+    mark[1] = current.offset;
+}
+
+extern "C" void xec_arena_exit(const size_t* mark) {
+    xec::threadArena().rewind({mark[0], mark[1]});
+}
+
+extern "C" void* xec_pool_alloc(size_t size) {
+    return xec::PoolAllocator::allocate(size);
+}
+
+extern "C" void xec_pool_free(void* pointer, size_t size) {
+    xec::PoolAllocator::free(pointer, size);
+}
+
+// RefCount.hpp
+extern "C" void* xec_rc_alloc(size_t size) {
+    size_t total = sizeof(xec::RcHeader) + size;
+    auto* header = new (xec::PoolAllocator::allocate(total)) xec::RcHeader();
+    header->size = static_cast<uint32_t>(total);
+    header->destroy = [](xec::RcHeader* object) {
+        size_t bytes = object->size;
+        object->~RcHeader();
+        xec::PoolAllocator::free(object, bytes);
+    };
+    return header + 1;
+}
+
+extern "C" void xec_rc_retain(void* object) {
+    xec::rcRetain(static_cast<xec::RcHeader*>(object) - 1);
+}
+
+extern "C" void xec_rc_release(void* object) {
+    if (!object) {
+        return;
+    }
+    xec::rcRelease(static_cast<xec::RcHeader*>(object) - 1);
+}
+
+extern "C" void xec_rc_collect() {
+    xec::rcCollect();
+}
+
+// EventLoop.hpp
+extern "C" xec::AsyncFrame* xec_async_frame(size_t size, void (*resume)(xec::AsyncFrame*)) {
+    return xec::allocateFrame(size, resume);
+}
+
+extern "C" int xec_await(xec::AsyncFrame* self, xec::AsyncFrame* child) {
+    return xec::awaitFrame(self, child);
+}
+
+extern "C" int64_t xec_async_take(xec::AsyncFrame* child) {
+    int64_t result = child->result;
+    xec::freeFrame(child);
+    return result;
+}
+
+extern "C" void xec_async_return(xec::AsyncFrame* frame, int64_t value) {
+    xec::completeFrame(frame, value);
+}
+
+extern "C" int xec_await_readable(xec::AsyncFrame* self, int fd) {
+    self->loop->awaitIo(self, fd, EPOLLIN);
+    return 1;
+}
+
+extern "C" int xec_await_writable(xec::AsyncFrame* self, int fd) {
+    self->loop->awaitIo(self, fd, EPOLLOUT);
+    return 1;
+}
+
+extern "C" int xec_await_sleep(xec::AsyncFrame* self, int64_t nanoseconds) {
+    self->loop->sleepFor(self, std::chrono::nanoseconds(nanoseconds));
+    return 1;
+}
+
+extern "C" void xec_async_spawn(xec::AsyncFrame* frame) {
+    xec::Scheduler::instance().spawn(frame);
+}
+
+extern "C" void xec_async_run() {
+    xec::Scheduler::instance().run();
+}
+
+// TaskScheduler.hpp
+extern "C" void* xec_task_group() {
+    return new (xec::PoolAllocator::allocate(sizeof(xec::TaskGroup))) xec::TaskGroup();
+}
+
+extern "C" void xec_task_spawn(void* group, void (*function)(void*), void* frame) {
+    xec::TaskScheduler::instance().spawn(*static_cast<xec::TaskGroup*>(group), [function, frame] { function(frame); });
+}
+
+extern "C" void xec_task_wait(void* group) {
+    auto* tasks = static_cast<xec::TaskGroup*>(group);
+    xec::TaskScheduler::instance().wait(*tasks);
+    tasks->~TaskGroup();
+    xec::PoolAllocator::free(tasks, sizeof(xec::TaskGroup));
+}
+
+extern "C" void xec_parallel_for(int64_t begin, int64_t end, int64_t grain,
+                                 void (*body)(void*, int64_t, int64_t), void* frame) {
+    if (begin >= end) {
+        return;
+    }
+    xec::TaskScheduler::instance().parallelFor(0, static_cast<size_t>(end - begin), static_cast<size_t>(std::max<int64_t>(grain, 0)),
+                                               [body, frame, begin](size_t lo, size_t hi) {
+                                                   body(frame, begin + static_cast<int64_t>(lo), begin + static_cast<int64_t>(hi));
+                                               });
+}
+
+// Channel.hpp
+namespace {
+
+// A channel with an RcHeader directly in front of it, so xec_rc_retain/xec_rc_release manage it
+// like any other heap object of generated code; the last release destroys it
+template <typename ChannelType>
+void* newCountedChannel(size_t slots) {
+    constexpr std::align_val_t align{alignof(ChannelType)};
+    constexpr size_t offset = (sizeof(xec::RcHeader) + alignof(ChannelType) - 1) / alignof(ChannelType) * alignof(ChannelType);
+    char* block = static_cast<char*>(::operator new(offset + sizeof(ChannelType), align));
+    ChannelType* channel;
+    try {
+        channel = new (block + offset) ChannelType(slots);
+    } catch (...) {
+        ::operator delete(block, align);
+        throw;
+    }
+    auto* header = new (reinterpret_cast<xec::RcHeader*>(block + offset) - 1) xec::RcHeader();
+    header->destroy = [](xec::RcHeader* object) {
+        char* start = reinterpret_cast<char*>(object + 1);
+        object->~RcHeader();
+        reinterpret_cast<ChannelType*>(start)->~ChannelType();
+        ::operator delete(start - offset, align);
+    };
+    return static_cast<xec::ChannelBase*>(channel);
+}
+
+} // namespace
+
+extern "C" void* xec_chan_new(int64_t capacity, int singleProducer) {
+    size_t slots = static_cast<size_t>(std::max<int64_t>(capacity, 1));
+    if (singleProducer) {
+        return newCountedChannel<xec::SpscChannel<int64_t>>(slots);
+    }
+    return newCountedChannel<xec::Channel<int64_t>>(slots);
+}
+
+extern "C" void xec_chan_free(void* channel) {
+    xec_rc_release(channel);
+}
+
+extern "C" void xec_chan_close(void* channel) {
+    static_cast<xec::ChannelBase*>(channel)->close();
+}
+
+extern "C" int xec_chan_send(void* channel, int64_t value) {
+    return xec::detail::withChannel(channel, [&](auto& typed) { return typed.send(value) ? 0 : xec::CHANNEL_CLOSED; });
+}
+
+extern "C" xec::ChannelReceive xec_chan_receive(void* channel) {
+    xec::ChannelReceive received{0, 0};
+    if (!xec::detail::withChannel(channel, [&](auto& typed) { return typed.receive(received.value); })) {
+        received.index = xec::CHANNEL_CLOSED;
+    }
+    return received;
+}
+
+extern "C" xec::ChannelReceive xec_chan_select(void* const* channels, int64_t count) {
+    xec::ChannelReceive received{0, 0};
+    received.index = xec::detail::selectAny(channels, static_cast<size_t>(count), received.value, [](auto... args) {
+        return xec::detail::blockOn(args...);
+    });
+    return received;
+}
+
+extern "C" int64_t xec_chan_send_batch(void* channel, int64_t* values, int64_t count) {
+    return static_cast<int64_t>(xec::detail::withChannel(channel, [&](auto& typed) {
+        return typed.sendBatch(values, static_cast<size_t>(count));
+    }));
+}
+
+extern "C" int64_t xec_chan_receive_batch(void* channel, int64_t* values, int64_t max) {
+    return static_cast<int64_t>(xec::detail::withChannel(channel, [&](auto& typed) {
+        return typed.receiveBatch(values, static_cast<size_t>(max));
+    }));
+}
+
+extern "C" int xec_chan_send_async(xec::AsyncFrame* frame, void* channel, int64_t value) {
+    int result = xec::detail::withChannel(channel, [&](auto& typed) { return typed.awaitSend(frame, value); });
+    frame->events = static_cast<uint32_t>(result);
+    return result == xec::CHANNEL_WAIT;
+}
+
+extern "C" int xec_chan_receive_async(xec::AsyncFrame* frame, void* channel) {
+    int64_t value = 0;
+    int result = xec::detail::withChannel(channel, [&](auto& typed) { return typed.awaitReceive(frame, value); });
+    frame->result = value;
+    frame->events = static_cast<uint32_t>(result);
+    return result == xec::CHANNEL_WAIT;
+}
+
+extern "C" int xec_chan_select_async(xec::AsyncFrame* frame, void* const* channels, int64_t count) {
+    int64_t value = 0;
+    int result = xec::detail::selectAny(channels, static_cast<size_t>(count), value, [frame](auto... args) {
+        return xec::detail::awaitOn(frame, args...);
+    });
+    frame->result = value;
+    frame->events = static_cast<uint32_t>(result);
+    return result == xec::CHANNEL_WAIT;
+}
+
+// Packet.hpp
+extern "C" void* xec_port_open(const char* spec) {
+    try {
+        return xec::openPort(spec).release();
+    } catch (const std::exception& error) {
+        std::fprintf(stderr, "xec: %s\n", error.what());
+        return nullptr;
+    }
+}
+
+extern "C" void xec_port_close(void* port) {
+    delete static_cast<xec::PacketPort*>(port);
+}
+
+extern "C" int64_t xec_port_receive_burst(void* port, xec::Packet** packets, int64_t max) {
+    return static_cast<int64_t>(static_cast<xec::PacketPort*>(port)->receiveBurst(packets, static_cast<size_t>(max)));
+}
+
+extern "C" int64_t xec_port_transmit_burst(void* port, xec::Packet** packets, int64_t count) {
+    return static_cast<int64_t>(static_cast<xec::PacketPort*>(port)->transmitBurst(packets, static_cast<size_t>(count)));
+}
+
+extern "C" int xec_port_exhausted(void* port) {
+    return static_cast<xec::PacketPort*>(port)->exhausted();
+}
+
+extern "C" void xec_packet_free(xec::Packet* packet) {
+    xec::freePackets(&packet, 1);
+}
+
+// Crypto.hpp
+extern "C" uint32_t xec_crc32c(const uint8_t* data, size_t length, uint32_t crc) {
+    return xec::crc32c(data, length, crc);
+}
+
+extern "C" uint64_t xec_xxh3(const uint8_t* data, size_t length, uint64_t seed) {
+    return xec::xxh3(data, length, seed);
+}
+
+extern "C" void* xec_aes_gcm_new(const uint8_t* key, size_t keyLength) {
+    return new xec::AesGcm(key, keyLength);
+}
+
+extern "C" void xec_aes_gcm_free(void* cipher) {
+    delete static_cast<xec::AesGcm*>(cipher);
+}
+
+extern "C" void xec_aes_gcm_encrypt(void* cipher, const uint8_t* iv, uint8_t* data, size_t length, uint8_t* tag) {
+    static_cast<xec::AesGcm*>(cipher)->encrypt(iv, nullptr, 0, data, length, tag);
+}
+
+extern "C" int xec_aes_gcm_decrypt(void* cipher, const uint8_t* iv, uint8_t* data, size_t length, const uint8_t* tag) {
+    return static_cast<xec::AesGcm*>(cipher)->decrypt(iv, nullptr, 0, data, length, tag);
+}
+
+// Profile.hpp
+extern "C" void xec_profile_register(xec::ProfileModule* module) {
+    xec::ProfileRuntime::registerModule(module);
+}
+
+// Pipeline.hpp, and the packet stages declared in Packet.hpp
+namespace {
+
+// What a lowered `pipeline { }` builds: a chunk pipeline from a named source, or a packet program
+// from a port. The first failure is kept, and the calls after it do nothing.
+struct ProgramPipeline {
+    std::unique_ptr<xec::Pipeline> chunks;
+    bool hasSink = false;
+    std::unique_ptr<xec::PacketPort> input;
+    std::unique_ptr<xec::PacketPort> output;
+    std::vector<std::function<void(xec::PacketHeaders*, size_t)>> packetStages;
+    std::atomic<uint64_t> records{0};  // Found by parse()
+    std::string error;
+};
+
+struct HostBindings {
+    std::mutex mutex;
+    std::map<std::string, xec::SourceFactory> sources;
+    std::map<std::string, xec::SinkFactory> sinks;
+    std::map<std::string, xec::PortFactory> ports;
+};
+
+HostBindings& hostBindings() {
+    static HostBindings bindings;
+    return bindings;
+}
+
+template <typename Factory>
+Factory boundFactory(const std::map<std::string, Factory>& factories, const std::string& key) {
+    std::lock_guard<std::mutex> lock(hostBindings().mutex);
+    auto found = factories.find(key);
+    return found == factories.end() ? Factory() : found->second;
+}
+
+// Applies one call to the handle unless an earlier one failed
+template <typename Build>
+void build(void* handle, Build apply) {
+    auto* pipeline = static_cast<ProgramPipeline*>(handle);
+    if (!pipeline->error.empty()) {
+        return;
+    }
+    try {
+        apply(*pipeline);
+    } catch (const std::exception& error) {
+        pipeline->error = error.what();
+    }
+}
+
+xec::Pipeline& chunkPipeline(ProgramPipeline& pipeline, const char* stage) {
+    if (!pipeline.chunks) {
+        throw std::runtime_error(std::string(stage) + "() needs a chunk source, not a packet source");
+    }
+    if (pipeline.hasSink) {
+        throw std::runtime_error(std::string(stage) + "() after writeTo(), which must end the pipeline");
+    }
+    return *pipeline.chunks;
+}
+
+ProgramPipeline& packetProgram(ProgramPipeline& pipeline, const char* stage) {
+    if (!pipeline.input) {
+        throw std::runtime_error(std::string(stage) + "() needs a packet source such as replay()");
+    }
+    if (pipeline.output) {
+        throw std::runtime_error(std::string(stage) + "() after transmit(), which must end the pipeline");
+    }
+    return pipeline;
+}
+
+std::unique_ptr<xec::PacketPort> openProgramPort(const std::string& path, const std::string& spec) {
+    if (auto factory = boundFactory(hostBindings().ports, path)) {
+        return factory(spec);
+    }
+    return xec::openPort(spec);
+}
+
+void runPacketProgram(ProgramPipeline& program) {
+    xec::Packet* packets[xec::MAX_BURST];
+    xec::PacketHeaders headers[xec::MAX_BURST];
+    while (!program.input->exhausted()) {
+        size_t n = program.input->receiveBurst(packets, xec::MAX_BURST);
+        xec::parseHeadersBurst(packets, n, headers);
+        for (const auto& stage : program.packetStages) {
+            stage(headers, n);
+        }
+        for (size_t i = 0; i < n; i++) {
+            xec::updateTransportChecksum(*packets[i], headers[i]);
+        }
+        if (!program.output) {
+            xec::freePackets(packets, n);
+            continue;
+        }
+        for (size_t sent = 0; sent < n;) {
+            sent += program.output->transmitBurst(packets + sent, n - sent);
+        }
+    }
+    program.output.reset();  // Flushes
+}
+
+} // namespace
+
+void xec::bindSource(const std::string& name, SourceFactory factory) {
+    std::lock_guard<std::mutex> lock(hostBindings().mutex);
+    hostBindings().sources[name] = std::move(factory);
+}
+
+void xec::bindSink(const std::string& path, SinkFactory factory) {
+    std::lock_guard<std::mutex> lock(hostBindings().mutex);
+    hostBindings().sinks[path] = std::move(factory);
+}
+
+void xec::bindPort(const std::string& path, PortFactory factory) {
+    std::lock_guard<std::mutex> lock(hostBindings().mutex);
+    hostBindings().ports[path] = std::move(factory);
+}
+
+xec::PipelineOptions& xec::programPipelineOptions() {
+    static PipelineOptions options = [] {
+        PipelineOptions defaults;
+        if (const char* workers = std::getenv("XEC_WORKERS")) {
+            defaults.workers = static_cast<unsigned>(std::max(1, std::atoi(workers)));
+        }
+        return defaults;
+    }();
+    return options;
+}
+
+extern "C" void* xec_pipeline_from(const char* source) {
+    auto* pipeline = new ProgramPipeline();
+    build(pipeline, [source](ProgramPipeline& program) {
+        program.chunks = std::make_unique<xec::Pipeline>(xec::programPipelineOptions());
+        if (auto factory = boundFactory(hostBindings().sources, source)) {
+            program.chunks->from(factory(source));
+            return;
+        }
+        const char* path = std::getenv(("XEC_SOURCE_" + std::string(source)).c_str());
+        if (!path) {
+            throw std::runtime_error("No input bound to " + std::string(source) + "; set XEC_SOURCE_" + source);
+        }
+        program.chunks->from(std::make_unique<xec::MappedFileSource>(path));
+    });
+    return pipeline;
+}
+
+extern "C" void xec_stage_splitChunks(void* pipeline, int64_t size) {
+    build(pipeline, [size](ProgramPipeline& program) {
+        xec::SplitOptions split;
+        if (size > 0) {
+            split.size = static_cast<size_t>(size);
+        }
+        chunkPipeline(program, "splitChunks").then(std::make_unique<xec::SplitChunksStage>(split));
+    });
+}
+
+// Counts newline-terminated records; stateless, so it fans out over the workers
+extern "C" void xec_stage_parse(void* pipeline) {
+    build(pipeline, [](ProgramPipeline& program) {
+        std::atomic<uint64_t>* records = &program.records;
+        chunkPipeline(program, "parse").then(xec::makeMapStage("parse", [records](xec::Chunk& chunk) {
+            uint64_t found = 0;
+            for (const uint8_t* p = chunk.begin(); (p = static_cast<const uint8_t*>(std::memchr(p, '\n', chunk.end() - p)));) {
+                found++;
+                p++;
+            }
+            records->fetch_add(found, std::memory_order_relaxed);
+        }));
+    });
+}
+
+extern "C" void xec_stage_truncate(void* pipeline, int64_t maxChunks, int64_t limit, const char* policy) {
+    build(pipeline, [=](ProgramPipeline& program) {
+        xec::TruncationLimits limits;
+        if (maxChunks > 0) {
+            limits.maxChunks = static_cast<size_t>(maxChunks);
+        }
+        if (limit > 0) {
+            limits.maxBytes = static_cast<size_t>(limit);
+        }
+        std::string name = policy ? policy : "fifo";
+        if (name == "fifo") {
+            limits.policy = xec::TruncationPolicy::FIFO;
+        } else if (name == "lifo") {
+            limits.policy = xec::TruncationPolicy::LIFO;
+        } else if (name == "threshold") {
+            limits.policy = xec::TruncationPolicy::THRESHOLD;
+        } else {
+            throw std::runtime_error("Unknown truncate policy '" + name + "'");
+        }
+        chunkPipeline(program, "truncate").then(std::make_unique<xec::TruncateStage>(limits));
+    });
+}
+
+extern "C" void xec_stage_serialize(void* pipeline, const char* format) {
+    build(pipeline, [format](ProgramPipeline& program) {
+        if (format && std::string(format) != "binary") {
+            throw std::runtime_error("Unknown serialize format '" + std::string(format) + "'");
+        }
+        chunkPipeline(program, "serialize").then(std::make_unique<xec::SerializeStage>());
+    });
+}
+
+extern "C" void xec_stage_encryptData(void* pipeline, const char* key) {
+    build(pipeline, [key](ProgramPipeline& program) {
+        if (!key) {
+            throw std::runtime_error("encryptData() needs a key");
+        }
+        chunkPipeline(program, "encryptData")
+            .then(std::make_unique<xec::SealStage>(reinterpret_cast<const uint8_t*>(key), std::strlen(key)));
+    });
+}
+
+extern "C" void xec_stage_writeTo(void* pipeline, const char* path) {
+    build(pipeline, [path](ProgramPipeline& program) {
+        if (!path) {
+            throw std::runtime_error("writeTo() needs a path");
+        }
+        xec::Pipeline& chunks = chunkPipeline(program, "writeTo");
+        if (auto factory = boundFactory(hostBindings().sinks, path)) {
+            chunks.to(factory(path));
+        } else {
+            chunks.to(std::make_unique<xec::FileSink>(path));
+        }
+        program.hasSink = true;
+    });
+}
+
+extern "C" int xec_pipeline_run(void* pipeline) {
+    std::unique_ptr<ProgramPipeline> program(static_cast<ProgramPipeline*>(pipeline));
+    build(pipeline, [](ProgramPipeline& built) {
+        if (built.input) {
+            runPacketProgram(built);
+        } else if (!built.hasSink) {
+            throw std::runtime_error("Pipeline has no writeTo()");
+        } else {
+            built.chunks->run();
+        }
+    });
+    if (!program->error.empty()) {
+        std::fprintf(stderr, "xec: pipeline: %s\n", program->error.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+extern "C" void* xec_source_replay(const char* path, int64_t replays) {
+    auto* pipeline = new ProgramPipeline();
+    build(pipeline, [=](ProgramPipeline& program) {
+        if (!path) {
+            throw std::runtime_error("replay() needs a capture file");
+        }
+        program.input = openProgramPort(path, "pcap:" + std::string(path) + ":" + std::to_string(replays > 0 ? replays : 1));
+    });
+    return pipeline;
+}
+
+extern "C" void xec_stage_modifyHeader(void* pipeline, const char* flag) {
+    static const std::map<std::string, uint8_t> flags = {{"FIN", xec::TCP_FIN}, {"SYN", xec::TCP_SYN}, {"RST", xec::TCP_RST},
+                                                         {"PSH", xec::TCP_PSH}, {"ACK", xec::TCP_ACK}, {"URG", xec::TCP_URG}};
+    build(pipeline, [flag](ProgramPipeline& program) {
+        auto found = flags.find(flag ? flag : "");
+        if (found == flags.end()) {
+            throw std::runtime_error("Unknown TCP flag '" + std::string(flag ? flag : "") + "'");
+        }
+        uint8_t bit = found->second;
+        packetProgram(program, "modifyHeader").packetStages.push_back([bit](xec::PacketHeaders* headers, size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                if (headers[i].tcp) {
+                    headers[i].tcp.setFlags(headers[i].tcp.flags() | bit);
+                }
+            }
+        });
+    });
+}
+
+// Overwrites the start of each payload, never past its end
+extern "C" void xec_stage_modifyPayload(void* pipeline, const char* data) {
+    build(pipeline, [data](ProgramPipeline& program) {
+        std::string bytes = data ? data : "";
+        packetProgram(program, "modifyPayload").packetStages.push_back([bytes](xec::PacketHeaders* headers, size_t n) {
+            for (size_t i = 0; i < n; i++) {
+                std::memcpy(headers[i].payload, bytes.data(), std::min(bytes.size(), headers[i].payloadLength));
+            }
+        });
+    });
+}
+
+extern "C" void xec_stage_transmit(void* pipeline, const char* path) {
+    build(pipeline, [path](ProgramPipeline& program) {
+        if (!path) {
+            throw std::runtime_error("transmit() needs a capture file");
+        }
+        packetProgram(program, "transmit").output = openProgramPort(path, "pcap-out:" + std::string(path));
+    });
+}
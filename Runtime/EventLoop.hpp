@@ -0,0 +1,376 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <pthread.h>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "Allocator.hpp"
+
+// Event loop for stackless coroutines (`async function` / `await`).
+//
+// The compiler lowers an async function into a frame holding the locals that live across an
+// await, plus a resume function that switches on the frame's state and runs to the next await.
+// Suspending is therefore a return, and a waiting coroutine costs its frame (tens of bytes plus
+// its locals) instead of a thread stack. Hand-written runtime code can use the same protocol by
+// deriving from AsyncFrame.
+//
+// Each EventLoop is single-threaded: ready frames run in FIFO order, I/O waits are one-shot epoll
+// registrations, and sleeps sit in a timer heap. A Scheduler runs one loop per core and spreads
+// spawned coroutines across them; a coroutine and everything it awaits stays on its loop, so
+// frames are never touched by two threads. Other threads hand work to a loop through post() and
+// resume its waiting frames through wakeFrame().
+
+namespace xec {
+
+class EventLoop;
+
+struct AsyncFrame {
+    void (*resume)(AsyncFrame*) = nullptr; // Runs from `state` to the next await or completion
+    uint32_t state = 0;
+    uint32_t events = 0;                   // epoll events that ended the last I/O wait
+    int64_t result = 0;
+    AsyncFrame* continuation = nullptr;    // Frame awaiting this one
+    AsyncFrame* nextReady = nullptr;
+    EventLoop* loop = nullptr;
+    void* waitSignal = nullptr;            // Channel wait in progress (Channel.hpp)
+    uint32_t size = 0;                     // Non-zero when allocated by allocateFrame
+    bool done = false;
+    bool detached = false;                 // Spawned: nobody awaits it, it frees itself
+};
+
+// Zeroed frame of `size` bytes (at least sizeof(AsyncFrame)) from the runtime pools
+inline AsyncFrame* allocateFrame(size_t size, void (*resume)(AsyncFrame*)) {
+    size = std::max(size, sizeof(AsyncFrame));
+    void* memory = PoolAllocator::allocate(size);
+    std::memset(memory, 0, size);
+    auto* frame = new (memory) AsyncFrame();
+    frame->resume = resume;
+    frame->size = static_cast<uint32_t>(size);
+    return frame;
+}
+
+inline void freeFrame(AsyncFrame* frame) {
+    if (frame->size) {
+        PoolAllocator::free(frame, frame->size);
+    }
+}
+
+class Scheduler;
+
+class EventLoop {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    EventLoop() {
+        epoll = epoll_create1(EPOLL_CLOEXEC);
+        wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epoll < 0 || wake < 0) {
+            throw std::runtime_error(std::string("Cannot create event loop: ") + std::strerror(errno));
+        }
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.ptr = nullptr;
+        epoll_ctl(epoll, EPOLL_CTL_ADD, wake, &event);
+    }
+
+    ~EventLoop() {
+        close(wake);
+        close(epoll);
+    }
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // Start a coroutine on this loop; loop thread only
+    void spawn(AsyncFrame* frame) {
+        frame->loop = this;
+        frame->detached = true;
+        roots++;
+        schedule(frame);
+    }
+
+    // Start a coroutine on this loop from any thread
+    void post(AsyncFrame* frame) {
+        {
+            std::lock_guard<std::mutex> lock(inboxMutex);
+            inbox.push_back(frame);
+        }
+        uint64_t one = 1;
+        ssize_t written = write(wake, &one, sizeof(one));
+        (void)written;
+    }
+
+    // Resume a suspended frame of this loop from any thread
+    void wakeFrame(AsyncFrame* frame) {
+        if (running == this) {
+            schedule(frame);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(inboxMutex);
+            woken.push_back(frame);
+        }
+        uint64_t one = 1;
+        ssize_t written = write(wake, &one, sizeof(one));
+        (void)written;
+    }
+
+    void schedule(AsyncFrame* frame) {
+        frame->nextReady = nullptr;
+        if (readyTail) {
+            readyTail->nextReady = frame;
+        } else {
+            readyHead = frame;
+        }
+        readyTail = frame;
+    }
+
+    // Resume `frame` once `fd` is ready for `events` (EPOLLIN, EPOLLOUT). One waiter per fd.
+    void awaitIo(AsyncFrame* frame, int fd, uint32_t events) {
+        epoll_event event{};
+        event.events = events | EPOLLONESHOT;
+        event.data.ptr = frame;
+        if (static_cast<size_t>(fd) >= registered.size()) {
+            registered.resize(std::max<size_t>(fd + 1, registered.size() * 2));
+        }
+        // Closing an fd drops its registration, so a reused fd number may need ADD again
+        if (!registered[fd] || epoll_ctl(epoll, EPOLL_CTL_MOD, fd, &event) != 0) {
+            if (epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+                throw std::runtime_error("Cannot wait on fd " + std::to_string(fd) + ": " + std::strerror(errno));
+            }
+            registered[fd] = 1;
+        }
+        ioWaiters++;
+    }
+
+    void sleepFor(AsyncFrame* frame, std::chrono::nanoseconds duration) {
+        timers.push({Clock::now() + duration, frame});
+    }
+
+    // Run frames until stop(), or for a standalone loop until every spawned coroutine finished
+    void run() {
+        std::vector<epoll_event> events(256);
+        EventLoop* outer = std::exchange(running, this);
+        while (!stopped.load(std::memory_order_acquire)) {
+            runReady();
+            if (!scheduler && roots == 0) {
+                break;
+            }
+            int timeout = -1;
+            if (!timers.empty()) {
+                auto wait = std::chrono::ceil<std::chrono::milliseconds>(timers.top().deadline - Clock::now());
+                timeout = static_cast<int>(std::max<int64_t>(wait.count(), 0));
+            }
+            int count = epoll_wait(epoll, events.data(), static_cast<int>(events.size()), timeout);
+            if (count < 0 && errno != EINTR) {
+                throw std::runtime_error(std::string("epoll_wait failed: ") + std::strerror(errno));
+            }
+            for (int i = 0; i < count; i++) {
+                auto* frame = static_cast<AsyncFrame*>(events[i].data.ptr);
+                if (!frame) {
+                    takeInbox();
+                    continue;
+                }
+                frame->events = events[i].events;
+                ioWaiters--;
+                schedule(frame);
+            }
+            for (auto now = Clock::now(); !timers.empty() && timers.top().deadline <= now;) {
+                schedule(timers.top().frame);
+                timers.pop();
+            }
+        }
+        running = outer;
+    }
+
+    void stop() {
+        stopped.store(true, std::memory_order_release);
+        uint64_t one = 1;
+        ssize_t written = write(wake, &one, sizeof(one));
+        (void)written;
+    }
+
+    // A spawned coroutine completed
+    void rootFinished();
+
+    size_t pendingIo() const { return ioWaiters; }
+
+private:
+    friend class Scheduler;
+
+    struct Timer {
+        Clock::time_point deadline;
+        AsyncFrame* frame;
+        bool operator>(const Timer& other) const { return deadline > other.deadline; }
+    };
+
+    int epoll = -1;
+    int wake = -1;
+    AsyncFrame* readyHead = nullptr;
+    AsyncFrame* readyTail = nullptr;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    std::vector<uint8_t> registered;
+    size_t ioWaiters = 0;
+    size_t roots = 0;
+    Scheduler* scheduler = nullptr;
+    std::atomic<bool> stopped{false};
+    std::mutex inboxMutex;
+    std::vector<AsyncFrame*> inbox;
+    std::vector<AsyncFrame*> woken;
+    static inline thread_local EventLoop* running = nullptr;
+
+    void runReady() {
+        while (readyHead) {
+            AsyncFrame* frame = readyHead;
+            readyHead = frame->nextReady;
+            if (!readyHead) {
+                readyTail = nullptr;
+            }
+            frame->resume(frame);
+        }
+    }
+
+    void takeInbox() {
+        uint64_t value;
+        ssize_t drained = read(wake, &value, sizeof(value));
+        (void)drained;
+        std::vector<AsyncFrame*> frames;
+        std::vector<AsyncFrame*> resumed;
+        {
+            std::lock_guard<std::mutex> lock(inboxMutex);
+            frames.swap(inbox);
+            resumed.swap(woken);
+        }
+        for (AsyncFrame* frame : frames) {
+            spawn(frame);
+        }
+        for (AsyncFrame* frame : resumed) {
+            schedule(frame);
+        }
+    }
+};
+
+// Awaiting another coroutine. Returns false when `child` finished without suspending; its
+// result can then be read straight away. Otherwise the caller returns and is resumed on completion.
+inline bool awaitFrame(AsyncFrame* self, AsyncFrame* child) {
+    child->loop = self->loop;
+    child->resume(child);
+    if (child->done) {
+        return false;
+    }
+    child->continuation = self;
+    return true;
+}
+
+inline void completeFrame(AsyncFrame* frame, int64_t value) {
+    frame->done = true;
+    frame->result = value;
+    if (frame->continuation) {
+        frame->loop->schedule(frame->continuation);
+    } else if (frame->detached) {
+        EventLoop* loop = frame->loop;
+        freeFrame(frame);
+        loop->rootFinished();
+    }
+}
+
+// One event loop per core; spawned coroutines are spread round-robin and stay where they start
+class Scheduler {
+public:
+    explicit Scheduler(unsigned threads = std::max(1u, std::thread::hardware_concurrency())) {
+        for (unsigned i = 0; i < threads; i++) {
+            loops.push_back(std::make_unique<EventLoop>());
+            loops.back()->scheduler = this;
+        }
+    }
+
+    void spawn(AsyncFrame* frame) {
+        outstanding.fetch_add(1, std::memory_order_relaxed);
+        loops[next.fetch_add(1, std::memory_order_relaxed) % loops.size()]->post(frame);
+    }
+
+    // Run until every spawned coroutine has finished; loop i runs on core i where allowed
+    void run() {
+        if (outstanding.load() == 0) {
+            return;
+        }
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < loops.size(); i++) {
+            threads.emplace_back([this, i] {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(i % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+                pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus); // Best effort
+                loops[i]->run();
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        for (auto& loop : loops) {
+            loop->stopped.store(false);
+        }
+    }
+
+    size_t size() const { return loops.size(); }
+
+    static Scheduler& instance() {
+        static Scheduler scheduler;
+        return scheduler;
+    }
+
+private:
+    friend class EventLoop;
+
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    std::atomic<size_t> outstanding{0};
+    std::atomic<size_t> next{0};
+
+    void finished() {
+        if (outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            for (auto& loop : loops) {
+                loop->stop();
+            }
+        }
+    }
+};
+
+inline void EventLoop::rootFinished() {
+    roots--;
+    if (scheduler) {
+        scheduler->finished();
+    }
+}
+
+} // namespace xec
+
+// Entry points for lowered async functions, defined in EntryPoints.cpp. Each await in generated
+// code is
+//     mov dword [frame + state], k ; call xec_await* ; test eax, eax ; jnz .Lsuspend ; .Lstate_k:
+// and the resume function's jump table continues at .Lstate_k when the frame is resumed.
+extern "C" xec::AsyncFrame* xec_async_frame(size_t size, void (*resume)(xec::AsyncFrame*));
+extern "C" int xec_await(xec::AsyncFrame* self, xec::AsyncFrame* child);
+
+// Result of a finished child frame, which is freed
+extern "C" int64_t xec_async_take(xec::AsyncFrame* child);
+extern "C" void xec_async_return(xec::AsyncFrame* frame, int64_t value);
+extern "C" int xec_await_readable(xec::AsyncFrame* self, int fd);
+extern "C" int xec_await_writable(xec::AsyncFrame* self, int fd);
+extern "C" int xec_await_sleep(xec::AsyncFrame* self, int64_t nanoseconds);
+extern "C" void xec_async_spawn(xec::AsyncFrame* frame);
+extern "C" void xec_async_run();
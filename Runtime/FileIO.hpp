@@ -0,0 +1,572 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "Pipeline.hpp"
+
+// File endpoints for pipelines: `inputFile | ...` and `writeTo("output.dat")`.
+//
+// MappedFileSource maps the whole file privately and hands out slices of the mapping, so chunks
+// reach downstream stages without a copy; the kernel is told the access is sequential and asked
+// to read ahead of the cursor. The mapping is copy-on-write, so stages that work in place (such
+// as decryption) may write to the chunks without touching the file.
+//
+// FileSink writes chunks asynchronously at increasing offsets. It submits batches of writes
+// through io_uring when the kernel allows it (talking to the ring directly; no liburing) and
+// otherwise falls back to a small pool of threads calling pwrite. Stages that produce output can
+// take their buffers from the sink with acquireBuffer(): those buffers are registered with the
+// ring once up front and are written with IORING_OP_WRITE_FIXED.
+
+namespace xec {
+
+inline std::runtime_error systemError(const std::string& what) {
+    return std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+class MappedFileSource : public Source, private Checkpointable {
+public:
+    explicit MappedFileSource(const std::string& path, size_t chunkSize = 256 << 10, size_t readAheadChunks = 16)
+        : chunkSize(chunkSize), readAhead(chunkSize * readAheadChunks) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw systemError("Cannot open " + path);
+        }
+        struct stat info {};
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw systemError("Cannot stat " + path);
+        }
+        size = static_cast<size_t>(info.st_size);
+        if (size > 0) {
+            void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+            if (address == MAP_FAILED) {
+                close(fd);
+                throw systemError("Cannot map " + path);
+            }
+            madvise(address, size, MADV_SEQUENTIAL);
+            size_t length = size;
+            // Chunks alias the mapping; it goes away with the last of them
+            mapping = std::shared_ptr<uint8_t>(static_cast<uint8_t*>(address), [length](uint8_t* base) {
+                munmap(base, length);
+            });
+        }
+        close(fd);
+    }
+
+    bool next(Chunk& chunk) override {
+        if (offset >= size) {
+            return false;
+        }
+        // Keep a window of readahead in front of the cursor, one chunk's worth at a time
+        if (offset + readAhead < size && offset % chunkSize == 0) {
+            size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            size_t start = (offset + readAhead) & ~(page - 1);
+            madvise(mapping.get() + start, std::min(chunkSize, size - start), MADV_WILLNEED);
+        }
+        size_t length = std::min(chunkSize, size - offset);
+        chunk.data = std::shared_ptr<uint8_t>(mapping, mapping.get() + offset);
+        chunk.size = length;
+        chunk.sequence = sequence++;
+        offset += length;
+        return true;
+    }
+
+    size_t fileSize() const {
+        return size;
+    }
+
+    // Resumes at the saved offset
+    Checkpointable* checkpointable() override { return this; }
+
+private:
+    std::shared_ptr<uint8_t> mapping;
+    size_t size = 0;
+    size_t chunkSize;
+    size_t readAhead;
+    size_t offset = 0;
+    uint64_t sequence = 0;
+
+    void saveState(StateWriter& out) override {
+        out.u64(offset);
+        out.u64(sequence);
+    }
+
+    void loadState(StateReader& in) override {
+        offset = static_cast<size_t>(in.u64());
+        sequence = in.u64();
+        if (offset > size) {
+            throw std::runtime_error("Checkpoint is past the end of the input file");
+        }
+    }
+};
+
+// Page-aligned buffers allocated once, for registration with the kernel. Chunks handed out by
+// acquire() return their buffer to the pool when the last reference drops.
+class RegisteredBuffers {
+public:
+    RegisteredBuffers(size_t count, size_t bufferSize) : bufferSize(bufferSize), state(std::make_shared<State>()) {
+        for (size_t i = 0; i < count; i++) {
+            void* memory = std::aligned_alloc(4096, (bufferSize + 4095) & ~size_t(4095));
+            if (!memory) {
+                throw std::bad_alloc();
+            }
+            state->buffers.push_back(static_cast<uint8_t*>(memory));
+            state->free.push_back(i);
+        }
+    }
+
+    ~RegisteredBuffers() {
+        // Outstanding chunks keep `state` alive; the memory itself is freed with the last of them
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->closed = true;
+        for (size_t index : state->free) {
+            std::free(state->buffers[index]);
+            state->buffers[index] = nullptr;
+        }
+    }
+
+    // Blocks while every buffer is in flight, which throttles the producer to the disk
+    Chunk acquire(size_t size, uint64_t sequence = 0) {
+        if (size > bufferSize) {
+            throw std::runtime_error("Requested " + std::to_string(size) + " bytes from " +
+                                     std::to_string(bufferSize) + "-byte registered buffers");
+        }
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->available.wait(lock, [this] { return !state->free.empty(); });
+        size_t index = state->free.back();
+        state->free.pop_back();
+        std::shared_ptr<State> owner = state;
+        std::shared_ptr<uint8_t> data(state->buffers[index], [owner, index](uint8_t* buffer) {
+            std::lock_guard<std::mutex> lock(owner->mutex);
+            if (owner->closed) {
+                std::free(buffer);
+                return;
+            }
+            owner->free.push_back(index);
+            owner->available.notify_one();
+        });
+        return {std::move(data), size, sequence};
+    }
+
+    // Index of the registered buffer containing [data, data + size), or -1
+    int indexOf(const uint8_t* data, size_t size) const {
+        for (size_t i = 0; i < state->buffers.size(); i++) {
+            const uint8_t* base = state->buffers[i];
+            if (data >= base && data + size <= base + bufferSize) {
+                return static_cast<int>(i);
+            }
+        }
+        return -1;
+    }
+
+    std::vector<iovec> iovecs() const {
+        std::vector<iovec> vectors;
+        for (uint8_t* buffer : state->buffers) {
+            vectors.push_back({buffer, bufferSize});
+        }
+        return vectors;
+    }
+
+private:
+    struct State {
+        std::mutex mutex;
+        std::condition_variable available;
+        std::vector<uint8_t*> buffers;
+        std::vector<size_t> free;
+        bool closed = false;
+    };
+
+    size_t bufferSize;
+    std::shared_ptr<State> state;
+};
+
+class WriteBackend {
+public:
+    virtual ~WriteBackend() = default;
+    virtual std::string name() const = 0;
+
+    // Queue a write; the backend keeps the chunk alive until it is on disk
+    virtual void write(Chunk chunk, uint64_t offset) = 0;
+
+    // Wait for every queued write; throws the first error seen
+    virtual void flush() = 0;
+};
+
+inline void writeFully(int fd, const uint8_t* data, size_t size, uint64_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, static_cast<off_t>(offset));
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw systemError("Write failed");
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+        offset += static_cast<uint64_t>(written);
+    }
+}
+
+class ThreadPoolWriter : public WriteBackend {
+public:
+    ThreadPoolWriter(int fd, unsigned threads, size_t maxQueued) : fd(fd), maxQueued(maxQueued) {
+        for (unsigned i = 0; i < std::max(1u, threads); i++) {
+            workers.emplace_back([this] { run(); });
+        }
+    }
+
+    ~ThreadPoolWriter() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    std::string name() const override { return "pwrite"; }
+
+    void write(Chunk chunk, uint64_t offset) override {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return queue.size() < maxQueued; });
+        queue.push_back({std::move(chunk), offset});
+        pending++;
+        changed.notify_all();
+    }
+
+    void flush() override {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return pending == 0; });
+        if (!error.empty()) {
+            throw std::runtime_error(error);
+        }
+    }
+
+private:
+    struct Request {
+        Chunk chunk;
+        uint64_t offset;
+    };
+
+    int fd;
+    size_t maxQueued;
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Request> queue;
+    size_t pending = 0;
+    bool stopping = false;
+    std::string error;
+    std::vector<std::thread> workers;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            changed.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) {
+                return;
+            }
+            Request request = std::move(queue.front());
+            queue.pop_front();
+            changed.notify_all();
+            lock.unlock();
+            std::string failure;
+            try {
+                writeFully(fd, request.chunk.begin(), request.chunk.size, request.offset);
+            } catch (const std::exception& e) {
+                failure = e.what();
+            }
+            request.chunk = {};
+            lock.lock();
+            if (!failure.empty() && error.empty()) {
+                error = failure;
+            }
+            pending--;
+            changed.notify_all();
+        }
+    }
+};
+
+class IoUringWriter : public WriteBackend {
+public:
+    // Null when the kernel has no io_uring or it is blocked (seccomp, containers)
+    static std::unique_ptr<IoUringWriter> create(int fd, unsigned depth, unsigned batch, const RegisteredBuffers* buffers) {
+        io_uring_params params{};
+        int ring = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+        if (ring < 0) {
+            return nullptr;
+        }
+        std::unique_ptr<IoUringWriter> writer(new IoUringWriter(fd, ring, params, batch));
+        if (!writer->mapRings(params)) {
+            return nullptr;
+        }
+        if (buffers) {
+            auto vectors = buffers->iovecs();
+            if (syscall(__NR_io_uring_register, ring, IORING_REGISTER_BUFFERS, vectors.data(), vectors.size()) == 0) {
+                writer->registered = buffers;
+            }
+        }
+        return writer;
+    }
+
+    ~IoUringWriter() override {
+        try {
+            flush();
+        } catch (...) {
+        }
+        if (sqRing != MAP_FAILED) {
+            munmap(sqRing, sqRingSize);
+        }
+        if (cqRing != MAP_FAILED) {
+            munmap(cqRing, cqRingSize);
+        }
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqesSize);
+        }
+        close(ring);
+    }
+
+    std::string name() const override { return registered ? "io_uring (registered buffers)" : "io_uring"; }
+
+    void write(Chunk chunk, uint64_t offset) override {
+        // A free slot is needed both in the submission queue and in our in-flight table
+        while (freeSlots.empty()) {
+            enter(1);
+        }
+        size_t slot = freeSlots.back();
+        freeSlots.pop_back();
+
+        unsigned tail = *sqTail;
+        io_uring_sqe& sqe = static_cast<io_uring_sqe*>(sqes)[tail & *sqMask];
+        std::memset(&sqe, 0, sizeof(sqe));
+        int index = registered ? registered->indexOf(chunk.begin(), chunk.size) : -1;
+        sqe.opcode = index >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe.fd = fd;
+        sqe.off = offset;
+        sqe.addr = reinterpret_cast<uint64_t>(chunk.begin());
+        sqe.len = static_cast<uint32_t>(chunk.size);
+        sqe.buf_index = static_cast<uint16_t>(index >= 0 ? index : 0);
+        sqe.user_data = slot;
+        sqArray[tail & *sqMask] = tail & *sqMask;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+        inFlight[slot] = {std::move(chunk), offset};
+        unsubmitted++;
+        if (unsubmitted >= batch) {
+            enter(0);
+        }
+    }
+
+    void flush() override {
+        while (freeSlots.size() < inFlight.size() || unsubmitted > 0) {
+            enter(freeSlots.size() < inFlight.size() ? 1 : 0);
+        }
+        if (!error.empty()) {
+            std::string message = error;
+            error.clear();
+            throw std::runtime_error(message);
+        }
+    }
+
+private:
+    struct Request {
+        Chunk chunk;
+        uint64_t offset = 0;
+    };
+
+    int fd;
+    int ring;
+    unsigned batch;
+    unsigned unsubmitted = 0;
+    const RegisteredBuffers* registered = nullptr;
+    std::vector<Request> inFlight;
+    std::vector<size_t> freeSlots;
+    std::string error;
+
+    void* sqRing = MAP_FAILED;
+    void* cqRing = MAP_FAILED;
+    void* sqes = MAP_FAILED;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    size_t sqesSize = 0;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    IoUringWriter(int fd, int ring, const io_uring_params& params, unsigned batch)
+        : fd(fd), ring(ring), batch(std::max(1u, batch)), inFlight(params.sq_entries) {
+        for (size_t i = params.sq_entries; i-- > 0;) {
+            freeSlots.push_back(i);
+        }
+    }
+
+    bool mapRings(const io_uring_params& params) {
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+        cqRing = mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+        sqes = mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES);
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+            return false;
+        }
+        auto* sq = static_cast<uint8_t*>(sqRing);
+        auto* cq = static_cast<uint8_t*>(cqRing);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    // Submit whatever is queued, wait for at least `minComplete` completions, then reap them all
+    void enter(unsigned minComplete) {
+        unsigned flags = minComplete ? IORING_ENTER_GETEVENTS : 0;
+        long result = syscall(__NR_io_uring_enter, ring, unsubmitted, minComplete, flags, nullptr, 0);
+        if (result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            throw systemError("io_uring_enter failed");
+        }
+        if (result > 0) {
+            unsubmitted -= std::min<unsigned>(unsubmitted, static_cast<unsigned>(result));
+        }
+        reap();
+    }
+
+    void reap() {
+        unsigned head = *cqHead;
+        while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+            const io_uring_cqe& cqe = cqes[head & *cqMask];
+            Request& request = inFlight[cqe.user_data];
+            if (cqe.res < 0) {
+                if (error.empty()) {
+                    error = std::string("Write failed: ") + std::strerror(-cqe.res);
+                }
+            } else if (static_cast<size_t>(cqe.res) < request.chunk.size) {
+                // Short writes are rare enough to finish synchronously
+                size_t done = static_cast<size_t>(cqe.res);
+                writeFully(fd, request.chunk.begin() + done, request.chunk.size - done, request.offset + done);
+            }
+            request.chunk = {};
+            freeSlots.push_back(cqe.user_data);
+            head++;
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+    }
+};
+
+struct FileSinkOptions {
+    unsigned queueDepth = 64;       // Writes in flight
+    unsigned submitBatch = 8;       // io_uring: SQEs queued before one io_uring_enter
+    size_t bufferCount = 32;        // Registered buffers offered through acquireBuffer()
+    size_t bufferSize = 256 << 10;
+    unsigned fallbackThreads = 4;   // pwrite threads when io_uring is unavailable
+    bool forceThreadPool = false;
+    bool resume = false;            // Keep the file so a checkpointed run can continue it
+};
+
+// With `resume`, an existing file is kept: loading a checkpoint cuts it back to the length saved
+// there, and finish() cuts off anything a previous run wrote past the end of this one.
+class FileSink : public Sink, private Checkpointable {
+public:
+    explicit FileSink(const std::string& path, FileSinkOptions options = {})
+        : path(path), resume(options.resume), buffers(options.bufferCount, options.bufferSize) {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | (resume ? 0 : O_TRUNC) | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw systemError("Cannot create " + path);
+        }
+        if (!options.forceThreadPool) {
+            backend = IoUringWriter::create(fd, options.queueDepth, options.submitBatch, &buffers);
+        }
+        if (!backend) {
+            backend = std::make_unique<ThreadPoolWriter>(fd, options.fallbackThreads, options.queueDepth);
+        }
+    }
+
+    ~FileSink() override {
+        backend.reset();
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    // A buffer that can be written without the kernel pinning pages per request
+    Chunk acquireBuffer(size_t size, uint64_t sequence = 0) {
+        return buffers.acquire(size, sequence);
+    }
+
+    void consume(Chunk chunk) override {
+        size_t size = chunk.size;
+        backend->write(std::move(chunk), offset);
+        offset += size;
+    }
+
+    void finish() override {
+        backend->flush();
+        if (resume && ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+            throw systemError("Cannot truncate " + path);
+        }
+    }
+
+    std::string backendName() const {
+        return backend->name();
+    }
+
+    uint64_t bytesWritten() const {
+        return offset;
+    }
+
+    // The bytes written so far, made durable first
+    Checkpointable* checkpointable() override { return this; }
+
+private:
+    std::string path;
+    bool resume;
+    int fd = -1;
+    uint64_t offset = 0;
+    RegisteredBuffers buffers;
+    std::unique_ptr<WriteBackend> backend;
+
+    // The checkpoint may only claim what is on disk, so this is the one place the sink waits
+    void saveState(StateWriter& out) override {
+        backend->flush();
+        if (fdatasync(fd) != 0) {
+            throw systemError("Cannot sync " + path);
+        }
+        out.u64(offset);
+    }
+
+    void loadState(StateReader& in) override {
+        offset = in.u64();
+        if (ftruncate(fd, static_cast<off_t>(offset)) != 0) {
+            throw systemError("Cannot truncate " + path);
+        }
+    }
+};
+
+} // namespace xec
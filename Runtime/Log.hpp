@@ -0,0 +1,454 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Logging for the compiler and runtime: `Logger::log("Inlined ", callee, " into ", caller)`.
+//
+// A call neither formats nor locks. It encodes its arguments into a binary record (strings copied,
+// numbers stored as they are) in a ring buffer owned by the calling thread. A background thread
+// drains every thread's ring, puts the records in timestamp order, formats them and writes them:
+// [LOG] and [PROFILE] lines to stdout, [WARNING] and [ERROR] to stderr. An error waits until it is
+// written, so the message explaining a failure is out before the caller exits. A thread whose ring
+// is full waits for the drain rather than lose records. The drain thread sleeps on a condition
+// variable between passes; a writer only signals it while it sleeps.
+//
+// Levels below XEC_LOG_LEVEL (0 debug, 1 log, 2 profile, 3 warning, 4 error; default 1) compile to
+// empty inline functions. Their arguments are still evaluated, so pass the pieces of a message
+// rather than building it: `Logger::debug("Handling ", node->value)`, not `"Handling " + node->value`.
+
+#ifndef XEC_LOG_LEVEL
+#define XEC_LOG_LEVEL 1
+#endif
+
+namespace xec {
+
+enum class LogLevel : uint8_t { DEBUG, LOG, PROFILE, WARNING, ERROR };
+
+namespace detail {
+
+// Record: {u32 size, u8 level, u8 arguments, u16 unused, u64 nanoseconds}, then per argument a
+// type byte and its value. Records are padded to 8 bytes; a record of level SKIP fills the end
+// of the ring when the next one does not fit there.
+constexpr size_t LOG_HEADER = 16;
+constexpr uint8_t LOG_SKIP = 0xff;
+constexpr size_t LOG_RING_BYTES = 256 << 10;
+constexpr size_t LOG_INLINE_STRING = 1024;  // Longer strings move to the heap and the record holds a pointer
+
+enum LogArgument : uint8_t { LOG_STRING, LOG_HEAP_STRING, LOG_SIGNED, LOG_UNSIGNED, LOG_DOUBLE, LOG_CHAR, LOG_BOOL };
+
+// Single producer (the owning thread), single consumer (the drain thread)
+struct LogRing {
+    std::unique_ptr<uint8_t[]> bytes{new uint8_t[LOG_RING_BYTES]};
+    alignas(64) std::atomic<uint64_t> head{0};  // Consumer
+    alignas(64) std::atomic<uint64_t> tail{0};  // Producer
+    std::atomic<bool> retired{false};           // Owning thread has exited
+};
+
+inline std::string_view logText(const std::string& value) { return value; }
+inline std::string_view logText(std::string_view value) { return value; }
+inline std::string_view logText(const char* value) { return value ? std::string_view(value) : std::string_view("(null)"); }
+
+template <typename T>
+constexpr bool isLogText = std::is_convertible_v<const T&, std::string_view> || std::is_same_v<std::decay_t<T>, char*> ||
+                           std::is_same_v<std::decay_t<T>, const char*>;
+
+template <typename T>
+size_t encodedSize(const T& value) {
+    if constexpr (isLogText<T>) {
+        size_t length = logText(value).size();
+        return 1 + (length > LOG_INLINE_STRING ? sizeof(std::string*) : 4 + length);
+    } else {
+        static_assert(std::is_arithmetic_v<T>, "Log arguments must be strings, characters, booleans or numbers");
+        return 1 + 8;
+    }
+}
+
+template <typename T>
+uint8_t* encode(uint8_t* out, const T& value) {
+    if constexpr (isLogText<T>) {
+        std::string_view text = logText(value);
+        if (text.size() > LOG_INLINE_STRING) {
+            *out++ = LOG_HEAP_STRING;
+            std::string* copy = new std::string(text);
+            std::memcpy(out, &copy, sizeof(copy));
+            return out + sizeof(copy);
+        }
+        *out++ = LOG_STRING;
+        uint32_t length = static_cast<uint32_t>(text.size());
+        std::memcpy(out, &length, 4);
+        std::memcpy(out + 4, text.data(), text.size());
+        return out + 4 + text.size();
+    } else if constexpr (std::is_same_v<T, bool>) {
+        *out++ = LOG_BOOL;
+        uint64_t word = value ? 1 : 0;
+        std::memcpy(out, &word, 8);
+        return out + 8;
+    } else if constexpr (std::is_same_v<T, char>) {
+        *out++ = LOG_CHAR;
+        uint64_t word = static_cast<unsigned char>(value);
+        std::memcpy(out, &word, 8);
+        return out + 8;
+    } else if constexpr (std::is_floating_point_v<T>) {
+        *out++ = LOG_DOUBLE;
+        double word = static_cast<double>(value);
+        std::memcpy(out, &word, 8);
+        return out + 8;
+    } else if constexpr (std::is_signed_v<T>) {
+        *out++ = LOG_SIGNED;
+        int64_t word = static_cast<int64_t>(value);
+        std::memcpy(out, &word, 8);
+        return out + 8;
+    } else {
+        *out++ = LOG_UNSIGNED;
+        uint64_t word = static_cast<uint64_t>(value);
+        std::memcpy(out, &word, 8);
+        return out + 8;
+    }
+}
+
+inline const char* logPrefix(LogLevel level) {
+    switch (level) {
+    case LogLevel::DEBUG: return "[DEBUG] ";
+    case LogLevel::LOG: return "[LOG] ";
+    case LogLevel::PROFILE: return "[PROFILE] ";
+    case LogLevel::WARNING: return "[WARNING] ";
+    case LogLevel::ERROR: return "[ERROR] ";
+    }
+    return "";
+}
+
+// Appends one record's line to `out`; frees strings that were moved to the heap
+inline void formatRecord(const uint8_t* record, std::string& out) {
+    uint8_t arguments = record[5];
+    out += logPrefix(static_cast<LogLevel>(record[4]));
+    const uint8_t* in = record + LOG_HEADER;
+    char number[32];
+    for (uint8_t i = 0; i < arguments; i++) {
+        uint8_t type = *in++;
+        if (type == LOG_STRING) {
+            uint32_t length;
+            std::memcpy(&length, in, 4);
+            out.append(reinterpret_cast<const char*>(in + 4), length);
+            in += 4 + length;
+            continue;
+        }
+        if (type == LOG_HEAP_STRING) {
+            std::string* text;
+            std::memcpy(&text, in, sizeof(text));
+            out += *text;
+            delete text;
+            in += sizeof(text);
+            continue;
+        }
+        uint64_t word;
+        std::memcpy(&word, in, 8);
+        in += 8;
+        if (type == LOG_SIGNED) {
+            std::snprintf(number, sizeof(number), "%lld", static_cast<long long>(word));
+        } else if (type == LOG_UNSIGNED) {
+            std::snprintf(number, sizeof(number), "%llu", static_cast<unsigned long long>(word));
+        } else if (type == LOG_DOUBLE) {
+            double value;
+            std::memcpy(&value, &word, 8);
+            std::snprintf(number, sizeof(number), "%g", value);
+        } else if (type == LOG_CHAR) {
+            number[0] = static_cast<char>(word);
+            number[1] = '\0';
+        } else {
+            std::snprintf(number, sizeof(number), "%s", word ? "true" : "false");
+        }
+        out += number;
+    }
+    out += '\n';
+}
+
+} // namespace detail
+
+class Logger {
+public:
+    static constexpr int LEVEL = XEC_LOG_LEVEL;
+
+    template <typename... Args>
+    static void debug(const Args&... args) {
+        if constexpr (LEVEL <= static_cast<int>(LogLevel::DEBUG)) {
+            write(LogLevel::DEBUG, args...);
+        }
+    }
+
+    template <typename... Args>
+    static void log(const Args&... args) {
+        if constexpr (LEVEL <= static_cast<int>(LogLevel::LOG)) {
+            write(LogLevel::LOG, args...);
+        }
+    }
+
+    template <typename... Args>
+    static void logProfile(const Args&... args) {
+        if constexpr (LEVEL <= static_cast<int>(LogLevel::PROFILE)) {
+            write(LogLevel::PROFILE, args...);
+        }
+    }
+
+    template <typename... Args>
+    static void logWarning(const Args&... args) {
+        if constexpr (LEVEL <= static_cast<int>(LogLevel::WARNING)) {
+            write(LogLevel::WARNING, args...);
+        }
+    }
+
+    template <typename... Args>
+    static void logError(const Args&... args) {
+        write(LogLevel::ERROR, args...);
+        flush();
+    }
+
+    // Until everything logged before the call is written
+    static void flush() {
+        instance().waitForDrain();
+    }
+
+private:
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable drained;
+    std::vector<std::shared_ptr<detail::LogRing>> rings;
+    uint64_t passesStarted = 0;
+    uint64_t passesDone = 0;
+    bool wakeRequested = false;
+    bool stopping = false;
+    std::atomic<bool> sleeping{false};  // Drain thread is waiting, or about to, for a signal
+    std::atomic<bool> stopped{false};
+    std::thread drainer;
+
+    // Owned by the thread; marks the ring retired when the thread exits so the drainer can drop it
+    struct ThreadRing {
+        std::shared_ptr<detail::LogRing> ring;
+
+        ~ThreadRing() {
+            if (ring) {
+                ring->retired.store(true, std::memory_order_release);
+            }
+        }
+    };
+
+    Logger() : drainer([this] { run(); }) {}
+
+    // Never destroyed: threads may log until exit, after which writes become synchronous
+    static Logger& instance() {
+        static Logger* logger = [] {
+            Logger* created = new Logger();
+            std::atexit([] { instance().stop(); });
+            return created;
+        }();
+        return *logger;
+    }
+
+    template <typename... Args>
+    static void write(LogLevel level, const Args&... args) {
+        static_assert(sizeof...(Args) <= 32, "Too many log arguments");
+        size_t size = detail::LOG_HEADER;
+        ((size += detail::encodedSize(args)), ...);
+        size = (size + 7) & ~size_t(7);
+
+        Logger& logger = instance();
+        detail::LogRing& ring = logger.threadRing();
+        uint8_t* record = logger.reserve(ring, size);
+        if (!record) {
+            // The drain thread is gone (the process is exiting): format and write in place
+            std::vector<uint8_t> bytes(size);
+            fill(bytes.data(), size, level, args...);
+            std::string line;
+            detail::formatRecord(bytes.data(), line);
+            std::fwrite(line.data(), 1, line.size(), level >= LogLevel::WARNING ? stderr : stdout);
+            return;
+        }
+        fill(record, size, level, args...);
+        ring.tail.store(ring.tail.load(std::memory_order_relaxed) + size, std::memory_order_release);
+        // Pairs with the fence in run(): either the drain thread sees this record before it
+        // sleeps, or this sees it asleep and wakes it
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (logger.sleeping.load(std::memory_order_relaxed) && logger.sleeping.exchange(false)) {
+            std::lock_guard<std::mutex> lock(logger.mutex);
+            logger.wakeRequested = true;
+            logger.wake.notify_one();
+        }
+    }
+
+    template <typename... Args>
+    static void fill(uint8_t* record, size_t size, LogLevel level, const Args&... args) {
+        uint32_t size32 = static_cast<uint32_t>(size);
+        uint64_t nanoseconds = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+        std::memcpy(record, &size32, 4);
+        record[4] = static_cast<uint8_t>(level);
+        record[5] = static_cast<uint8_t>(sizeof...(Args));
+        record[6] = record[7] = 0;
+        std::memcpy(record + 8, &nanoseconds, 8);
+        uint8_t* out = record + detail::LOG_HEADER;
+        ((out = detail::encode(out, args)), ...);
+    }
+
+    detail::LogRing& threadRing() {
+        static thread_local ThreadRing local;
+        if (!local.ring) {
+            local.ring = std::make_shared<detail::LogRing>();
+            std::lock_guard<std::mutex> lock(mutex);
+            rings.push_back(local.ring);
+        }
+        return *local.ring;
+    }
+
+    // Contiguous space for one record, or null once the drain thread has stopped
+    uint8_t* reserve(detail::LogRing& ring, size_t size) {
+        uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+        size_t offset = tail % detail::LOG_RING_BYTES;
+        size_t skip = offset + size > detail::LOG_RING_BYTES ? detail::LOG_RING_BYTES - offset : 0;
+        for (unsigned spins = 0; tail + skip + size - ring.head.load(std::memory_order_acquire) > detail::LOG_RING_BYTES; spins++) {
+            if (stopped.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+            if (spins == 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                wakeRequested = true;
+                wake.notify_one();
+            }
+            std::this_thread::yield();
+        }
+        if (stopped.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        if (skip) {
+            uint32_t skip32 = static_cast<uint32_t>(skip);
+            std::memcpy(ring.bytes.get() + offset, &skip32, 4);
+            ring.bytes[offset + 4] = detail::LOG_SKIP;
+            tail += skip;
+            ring.tail.store(tail, std::memory_order_release);
+        }
+        return ring.bytes.get() + tail % detail::LOG_RING_BYTES;
+    }
+
+    void waitForDrain() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (stopped) {
+            std::fflush(stdout);
+            std::fflush(stderr);
+            return;
+        }
+        uint64_t target = passesStarted + 1;
+        wakeRequested = true;
+        wake.notify_one();
+        drained.wait(lock, [&] { return passesDone >= target || stopped.load(std::memory_order_relaxed); });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            wake.notify_one();
+        }
+        drainer.join();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            if (!wakeRequested && !stopping) {
+                sleeping.store(true, std::memory_order_seq_cst);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (!published()) {
+                    wake.wait(lock, [this] { return wakeRequested || stopping; });
+                }
+                sleeping.store(false, std::memory_order_relaxed);
+            }
+            wakeRequested = false;
+            uint64_t pass = ++passesStarted;
+            bool last = stopping;
+            std::vector<std::shared_ptr<detail::LogRing>> snapshot = rings;
+            lock.unlock();
+            drain(snapshot);
+            lock.lock();
+            passesDone = pass;
+            rings.erase(std::remove_if(rings.begin(), rings.end(),
+                                       [](const auto& ring) {
+                                           return ring->retired.load(std::memory_order_acquire) &&
+                                                  ring->head.load(std::memory_order_relaxed) ==
+                                                      ring->tail.load(std::memory_order_acquire);
+                                       }),
+                        rings.end());
+            if (last) {
+                stopped.store(true, std::memory_order_release);
+                drained.notify_all();
+                return;
+            }
+            drained.notify_all();
+        }
+    }
+
+    // Whether any ring holds records not yet drained; called with the mutex held
+    bool published() const {
+        for (const auto& ring : rings) {
+            if (ring->head.load(std::memory_order_relaxed) != ring->tail.load(std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // One pass: everything published so far, merged across threads by timestamp
+    static void drain(const std::vector<std::shared_ptr<detail::LogRing>>& snapshot) {
+        struct Pending {
+            uint64_t nanoseconds;
+            const uint8_t* record;
+        };
+        std::vector<Pending> pending;
+        std::vector<uint64_t> ends(snapshot.size());
+        for (size_t r = 0; r < snapshot.size(); r++) {
+            detail::LogRing& ring = *snapshot[r];
+            uint64_t position = ring.head.load(std::memory_order_relaxed);
+            ends[r] = ring.tail.load(std::memory_order_acquire);
+            while (position < ends[r]) {
+                const uint8_t* record = ring.bytes.get() + position % detail::LOG_RING_BYTES;
+                uint32_t size;
+                std::memcpy(&size, record, 4);
+                if (record[4] != detail::LOG_SKIP) {
+                    uint64_t nanoseconds;
+                    std::memcpy(&nanoseconds, record + 8, 8);
+                    pending.push_back({nanoseconds, record});
+                }
+                position += size;
+            }
+        }
+        if (pending.empty()) {
+            return;
+        }
+        std::stable_sort(pending.begin(), pending.end(),
+                         [](const Pending& a, const Pending& b) { return a.nanoseconds < b.nanoseconds; });
+        std::string out, errors;
+        for (const Pending& entry : pending) {
+            detail::formatRecord(entry.record, entry.record[4] >= static_cast<uint8_t>(LogLevel::WARNING) ? errors : out);
+        }
+        for (size_t r = 0; r < snapshot.size(); r++) {
+            snapshot[r]->head.store(ends[r], std::memory_order_release);
+        }
+        std::fwrite(out.data(), 1, out.size(), stdout);
+        std::fwrite(errors.data(), 1, errors.size(), stderr);
+        std::fflush(stdout);
+        std::fflush(stderr);
+    }
+};
+
+} // namespace xec
@@ -0,0 +1,965 @@
+#pragma once
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <functional>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <memory>
+#include <net/if.h>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "FileIO.hpp"
+
+// Runtime for the `packet` type and OSI-layer code.
+//
+// Packets live in fixed-size buffers carved out of one PacketPool region: a cache-line descriptor,
+// PACKET_HEADROOM bytes for prepending encapsulation headers, then the frame. Pools hand out and
+// take back whole bursts with a single CAS on their free ring, so a port moving 32-64 packets per
+// call pays for the pool once per burst, not once per packet.
+//
+// Header views (EthernetView, Ipv4View, ...) read and write fields in place in network byte
+// order; parseHeaders() locates them in a frame without copying anything. Setters do not touch
+// checksums; call Ipv4View::updateChecksum() and updateTransportChecksum() after editing.
+//
+// A PacketPort moves bursts of packets in and out:
+//   PcapReader    replays a capture file, optionally several times over (offline testing)
+//   PcapWriter    appends transmitted packets to a capture file
+//   AfPacketPort  a live interface through TPACKET_V3 mmap rings: RX walks whole blocks the
+//                 kernel has filled, TX fills ring frames and kicks the kernel once per burst
+// Received packets belong to the caller; transmitBurst() takes ownership of the packets it sent.
+
+namespace xec {
+
+constexpr size_t PACKET_HEADROOM = 128;
+constexpr size_t PACKET_DATA_ROOM = 2048;
+constexpr size_t MAX_BURST = 64;
+
+class PacketPool;
+
+// Descriptor at the start of each pool buffer
+struct alignas(CACHE_LINE) Packet {
+    PacketPool* pool = nullptr;
+    uint8_t* data = nullptr;       // First byte of the frame, inside the buffer
+    uint32_t length = 0;           // Bytes held
+    uint32_t wireLength = 0;       // Bytes on the wire; larger than length for truncated captures
+    uint64_t timestamp = 0;        // Nanoseconds since the epoch
+
+    uint8_t* buffer() { return reinterpret_cast<uint8_t*>(this) + sizeof(Packet); }
+    uint8_t* end() { return data + length; }
+
+    // Restore an empty frame at the default offset
+    void reset() {
+        data = buffer() + PACKET_HEADROOM;
+        length = wireLength = 0;
+        timestamp = 0;
+    }
+
+    // Grow the frame at the front; nullptr when the headroom is used up
+    uint8_t* prepend(size_t bytes) {
+        if (data - buffer() < static_cast<std::ptrdiff_t>(bytes)) {
+            return nullptr;
+        }
+        data -= bytes;
+        length += static_cast<uint32_t>(bytes);
+        return data;
+    }
+
+    // Drop bytes from the front, e.g. a decapsulated header
+    bool strip(size_t bytes) {
+        if (bytes > length) {
+            return false;
+        }
+        data += bytes;
+        length -= static_cast<uint32_t>(bytes);
+        return true;
+    }
+
+    // Grow the frame at the back; nullptr when the buffer is full
+    uint8_t* append(size_t bytes) {
+        if (end() + bytes > buffer() + PACKET_HEADROOM + PACKET_DATA_ROOM) {
+            return nullptr;
+        }
+        uint8_t* tail = end();
+        length += static_cast<uint32_t>(bytes);
+        return tail;
+    }
+};
+
+class PacketPool {
+public:
+    // `node` places the buffers on a NUMA node (Topology.hpp); the pool is usually placed with the
+    // thread that polls the port it feeds
+    explicit PacketPool(size_t count, int node = -1)
+        : count(count), bytes(count * STRIDE), freeList(count, node) {
+        memory = static_cast<uint8_t*>(allocateOnNode(bytes, node));
+        std::vector<Packet*> packets;
+        for (size_t i = 0; i < count; i++) {
+            Packet* packet = new (memory + i * STRIDE) Packet();
+            packet->pool = this;
+            packets.push_back(packet);
+        }
+        freeBurst(packets.data(), packets.size());
+    }
+
+    ~PacketPool() {
+        freeOnNode(memory, bytes);
+    }
+
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    // Fewer than `wanted` (possibly 0) when the pool is running dry
+    size_t allocateBurst(Packet** packets, size_t wanted) {
+        size_t taken = freeList.tryPopBatch(packets, wanted);
+        for (size_t i = 0; i < taken; i++) {
+            packets[i]->reset();
+        }
+        return taken;
+    }
+
+    Packet* allocate() {
+        Packet* packet = nullptr;
+        return allocateBurst(&packet, 1) ? packet : nullptr;
+    }
+
+    // Every packet must come from this pool
+    void freeBurst(Packet** packets, size_t n) {
+        while (n > 0) {
+            size_t pushed = freeList.tryPushBatch(packets, n);
+            packets += pushed;
+            n -= pushed;
+        }
+    }
+
+    size_t capacity() const {
+        return count;
+    }
+
+    static constexpr size_t STRIDE = sizeof(Packet) + PACKET_HEADROOM + PACKET_DATA_ROOM;
+
+private:
+    size_t count;
+    size_t bytes;
+    uint8_t* memory = nullptr;
+    MpmcRing<Packet*> freeList;
+};
+
+// Return packets to their pools, one freeBurst per run of packets sharing a pool
+inline void freePackets(Packet** packets, size_t n) {
+    size_t first = 0;
+    for (size_t i = 1; i <= n; i++) {
+        if (i == n || packets[i]->pool != packets[first]->pool) {
+            packets[first]->pool->freeBurst(packets + first, i - first);
+            first = i;
+        }
+    }
+}
+
+namespace detail {
+
+inline uint16_t load16(const uint8_t* bytes) {
+    return static_cast<uint16_t>(bytes[0] << 8 | bytes[1]);
+}
+
+inline uint32_t load32(const uint8_t* bytes) {
+    return static_cast<uint32_t>(bytes[0]) << 24 | static_cast<uint32_t>(bytes[1]) << 16 |
+           static_cast<uint32_t>(bytes[2]) << 8 | bytes[3];
+}
+
+inline void store16(uint8_t* bytes, uint16_t value) {
+    bytes[0] = static_cast<uint8_t>(value >> 8);
+    bytes[1] = static_cast<uint8_t>(value);
+}
+
+inline void store32(uint8_t* bytes, uint32_t value) {
+    store16(bytes, static_cast<uint16_t>(value >> 16));
+    store16(bytes + 2, static_cast<uint16_t>(value));
+}
+
+// One's-complement sum of big-endian 16-bit words, not yet folded
+inline uint32_t checksumAdd(uint32_t sum, const uint8_t* bytes, size_t length) {
+    for (; length > 1; bytes += 2, length -= 2) {
+        sum += load16(bytes);
+    }
+    if (length) {
+        sum += static_cast<uint32_t>(bytes[0]) << 8;
+    }
+    return sum;
+}
+
+inline uint16_t checksumFold(uint32_t sum) {
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return static_cast<uint16_t>(~sum);
+}
+
+} // namespace detail
+
+// Views are a pointer into a frame; a default-constructed view means the header is absent
+
+class EthernetView {
+public:
+    static constexpr size_t SIZE = 14;
+
+    EthernetView(uint8_t* bytes = nullptr) : bytes(bytes) {}
+    explicit operator bool() const { return bytes != nullptr; }
+    uint8_t* begin() const { return bytes; }
+
+    uint8_t* destination() const { return bytes; }
+    uint8_t* source() const { return bytes + 6; }
+    uint16_t etherType() const { return detail::load16(bytes + 12); }
+    void setEtherType(uint16_t type) { detail::store16(bytes + 12, type); }
+
+    void swapAddresses() {
+        uint8_t saved[6];
+        std::memcpy(saved, bytes, 6);
+        std::memcpy(bytes, bytes + 6, 6);
+        std::memcpy(bytes + 6, saved, 6);
+    }
+
+private:
+    uint8_t* bytes;
+};
+
+class Ipv4View {
+public:
+    static constexpr size_t MIN_SIZE = 20;
+
+    Ipv4View(uint8_t* bytes = nullptr) : bytes(bytes) {}
+    explicit operator bool() const { return bytes != nullptr; }
+    uint8_t* begin() const { return bytes; }
+
+    uint8_t version() const { return bytes[0] >> 4; }
+    size_t headerLength() const { return static_cast<size_t>(bytes[0] & 0x0f) * 4; }
+    uint16_t totalLength() const { return detail::load16(bytes + 2); }
+    uint16_t identification() const { return detail::load16(bytes + 4); }
+    // More-fragments set, or a non-zero fragment offset
+    bool fragment() const { return (detail::load16(bytes + 6) & 0x3fff) != 0; }
+    uint8_t ttl() const { return bytes[8]; }
+    uint8_t protocol() const { return bytes[9]; }
+    uint16_t checksum() const { return detail::load16(bytes + 10); }
+    uint32_t source() const { return detail::load32(bytes + 12); }
+    uint32_t destination() const { return detail::load32(bytes + 16); }
+
+    void setTotalLength(uint16_t length) { detail::store16(bytes + 2, length); }
+    void setTtl(uint8_t ttl) { bytes[8] = ttl; }
+    void setSource(uint32_t address) { detail::store32(bytes + 12, address); }
+    void setDestination(uint32_t address) { detail::store32(bytes + 16, address); }
+
+    bool checksumValid() const { return detail::checksumFold(detail::checksumAdd(0, bytes, headerLength())) == 0; }
+
+    void updateChecksum() {
+        detail::store16(bytes + 10, 0);
+        detail::store16(bytes + 10, detail::checksumFold(detail::checksumAdd(0, bytes, headerLength())));
+    }
+
+private:
+    uint8_t* bytes;
+};
+
+class Ipv6View {
+public:
+    static constexpr size_t SIZE = 40;
+
+    Ipv6View(uint8_t* bytes = nullptr) : bytes(bytes) {}
+    explicit operator bool() const { return bytes != nullptr; }
+    uint8_t* begin() const { return bytes; }
+
+    uint8_t version() const { return bytes[0] >> 4; }
+    uint32_t flowLabel() const { return detail::load32(bytes) & 0xfffff; }
+    uint16_t payloadLength() const { return detail::load16(bytes + 4); }
+    uint8_t nextHeader() const { return bytes[6]; }
+    uint8_t hopLimit() const { return bytes[7]; }
+    uint8_t* source() const { return bytes + 8; }
+    uint8_t* destination() const { return bytes + 24; }
+
+    void setPayloadLength(uint16_t length) { detail::store16(bytes + 4, length); }
+    void setHopLimit(uint8_t limit) { bytes[7] = limit; }
+
+private:
+    uint8_t* bytes;
+};
+
+class UdpView {
+public:
+    static constexpr size_t SIZE = 8;
+
+    UdpView(uint8_t* bytes = nullptr) : bytes(bytes) {}
+    explicit operator bool() const { return bytes != nullptr; }
+    uint8_t* begin() const { return bytes; }
+
+    uint16_t sourcePort() const { return detail::load16(bytes); }
+    uint16_t destinationPort() const { return detail::load16(bytes + 2); }
+    uint16_t length() const { return detail::load16(bytes + 4); }
+    uint16_t checksum() const { return detail::load16(bytes + 6); }
+
+    void setSourcePort(uint16_t port) { detail::store16(bytes, port); }
+    void setDestinationPort(uint16_t port) { detail::store16(bytes + 2, port); }
+    void setLength(uint16_t length) { detail::store16(bytes + 4, length); }
+
+private:
+    uint8_t* bytes;
+};
+
+constexpr uint8_t TCP_FIN = 0x01;
+constexpr uint8_t TCP_SYN = 0x02;
+constexpr uint8_t TCP_RST = 0x04;
+constexpr uint8_t TCP_PSH = 0x08;
+constexpr uint8_t TCP_ACK = 0x10;
+constexpr uint8_t TCP_URG = 0x20;
+
+class TcpView {
+public:
+    static constexpr size_t MIN_SIZE = 20;
+
+    TcpView(uint8_t* bytes = nullptr) : bytes(bytes) {}
+    explicit operator bool() const { return bytes != nullptr; }
+    uint8_t* begin() const { return bytes; }
+
+    uint16_t sourcePort() const { return detail::load16(bytes); }
+    uint16_t destinationPort() const { return detail::load16(bytes + 2); }
+    uint32_t sequence() const { return detail::load32(bytes + 4); }
+    uint32_t acknowledgment() const { return detail::load32(bytes + 8); }
+    size_t headerLength() const { return static_cast<size_t>(bytes[12] >> 4) * 4; }
+    uint8_t flags() const { return bytes[13]; }
+    uint16_t window() const { return detail::load16(bytes + 14); }
+    uint16_t checksum() const { return detail::load16(bytes + 16); }
+
+    void setSourcePort(uint16_t port) { detail::store16(bytes, port); }
+    void setDestinationPort(uint16_t port) { detail::store16(bytes + 2, port); }
+    void setSequence(uint32_t sequence) { detail::store32(bytes + 4, sequence); }
+    void setAcknowledgment(uint32_t number) { detail::store32(bytes + 8, number); }
+    void setFlags(uint8_t flags) { bytes[13] = flags; }
+    void setWindow(uint16_t window) { detail::store16(bytes + 14, window); }
+
+private:
+    uint8_t* bytes;
+};
+
+constexpr uint16_t ETHER_TYPE_IPV4 = 0x0800;
+constexpr uint16_t ETHER_TYPE_IPV6 = 0x86dd;
+constexpr uint16_t ETHER_TYPE_VLAN = 0x8100;
+constexpr uint16_t ETHER_TYPE_QINQ = 0x88a8;
+constexpr uint8_t IP_PROTOCOL_TCP = 6;
+constexpr uint8_t IP_PROTOCOL_UDP = 17;
+
+// Where each layer starts in one frame; layers that are absent, truncated or not understood
+// (fragments past the first, unknown extension headers) have empty views
+struct PacketHeaders {
+    EthernetView ethernet;
+    uint16_t etherType = 0;        // After any VLAN tags
+    Ipv4View ipv4;
+    Ipv6View ipv6;
+    uint8_t protocol = 0;          // Transport protocol, 0 without IP
+    UdpView udp;
+    TcpView tcp;
+    uint8_t* payload = nullptr;    // Past the last header found
+    size_t payloadLength = 0;
+};
+
+// False when the frame is too short to hold an Ethernet header
+inline bool parseHeaders(Packet& packet, PacketHeaders& headers) {
+    headers = PacketHeaders();
+    uint8_t* bytes = packet.data;
+    uint8_t* end = packet.end();
+    if (packet.length < EthernetView::SIZE) {
+        return false;
+    }
+    headers.ethernet = EthernetView(bytes);
+    headers.etherType = headers.ethernet.etherType();
+    uint8_t* cursor = bytes + EthernetView::SIZE;
+    while ((headers.etherType == ETHER_TYPE_VLAN || headers.etherType == ETHER_TYPE_QINQ) && cursor + 4 <= end) {
+        headers.etherType = detail::load16(cursor + 2);
+        cursor += 4;
+    }
+    headers.payload = cursor;
+
+    uint8_t protocol = 0;
+    if (headers.etherType == ETHER_TYPE_IPV4 && cursor + Ipv4View::MIN_SIZE <= end) {
+        Ipv4View ipv4(cursor);
+        if (ipv4.version() != 4 || ipv4.headerLength() < Ipv4View::MIN_SIZE || cursor + ipv4.headerLength() > end) {
+            headers.payloadLength = static_cast<size_t>(end - headers.payload);
+            return true;
+        }
+        headers.ipv4 = ipv4;
+        cursor += ipv4.headerLength();
+        // Later fragments carry no transport header
+        protocol = (detail::load16(ipv4.begin() + 6) & 0x1fff) == 0 ? ipv4.protocol() : 0;
+    } else if (headers.etherType == ETHER_TYPE_IPV6 && cursor + Ipv6View::SIZE <= end) {
+        headers.ipv6 = Ipv6View(cursor);
+        cursor += Ipv6View::SIZE;
+        protocol = headers.ipv6.nextHeader();
+        // Hop-by-hop, routing and destination options; a fragment header only on the first fragment
+        for (;;) {
+            if ((protocol == 0 || protocol == 43 || protocol == 60) && cursor + 8 <= end) {
+                size_t length = (static_cast<size_t>(cursor[1]) + 1) * 8;
+                protocol = cursor[0];
+                cursor += length;
+            } else if (protocol == 44 && cursor + 8 <= end) {
+                protocol = (detail::load16(cursor + 2) & 0xfff8) == 0 ? cursor[0] : 0;
+                cursor += 8;
+            } else {
+                break;
+            }
+        }
+        if (cursor > end) {
+            cursor = end;
+            protocol = 0;
+        }
+    }
+    headers.protocol = protocol;
+    if (protocol == IP_PROTOCOL_UDP && cursor + UdpView::SIZE <= end) {
+        headers.udp = UdpView(cursor);
+        cursor += UdpView::SIZE;
+    } else if (protocol == IP_PROTOCOL_TCP && cursor + TcpView::MIN_SIZE <= end) {
+        TcpView tcp(cursor);
+        if (tcp.headerLength() >= TcpView::MIN_SIZE && cursor + tcp.headerLength() <= end) {
+            headers.tcp = tcp;
+            cursor += tcp.headerLength();
+        }
+    }
+    headers.payload = cursor;
+    headers.payloadLength = static_cast<size_t>(end - cursor);
+    return true;
+}
+
+// Parse a burst, prefetching a few frames ahead so the header loads overlap
+inline void parseHeadersBurst(Packet** packets, size_t n, PacketHeaders* headers) {
+    constexpr size_t AHEAD = 4;
+    for (size_t i = 0; i < std::min(n, AHEAD); i++) {
+        __builtin_prefetch(packets[i]->data);
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (i + AHEAD < n) {
+            __builtin_prefetch(packets[i + AHEAD]->data);
+        }
+        parseHeaders(*packets[i], headers[i]);
+    }
+}
+
+// Recompute the TCP or UDP checksum over the pseudo-header and the whole segment. Returns false
+// when there is no transport header or the segment is cut short by the capture.
+inline bool updateTransportChecksum(Packet& packet, const PacketHeaders& headers) {
+    uint8_t* segment = headers.tcp ? headers.tcp.begin() : headers.udp ? headers.udp.begin() : nullptr;
+    if (!segment) {
+        return false;
+    }
+    size_t length;
+    uint32_t sum = 0;
+    if (headers.ipv4) {
+        length = headers.ipv4.totalLength() - headers.ipv4.headerLength();
+        sum = detail::checksumAdd(sum, headers.ipv4.begin() + 12, 8);
+    } else if (headers.ipv6) {
+        length = static_cast<size_t>(headers.ipv6.begin() + Ipv6View::SIZE + headers.ipv6.payloadLength() - segment);
+        sum = detail::checksumAdd(sum, headers.ipv6.source(), 32);
+    } else {
+        return false;
+    }
+    if (segment + length > packet.end()) {
+        return false;
+    }
+    sum += headers.protocol;
+    sum += static_cast<uint32_t>(length);
+    uint8_t* field = headers.tcp ? segment + 16 : segment + 6;
+    detail::store16(field, 0);
+    uint16_t checksum = detail::checksumFold(detail::checksumAdd(sum, segment, length));
+    // UDP sends 0 for "no checksum", so a computed 0 goes out as all ones
+    detail::store16(field, headers.udp && checksum == 0 ? 0xffff : checksum);
+    return true;
+}
+
+class PacketPort {
+public:
+    virtual ~PacketPort() = default;
+    virtual std::string name() const = 0;
+
+    // Up to `wanted` packets, which now belong to the caller; 0 when nothing is waiting
+    virtual size_t receiveBurst(Packet** packets, size_t wanted) = 0;
+
+    // Sends a prefix of the burst and returns its length; those packets go back to their pools.
+    // The rest (a full TX ring, say) stay with the caller.
+    virtual size_t transmitBurst(Packet** packets, size_t n) = 0;
+
+    // Offline sources: true once every packet has been delivered
+    virtual bool exhausted() const { return false; }
+};
+
+namespace detail {
+
+constexpr uint32_t PCAP_MAGIC_MICROS = 0xa1b2c3d4;
+constexpr uint32_t PCAP_MAGIC_NANOS = 0xa1b23c4d;
+constexpr uint32_t PCAP_LINKTYPE_ETHERNET = 1;
+
+struct PcapFileHeader {
+    uint32_t magic;
+    uint16_t versionMajor;
+    uint16_t versionMinor;
+    int32_t zone;
+    uint32_t sigfigs;
+    uint32_t snapLength;
+    uint32_t linkType;
+};
+
+struct PcapRecordHeader {
+    uint32_t seconds;
+    uint32_t fraction;             // Microseconds or nanoseconds, per the magic
+    uint32_t capturedLength;
+    uint32_t wireLength;
+};
+
+} // namespace detail
+
+// Replays a classic pcap file (either byte order, micro- or nanosecond stamps, Ethernet link
+// type) from a read-only mapping. Frames longer than PACKET_DATA_ROOM are truncated, and
+// wireLength keeps the original size.
+class PcapReader : public PacketPort {
+public:
+    PcapReader(const std::string& path, PacketPool& pool, size_t replays = 1)
+        : path(path), pool(pool), replays(std::max<size_t>(replays, 1)) {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw systemError("Cannot open " + path);
+        }
+        struct stat info {};
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            throw systemError("Cannot stat " + path);
+        }
+        size = static_cast<size_t>(info.st_size);
+        if (size < sizeof(detail::PcapFileHeader)) {
+            close(fd);
+            throw std::runtime_error(path + " is not a pcap file");
+        }
+        void* address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (address == MAP_FAILED) {
+            throw systemError("Cannot map " + path);
+        }
+        mapping = static_cast<const uint8_t*>(address);
+        madvise(address, size, MADV_SEQUENTIAL);
+
+        detail::PcapFileHeader header;
+        std::memcpy(&header, mapping, sizeof(header));
+        if (header.magic == detail::PCAP_MAGIC_MICROS || header.magic == detail::PCAP_MAGIC_NANOS) {
+            swapped = false;
+        } else if (__builtin_bswap32(header.magic) == detail::PCAP_MAGIC_MICROS ||
+                   __builtin_bswap32(header.magic) == detail::PCAP_MAGIC_NANOS) {
+            swapped = true;
+        } else {
+            munmap(address, size);
+            throw std::runtime_error(path + " is not a pcap file (pcapng is not supported)");
+        }
+        nanoseconds = field(header.magic) == detail::PCAP_MAGIC_NANOS;
+        if (field(header.linkType) != detail::PCAP_LINKTYPE_ETHERNET) {
+            munmap(address, size);
+            throw std::runtime_error(path + " has link type " + std::to_string(field(header.linkType)) + ", not Ethernet");
+        }
+        offset = sizeof(detail::PcapFileHeader);
+    }
+
+    ~PcapReader() override {
+        munmap(const_cast<uint8_t*>(mapping), size);
+    }
+
+    std::string name() const override { return "pcap:" + path; }
+
+    size_t receiveBurst(Packet** packets, size_t wanted) override {
+        if (exhausted()) {
+            return 0;
+        }
+        size_t allocated = pool.allocateBurst(packets, std::min(wanted, MAX_BURST));
+        size_t filled = 0;
+        while (filled < allocated && !exhausted()) {
+            if (offset + sizeof(detail::PcapRecordHeader) > size) {
+                rewind();
+                continue;
+            }
+            detail::PcapRecordHeader record;
+            std::memcpy(&record, mapping + offset, sizeof(record));
+            size_t captured = field(record.capturedLength);
+            if (offset + sizeof(record) + captured > size) {
+                // A capture cut off mid-record ends like a clean one
+                rewind();
+                continue;
+            }
+            Packet* packet = packets[filled++];
+            packet->length = static_cast<uint32_t>(std::min(captured, PACKET_DATA_ROOM));
+            packet->wireLength = field(record.wireLength);
+            packet->timestamp = uint64_t(field(record.seconds)) * 1000000000 + uint64_t(field(record.fraction)) * (nanoseconds ? 1 : 1000);
+            std::memcpy(packet->data, mapping + offset + sizeof(record), packet->length);
+            offset += sizeof(record) + captured;
+            delivered++;
+        }
+        if (filled < allocated) {
+            pool.freeBurst(packets + filled, allocated - filled);
+        }
+        return filled;
+    }
+
+    size_t transmitBurst(Packet**, size_t) override {
+        throw std::runtime_error("Cannot transmit on " + name());
+    }
+
+    bool exhausted() const override { return pass >= replays; }
+
+    uint64_t packetsDelivered() const { return delivered; }
+
+private:
+    uint32_t field(uint32_t value) const { return swapped ? __builtin_bswap32(value) : value; }
+
+    void rewind() {
+        pass++;
+        offset = sizeof(detail::PcapFileHeader);
+    }
+
+    std::string path;
+    PacketPool& pool;
+    size_t replays;
+    const uint8_t* mapping = nullptr;
+    size_t size = 0;
+    size_t offset = 0;
+    size_t pass = 0;
+    bool swapped = false;
+    bool nanoseconds = false;
+    uint64_t delivered = 0;
+};
+
+// Writes transmitted packets as a nanosecond pcap, buffering whole bursts between writes
+class PcapWriter : public PacketPort {
+public:
+    explicit PcapWriter(const std::string& path, size_t bufferSize = 1 << 20) : path(path), limit(bufferSize) {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            throw systemError("Cannot create " + path);
+        }
+        detail::PcapFileHeader header{detail::PCAP_MAGIC_NANOS, 2, 4, 0, 0, static_cast<uint32_t>(PACKET_DATA_ROOM),
+                                      detail::PCAP_LINKTYPE_ETHERNET};
+        buffer.reserve(limit + MAX_BURST * (sizeof(detail::PcapRecordHeader) + PACKET_DATA_ROOM));
+        append(&header, sizeof(header));
+    }
+
+    ~PcapWriter() override {
+        try {
+            flush();
+        } catch (...) {
+        }
+        close(fd);
+    }
+
+    std::string name() const override { return "pcap-out:" + path; }
+
+    size_t receiveBurst(Packet**, size_t) override {
+        return 0;
+    }
+
+    size_t transmitBurst(Packet** packets, size_t n) override {
+        for (size_t i = 0; i < n; i++) {
+            const Packet* packet = packets[i];
+            detail::PcapRecordHeader record{static_cast<uint32_t>(packet->timestamp / 1000000000),
+                                            static_cast<uint32_t>(packet->timestamp % 1000000000), packet->length,
+                                            std::max(packet->wireLength, packet->length)};
+            append(&record, sizeof(record));
+            append(packet->data, packet->length);
+        }
+        freePackets(packets, n);
+        if (buffer.size() >= limit) {
+            flush();
+        }
+        return n;
+    }
+
+    void flush() {
+        writeFully(fd, buffer.data(), buffer.size(), written);
+        written += buffer.size();
+        buffer.clear();
+    }
+
+private:
+    void append(const void* bytes, size_t length) {
+        const auto* begin = static_cast<const uint8_t*>(bytes);
+        buffer.insert(buffer.end(), begin, begin + length);
+    }
+
+    std::string path;
+    int fd = -1;
+    size_t limit;
+    std::vector<uint8_t> buffer;
+    uint64_t written = 0;
+};
+
+struct AfPacketOptions {
+    size_t blockSize = 1 << 20;    // RX ring block; the kernel hands over a block at a time
+    size_t blockCount = 64;
+    unsigned blockTimeoutMs = 10;  // Retire a partly filled block after this long
+    size_t txFrames = 1024;        // 0 for a receive-only port
+    int fanoutGroup = -1;          // >= 0: share the interface's traffic by flow hash with other sockets in the group
+    bool bypassQdisc = true;       // Transmit straight to the driver
+};
+
+// A live interface through PACKET_RX_RING and PACKET_TX_RING (TPACKET_V3). Needs CAP_NET_RAW.
+// One port per polling thread; with fanoutGroup set, several ports split the interface.
+class AfPacketPort : public PacketPort {
+public:
+    AfPacketPort(const std::string& interface, PacketPool& pool, AfPacketOptions options = {})
+        : interface(interface), pool(pool), options(options) {
+        fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, htons(ETH_P_ALL));
+        if (fd < 0) {
+            throw systemError("Cannot open a packet socket for " + interface);
+        }
+        try {
+            setup();
+        } catch (...) {
+            if (ring != MAP_FAILED) {
+                munmap(ring, rxBytes + txBytes);
+            }
+            close(fd);
+            throw;
+        }
+    }
+
+    ~AfPacketPort() override {
+        munmap(ring, rxBytes + txBytes);
+        close(fd);
+    }
+
+    std::string name() const override { return "afpacket:" + interface; }
+
+    int descriptor() const { return fd; }
+
+    // Block until the RX ring has a block ready or `timeoutMs` passes; for event loops, poll
+    // descriptor() instead
+    bool wait(int timeoutMs) {
+        if (blockReady()) {
+            return true;
+        }
+        pollfd entry{fd, POLLIN, 0};
+        return poll(&entry, 1, timeoutMs) > 0;
+    }
+
+    size_t receiveBurst(Packet** packets, size_t wanted) override {
+        if (!blockReady()) {
+            return 0;
+        }
+        size_t allocated = pool.allocateBurst(packets, std::min(wanted, MAX_BURST));
+        size_t filled = 0;
+        while (filled < allocated && blockReady()) {
+            tpacket_block_desc* block = blockAt(rxBlock);
+            if (!frame) {
+                frame = reinterpret_cast<uint8_t*>(block) + block->hdr.bh1.offset_to_first_pkt;
+                framesLeft = block->hdr.bh1.num_pkts;
+            }
+            if (framesLeft > 0) {
+                auto* header = reinterpret_cast<tpacket3_hdr*>(frame);
+                Packet* packet = packets[filled++];
+                packet->length = std::min<uint32_t>(header->tp_snaplen, PACKET_DATA_ROOM);
+                packet->wireLength = header->tp_len;
+                packet->timestamp = uint64_t(header->tp_sec) * 1000000000 + header->tp_nsec;
+                std::memcpy(packet->data, frame + header->tp_mac, packet->length);
+                frame += header->tp_next_offset;
+                framesLeft--;
+            }
+            if (framesLeft == 0) {
+                // Hand the block back as soon as it is drained
+                __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+                rxBlock = (rxBlock + 1) % options.blockCount;
+                frame = nullptr;
+            }
+        }
+        if (filled < allocated) {
+            pool.freeBurst(packets + filled, allocated - filled);
+        }
+        return filled;
+    }
+
+    size_t transmitBurst(Packet** packets, size_t n) override {
+        if (options.txFrames == 0) {
+            throw std::runtime_error(name() + " was opened receive-only");
+        }
+        size_t sent = 0;
+        for (; sent < n; sent++) {
+            uint8_t* slot = static_cast<uint8_t*>(ring) + rxBytes + txHead * TX_FRAME_SIZE;
+            auto* header = reinterpret_cast<tpacket3_hdr*>(slot);
+            if (__atomic_load_n(&header->tp_status, __ATOMIC_ACQUIRE) != TP_STATUS_AVAILABLE) {
+                break;
+            }
+            const Packet* packet = packets[sent];
+            uint32_t length = std::min<uint32_t>(packet->length, TX_FRAME_SIZE - TX_DATA_OFFSET);
+            std::memcpy(slot + TX_DATA_OFFSET, packet->data, length);
+            header->tp_len = length;
+            header->tp_snaplen = length;
+            header->tp_next_offset = 0;
+            __atomic_store_n(&header->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+            txHead = (txHead + 1) % options.txFrames;
+        }
+        if (sent > 0) {
+            // One kick for the whole burst; the kernel drains every frame marked for sending
+            if (sendto(fd, nullptr, 0, MSG_DONTWAIT, nullptr, 0) < 0 && errno != EAGAIN && errno != ENOBUFS) {
+                throw systemError("Cannot transmit on " + name());
+            }
+            freePackets(packets, sent);
+        }
+        return sent;
+    }
+
+private:
+    // The kernel expects TX data right after the aligned frame header (TPACKET3_HDRLEN less the
+    // sockaddr_ll it reserves for RX)
+    static constexpr uint32_t TX_FRAME_SIZE = 4096;
+    static constexpr uint32_t TX_DATA_OFFSET = TPACKET_ALIGN(sizeof(tpacket3_hdr));
+
+    void setup() {
+        int version = TPACKET_V3;
+        if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0) {
+            throw systemError("TPACKET_V3 is not available");
+        }
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        options.blockSize = (std::max(options.blockSize, page) + page - 1) & ~(page - 1);
+
+        tpacket_req3 rx{};
+        rx.tp_block_size = static_cast<unsigned>(options.blockSize);
+        rx.tp_block_nr = static_cast<unsigned>(options.blockCount);
+        rx.tp_frame_size = PACKET_DATA_ROOM;
+        rx.tp_frame_nr = static_cast<unsigned>(options.blockSize / PACKET_DATA_ROOM * options.blockCount);
+        rx.tp_retire_blk_tov = options.blockTimeoutMs;
+        if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &rx, sizeof(rx)) != 0) {
+            throw systemError("Cannot set up the RX ring on " + interface);
+        }
+        rxBytes = options.blockSize * options.blockCount;
+
+        if (options.txFrames > 0) {
+            // TX frames are fixed-size; a V3 TX ring takes no block timeout
+            size_t framesPerBlock = std::max<size_t>(page / TX_FRAME_SIZE, 1);
+            options.txFrames = (options.txFrames + framesPerBlock - 1) / framesPerBlock * framesPerBlock;
+            tpacket_req3 tx{};
+            tx.tp_block_size = static_cast<unsigned>(framesPerBlock * TX_FRAME_SIZE);
+            tx.tp_block_nr = static_cast<unsigned>(options.txFrames / framesPerBlock);
+            tx.tp_frame_size = TX_FRAME_SIZE;
+            tx.tp_frame_nr = static_cast<unsigned>(options.txFrames);
+            if (setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &tx, sizeof(tx)) != 0) {
+                throw systemError("Cannot set up the TX ring on " + interface);
+            }
+            txBytes = options.txFrames * TX_FRAME_SIZE;
+            if (options.bypassQdisc) {
+                int on = 1;
+                setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &on, sizeof(on));
+            }
+        }
+
+        ring = mmap(nullptr, rxBytes + txBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, fd, 0);
+        if (ring == MAP_FAILED) {
+            // MAP_LOCKED fails under a low RLIMIT_MEMLOCK; the ring works unlocked, just less predictably
+            ring = mmap(nullptr, rxBytes + txBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (ring == MAP_FAILED) {
+            throw systemError("Cannot map the rings of " + interface);
+        }
+
+        sockaddr_ll address{};
+        address.sll_family = AF_PACKET;
+        address.sll_protocol = htons(ETH_P_ALL);
+        address.sll_ifindex = static_cast<int>(if_nametoindex(interface.c_str()));
+        if (address.sll_ifindex == 0) {
+            throw std::runtime_error("No interface named " + interface);
+        }
+        if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            throw systemError("Cannot bind to " + interface);
+        }
+        if (options.fanoutGroup >= 0) {
+            int fanout = (options.fanoutGroup & 0xffff) | (PACKET_FANOUT_HASH << 16);
+            if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) != 0) {
+                throw systemError("Cannot join fanout group " + std::to_string(options.fanoutGroup));
+            }
+        }
+    }
+
+    tpacket_block_desc* blockAt(size_t index) const {
+        return reinterpret_cast<tpacket_block_desc*>(static_cast<uint8_t*>(ring) + index * options.blockSize);
+    }
+
+    bool blockReady() const {
+        return frame || (__atomic_load_n(&blockAt(rxBlock)->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER);
+    }
+
+    std::string interface;
+    PacketPool& pool;
+    AfPacketOptions options;
+    int fd = -1;
+    void* ring = MAP_FAILED;
+    size_t rxBytes = 0;
+    size_t txBytes = 0;
+    size_t rxBlock = 0;
+    uint8_t* frame = nullptr;      // Next frame in the block being read, nullptr between blocks
+    uint32_t framesLeft = 0;
+    size_t txHead = 0;
+};
+
+namespace detail {
+
+inline PacketPool& sharedPacketPool() {
+    static PacketPool pool(16384);
+    return pool;
+}
+
+} // namespace detail
+
+// "pcap:<file>[:replays]", "pcap-out:<file>" or "afpacket:<interface>"; packets come from a
+// shared pool
+inline std::unique_ptr<PacketPort> openPort(const std::string& spec) {
+    size_t colon = spec.find(':');
+    std::string kind = spec.substr(0, colon);
+    std::string target = colon == std::string::npos ? std::string() : spec.substr(colon + 1);
+    if (kind == "pcap") {
+        size_t replays = 1;
+        size_t last = target.rfind(':');
+        if (last != std::string::npos && last + 1 < target.size() &&
+            target.find_first_not_of("0123456789", last + 1) == std::string::npos) {
+            replays = std::stoul(target.substr(last + 1));
+            target.resize(last);
+        }
+        return std::make_unique<PcapReader>(target, detail::sharedPacketPool(), replays);
+    }
+    if (kind == "pcap-out") {
+        return std::make_unique<PcapWriter>(target);
+    }
+    if (kind == "afpacket") {
+        return std::make_unique<AfPacketPort>(target, detail::sharedPacketPool());
+    }
+    throw std::runtime_error("Unknown packet port '" + spec + "'");
+}
+
+// Host binding for compiled programs, defined in EntryPoints.cpp: replay() and transmit() on
+// `path` call the factory with the spec they would otherwise have opened
+using PortFactory = std::function<std::unique_ptr<PacketPort>(const std::string& spec)>;
+void bindPort(const std::string& path, PortFactory factory);
+
+} // namespace xec
+
+// Entry points for generated code, defined in EntryPoints.cpp. A failed open reports why on
+// stderr and returns null.
+extern "C" void* xec_port_open(const char* spec);
+extern "C" void xec_port_close(void* port);
+extern "C" int64_t xec_port_receive_burst(void* port, xec::Packet** packets, int64_t max);
+extern "C" int64_t xec_port_transmit_burst(void* port, xec::Packet** packets, int64_t count);
+extern "C" int xec_port_exhausted(void* port);
+extern "C" void xec_packet_free(xec::Packet* packet);
+
+// Packet programs, `replay(file, replays) | modifyHeader(flag="ACK") | ... | transmit(file)`, use
+// the pipeline handle of Pipeline.hpp; xec_pipeline_run moves one burst at a time through them
+extern "C" void* xec_source_replay(const char* path, int64_t replays);
+extern "C" void xec_stage_modifyHeader(void* pipeline, const char* flag);
+extern "C" void xec_stage_modifyPayload(void* pipeline, const char* data);
+extern "C" void xec_stage_transmit(void* pipeline, const char* path);
@@ -0,0 +1,1081 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Topology.hpp"
+
+// Runtime for `pipeline { a | b() | c() }` chains.
+//
+// A chain is a Source, a list of Stages and a Sink. Adjacent stateless stages are fused into one
+// group that runs in a single loop: a chunk emitted by one stage is handed straight to the next
+// as a function call. Every stateful stage gets a group of its own. Groups run on their own
+// threads and are connected by bounded single-producer/single-consumer rings, so a slow group
+// applies backpressure to everything upstream.
+//
+// With PipelineOptions::workers > 1, a fused group of stateless stages fans out: a coordinator
+// thread hands each input chunk a ticket and dispatches it to one of the workers, and puts the
+// workers' results back in ticket order before they move on. At most reorderWindow tickets are in
+// flight, so a slow sink stalls dispatch instead of growing the reorder buffer.
+//
+// With PipelineOptions::placement set, every group thread (and parallel worker) is pinned to a core
+// chosen by the policy (Topology.hpp), and each ring is allocated on the node of the thread that
+// consumes from it.
+//
+// With a CheckpointStore attached (checkpointTo(), Checkpoint.hpp), the source's thread injects a
+// barrier whenever the store asks for a checkpoint, right after saving the source's position. The
+// barrier travels behind the chunks already in flight; each group saves its stages' state when it
+// arrives and passes it on, and once it reaches the sink the checkpoint is complete. Nothing waits
+// on the whole pipeline: every group pauses only for as long as its own stages take to save.
+// Because the source resumes at the saved position, chunks that were in flight at the barrier are
+// replayed rather than stored.
+
+namespace xec {
+
+constexpr size_t CACHE_LINE = 64;
+
+// A view of bytes plus a handle keeping the backing storage alive. Slicing shares the storage,
+// so stages can pass sub-ranges downstream without copying.
+struct Chunk {
+    std::shared_ptr<uint8_t> data;
+    size_t size = 0;
+    uint64_t sequence = 0;
+
+    static Chunk allocate(size_t size, uint64_t sequence = 0) {
+        return {std::shared_ptr<uint8_t>(new uint8_t[size], std::default_delete<uint8_t[]>()), size, sequence};
+    }
+
+    Chunk slice(size_t offset, size_t length) const {
+        return {std::shared_ptr<uint8_t>(data, data.get() + offset), length, sequence};
+    }
+
+    uint8_t* begin() const { return data.get(); }
+    uint8_t* end() const { return data.get() + size; }
+
+    // Checkpoint barriers share the rings with data as chunks without storage; stages never see them
+    static constexpr uint64_t BARRIER = uint64_t(1) << 63;
+
+    static Chunk barrier(uint64_t checkpoint) {
+        return {nullptr, 0, BARRIER | checkpoint};
+    }
+
+    bool isBarrier() const { return !data && (sequence & BARRIER); }
+};
+
+// Bounded lock-free ring for exactly one producer thread and one consumer thread. Each side keeps
+// a cached copy of the other side's index and only reloads it when the ring looks full/empty, so
+// the shared cache lines are touched once per wrap rather than once per element.
+inline size_t ringSlots(size_t capacity) {
+    size_t rounded = 2;
+    while (rounded < capacity) {
+        rounded <<= 1;
+    }
+    return rounded;
+}
+
+// `node` places the slots on a NUMA node (Topology.hpp); -1 leaves them to the allocator
+template <typename T>
+class SpscRing {
+public:
+    explicit SpscRing(size_t capacity, int node = -1) : mask(ringSlots(capacity) - 1), slots(mask + 1, node) {}
+
+    bool tryPush(T&& value) {
+        size_t tail = producer.index.load(std::memory_order_relaxed);
+        if (tail - producer.cachedOther > mask) {
+            producer.cachedOther = consumer.index.load(std::memory_order_acquire);
+            if (tail - producer.cachedOther > mask) {
+                return false;
+            }
+        }
+        slots[tail & mask] = std::move(value);
+        producer.index.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& value) {
+        size_t head = consumer.index.load(std::memory_order_relaxed);
+        if (head == consumer.cachedOther) {
+            consumer.cachedOther = producer.index.load(std::memory_order_acquire);
+            if (head == consumer.cachedOther) {
+                return false;
+            }
+        }
+        value = std::move(slots[head & mask]);
+        consumer.index.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Moves in as many of `values` as fit, publishing them with one index store
+    size_t tryPushBatch(T* values, size_t count) {
+        size_t tail = producer.index.load(std::memory_order_relaxed);
+        if (count > mask + 1 - (tail - producer.cachedOther)) {
+            producer.cachedOther = consumer.index.load(std::memory_order_acquire);
+        }
+        count = std::min(count, mask + 1 - (tail - producer.cachedOther));
+        for (size_t i = 0; i < count; i++) {
+            slots[(tail + i) & mask] = std::move(values[i]);
+        }
+        if (count) {
+            producer.index.store(tail + count, std::memory_order_release);
+        }
+        return count;
+    }
+
+    size_t tryPopBatch(T* values, size_t count) {
+        size_t head = consumer.index.load(std::memory_order_relaxed);
+        if (count > consumer.cachedOther - head) {
+            consumer.cachedOther = producer.index.load(std::memory_order_acquire);
+        }
+        count = std::min(count, consumer.cachedOther - head);
+        for (size_t i = 0; i < count; i++) {
+            values[i] = std::move(slots[(head + i) & mask]);
+        }
+        if (count) {
+            consumer.index.store(head + count, std::memory_order_release);
+        }
+        return count;
+    }
+
+    // Snapshots. The consumer index is read first, so it never overtakes the producer index read.
+    bool empty() const {
+        size_t head = consumer.index.load(std::memory_order_acquire);
+        return producer.index.load(std::memory_order_acquire) == head;
+    }
+
+    bool full() const {
+        size_t head = consumer.index.load(std::memory_order_acquire);
+        return producer.index.load(std::memory_order_acquire) - head > mask;
+    }
+
+    // Blocking variants spin briefly and then yield; the ring is meant to stay mostly non-empty
+    void push(T value) {
+        for (unsigned spins = 0; !tryPush(std::move(value)); spins++) {
+            backoff(spins);
+        }
+    }
+
+    // Returns false once the ring is closed and drained
+    bool pop(T& value) {
+        for (unsigned spins = 0;; spins++) {
+            if (tryPop(value)) {
+                return true;
+            }
+            if (closed.load(std::memory_order_acquire)) {
+                return tryPop(value);
+            }
+            backoff(spins);
+        }
+    }
+
+    void close() {
+        closed.store(true, std::memory_order_release);
+    }
+
+    bool isClosed() const {
+        return closed.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+private:
+    struct alignas(CACHE_LINE) Side {
+        std::atomic<size_t> index{0};
+        size_t cachedOther = 0;
+    };
+
+    Side producer;
+    Side consumer;
+    size_t mask;
+    NodeArray<T> slots;
+    alignas(CACHE_LINE) std::atomic<bool> closed{false};
+
+    static void backoff(unsigned spins) {
+        if (spins > 64) {
+            std::this_thread::yield();
+        }
+    }
+};
+
+// Bounded lock-free ring for any number of producers and consumers (Vyukov's bounded MPMC queue).
+// Each cell carries a sequence number saying whose turn it is, so a push or pop is one CAS on its
+// own side's index and producers never contend with consumers. A batch claims a run of ready cells
+// with a single CAS.
+template <typename T>
+class MpmcRing {
+public:
+    explicit MpmcRing(size_t capacity, int node = -1) : mask(ringSlots(capacity) - 1), cells(mask + 1, node) {
+        for (size_t i = 0; i <= mask; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Leaves `value` untouched when the ring is full
+    bool tryPush(T&& value) {
+        return tryPushBatch(&value, 1) == 1;
+    }
+
+    bool tryPop(T& value) {
+        return tryPopBatch(&value, 1) == 1;
+    }
+
+    size_t tryPushBatch(T* values, size_t count) {
+        size_t position = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            // Cell position + i is free for this lap when its sequence equals position + i
+            size_t ready = 0;
+            while (ready < count && cells[(position + ready) & mask].sequence.load(std::memory_order_acquire) == position + ready) {
+                ready++;
+            }
+            if (ready == 0) {
+                size_t sequence = cells[position & mask].sequence.load(std::memory_order_acquire);
+                if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position) < 0) {
+                    return 0;
+                }
+                position = tail.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (tail.compare_exchange_weak(position, position + ready, std::memory_order_relaxed)) {
+                for (size_t i = 0; i < ready; i++) {
+                    Cell& cell = cells[(position + i) & mask];
+                    cell.value = std::move(values[i]);
+                    cell.sequence.store(position + i + 1, std::memory_order_release);
+                }
+                return ready;
+            }
+        }
+    }
+
+    size_t tryPopBatch(T* values, size_t count) {
+        size_t position = head.load(std::memory_order_relaxed);
+        for (;;) {
+            size_t ready = 0;
+            while (ready < count &&
+                   cells[(position + ready) & mask].sequence.load(std::memory_order_acquire) == position + ready + 1) {
+                ready++;
+            }
+            if (ready == 0) {
+                size_t sequence = cells[position & mask].sequence.load(std::memory_order_acquire);
+                if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1) < 0) {
+                    return 0;
+                }
+                position = head.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (head.compare_exchange_weak(position, position + ready, std::memory_order_relaxed)) {
+                for (size_t i = 0; i < ready; i++) {
+                    Cell& cell = cells[(position + i) & mask];
+                    values[i] = std::move(cell.value);
+                    cell.sequence.store(position + i + mask + 1, std::memory_order_release);
+                }
+                return ready;
+            }
+        }
+    }
+
+    // Snapshots, as for SpscRing
+    bool empty() const {
+        size_t first = head.load(std::memory_order_acquire);
+        return tail.load(std::memory_order_acquire) == first;
+    }
+
+    bool full() const {
+        size_t first = head.load(std::memory_order_acquire);
+        return tail.load(std::memory_order_acquire) - first > mask;
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    size_t mask;
+    NodeArray<Cell> cells;
+    alignas(CACHE_LINE) std::atomic<size_t> tail{0};
+    alignas(CACHE_LINE) std::atomic<size_t> head{0};
+};
+
+// Input queue owned by a stage, used instead of a ring to connect it to the previous group.
+// offer() must not block; the queue decides what to drop when it is full (see Truncation.hpp).
+class Inbox {
+public:
+    virtual ~Inbox() = default;
+    virtual void offer(Chunk chunk) = 0;
+    virtual bool tryTake(Chunk& chunk) = 0;
+    virtual void close() = 0;
+    virtual bool isClosed() const = 0;
+};
+
+// Appends checkpoint state as native-endian words and length-prefixed byte strings
+class StateWriter {
+public:
+    explicit StateWriter(std::vector<uint8_t>& out) : out(out) {}
+
+    void u64(uint64_t value) {
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(value));
+    }
+
+    void bytes(const void* data, size_t size) {
+        u64(size);
+        const uint8_t* begin = static_cast<const uint8_t*>(data);
+        out.insert(out.end(), begin, begin + size);
+    }
+
+private:
+    std::vector<uint8_t>& out;
+};
+
+class StateReader {
+public:
+    StateReader(const uint8_t* data, size_t size) : data(data), size(size) {}
+
+    uint64_t u64() {
+        uint64_t value;
+        std::memcpy(&value, take(sizeof(value)), sizeof(value));
+        return value;
+    }
+
+    std::vector<uint8_t> bytes() {
+        size_t length = static_cast<size_t>(u64());
+        const uint8_t* begin = take(length);
+        return std::vector<uint8_t>(begin, begin + length);
+    }
+
+    // Reads exactly `length` bytes written by StateWriter::bytes()
+    void bytes(void* destination, size_t length) {
+        if (u64() != length) {
+            throw std::runtime_error("Checkpoint state does not match this stage");
+        }
+        std::memcpy(destination, take(length), length);
+    }
+
+private:
+    const uint8_t* data;
+    size_t size;
+    size_t position = 0;
+
+    const uint8_t* take(size_t length) {
+        if (length > size - position) {
+            throw std::runtime_error("Checkpoint state is truncated");
+        }
+        position += length;
+        return data + position - length;
+    }
+};
+
+// State a source, stage or sink saves at each checkpoint and loads before a resumed run. A stage
+// that carries data from one chunk to the next must implement it, or a resumed run loses that data.
+class Checkpointable {
+public:
+    virtual ~Checkpointable() = default;
+
+    // Called on the thread that runs the part, between two chunks
+    virtual void saveState(StateWriter& out) = 0;
+    virtual void loadState(StateReader& in) = 0;
+};
+
+// Where the pipeline hands checkpoint state (Checkpoint.hpp has one that writes to a directory).
+// Parts are named "source", "stage <index> <name>" and "sink".
+class CheckpointStore {
+public:
+    virtual ~CheckpointStore() = default;
+
+    // Polled by the source's thread between chunks; true starts a checkpoint
+    virtual bool due() = 0;
+
+    // One part's state at checkpoint `id`; parts save concurrently from their own threads
+    virtual void save(uint64_t id, const std::string& part, std::vector<uint8_t> state) = 0;
+
+    // The barrier of `id` reached the sink, so every part has saved
+    virtual void complete(uint64_t id) = 0;
+
+    // Parts of the last complete checkpoint; empty when there is none
+    virtual std::vector<std::pair<std::string, std::vector<uint8_t>>> latest() = 0;
+};
+
+// Receives the chunks a stage produces
+class Emitter {
+public:
+    virtual ~Emitter() = default;
+    virtual void emit(Chunk chunk) = 0;
+};
+
+class Stage {
+public:
+    virtual ~Stage() = default;
+
+    // Stateless stages depend only on the chunk in hand. They may be fused with their neighbours,
+    // and process() may then run on several threads at once
+    virtual bool stateless() const { return false; }
+
+    virtual std::string name() const = 0;
+
+    // Transform one chunk into zero or more output chunks
+    virtual void process(Chunk chunk, Emitter& out) = 0;
+
+    // End of stream: flush anything buffered
+    virtual void finish(Emitter& out) { (void)out; }
+
+    // Non-null when the stage brings its own input queue; such a stage always starts a group
+    virtual Inbox* inbox() { return nullptr; }
+
+    // Non-null when the stage has state to save at a checkpoint
+    virtual Checkpointable* checkpointable() { return nullptr; }
+};
+
+class Source {
+public:
+    virtual ~Source() = default;
+
+    // Produce the next chunk; false at end of stream
+    virtual bool next(Chunk& chunk) = 0;
+
+    // Non-null when the source can save its position and resume from it; required to checkpoint
+    virtual Checkpointable* checkpointable() { return nullptr; }
+};
+
+class Sink {
+public:
+    virtual ~Sink() = default;
+    virtual void consume(Chunk chunk) = 0;
+    virtual void finish() {}
+
+    // Non-null when the sink can save how far it got, e.g. to cut its output back on resume
+    virtual Checkpointable* checkpointable() { return nullptr; }
+};
+
+// Stateless stage from a callable, for per-chunk transforms emitted by generated code
+template <typename Fn>
+class MapStage : public Stage {
+public:
+    MapStage(std::string name, Fn fn) : stageName(std::move(name)), fn(std::move(fn)) {}
+
+    bool stateless() const override { return true; }
+    std::string name() const override { return stageName; }
+
+    void process(Chunk chunk, Emitter& out) override {
+        fn(chunk);
+        out.emit(std::move(chunk));
+    }
+
+private:
+    std::string stageName;
+    Fn fn;
+};
+
+template <typename Fn>
+std::unique_ptr<Stage> makeMapStage(std::string name, Fn fn) {
+    return std::make_unique<MapStage<Fn>>(std::move(name), std::move(fn));
+}
+
+struct PipelineOptions {
+    size_t ringCapacity = 64;  // Chunks in flight between two groups
+    bool fuseStages = true;    // Off: every stage gets its own thread (for comparison and debugging)
+    unsigned workers = 1;      // Threads per stateless group; 1 keeps every group single-threaded
+    size_t reorderWindow = 0;  // Max tickets in flight in a parallel group; 0 means 4 per worker
+    Placement placement = Placement::NONE;  // Pin threads and place rings by node (Topology.hpp)
+};
+
+// Where a group runs: its thread's core followed by its parallel workers' cores, and the node of
+// its thread, which holds its input ring
+struct GroupPlacement {
+    std::vector<std::string> stages;
+    std::vector<unsigned> cores;   // Empty without a placement policy
+    int node = -1;
+};
+
+class Pipeline {
+public:
+    explicit Pipeline(PipelineOptions options = {}) : options(options) {}
+
+    Pipeline& from(std::unique_ptr<Source> source) {
+        this->source = std::move(source);
+        return *this;
+    }
+
+    Pipeline& then(std::unique_ptr<Stage> stage) {
+        stages.push_back(std::move(stage));
+        return *this;
+    }
+
+    Pipeline& to(std::unique_ptr<Sink> sink) {
+        this->sink = std::move(sink);
+        return *this;
+    }
+
+    // Take checkpoints into `store` while running, and resume from its latest one when run() starts.
+    // The store must outlive run().
+    Pipeline& checkpointTo(CheckpointStore& store) {
+        checkpoints = &store;
+        return *this;
+    }
+
+    // Stage names per group, e.g. {{"parse", "mask"}, {"truncate"}, {"serialize"}}
+    std::vector<std::vector<std::string>> groups() const {
+        std::vector<std::vector<std::string>> names;
+        for (const auto& group : planGroups()) {
+            names.emplace_back();
+            for (size_t i = group.first; i < group.second; i++) {
+                names.back().push_back(stages[i]->name());
+            }
+        }
+        return names;
+    }
+
+    // What run() will pin where under the current topology
+    std::vector<GroupPlacement> placement() const {
+        auto plan = planGroups();
+        std::vector<size_t> slots;
+        std::vector<unsigned> cores = assignCores(plan, slots);
+        std::vector<GroupPlacement> placements;
+        for (size_t g = 0; g < plan.size(); g++) {
+            GroupPlacement placement;
+            for (size_t i = plan[g].first; i < plan[g].second; i++) {
+                placement.stages.push_back(stages[i]->name());
+            }
+            if (!cores.empty()) {
+                size_t end = g + 1 < plan.size() ? slots[g + 1] : cores.size();
+                placement.cores.assign(cores.begin() + static_cast<std::ptrdiff_t>(slots[g]), cores.begin() + static_cast<std::ptrdiff_t>(end));
+                placement.node = Topology::current().nodeOf(cores[slots[g]]);
+            }
+            placements.push_back(std::move(placement));
+        }
+        return placements;
+    }
+
+    // Run the chain to completion
+    void run() {
+        if (!source || !sink) {
+            throw std::logic_error("Pipeline needs a source and a sink");
+        }
+        if (checkpoints) {
+            restore();
+        }
+        auto plan = planGroups();
+        if (plan.empty()) {
+            // No stages: source feeds the sink directly
+            Chunk chunk;
+            for (;;) {
+                if (checkpoints && checkpoints->due()) {
+                    passBarrier(startCheckpoint(), nullptr);
+                }
+                if (!source->next(chunk)) {
+                    break;
+                }
+                sink->consume(std::move(chunk));
+            }
+            sink->finish();
+            return;
+        }
+
+        std::vector<size_t> slots;
+        cores = assignCores(plan, slots);
+
+        // connections[i] feeds group i + 1: its first stage's inbox if it has one, else a ring on
+        // that group's node
+        std::vector<std::unique_ptr<SpscRing<Chunk>>> rings;
+        std::vector<Connection> connections(plan.size() - 1);
+        for (size_t i = 0; i + 1 < plan.size(); i++) {
+            connections[i].inbox = stages[plan[i + 1].first]->inbox();
+            if (!connections[i].inbox) {
+                rings.push_back(std::make_unique<SpscRing<Chunk>>(options.ringCapacity, nodeOfSlot(slots[i + 1])));
+                connections[i].ring = rings.back().get();
+            }
+        }
+
+        std::vector<std::thread> threads;
+        for (size_t g = 0; g < plan.size(); g++) {
+            Connection* input = g > 0 ? &connections[g - 1] : nullptr;
+            Connection* output = g + 1 < plan.size() ? &connections[g] : nullptr;
+            auto [first, last] = plan[g];
+            threads.emplace_back([this, input, output, first = first, last = last, slot = slots[g]] {
+                pinSlot(slot);
+                runGroup(input, output, first, last, slot);
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        sink->finish();
+    }
+
+private:
+    PipelineOptions options;
+    std::unique_ptr<Source> source;
+    std::vector<std::unique_ptr<Stage>> stages;
+    std::unique_ptr<Sink> sink;
+    std::vector<unsigned> cores;   // Per thread slot during run(); empty without a placement policy
+    CheckpointStore* checkpoints = nullptr;
+    uint64_t checkpointsStarted = 0;
+
+    bool parallelGroup(size_t first) const {
+        return options.workers > 1 && stages[first]->stateless();
+    }
+
+    // A slot per thread: each group's own, followed by its workers if it is parallel. Consecutive
+    // slots get neighbouring cores under COMPACT, so a group's workers share its node.
+    std::vector<unsigned> assignCores(const std::vector<std::pair<size_t, size_t>>& plan, std::vector<size_t>& slots) const {
+        size_t threads = 0;
+        for (const auto& group : plan) {
+            slots.push_back(threads);
+            threads += parallelGroup(group.first) ? 1 + options.workers : 1;
+        }
+        return Topology::current().assign(options.placement, threads);
+    }
+
+    int nodeOfSlot(size_t slot) const {
+        return cores.empty() ? -1 : Topology::current().nodeOf(cores[slot]);
+    }
+
+    void pinSlot(size_t slot) const {
+        if (!cores.empty()) {
+            pinThread(cores[slot]);
+        }
+    }
+
+    // Half-open [first, last) stage ranges, one per thread
+    std::vector<std::pair<size_t, size_t>> planGroups() const {
+        std::vector<std::pair<size_t, size_t>> plan;
+        size_t i = 0;
+        while (i < stages.size()) {
+            size_t end = i + 1;
+            if (options.fuseStages && stages[i]->stateless() && !stages[i]->inbox()) {
+                while (end < stages.size() && stages[end]->stateless() && !stages[end]->inbox()) {
+                    end++;
+                }
+            }
+            plan.emplace_back(i, end);
+            i = end;
+        }
+        return plan;
+    }
+
+    // The path between two groups. A ring blocks the producer when full; an inbox never does.
+    struct Connection {
+        SpscRing<Chunk>* ring = nullptr;
+        Inbox* inbox = nullptr;
+
+        void push(Chunk chunk) {
+            if (ring) {
+                ring->push(std::move(chunk));
+            } else {
+                inbox->offer(std::move(chunk));
+            }
+        }
+
+        bool tryPop(Chunk& chunk) {
+            return ring ? ring->tryPop(chunk) : inbox->tryTake(chunk);
+        }
+
+        bool isClosed() const {
+            return ring ? ring->isClosed() : inbox->isClosed();
+        }
+
+        // Returns false once the connection is closed and drained
+        bool pop(Chunk& chunk) {
+            if (ring) {
+                return ring->pop(chunk);
+            }
+            for (unsigned spins = 0;; spins++) {
+                if (inbox->tryTake(chunk)) {
+                    return true;
+                }
+                if (inbox->isClosed()) {
+                    return inbox->tryTake(chunk);
+                }
+                if (spins > 64) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        void close() {
+            if (ring) {
+                ring->close();
+            } else {
+                inbox->close();
+            }
+        }
+    };
+
+    std::string stagePart(size_t index) const {
+        return "stage " + std::to_string(index) + " " + stages[index]->name();
+    }
+
+    static std::vector<uint8_t> saveState(Checkpointable& part) {
+        std::vector<uint8_t> state;
+        StateWriter writer(state);
+        part.saveState(writer);
+        return state;
+    }
+
+    // Load every checkpointable part from the store's latest checkpoint, which must have been
+    // taken from a pipeline of the same shape
+    void restore() {
+        if (!source->checkpointable()) {
+            throw std::logic_error("Checkpointing needs a source that can resume from a saved position");
+        }
+        std::vector<std::pair<std::string, Checkpointable*>> parts{{"source", source->checkpointable()}};
+        for (size_t i = 0; i < stages.size(); i++) {
+            if (Checkpointable* stage = stages[i]->checkpointable()) {
+                parts.emplace_back(stagePart(i), stage);
+            }
+        }
+        if (Checkpointable* last = sink->checkpointable()) {
+            parts.emplace_back("sink", last);
+        }
+        auto saved = checkpoints->latest();
+        if (saved.empty()) {
+            return;
+        }
+        if (saved.size() != parts.size()) {
+            throw std::runtime_error("Checkpoint was taken from a different pipeline");
+        }
+        for (auto& [name, part] : parts) {
+            auto match = std::find_if(saved.begin(), saved.end(), [&name = name](const auto& entry) { return entry.first == name; });
+            if (match == saved.end()) {
+                throw std::runtime_error("Checkpoint has no state for " + name);
+            }
+            StateReader reader(match->second.data(), match->second.size());
+            part->loadState(reader);
+        }
+    }
+
+    // On the source's thread: save its position and make the barrier that follows it
+    Chunk startCheckpoint() {
+        uint64_t id = ++checkpointsStarted;
+        checkpoints->save(id, "source", saveState(*source->checkpointable()));
+        return Chunk::barrier(id);
+    }
+
+    // A barrier reached a sequential group: everything before it has passed stages [first, last)
+    void saveStages(uint64_t id, size_t first, size_t last) {
+        for (size_t i = first; i < last; i++) {
+            if (Checkpointable* stage = stages[i]->checkpointable()) {
+                checkpoints->save(id, stagePart(i), saveState(*stage));
+            }
+        }
+    }
+
+    // Send a barrier on to the next group, or finish the checkpoint at the sink
+    void passBarrier(Chunk barrier, Connection* output) {
+        if (output) {
+            output->push(std::move(barrier));
+            return;
+        }
+        uint64_t id = barrier.sequence & ~Chunk::BARRIER;
+        if (Checkpointable* last = sink->checkpointable()) {
+            checkpoints->save(id, "sink", saveState(*last));
+        }
+        checkpoints->complete(id);
+    }
+
+    // Links stage k of a fused group to stage k + 1, or to whatever follows the group
+    class Link : public Emitter {
+    public:
+        Stage* next = nullptr;
+        Emitter* after = nullptr;
+        Connection* connection = nullptr;
+        Sink* sink = nullptr;
+
+        void emit(Chunk chunk) override {
+            if (next) {
+                next->process(std::move(chunk), *after);
+            } else if (connection) {
+                connection->push(std::move(chunk));
+            } else {
+                sink->consume(std::move(chunk));
+            }
+        }
+    };
+
+    struct Ticketed {
+        uint64_t ticket = 0;
+        Chunk chunk;
+    };
+
+    // Everything one input chunk turned into after passing a worker's fused stages
+    struct Batch {
+        uint64_t ticket = 0;
+        std::vector<Chunk> chunks;
+    };
+
+    class BatchCollector : public Emitter {
+    public:
+        std::vector<Chunk>* chunks = nullptr;
+
+        void emit(Chunk chunk) override {
+            chunks->push_back(std::move(chunk));
+        }
+    };
+
+    // Each worker runs stages [first, last) with its own links, the last of which gathers what one
+    // input turned into
+    void runWorker(SpscRing<Ticketed>& in, SpscRing<Batch>& out, size_t first, size_t last) {
+        BatchCollector collector;
+        std::vector<Link> links(last - first - 1);
+        for (size_t k = 0; k < links.size(); k++) {
+            links[k].next = stages[first + k + 1].get();
+            links[k].after = k + 1 < links.size() ? static_cast<Emitter*>(&links[k + 1]) : &collector;
+        }
+        Emitter& headOut = links.empty() ? static_cast<Emitter&>(collector) : links[0];
+
+        Ticketed item;
+        while (in.pop(item)) {
+            Batch batch;
+            batch.ticket = item.ticket;
+            collector.chunks = &batch.chunks;
+            stages[first]->process(std::move(item.chunk), headOut);
+            out.push(std::move(batch));
+        }
+    }
+
+    // Coordinator for a parallel group: pulls input, dispatches by ticket, and re-emits finished
+    // batches strictly in ticket order through `downstream`
+    void runParallelGroup(Connection* input, Connection* output, size_t first, size_t last, size_t slot, Link& downstream) {
+        const unsigned workerCount = options.workers;
+        const size_t window = options.reorderWindow ? options.reorderWindow : workerCount * 4;
+        const size_t perWorker = std::max<size_t>(2, window / workerCount);
+
+        std::vector<std::unique_ptr<SpscRing<Ticketed>>> toWorkers;
+        std::vector<std::unique_ptr<SpscRing<Batch>>> fromWorkers;
+        std::vector<std::thread> workers;
+        for (unsigned w = 0; w < workerCount; w++) {
+            toWorkers.push_back(std::make_unique<SpscRing<Ticketed>>(perWorker, nodeOfSlot(slot + 1 + w)));
+            fromWorkers.push_back(std::make_unique<SpscRing<Batch>>(perWorker, nodeOfSlot(slot)));
+        }
+        for (unsigned w = 0; w < workerCount; w++) {
+            workers.emplace_back([this, &toWorkers, &fromWorkers, w, first, last, slot] {
+                pinSlot(slot + 1 + w);
+                runWorker(*toWorkers[w], *fromWorkers[w], first, last);
+            });
+        }
+
+        // 1: got a chunk, 0: nothing yet, -1: end of stream
+        auto pull = [&](Chunk& chunk) -> int {
+            if (!input) {
+                if (checkpoints && checkpoints->due()) {
+                    chunk = startCheckpoint();
+                    return 1;
+                }
+                return source->next(chunk) ? 1 : -1;
+            }
+            if (input->tryPop(chunk)) {
+                return 1;
+            }
+            if (input->isClosed()) {
+                return input->tryPop(chunk) ? 1 : -1;
+            }
+            return 0;
+        };
+
+        std::vector<Batch> reorder(window);
+        std::vector<bool> ready(window, false);
+        uint64_t dispatched = 0;
+        uint64_t delivered = 0;
+        unsigned nextWorker = 0;
+        bool upstreamDone = false;
+        bool havePending = false;
+        Ticketed pending;
+
+        for (unsigned spins = 0;; spins++) {
+            bool progress = false;
+
+            // Dispatch while the window has room, to the first worker with space
+            while (!upstreamDone && dispatched - delivered < window) {
+                if (!havePending) {
+                    int pulled = pull(pending.chunk);
+                    if (pulled < 0) {
+                        upstreamDone = true;
+                        for (auto& ring : toWorkers) {
+                            ring->close();
+                        }
+                        break;
+                    }
+                    if (pulled == 0) {
+                        break;
+                    }
+                    pending.ticket = dispatched;
+                    if (pending.chunk.isBarrier()) {
+                        // Stateless stages have nothing to save: the barrier takes its turn in
+                        // the reorder buffer without visiting a worker
+                        size_t slot = dispatched % window;
+                        reorder[slot].ticket = dispatched;
+                        reorder[slot].chunks.push_back(std::move(pending.chunk));
+                        ready[slot] = true;
+                        dispatched++;
+                        progress = true;
+                        continue;
+                    }
+                    havePending = true;
+                }
+                bool placed = false;
+                for (unsigned attempt = 0; attempt < workerCount && !placed; attempt++) {
+                    placed = toWorkers[nextWorker]->tryPush(std::move(pending));
+                    nextWorker = (nextWorker + 1) % workerCount;
+                }
+                if (!placed) {
+                    break;
+                }
+                havePending = false;
+                dispatched++;
+                progress = true;
+            }
+
+            // Collect finished batches into their reorder slots
+            for (auto& ring : fromWorkers) {
+                Batch batch;
+                while (ring->tryPop(batch)) {
+                    size_t slot = batch.ticket % window;
+                    reorder[slot] = std::move(batch);
+                    ready[slot] = true;
+                    progress = true;
+                }
+            }
+
+            // Release the in-order prefix; pushing downstream blocks when the next group is slow
+            while (ready[delivered % window]) {
+                size_t slot = delivered % window;
+                for (auto& chunk : reorder[slot].chunks) {
+                    if (chunk.isBarrier()) {
+                        passBarrier(std::move(chunk), output);
+                    } else {
+                        downstream.emit(std::move(chunk));
+                    }
+                }
+                reorder[slot].chunks.clear();
+                ready[slot] = false;
+                delivered++;
+                progress = true;
+            }
+
+            if (upstreamDone && delivered == dispatched) {
+                break;
+            }
+            if (progress) {
+                spins = 0;
+            } else if (spins > 64) {
+                std::this_thread::yield();
+            }
+        }
+
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        // Stateless stages rarely buffer, but flush them in order like a sequential group. Every
+        // link is built first: what stage k flushes passes through the links after it.
+        std::vector<Link> links(last - first);
+        for (size_t k = 0; k < links.size(); k++) {
+            if (first + k + 1 < last) {
+                links[k].next = stages[first + k + 1].get();
+                links[k].after = &links[k + 1];
+            } else {
+                links[k] = downstream;
+            }
+        }
+        for (size_t k = 0; k < links.size(); k++) {
+            stages[first + k]->finish(links[k]);
+        }
+        if (output) {
+            output->close();
+        }
+    }
+
+    void runGroup(Connection* input, Connection* output, size_t first, size_t last, size_t slot) {
+        // links[k] is what stage first + k emits into
+        std::vector<Link> links(last - first);
+        for (size_t k = 0; k < links.size(); k++) {
+            if (first + k + 1 < last) {
+                links[k].next = stages[first + k + 1].get();
+                links[k].after = &links[k + 1];
+            } else {
+                links[k].connection = output;
+                links[k].sink = output ? nullptr : sink.get();
+            }
+        }
+
+        if (parallelGroup(first)) {
+            runParallelGroup(input, output, first, last, slot, links.back());
+            return;
+        }
+
+        Stage* head = stages[first].get();
+        Chunk chunk;
+        auto barrier = [&](Chunk marker) {
+            saveStages(marker.sequence & ~Chunk::BARRIER, first, last);
+            passBarrier(std::move(marker), output);
+        };
+        if (input) {
+            while (input->pop(chunk)) {
+                if (chunk.isBarrier()) {
+                    barrier(std::move(chunk));
+                    continue;
+                }
+                head->process(std::move(chunk), links[0]);
+            }
+        } else {
+            for (;;) {
+                if (checkpoints && checkpoints->due()) {
+                    barrier(startCheckpoint());
+                }
+                if (!source->next(chunk)) {
+                    break;
+                }
+                head->process(std::move(chunk), links[0]);
+            }
+        }
+        // Flush in order so data buffered by stage k still passes through stage k + 1
+        for (size_t k = 0; k < links.size(); k++) {
+            stages[first + k]->finish(links[k]);
+        }
+        if (output) {
+            output->close();
+        }
+    }
+};
+
+// Host bindings for compiled programs, defined in EntryPoints.cpp. A program's pipelines use the
+// factory bound to their source's name or their writeTo() path; without one, a source maps the
+// file named by the environment variable XEC_SOURCE_<name> and writeTo() creates the file. Bind
+// before the program's code runs.
+using SourceFactory = std::function<std::unique_ptr<Source>(const std::string& name)>;
+using SinkFactory = std::function<std::unique_ptr<Sink>(const std::string& path)>;
+void bindSource(const std::string& name, SourceFactory factory);
+void bindSink(const std::string& path, SinkFactory factory);
+
+// Options for every pipeline a compiled program builds; workers start at $XEC_WORKERS, or 1
+PipelineOptions& programPipelineOptions();
+
+} // namespace xec
+
+// Entry points for lowered `pipeline { }` blocks, defined in EntryPoints.cpp. The source call
+// returns a handle, each stage call adds to it, and xec_pipeline_run runs the chain and frees the
+// handle. A failing call marks the handle rather than returning an error: the calls after it do
+// nothing, and xec_pipeline_run reports the first failure on stderr and returns 1. A numeric
+// argument of 0 or a null string selects the stage's default.
+extern "C" void* xec_pipeline_from(const char* source);
+extern "C" void xec_stage_splitChunks(void* pipeline, int64_t size);
+extern "C" void xec_stage_parse(void* pipeline);
+extern "C" void xec_stage_truncate(void* pipeline, int64_t maxChunks, int64_t limit, const char* policy);
+extern "C" void xec_stage_serialize(void* pipeline, const char* format);
+extern "C" void xec_stage_encryptData(void* pipeline, const char* key);
+extern "C" void xec_stage_writeTo(void* pipeline, const char* path);
+extern "C" int xec_pipeline_run(void* pipeline);
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+
+// Profile support for --profile-generate / --profile-use builds.
+//
+// Instrumented code owns a table of counters per module and registers it at startup; the table is
+// appended to the profile file at exit. One line per counter:
+//
+//   function <name> <count>          entry count
+//   call <caller>><callee> <count>   calls from caller to callee
+//   taken <function>#<n> <count>     n-th conditional of a function, then-edge
+//   fallthrough <function>#<n> <count>   same conditional, else-edge
+//
+// Lines from several runs are summed when the profile is loaded, so appending is enough to merge.
+
+namespace xec {
+
+struct ProfileCounter {
+    const char* kind;
+    const char* key;
+    uint64_t count; // Incremented non-atomically by generated code; a lost update only costs precision
+};
+
+struct ProfileModule {
+    const char* name;
+    ProfileCounter* counters;
+    size_t size;
+    const char* defaultPath;
+    ProfileModule* next;
+};
+
+class ProfileRuntime {
+public:
+    static void registerModule(ProfileModule* module) {
+        std::lock_guard<std::mutex> lock(mutex());
+        if (!head()) {
+            std::atexit(&ProfileRuntime::dumpAtExit);
+        }
+        module->next = head();
+        head() = module;
+    }
+
+    // Append every registered counter to the profile file (XEC_PROFILE_FILE overrides the path)
+    static void dump() {
+        std::lock_guard<std::mutex> lock(mutex());
+        for (ProfileModule* module = head(); module; module = module->next) {
+            const char* path = std::getenv("XEC_PROFILE_FILE");
+            std::ofstream out(path ? path : module->defaultPath, std::ios::app);
+            for (size_t i = 0; i < module->size; i++) {
+                const ProfileCounter& counter = module->counters[i];
+                out << counter.kind << " " << counter.key << " " << counter.count << "\n";
+            }
+        }
+    }
+
+private:
+    static void dumpAtExit() {
+        dump();
+    }
+
+    static std::mutex& mutex() {
+        static std::mutex instance;
+        return instance;
+    }
+
+    static ProfileModule*& head() {
+        static ProfileModule* instance = nullptr;
+        return instance;
+    }
+};
+
+// Reader used by the compiler to drive optimizations from a collected profile
+class ProfileData {
+public:
+    bool load(const std::string& path) {
+        std::ifstream in(path);
+        if (!in) {
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string kind, key;
+            uint64_t count = 0;
+            if (!(fields >> kind >> key >> count)) {
+                continue;
+            }
+            uint64_t total = counts[{kind, key}] += count;
+            if (total > maxCounts[kind]) {
+                maxCounts[kind] = total;
+            }
+        }
+        return true;
+    }
+
+    bool empty() const {
+        return counts.empty();
+    }
+
+    bool contains(const std::string& kind, const std::string& key) const {
+        return counts.find({kind, key}) != counts.end();
+    }
+
+    uint64_t count(const std::string& kind, const std::string& key) const {
+        auto it = counts.find({kind, key});
+        return it != counts.end() ? it->second : 0;
+    }
+
+    uint64_t maxCount(const std::string& kind) const {
+        auto it = maxCounts.find(kind);
+        return it != maxCounts.end() ? it->second : 0;
+    }
+
+    // Hot means at least 1% of the hottest counter of the same kind
+    bool isHot(const std::string& kind, const std::string& key) const {
+        uint64_t max = maxCount(kind);
+        return max > 0 && count(kind, key) * 100 >= max;
+    }
+
+private:
+    std::map<std::pair<std::string, std::string>, uint64_t> counts;
+    std::map<std::string, uint64_t> maxCounts;
+};
+
+} // namespace xec
+
+// Defined in EntryPoints.cpp; instrumented modules call it from .init_array
+extern "C" void xec_profile_register(xec::ProfileModule* module);
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+#include "Allocator.hpp"
+
+// Biased reference counting for runtime objects.
+//
+// Every object is biased towards the thread that created it. That thread counts its references
+// in a plain integer; every other thread uses an atomic counter beside it. An object shared with
+// a consumer thread therefore costs the producer no atomic operations at all, and the consumer one
+// per retain/release.
+//
+// The two counts are merged when the owner drops its last biased reference (the object is freed
+// if nobody else holds it) or when the shared count goes negative, which happens when the owner
+// hands a reference to another thread that then releases it. In that case the releasing thread
+// queues the object to its owner, and the owner merges queued objects at its next collection
+// point (every 256 releases, rcCollect(), or thread exit). After a merge all operations are atomic.
+//
+// Shared word: count << 2 | QUEUED | MERGED. The thread whose atomic operation leaves an object
+// MERGED, not QUEUED and at count zero destroys it.
+
+namespace xec {
+
+struct RcHeader;
+
+namespace detail {
+
+struct RcOwner {
+    std::atomic<RcHeader*> queue{nullptr};
+    std::atomic<bool> exited{false};
+    unsigned releases = 0;
+};
+
+inline void mergeQueued(RcOwner* owner);
+
+// One per thread; intentionally never freed, since objects may name it after the thread exits.
+// Objects allocate pool memory before naming their owner, so this is destroyed before the
+// thread's pool cache and can still free into it.
+struct RcOwnerHandle {
+    RcOwner* owner = new RcOwner();
+
+    ~RcOwnerHandle() {
+        owner->exited.store(true, std::memory_order_seq_cst);
+        mergeQueued(owner);
+    }
+};
+
+inline RcOwner* currentOwner() {
+    thread_local RcOwnerHandle handle;
+    return handle.owner;
+}
+
+} // namespace detail
+
+struct RcHeader {
+    static constexpr int64_t MERGED = 1;
+    static constexpr int64_t QUEUED = 2;
+    static constexpr int64_t ONE = 4;
+
+    detail::RcOwner* owner = detail::currentOwner();
+    uint32_t biased = 1;      // Owner thread only; starts with the creating reference
+    uint32_t size = 0;        // Allocation size, for sized frees
+    std::atomic<int64_t> shared{0};
+    RcHeader* nextQueued = nullptr;
+    void (*destroy)(RcHeader*) = nullptr;
+
+    static int64_t count(int64_t word) {
+        return word >> 2;  // Arithmetic shift keeps negative counts
+    }
+
+    static bool dead(int64_t word) {
+        return (word & (MERGED | QUEUED)) == MERGED && count(word) == 0;
+    }
+};
+
+namespace detail {
+
+inline bool ownedByCaller(const RcHeader* header) {
+    return header->owner == currentOwner() && !(header->shared.load(std::memory_order_relaxed) & RcHeader::MERGED);
+}
+
+// Fold the biased count into the shared word. Only the owner may call this, or anyone once the
+// owner has exited and `biased` can no longer change.
+inline void merge(RcHeader* header) {
+    int64_t word = header->shared.load(std::memory_order_relaxed);
+    int64_t desired;
+    do {
+        desired = word & RcHeader::MERGED ? word : (word + header->biased * RcHeader::ONE) | RcHeader::MERGED;
+        desired &= ~RcHeader::QUEUED;
+    } while (!header->shared.compare_exchange_weak(word, desired, std::memory_order_acq_rel));
+    header->biased = 0;
+    if (RcHeader::dead(desired)) {
+        header->destroy(header);
+    }
+}
+
+inline void mergeQueued(RcOwner* owner) {
+    RcHeader* header = owner->queue.exchange(nullptr, std::memory_order_acquire);
+    while (header) {
+        RcHeader* next = header->nextQueued;
+        merge(header);
+        header = next;
+    }
+}
+
+inline void enqueue(RcHeader* header) {
+    RcOwner* owner = header->owner;
+    RcHeader* head = owner->queue.load(std::memory_order_relaxed);
+    do {
+        header->nextQueued = head;
+    } while (!owner->queue.compare_exchange_weak(head, header, std::memory_order_seq_cst));
+    // The owner drains its queue after marking itself exited, so one of the two sees the other
+    if (owner->exited.load(std::memory_order_seq_cst)) {
+        mergeQueued(owner);
+    }
+}
+
+} // namespace detail
+
+inline void rcRetain(RcHeader* header) {
+    if (detail::ownedByCaller(header)) {
+        header->biased++;
+        return;
+    }
+    header->shared.fetch_add(RcHeader::ONE, std::memory_order_relaxed);
+}
+
+inline void rcRelease(RcHeader* header) {
+    if (detail::ownedByCaller(header)) {
+        detail::RcOwner* owner = header->owner;
+        if (--header->biased == 0) {
+            // Implicit merge: the owner is done with the object
+            int64_t word = header->shared.fetch_or(RcHeader::MERGED, std::memory_order_acq_rel) | RcHeader::MERGED;
+            if (RcHeader::dead(word)) {
+                header->destroy(header);
+            }
+        }
+        if ((++owner->releases & 255) == 0 && owner->queue.load(std::memory_order_relaxed)) {
+            detail::mergeQueued(owner);
+        }
+        return;
+    }
+
+    int64_t word = header->shared.fetch_sub(RcHeader::ONE, std::memory_order_acq_rel) - RcHeader::ONE;
+    if (RcHeader::dead(word)) {
+        header->destroy(header);
+        return;
+    }
+    // The owner gave away a biased reference; ask it to merge
+    while (!(word & (RcHeader::MERGED | RcHeader::QUEUED)) && RcHeader::count(word) < 0) {
+        if (header->shared.compare_exchange_weak(word, word | RcHeader::QUEUED, std::memory_order_acq_rel)) {
+            detail::enqueue(header);
+            return;
+        }
+    }
+}
+
+// Merge objects other threads queued to this one; call at quiet points in long-running loops
+inline void rcCollect() {
+    detail::RcOwner* owner = detail::currentOwner();
+    if (owner->queue.load(std::memory_order_relaxed)) {
+        detail::mergeQueued(owner);
+    }
+}
+
+// Owning handle. Copies retain, moves transfer the reference without touching any counter.
+template <typename T>
+class Rc {
+public:
+    Rc() = default;
+
+    template <typename... Args>
+    static Rc make(Args&&... args) {
+        void* memory = PoolAllocator::allocate(sizeof(Box));
+        Box* box = new (memory) Box(std::forward<Args>(args)...);
+        box->header.size = sizeof(Box);
+        box->header.destroy = &destroyBox;
+        return Rc(box);
+    }
+
+    Rc(const Rc& other) : box(other.box) {
+        if (box) {
+            rcRetain(&box->header);
+        }
+    }
+
+    Rc(Rc&& other) noexcept : box(std::exchange(other.box, nullptr)) {}
+
+    Rc& operator=(Rc other) noexcept {
+        std::swap(box, other.box);
+        return *this;
+    }
+
+    ~Rc() {
+        if (box) {
+            rcRelease(&box->header);
+        }
+    }
+
+    T* get() const { return box ? &box->value : nullptr; }
+    T* operator->() const { return &box->value; }
+    T& operator*() const { return box->value; }
+    explicit operator bool() const { return box != nullptr; }
+
+private:
+    struct Box {
+        RcHeader header;
+        T value;
+
+        template <typename... Args>
+        explicit Box(Args&&... args) : value(std::forward<Args>(args)...) {}
+    };
+
+    Box* box = nullptr;
+
+    explicit Rc(Box* box) : box(box) {}
+
+    static void destroyBox(RcHeader* header) {
+        Box* box = reinterpret_cast<Box*>(header);
+        box->~Box();
+        PoolAllocator::free(box, sizeof(Box));
+    }
+};
+
+template <typename T, typename... Args>
+Rc<T> makeRc(Args&&... args) {
+    return Rc<T>::make(std::forward<Args>(args)...);
+}
+
+} // namespace xec
+
+// Entry points for generated code, defined in EntryPoints.cpp: payloads follow their header.
+// Releasing null does nothing, so locals can start out null and release before every store.
+extern "C" void* xec_rc_alloc(size_t size);
+extern "C" void xec_rc_retain(void* object);
+extern "C" void xec_rc_release(void* object);
+extern "C" void xec_rc_collect();
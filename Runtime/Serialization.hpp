@@ -0,0 +1,651 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Pipeline.hpp"
+
+// Binary format behind `serialize()`.
+//
+// A schema comes from a XecLang type declaration, e.g.
+//
+//   struct Reading { int id; float value; string source; array[int] samples; tuple(int, bool) flags }
+//
+// and fixes the layout of every record:
+//
+//   fixed part   every field at its natural alignment, like a C struct, rounded up to 8 bytes.
+//                int and float are 8 bytes, bool and byte are 1, tuples and structs are inlined.
+//                string and array fields hold a reference {u32 offset, u32 length}.
+//   tail         the bytes behind the references, each aligned for its element type. Offsets are
+//                from the start of the record.
+//
+// Because records start 8-aligned and nothing needs decoding, a RecordView reads fields straight
+// out of the buffer, including one that is mmapped from disk. Array elements must be fixed-size.
+//
+// Integer arrays can instead be stored compactly as zigzag LEB128 varints (the top bit of the
+// reference length marks this); decodeVarints() turns a run of one-byte varints into values 16
+// at a time.
+//
+// Records in a stream are framed as {u32 record length, u32 schema fingerprint} followed by the
+// record and padding to 8 bytes.
+
+namespace xec {
+
+// Varints
+
+inline uint64_t zigzagEncode(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t zigzagDecode(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+inline void encodeVarints(const int64_t* values, size_t count, std::vector<uint8_t>& out) {
+    size_t i = 0;
+    while (i < count) {
+        // Runs of small values are the common case and take one byte each
+        if (i + 8 <= count) {
+            bool small = true;
+            for (size_t k = 0; k < 8; k++) {
+                small &= zigzagEncode(values[i + k]) < 0x80;
+            }
+            if (small) {
+                for (size_t k = 0; k < 8; k++) {
+                    out.push_back(static_cast<uint8_t>(zigzagEncode(values[i + k])));
+                }
+                i += 8;
+                continue;
+            }
+        }
+        uint64_t value = zigzagEncode(values[i++]);
+        while (value >= 0x80) {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+}
+
+// Decodes `count` values and returns the number of bytes consumed
+inline size_t decodeVarints(const uint8_t* in, size_t size, int64_t* out, size_t count) {
+    size_t position = 0;
+    size_t i = 0;
+    while (i < count) {
+        // No continuation bit in the next 16 bytes: 16 complete one-byte values
+        if (i + 16 <= count && position + 16 <= size) {
+#ifdef __SSE2__
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + position));
+            bool allSmall = _mm_movemask_epi8(bytes) == 0;
+#else
+            uint64_t low, high;
+            std::memcpy(&low, in + position, 8);
+            std::memcpy(&high, in + position + 8, 8);
+            bool allSmall = ((low | high) & 0x8080808080808080ull) == 0;
+#endif
+            if (allSmall) {
+                for (size_t k = 0; k < 16; k++) {
+                    out[i + k] = zigzagDecode(in[position + k]);
+                }
+                i += 16;
+                position += 16;
+                continue;
+            }
+        }
+        uint64_t value = 0;
+        for (unsigned shift = 0;; shift += 7) {
+            if (position >= size || shift > 63) {
+                throw std::runtime_error("Corrupt varint data");
+            }
+            uint8_t byte = in[position++];
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                break;
+            }
+        }
+        out[i++] = zigzagDecode(value);
+    }
+    return position;
+}
+
+// Schema
+
+struct TypeLayout {
+    enum class Kind { BOOL, BYTE, INT, FLOAT, STRING, ARRAY, TUPLE, STRUCT };
+
+    Kind kind;
+    std::string name;                 // Struct name, if any
+    uint32_t size = 0;
+    uint32_t align = 1;
+    std::shared_ptr<TypeLayout> element;  // ARRAY
+    std::vector<std::pair<std::string, std::shared_ptr<TypeLayout>>> members;  // TUPLE ("0", "1", ...) and STRUCT
+    std::vector<uint32_t> offsets;
+
+    bool fixedSize() const {
+        if (kind == Kind::STRING || kind == Kind::ARRAY) {
+            return false;
+        }
+        for (const auto& member : members) {
+            if (!member.second->fixedSize()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Canonical spelling, used for fingerprints and error messages
+    std::string describe() const {
+        switch (kind) {
+            case Kind::BOOL: return "bool";
+            case Kind::BYTE: return "byte";
+            case Kind::INT: return "int";
+            case Kind::FLOAT: return "float";
+            case Kind::STRING: return "string";
+            case Kind::ARRAY: return "array[" + element->describe() + "]";
+            case Kind::TUPLE:
+            case Kind::STRUCT: {
+                std::string text = kind == Kind::TUPLE ? "tuple(" : "struct {";
+                for (size_t i = 0; i < members.size(); i++) {
+                    text += (i ? ", " : "") + members[i].second->describe();
+                    if (kind == Kind::STRUCT) {
+                        text += " " + members[i].first;
+                    }
+                }
+                return text + (kind == Kind::TUPLE ? ")" : "}");
+            }
+        }
+        return "?";
+    }
+};
+
+// A field resolved to its place in the fixed part
+struct Field {
+    uint32_t offset = 0;
+    std::shared_ptr<TypeLayout> layout;
+};
+
+class Schema {
+public:
+    static Schema parse(const std::string& declaration) {
+        DeclarationParser parser(declaration);
+        Schema schema;
+        schema.root = parser.parseType();
+        parser.expectEnd();
+        if (schema.root->kind != TypeLayout::Kind::STRUCT && schema.root->kind != TypeLayout::Kind::TUPLE) {
+            // A bare type becomes a one-field record named "value"
+            auto wrapper = std::make_shared<TypeLayout>();
+            wrapper->kind = TypeLayout::Kind::STRUCT;
+            wrapper->members.emplace_back("value", schema.root);
+            layOut(*wrapper);
+            schema.root = wrapper;
+        }
+        schema.fixedSize = (schema.root->size + 7) & ~7u;
+        schema.hash = fingerprintOf(schema.root->describe());
+        return schema;
+    }
+
+    // Dotted path through structs and tuples, e.g. "flags.1"
+    Field field(const std::string& path) const {
+        Field field{0, root};
+        size_t start = 0;
+        while (start <= path.size()) {
+            size_t dot = path.find('.', start);
+            std::string name = path.substr(start, dot == std::string::npos ? std::string::npos : dot - start);
+            const TypeLayout& parent = *field.layout;
+            bool found = false;
+            for (size_t i = 0; i < parent.members.size(); i++) {
+                if (parent.members[i].first == name) {
+                    field.offset += parent.offsets[i];
+                    field.layout = parent.members[i].second;
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                throw std::runtime_error("No field '" + path + "' in " + root->describe());
+            }
+            if (dot == std::string::npos) {
+                break;
+            }
+            start = dot + 1;
+        }
+        return field;
+    }
+
+    uint32_t fixedBytes() const { return fixedSize; }
+    uint32_t fingerprint() const { return hash; }
+    const TypeLayout& layout() const { return *root; }
+
+private:
+    std::shared_ptr<TypeLayout> root;
+    uint32_t fixedSize = 0;
+    uint32_t hash = 0;
+
+    static uint32_t fingerprintOf(const std::string& text) {
+        uint32_t hash = 2166136261u;
+        for (unsigned char c : text) {
+            hash = (hash ^ c) * 16777619u;
+        }
+        return hash;
+    }
+
+    static void layOut(TypeLayout& type) {
+        uint32_t offset = 0;
+        type.align = 1;
+        type.offsets.clear();
+        for (const auto& member : type.members) {
+            const TypeLayout& field = *member.second;
+            offset = (offset + field.align - 1) & ~(field.align - 1);
+            type.offsets.push_back(offset);
+            offset += field.size;
+            type.align = std::max(type.align, field.align);
+        }
+        type.size = (offset + type.align - 1) & ~(type.align - 1);
+    }
+
+    class DeclarationParser {
+    public:
+        explicit DeclarationParser(const std::string& text) : text(text) {}
+
+        std::shared_ptr<TypeLayout> parseType() {
+            std::string word = identifier();
+            std::string lower = word;
+            for (char& c : lower) {
+                c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+            }
+
+            auto type = std::make_shared<TypeLayout>();
+            if (lower == "bool") {
+                scalar(*type, TypeLayout::Kind::BOOL, 1);
+            } else if (lower == "byte") {
+                scalar(*type, TypeLayout::Kind::BYTE, 1);
+            } else if (lower == "int") {
+                scalar(*type, TypeLayout::Kind::INT, 8);
+            } else if (lower == "float") {
+                scalar(*type, TypeLayout::Kind::FLOAT, 8);
+            } else if (lower == "string") {
+                reference(*type, TypeLayout::Kind::STRING);
+            } else if (lower == "array") {
+                expect('[');
+                type = arrayOf(parseType());
+                expect(']');
+            } else if (lower == "tuple") {
+                type->kind = TypeLayout::Kind::TUPLE;
+                expect('(');
+                do {
+                    type->members.emplace_back(std::to_string(type->members.size()), parseType());
+                } while (accept(','));
+                expect(')');
+                layOut(*type);
+            } else if (lower == "struct") {
+                type->kind = TypeLayout::Kind::STRUCT;
+                if (peek() != '{') {
+                    type->name = identifier();
+                }
+                expect('{');
+                while (!accept('}')) {
+                    auto memberType = parseType();
+                    type->members.emplace_back(identifier(), memberType);
+                    if (!accept(';')) {
+                        accept(',');
+                    }
+                }
+                if (type->members.empty()) {
+                    throw std::runtime_error("Empty struct in schema: " + text);
+                }
+                layOut(*type);
+            } else {
+                throw std::runtime_error("Unknown type '" + word + "' in schema: " + text);
+            }
+
+            // README-style postfix arrays: Byte[]
+            while (peek() == '[' && text.compare(position, 2, "[]") == 0) {
+                position += 2;
+                type = arrayOf(type);
+            }
+            return type;
+        }
+
+        void expectEnd() {
+            accept(';');
+            if (peek() != '\0') {
+                throw std::runtime_error("Unexpected '" + text.substr(position) + "' in schema");
+            }
+        }
+
+    private:
+        const std::string& text;
+        size_t position = 0;
+
+        static void scalar(TypeLayout& type, TypeLayout::Kind kind, uint32_t size) {
+            type.kind = kind;
+            type.size = size;
+            type.align = size;
+        }
+
+        static void reference(TypeLayout& type, TypeLayout::Kind kind) {
+            type.kind = kind;
+            type.size = 8;
+            type.align = 4;
+        }
+
+        std::shared_ptr<TypeLayout> arrayOf(std::shared_ptr<TypeLayout> element) {
+            if (!element->fixedSize()) {
+                throw std::runtime_error("Array elements must be fixed-size: " + element->describe());
+            }
+            auto type = std::make_shared<TypeLayout>();
+            reference(*type, TypeLayout::Kind::ARRAY);
+            type->element = std::move(element);
+            return type;
+        }
+
+        char peek() {
+            while (position < text.size() && std::isspace(static_cast<unsigned char>(text[position]))) {
+                position++;
+            }
+            return position < text.size() ? text[position] : '\0';
+        }
+
+        bool accept(char c) {
+            if (peek() == c) {
+                position++;
+                return true;
+            }
+            return false;
+        }
+
+        void expect(char c) {
+            if (!accept(c)) {
+                throw std::runtime_error(std::string("Expected '") + c + "' in schema: " + text);
+            }
+        }
+
+        std::string identifier() {
+            peek();
+            size_t start = position;
+            while (position < text.size() && (std::isalnum(static_cast<unsigned char>(text[position])) || text[position] == '_')) {
+                position++;
+            }
+            if (start == position) {
+                throw std::runtime_error("Expected a name in schema: " + text);
+            }
+            return text.substr(start, position - start);
+        }
+    };
+};
+
+// Records
+
+constexpr uint32_t VARINT_ARRAY = 0x80000000u;
+
+class RecordBuilder {
+public:
+    explicit RecordBuilder(const Schema& schema) : schema(schema), bytes(schema.fixedBytes(), 0) {}
+
+    template <typename T>
+    void set(const Field& field, T value) {
+        check(field, sizeof(T));
+        std::memcpy(bytes.data() + field.offset, &value, sizeof(T));
+    }
+
+    void setString(const Field& field, std::string_view value) {
+        expectKind(field, TypeLayout::Kind::STRING);
+        writeReference(field, appendTail(value.data(), value.size(), 1), static_cast<uint32_t>(value.size()));
+    }
+
+    // Elements are laid out exactly as in memory, so T must match the element layout
+    template <typename T>
+    void setArray(const Field& field, const T* values, size_t count) {
+        expectKind(field, TypeLayout::Kind::ARRAY);
+        if (field.layout->element->size != sizeof(T)) {
+            throw std::runtime_error("Element size mismatch for " + field.layout->describe());
+        }
+        uint32_t offset = appendTail(values, count * sizeof(T), field.layout->element->align);
+        writeReference(field, offset, static_cast<uint32_t>(count));
+    }
+
+    // array[int] stored as {u32 byte length, varints}; smaller on the wire, decoded on read
+    void setCompactIntegers(const Field& field, const int64_t* values, size_t count) {
+        expectKind(field, TypeLayout::Kind::ARRAY);
+        if (field.layout->element->kind != TypeLayout::Kind::INT) {
+            throw std::runtime_error("Compact encoding needs array[int], not " + field.layout->describe());
+        }
+        scratch.assign(4, 0);
+        encodeVarints(values, count, scratch);
+        uint32_t length = static_cast<uint32_t>(scratch.size() - 4);
+        std::memcpy(scratch.data(), &length, 4);
+        uint32_t offset = appendTail(scratch.data(), scratch.size(), 4);
+        writeReference(field, offset, static_cast<uint32_t>(count) | VARINT_ARRAY);
+    }
+
+    const std::vector<uint8_t>& record() const {
+        return bytes;
+    }
+
+    // Append the framed record to a stream and reset for the next one
+    void appendTo(std::vector<uint8_t>& stream) {
+        uint32_t header[2] = {static_cast<uint32_t>(bytes.size()), schema.fingerprint()};
+        size_t start = stream.size();
+        stream.resize(start + 8 + ((bytes.size() + 7) & ~size_t(7)), 0);
+        std::memcpy(stream.data() + start, header, 8);
+        std::memcpy(stream.data() + start + 8, bytes.data(), bytes.size());
+        bytes.assign(schema.fixedBytes(), 0);
+    }
+
+private:
+    const Schema& schema;
+    std::vector<uint8_t> bytes;
+    std::vector<uint8_t> scratch;
+
+    void check(const Field& field, size_t size) const {
+        if (!field.layout->fixedSize() || field.layout->size != size) {
+            throw std::runtime_error("Cannot store a " + std::to_string(size) + "-byte value in " + field.layout->describe());
+        }
+    }
+
+    static void expectKind(const Field& field, TypeLayout::Kind kind) {
+        if (field.layout->kind != kind) {
+            throw std::runtime_error("Field is " + field.layout->describe());
+        }
+    }
+
+    uint32_t appendTail(const void* data, size_t size, uint32_t align) {
+        size_t offset = (bytes.size() + align - 1) & ~size_t(align - 1);
+        if (offset + size > UINT32_MAX) {
+            throw std::runtime_error("Record larger than 4 GB");
+        }
+        bytes.resize(offset + size);
+        if (size) {
+            std::memcpy(bytes.data() + offset, data, size);
+        }
+        return static_cast<uint32_t>(offset);
+    }
+
+    void writeReference(const Field& field, uint32_t offset, uint32_t length) {
+        std::memcpy(bytes.data() + field.offset, &offset, 4);
+        std::memcpy(bytes.data() + field.offset + 4, &length, 4);
+    }
+};
+
+// Pointer plus count into a record; valid as long as the record's buffer
+template <typename T>
+struct ArrayView {
+    const T* data = nullptr;
+    size_t count = 0;
+
+    const T* begin() const { return data; }
+    const T* end() const { return data + count; }
+    const T& operator[](size_t i) const { return data[i]; }
+    size_t size() const { return count; }
+};
+
+// Reads fields in place. Every reference is bounds-checked against the record, so a view over
+// untrusted bytes cannot read outside them.
+class RecordView {
+public:
+    RecordView() = default;
+    RecordView(const uint8_t* data, size_t size) : data(data), size(size) {}
+
+    template <typename T>
+    T get(const Field& field) const {
+        within(field.offset, sizeof(T));
+        T value;
+        std::memcpy(&value, data + field.offset, sizeof(T));
+        return value;
+    }
+
+    std::string_view string(const Field& field) const {
+        auto [offset, length] = reference(field);
+        within(offset, length);
+        return {reinterpret_cast<const char*>(data + offset), length};
+    }
+
+    template <typename T>
+    ArrayView<T> array(const Field& field) const {
+        auto [offset, count] = reference(field);
+        if (count & VARINT_ARRAY) {
+            throw std::runtime_error("Compact array has no in-place view; use integers()");
+        }
+        if (offset % alignof(T) != 0 || reinterpret_cast<uintptr_t>(data) % alignof(T) != 0) {
+            throw std::runtime_error("Misaligned array in record");
+        }
+        within(offset, static_cast<size_t>(count) * sizeof(T));
+        return {reinterpret_cast<const T*>(data + offset), count};
+    }
+
+    // array[int] in either encoding
+    std::vector<int64_t> integers(const Field& field) const {
+        auto [offset, count] = reference(field);
+        if (!(count & VARINT_ARRAY)) {
+            ArrayView<int64_t> view = array<int64_t>(field);
+            return {view.begin(), view.end()};
+        }
+        count &= ~VARINT_ARRAY;
+        within(offset, 4);
+        uint32_t length;
+        std::memcpy(&length, data + offset, 4);
+        within(offset + 4, length);
+        // Every varint takes at least one byte, so a larger count is corrupt; checked before the
+        // allocation it would size
+        if (count > length) {
+            throw std::runtime_error("Corrupt record: compact array count exceeds its bytes");
+        }
+        std::vector<int64_t> values(count);
+        decodeVarints(data + offset + 4, length, values.data(), count);
+        return values;
+    }
+
+private:
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    void within(size_t offset, size_t length) const {
+        if (offset > size || length > size - offset) {
+            throw std::runtime_error("Corrupt record: reference out of bounds");
+        }
+    }
+
+    std::pair<uint32_t, uint32_t> reference(const Field& field) const {
+        within(field.offset, 8);
+        uint32_t words[2];
+        std::memcpy(words, data + field.offset, 8);
+        return {words[0], words[1]};
+    }
+};
+
+// Walks a stream of framed records, checking each against the schema's fingerprint
+class RecordReader {
+public:
+    RecordReader(const Schema& schema, const uint8_t* data, size_t size) : schema(schema), data(data), size(size) {}
+
+    bool next(RecordView& record) {
+        if (position == size) {
+            return false;
+        }
+        if (size - position < 8) {
+            throw std::runtime_error("Corrupt record stream: truncated header");
+        }
+        uint32_t header[2];
+        std::memcpy(header, data + position, 8);
+        if (header[1] != schema.fingerprint()) {
+            throw std::runtime_error("Record written with a different schema than " + schema.layout().describe());
+        }
+        size_t padded = (static_cast<size_t>(header[0]) + 7) & ~size_t(7);
+        if (header[0] < schema.fixedBytes() || padded > size - position - 8) {
+            throw std::runtime_error("Corrupt record stream: bad record length");
+        }
+        record = RecordView(data + position + 8, header[0]);
+        position += 8 + padded;
+        return true;
+    }
+
+private:
+    const Schema& schema;
+    const uint8_t* data;
+    size_t size;
+    size_t position = 0;
+};
+
+// `serialize()` for raw chunks: each chunk becomes a record of
+// struct { int sequence; array[byte] data }. The fixed part goes out as its own small chunk and
+// the payload follows as the original chunk, so the data itself is never copied.
+class SerializeStage : public Stage {
+public:
+    SerializeStage()
+        : schema(Schema::parse("struct Chunk { int sequence; array[byte] data }")),
+          sequenceField(schema.field("sequence")), dataField(schema.field("data")) {}
+
+    bool stateless() const override { return true; }
+    std::string name() const override { return "serialize"; }
+
+    void process(Chunk chunk, Emitter& out) override {
+        uint32_t fixed = schema.fixedBytes();
+        // The frame's length is 32 bits and is padded up to a multiple of 8
+        if (chunk.size > UINT32_MAX - 7 - fixed) {
+            throw std::runtime_error("Chunk too large to serialize: " + std::to_string(chunk.size) + " bytes");
+        }
+        uint32_t recordBytes = fixed + static_cast<uint32_t>(chunk.size);
+        Chunk header = Chunk::allocate(8 + fixed, chunk.sequence);
+        uint32_t frame[2] = {recordBytes, schema.fingerprint()};
+        uint32_t reference[2] = {fixed, static_cast<uint32_t>(chunk.size)};
+        int64_t sequence = static_cast<int64_t>(chunk.sequence);
+        std::memset(header.begin(), 0, header.size);
+        std::memcpy(header.begin(), frame, 8);
+        std::memcpy(header.begin() + 8 + sequenceField.offset, &sequence, 8);
+        std::memcpy(header.begin() + 8 + dataField.offset, reference, 8);
+        out.emit(std::move(header));
+
+        size_t padding = ((recordBytes + 7) & ~7u) - recordBytes;
+        uint64_t chunkSequence = chunk.sequence;
+        out.emit(std::move(chunk));
+        if (padding) {
+            Chunk zeros = Chunk::allocate(padding, chunkSequence);
+            std::memset(zeros.begin(), 0, padding);
+            out.emit(std::move(zeros));
+        }
+    }
+
+    const Schema& recordSchema() const {
+        return schema;
+    }
+
+private:
+    Schema schema;
+    Field sequenceField;
+    Field dataField;
+};
+
+} // namespace xec
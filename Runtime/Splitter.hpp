@@ -0,0 +1,278 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "Pipeline.hpp"
+
+// `splitChunks(size=256_KB, ...)`: cut a byte stream into chunks of roughly `size` bytes that
+// always end on a record boundary.
+//
+// Records are newline-terminated, terminated by a custom delimiter, or prefixed with a
+// little-endian u32 length. Output chunks are slices of the input, so nothing is copied except a
+// record that straddles two input chunks; that one record is reassembled into a buffer of its own.
+// A record larger than `size` becomes a chunk by itself. Plain byte splitting (BYTES) ignores
+// records and is stateless.
+//
+// Delimiters are found 32 (AVX2) or 16 (SSE2) bytes at a time. Cutting scans backwards from the
+// size limit, so only the bytes between the limit and the last boundary are examined.
+
+namespace xec {
+
+// First occurrence of `byte` in [begin, end), or end
+inline const uint8_t* findByte(const uint8_t* begin, const uint8_t* end, uint8_t byte) {
+    const uint8_t* p = begin;
+#if defined(__AVX2__)
+    const __m256i needle = _mm256_set1_epi8(static_cast<char>(byte));
+    for (; p + 32 <= end; p += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i needle = _mm_set1_epi8(static_cast<char>(byte));
+    for (; p + 16 <= end; p += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; p < end; p++) {
+        if (*p == byte) {
+            return p;
+        }
+    }
+    return end;
+}
+
+// Last occurrence of `byte` in [begin, end), or nullptr
+inline const uint8_t* findLastByte(const uint8_t* begin, const uint8_t* end, uint8_t byte) {
+    const uint8_t* p = end;
+#if defined(__AVX2__)
+    const __m256i needle = _mm256_set1_epi8(static_cast<char>(byte));
+    for (; p - begin >= 32; p -= 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p - 32));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+        if (mask) {
+            return p - 32 + (31 - __builtin_clz(mask));
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128i needle = _mm_set1_epi8(static_cast<char>(byte));
+    for (; p - begin >= 16; p -= 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p - 16));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)));
+        if (mask) {
+            return p - 16 + (31 - __builtin_clz(mask));
+        }
+    }
+#endif
+    while (p > begin) {
+        if (*--p == byte) {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+enum class RecordFraming { BYTES, NEWLINE, DELIMITER, LENGTH_PREFIXED };
+
+struct SplitOptions {
+    size_t size = 256 << 10;
+    RecordFraming framing = RecordFraming::NEWLINE;
+    std::string delimiter = "\n";  // DELIMITER only; may be several bytes
+};
+
+class SplitChunksStage : public Stage, private Checkpointable {
+public:
+    explicit SplitChunksStage(SplitOptions options = {}) : options(std::move(options)) {
+        if (this->options.size == 0) {
+            throw std::runtime_error("splitChunks needs a non-zero size");
+        }
+        if (this->options.framing == RecordFraming::NEWLINE) {
+            this->options.delimiter = "\n";
+        }
+        if (this->options.framing == RecordFraming::DELIMITER && this->options.delimiter.empty()) {
+            throw std::runtime_error("splitChunks needs a non-empty delimiter");
+        }
+    }
+
+    bool stateless() const override { return options.framing == RecordFraming::BYTES; }
+    std::string name() const override { return "splitChunks"; }
+
+    // The partial record carried into the next chunk
+    Checkpointable* checkpointable() override { return stateless() ? nullptr : this; }
+
+    void process(Chunk chunk, Emitter& out) override {
+        if (options.framing == RecordFraming::BYTES) {
+            for (size_t offset = 0; offset < chunk.size; offset += options.size) {
+                out.emit(chunk.slice(offset, std::min(options.size, chunk.size - offset)));
+            }
+            return;
+        }
+
+        const uint8_t* data = chunk.begin();
+        size_t start = 0;
+        if (!carry.empty()) {
+            size_t take = completeCarry(data, chunk.size);
+            if (take == NONE) {
+                carry.insert(carry.end(), data, data + chunk.size);
+                return;
+            }
+            Chunk record = Chunk::allocate(carry.size() + take);
+            std::memcpy(record.begin(), carry.data(), carry.size());
+            std::memcpy(record.begin() + carry.size(), data, take);
+            carry.clear();
+            emit(std::move(record), out);
+            start = take;
+        }
+
+        while (start < chunk.size) {
+            size_t limit = std::min(chunk.size, start + options.size);
+            size_t cut = lastBoundary(data, start, limit);
+            if (cut == NONE) {
+                // One record longer than `size`: it becomes a chunk of its own
+                cut = firstBoundary(data, start, chunk.size);
+            }
+            if (cut == NONE) {
+                break;
+            }
+            emit(chunk.slice(start, cut - start), out);
+            start = cut;
+        }
+        carry.assign(data + start, data + chunk.size);
+    }
+
+    // A final record without its terminator is still a record
+    void finish(Emitter& out) override {
+        if (!carry.empty()) {
+            Chunk record = Chunk::allocate(carry.size());
+            std::memcpy(record.begin(), carry.data(), carry.size());
+            carry.clear();
+            emit(std::move(record), out);
+        }
+    }
+
+private:
+    static constexpr size_t NONE = static_cast<size_t>(-1);
+
+    void saveState(StateWriter& out) override {
+        out.bytes(carry.data(), carry.size());
+        out.u64(sequence);
+    }
+
+    void loadState(StateReader& in) override {
+        carry = in.bytes();
+        sequence = in.u64();
+    }
+
+    SplitOptions options;
+    std::vector<uint8_t> carry;
+    uint64_t sequence = 0;
+
+    void emit(Chunk chunk, Emitter& out) {
+        chunk.sequence = sequence++;
+        out.emit(std::move(chunk));
+    }
+
+    bool delimiterAt(const uint8_t* p) const {
+        return std::memcmp(p, options.delimiter.data(), options.delimiter.size()) == 0;
+    }
+
+    static uint32_t readLength(const uint8_t* p) {
+        return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 | static_cast<uint32_t>(p[2]) << 16 |
+               static_cast<uint32_t>(p[3]) << 24;
+    }
+
+    // End of the last record that ends in (start, limit], or NONE. `start` is a record boundary.
+    size_t lastBoundary(const uint8_t* data, size_t start, size_t limit) const {
+        if (options.framing == RecordFraming::LENGTH_PREFIXED) {
+            size_t last = NONE;
+            for (size_t position = start; limit - position >= 4;) {
+                size_t end = position + 4 + readLength(data + position);
+                if (end > limit) {
+                    break;
+                }
+                last = position = end;
+            }
+            return last;
+        }
+        size_t length = options.delimiter.size();
+        if (limit - start < length) {
+            return NONE;
+        }
+        const uint8_t* begin = data + start;
+        const uint8_t* end = data + limit - length + 1;
+        while (const uint8_t* found = findLastByte(begin, end, options.delimiter[0])) {
+            if (delimiterAt(found)) {
+                return static_cast<size_t>(found - data) + length;
+            }
+            end = found;
+        }
+        return NONE;
+    }
+
+    // End of the first record starting at `start`, if it ends before `size`
+    size_t firstBoundary(const uint8_t* data, size_t start, size_t size) const {
+        if (options.framing == RecordFraming::LENGTH_PREFIXED) {
+            if (size - start < 4) {
+                return NONE;
+            }
+            size_t end = start + 4 + readLength(data + start);
+            return end <= size ? end : NONE;
+        }
+        size_t length = options.delimiter.size();
+        if (size - start < length) {
+            return NONE;
+        }
+        const uint8_t* end = data + size - length + 1;
+        for (const uint8_t* p = data + start; (p = findByte(p, end, options.delimiter[0])) != end; p++) {
+            if (delimiterAt(p)) {
+                return static_cast<size_t>(p - data) + length;
+            }
+        }
+        return NONE;
+    }
+
+    // How many bytes of the new chunk finish the carried partial record, or NONE
+    size_t completeCarry(const uint8_t* data, size_t size) const {
+        if (options.framing == RecordFraming::LENGTH_PREFIXED) {
+            uint8_t header[4];
+            size_t have = std::min<size_t>(carry.size(), 4);
+            std::memcpy(header, carry.data(), have);
+            if (have + size < 4) {
+                return NONE;
+            }
+            std::memcpy(header + have, data, 4 - have);
+            size_t total = 4 + static_cast<size_t>(readLength(header));
+            size_t take = total - carry.size();
+            return take <= size ? take : NONE;
+        }
+        // The delimiter may itself straddle the two chunks
+        size_t length = options.delimiter.size();
+        size_t tail = std::min(carry.size(), length - 1);
+        std::vector<uint8_t> seam(carry.end() - tail, carry.end());
+        seam.insert(seam.end(), data, data + std::min(size, length - 1));
+        for (size_t i = 0; i + length <= seam.size(); i++) {
+            if (delimiterAt(seam.data() + i)) {
+                return i + length - tail;
+            }
+        }
+        return firstBoundary(data, 0, size);
+    }
+};
+
+} // namespace xec
@@ -0,0 +1,478 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <ctime>
+#include <linux/futex.h>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <random>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "Allocator.hpp"
+#include "Topology.hpp"
+
+// Work-stealing task runtime for `thread` blocks.
+//
+// One worker per core, each owning a Chase-Lev deque: the owner pushes and pops tasks at the
+// bottom without contention, idle workers steal the oldest task from the top of a random victim.
+// Threads outside the pool submit through a shared injection queue. A worker that finds nothing
+// after a short spin parks on a futex and is woken by the next submission, so an idle pool costs
+// nothing and a busy one never makes a system call to schedule.
+//
+// Tasks are a function pointer plus their captures in one pooled allocation, so spawning costs an
+// allocation from the thread's cache and a deque push: tens of nanoseconds instead of the
+// microseconds it takes to create a thread. TaskGroup is fork/join: wait() runs other tasks until
+// the group's own have finished. parallelFor splits a range in halves down to a grain size, and
+// the halves are stolen as whole subranges, so work is spread in O(log n) steals.
+//
+// Under a placement policy (XEC_PLACEMENT=compact|spread for the shared instance) workers are
+// pinned to cores, and a thief tries the workers on its own NUMA node before crossing to another,
+// so stolen tasks tend to find their data in the local memory and caches.
+
+namespace xec {
+
+namespace detail {
+
+inline void futexWait(std::atomic<uint32_t>* word, uint32_t expected, long timeoutNanoseconds = 0) {
+    timespec timeout{0, timeoutNanoseconds};
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE, expected,
+            timeoutNanoseconds ? &timeout : nullptr, nullptr, 0);
+}
+
+inline void futexWake(std::atomic<uint32_t>* word, int count) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+} // namespace detail
+
+class TaskGroup;
+
+struct Task {
+    void (*run)(Task*) = nullptr;   // Runs the task and frees it
+    TaskGroup* group = nullptr;
+};
+
+// Chase-Lev deque (Lê, Pop, Cohen, Zappa Nardelli, "Correct and efficient work-stealing for weak
+// memory models"). Grows when full; retired arrays are kept until the deque dies because a thief
+// may still be reading one.
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(size_t capacity = 256) {
+        arrays.emplace_back(new Array(capacity));
+        array.store(arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // Owner only
+    void push(Task* task) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Array* a = array.load(std::memory_order_relaxed);
+        if (b - t >= static_cast<int64_t>(a->capacity)) {
+            a = grow(a, t, b);
+        }
+        a->put(b, task);
+        bottom.store(b + 1, std::memory_order_release);
+    }
+
+    // Owner only; newest task first
+    Task* pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Array* a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        Task* task = a->get(b);
+        if (t == b) {
+            // Last task: race the thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                task = nullptr;
+            }
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return task;
+    }
+
+    // Any thread; oldest task first. Null when empty or when another thief won.
+    Task* steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        Array* a = array.load(std::memory_order_acquire);
+        Task* task = a->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return task;
+    }
+
+    bool empty() const {
+        return top.load(std::memory_order_acquire) >= bottom.load(std::memory_order_acquire);
+    }
+
+private:
+    struct Array {
+        explicit Array(size_t capacity) : capacity(capacity), mask(capacity - 1), slots(new std::atomic<Task*>[capacity]) {}
+
+        Task* get(int64_t index) const { return slots[index & mask].load(std::memory_order_relaxed); }
+        void put(int64_t index, Task* task) { slots[index & mask].store(task, std::memory_order_relaxed); }
+
+        size_t capacity;
+        size_t mask;
+        std::unique_ptr<std::atomic<Task*>[]> slots;
+    };
+
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    std::atomic<Array*> array;
+    std::vector<std::unique_ptr<Array>> arrays; // Owner only
+
+    Array* grow(Array* old, int64_t t, int64_t b) {
+        arrays.emplace_back(new Array(old->capacity * 2));
+        Array* grown = arrays.back().get();
+        for (int64_t i = t; i < b; i++) {
+            grown->put(i, old->get(i));
+        }
+        array.store(grown, std::memory_order_release);
+        return grown;
+    }
+};
+
+// Tasks spawned into a group are joined by wait().
+//
+// `pending` counts the unfinished tasks plus one reference held by the group's owner, which wait()
+// drops. Whoever drops the count to zero finishes the group: it wakes the sleeping waiters and
+// then sets `done`, its last access to the group. The waiter returns only once `done` is set, so
+// it may destroy the group without a finisher still touching it.
+class TaskGroup {
+public:
+    TaskGroup() = default;
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    // Outside wait(): no spawned task is outstanding
+    bool finished() const { return pending.load(std::memory_order_acquire) == 1; }
+
+private:
+    friend class TaskScheduler;
+
+    std::atomic<uint32_t> pending{1};
+    std::atomic<uint32_t> sleepers{0};
+    std::atomic<uint32_t> done{0};
+
+    // True if this dropped the last reference and the group is done
+    bool finishOne() {
+        if (pending.fetch_sub(1, std::memory_order_seq_cst) != 1) {
+            return false;
+        }
+        if (sleepers.load(std::memory_order_seq_cst)) {
+            detail::futexWake(&pending, INT_MAX);
+        }
+        done.store(1, std::memory_order_release);
+        return true;
+    }
+};
+
+class TaskScheduler {
+public:
+    explicit TaskScheduler(unsigned workerCount = std::max(1u, std::thread::hardware_concurrency()),
+                           Placement placement = Placement::NONE) {
+        cores = Topology::current().assign(placement, workerCount);
+        for (unsigned i = 0; i < workerCount; i++) {
+            workers.emplace_back(new Worker());
+            workers.back()->node = cores.empty() ? 0 : std::max(0, Topology::current().nodeOf(cores[i]));
+        }
+        // Steal order: workers on the same node, then the rest
+        for (unsigned i = 0; i < workerCount; i++) {
+            for (unsigned j = 0; j < workerCount; j++) {
+                if (j != i) {
+                    (workers[j]->node == workers[i]->node ? workers[i]->nearVictims : workers[i]->farVictims).push_back(j);
+                }
+            }
+        }
+        for (unsigned i = 0; i < workerCount; i++) {
+            workers[i]->thread = std::thread(&TaskScheduler::workerLoop, this, i);
+        }
+    }
+
+    ~TaskScheduler() {
+        stopping.store(true, std::memory_order_seq_cst);
+        epoch.fetch_add(1, std::memory_order_seq_cst);
+        detail::futexWake(&epoch, INT_MAX);
+        for (auto& worker : workers) {
+            worker->thread.join();
+        }
+    }
+
+    static TaskScheduler& instance() {
+        static TaskScheduler scheduler(std::max(1u, std::thread::hardware_concurrency()), parsePlacement(std::getenv("XEC_PLACEMENT")));
+        return scheduler;
+    }
+
+    // NUMA node index of each worker; all 0 without a placement policy
+    std::vector<int> workerNodes() const {
+        std::vector<int> nodes;
+        for (auto& worker : workers) {
+            nodes.push_back(worker->node);
+        }
+        return nodes;
+    }
+
+    size_t size() const { return workers.size(); }
+
+    // Run `function` asynchronously as part of `group`
+    template <typename F>
+    void spawn(TaskGroup& group, F&& function) {
+        using Body = std::decay_t<F>;
+        struct FunctionTask : Task {
+            Body body;
+            explicit FunctionTask(F&& function) : body(std::forward<F>(function)) {}
+        };
+        void* memory = PoolAllocator::allocate(sizeof(FunctionTask));
+        auto* task = new (memory) FunctionTask(std::forward<F>(function));
+        task->run = [](Task* base) {
+            auto* self = static_cast<FunctionTask*>(base);
+            self->body();
+            self->~FunctionTask();
+            PoolAllocator::free(self, sizeof(FunctionTask));
+        };
+        submit(group, task);
+    }
+
+    // Submit a task built elsewhere (generated code); its run function must free it
+    void submit(TaskGroup& group, Task* task) {
+        task->group = &group;
+        group.pending.fetch_add(1, std::memory_order_relaxed);
+        if (current.scheduler == this) {
+            workers[current.index]->deque.push(task);
+        } else {
+            std::lock_guard<std::mutex> lock(injectionMutex);
+            injection.push_back(task);
+            injected.store(true, std::memory_order_release);
+        }
+        notify();
+    }
+
+    // Join. Workers run other tasks (any group's) meanwhile; threads outside the pool only sleep,
+    // since the pool already has a thread per core to run them.
+    void wait(TaskGroup& group) {
+        bool worker = current.scheduler == this;
+        unsigned idle = 0;
+        bool last = group.finishOne();
+        while (!last && !group.done.load(std::memory_order_acquire)) {
+            if (Task* task = worker ? findTask(current.index) : nullptr) {
+                execute(task);
+                idle = 0;
+                continue;
+            }
+            if (++idle < 64) {
+                detail::cpuRelax();
+                continue;
+            }
+            // The group's remaining tasks are running elsewhere; sleep until they finish. The
+            // timeout bounds the wait should new work for this thread appear meanwhile. Once the
+            // count is zero the finisher is about to set `done`, so this only spins.
+            group.sleepers.fetch_add(1, std::memory_order_seq_cst);
+            uint32_t pending = group.pending.load(std::memory_order_seq_cst);
+            if (pending != 0) {
+                detail::futexWait(&group.pending, pending, 1000000);
+            }
+            group.sleepers.fetch_sub(1, std::memory_order_relaxed);
+            idle = 0;
+        }
+        // Every finisher is gone; the group can be spawned into and waited on again
+        group.done.store(0, std::memory_order_relaxed);
+        group.pending.store(1, std::memory_order_relaxed);
+    }
+
+    // body(lo, hi) over [begin, end) in subranges of at most `grain` (0: about 8 per worker)
+    template <typename F>
+    void parallelFor(size_t begin, size_t end, size_t grain, F&& body) {
+        if (begin >= end) {
+            return;
+        }
+        if (grain == 0) {
+            grain = std::max<size_t>(1, (end - begin) / (workers.size() * 8));
+        }
+        TaskGroup group;
+        splitRange(group, begin, end, grain, body);
+        wait(group);
+    }
+
+private:
+    struct Worker {
+        WorkStealingDeque deque;
+        std::thread thread;
+        int node = 0;
+        std::vector<size_t> nearVictims;   // Other workers on this node
+        std::vector<size_t> farVictims;
+    };
+
+    // Zero-initialized like every thread_local: not a worker of any scheduler
+    struct Current {
+        TaskScheduler* scheduler;
+        size_t index;
+    };
+    static inline thread_local Current current;
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<unsigned> cores;   // Worker i's core; empty when workers are not pinned
+    std::mutex injectionMutex;
+    std::vector<Task*> injection;
+    std::atomic<bool> injected{false};
+    std::atomic<bool> stopping{false};
+    alignas(64) std::atomic<uint32_t> epoch{0};
+    std::atomic<uint32_t> sleepers{0};
+    std::atomic<uint32_t> searching{0};   // Idle workers still looking for work before parking
+
+    template <typename F>
+    void splitRange(TaskGroup& group, size_t lo, size_t hi, size_t grain, F& body) {
+        while (hi - lo > grain) {
+            size_t mid = lo + (hi - lo) / 2;
+            spawn(group, [this, &group, mid, hi, grain, &body] { splitRange(group, mid, hi, grain, body); });
+            hi = mid;
+        }
+        body(lo, hi);
+    }
+
+    // A searching worker will find the new task itself, so only wake a sleeper if nobody searches
+    void notify() {
+        if (searching.load(std::memory_order_seq_cst) == 0 && sleepers.load(std::memory_order_seq_cst) != 0) {
+            epoch.fetch_add(1, std::memory_order_seq_cst);
+            detail::futexWake(&epoch, 1);
+        }
+    }
+
+    static void execute(Task* task) {
+        TaskGroup* group = task->group;
+        task->run(task);
+        group->finishOne();
+    }
+
+    // Own deque, then the injection queue, then other workers: this node's first, each group
+    // starting at a random victim
+    Task* findTask(size_t self) {
+        if (Task* task = workers[self]->deque.pop()) {
+            return task;
+        }
+        if (injected.load(std::memory_order_acquire)) {
+            std::lock_guard<std::mutex> lock(injectionMutex);
+            if (!injection.empty()) {
+                Task* task = injection.back();
+                injection.pop_back();
+                injected.store(!injection.empty(), std::memory_order_release);
+                return task;
+            }
+        }
+        Worker& worker = *workers[self];
+        if (Task* task = stealFrom(worker.nearVictims)) {
+            return task;
+        }
+        return stealFrom(worker.farVictims);
+    }
+
+    Task* stealFrom(const std::vector<size_t>& victims) {
+        if (victims.empty()) {
+            return nullptr;
+        }
+        thread_local std::minstd_rand random(static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())));
+        size_t count = victims.size();
+        size_t start = random() % count;
+        for (size_t i = 0; i < count; i++) {
+            if (Task* task = workers[victims[(start + i) % count]]->deque.steal()) {
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    bool haveWork() const {
+        if (injected.load(std::memory_order_seq_cst)) {
+            return true;
+        }
+        for (auto& worker : workers) {
+            if (!worker->deque.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(size_t index) {
+        current = {this, index};
+        if (!cores.empty()) {
+            pinThread(cores[index]);
+        }
+        unsigned idle = 0;
+        bool isSearching = false;
+        while (!stopping.load(std::memory_order_acquire)) {
+            if (Task* task = findTask(index)) {
+                // The last searcher to find work wakes a sleeper to keep looking in its place
+                if (isSearching) {
+                    isSearching = false;
+                    if (searching.fetch_sub(1, std::memory_order_seq_cst) == 1) {
+                        notify();
+                    }
+                }
+                execute(task);
+                idle = 0;
+                continue;
+            }
+            if (!isSearching) {
+                isSearching = true;
+                searching.fetch_add(1, std::memory_order_seq_cst);
+            }
+            if (++idle < 128) {
+                detail::cpuRelax();
+                continue;
+            }
+            // Park. Submitters push before checking for searchers and sleepers, so either we see
+            // the work here or the futex sees the new epoch.
+            uint32_t seen = epoch.load(std::memory_order_seq_cst);
+            sleepers.fetch_add(1, std::memory_order_seq_cst);
+            isSearching = false;
+            searching.fetch_sub(1, std::memory_order_seq_cst);
+            if (!haveWork() && !stopping.load(std::memory_order_seq_cst)) {
+                detail::futexWait(&epoch, seen);
+            }
+            sleepers.fetch_sub(1, std::memory_order_seq_cst);
+            idle = 0;
+        }
+    }
+};
+
+} // namespace xec
+
+// Entry points for lowered `thread` blocks, defined in EntryPoints.cpp. A block becomes an
+// outlined function taking the enclosing frame; the enclosing function joins its group before
+// returning.
+extern "C" void* xec_task_group();
+extern "C" void xec_task_spawn(void* group, void (*function)(void*), void* frame);
+
+// Waits and frees the group
+extern "C" void xec_task_wait(void* group);
+extern "C" void xec_parallel_for(int64_t begin, int64_t end, int64_t grain,
+                                 void (*body)(void*, int64_t, int64_t), void* frame);
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Log.hpp"
+
+// Compile-time profiling for --time-trace.
+//
+// `TimeScope scope("Parse", path);` times the enclosing block. Each thread appends its finished
+// scopes to a buffer of its own, kept after the thread exits, so the backend's worker threads show
+// up as their own rows. At the end the driver writes every event in Chrome's trace-event format
+// (load it in chrome://tracing or Perfetto) and logs a summary table of time per phase.
+//
+// Until TimeTrace::enable() is called a scope only reads one atomic flag, so the timers stay in
+// release builds.
+
+namespace xec {
+
+struct TimeTraceEvent {
+    const char* name;     // Phase; a string literal
+    std::string detail;   // Function, module or pass argument; may be empty
+    uint64_t start;       // Microseconds since TimeTrace::enable()
+    uint64_t duration;    // Microseconds
+    uint32_t thread;
+};
+
+class TimeTrace {
+public:
+    static void enable() {
+        State& state = instance();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        if (!state.enabled.load(std::memory_order_relaxed)) {
+            state.origin = std::chrono::steady_clock::now();
+            state.enabled.store(true, std::memory_order_release);
+        }
+    }
+
+    static bool enabled() { return instance().enabled.load(std::memory_order_acquire); }
+
+    static uint64_t now() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - instance().origin).count());
+    }
+
+    static void record(const char* name, std::string detail, uint64_t start, uint64_t duration) {
+        Buffer& buffer = threadBuffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        buffer.events.push_back({name, std::move(detail), start, duration, buffer.thread});
+    }
+
+    // Every event recorded so far, ordered by start time
+    static std::vector<TimeTraceEvent> events() {
+        State& state = instance();
+        std::vector<TimeTraceEvent> all;
+        std::lock_guard<std::mutex> lock(state.mutex);
+        for (const auto& buffer : state.buffers) {
+            std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+            all.insert(all.end(), buffer->events.begin(), buffer->events.end());
+        }
+        std::stable_sort(all.begin(), all.end(), [](const TimeTraceEvent& a, const TimeTraceEvent& b) {
+            return a.start < b.start;
+        });
+        return all;
+    }
+
+    // {"traceEvents": [...]} with one complete ("X") event per scope
+    static void writeChromeTrace(const std::string& path) {
+        std::ofstream out(path);
+        if (!out) {
+            throw std::runtime_error("Cannot write time trace: " + path);
+        }
+        out << "{\"traceEvents\":[\n";
+        bool first = true;
+        for (const auto& event : events()) {
+            out << (first ? "" : ",\n") << "{\"name\":\"" << escape(event.name) << "\",\"cat\":\"compile\",\"ph\":\"X\",\"ts\":"
+                << event.start << ",\"dur\":" << event.duration << ",\"pid\":1,\"tid\":" << event.thread;
+            if (!event.detail.empty()) {
+                out << ",\"args\":{\"detail\":\"" << escape(event.detail) << "\"}";
+            }
+            out << "}";
+            first = false;
+        }
+        out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+        if (!out) {
+            throw std::runtime_error("Cannot write time trace: " + path);
+        }
+    }
+
+    // Per phase: count, total, average and longest, slowest first; then the slowest scopes that
+    // name a function or module. Nested phases are counted inside their parents as well.
+    static void logSummary(size_t slowest = 5) {
+        struct Phase {
+            uint64_t count = 0, total = 0, longest = 0;
+        };
+        std::vector<TimeTraceEvent> all = events();
+        std::map<std::string, Phase> phases;
+        uint64_t begin = UINT64_MAX, end = 0;
+        for (const auto& event : all) {
+            Phase& phase = phases[event.name];
+            phase.count++;
+            phase.total += event.duration;
+            phase.longest = std::max(phase.longest, event.duration);
+            begin = std::min(begin, event.start);
+            end = std::max(end, event.start + event.duration);
+        }
+        if (all.empty()) {
+            return;
+        }
+        std::vector<std::pair<std::string, Phase>> sorted(phases.begin(), phases.end());
+        std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second.total > b.second.total; });
+
+        double wall = static_cast<double>(end - begin);
+        Logger::logProfile(row("Phase", "Count", "Total ms", "Avg ms", "Max ms", "Wall %"));
+        for (const auto& [name, phase] : sorted) {
+            Logger::logProfile(row(name, std::to_string(phase.count), milliseconds(phase.total),
+                                   milliseconds(phase.total / phase.count), milliseconds(phase.longest),
+                                   format("%.1f", wall > 0 ? 100.0 * phase.total / wall : 0.0)));
+        }
+
+        std::vector<const TimeTraceEvent*> detailed;
+        for (const auto& event : all) {
+            if (!event.detail.empty()) {
+                detailed.push_back(&event);
+            }
+        }
+        std::stable_sort(detailed.begin(), detailed.end(), [](const auto* a, const auto* b) { return a->duration > b->duration; });
+        for (size_t i = 0; i < std::min(slowest, detailed.size()); i++) {
+            Logger::logProfile("Slowest: ", detailed[i]->name, " ", detailed[i]->detail, " ", milliseconds(detailed[i]->duration),
+                               " ms (thread ", detailed[i]->thread, ")");
+        }
+    }
+
+private:
+    struct Buffer {
+        std::mutex mutex;
+        std::vector<TimeTraceEvent> events;
+        uint32_t thread;
+    };
+
+    struct State {
+        std::atomic<bool> enabled{false};
+        std::chrono::steady_clock::time_point origin;
+        std::mutex mutex;
+        std::vector<std::shared_ptr<Buffer>> buffers;  // Outlive their threads
+    };
+
+    static State& instance() {
+        static State state;
+        return state;
+    }
+
+    static Buffer& threadBuffer() {
+        thread_local std::shared_ptr<Buffer> buffer = [] {
+            State& state = instance();
+            auto created = std::make_shared<Buffer>();
+            std::lock_guard<std::mutex> lock(state.mutex);
+            created->thread = static_cast<uint32_t>(state.buffers.size() + 1);
+            state.buffers.push_back(created);
+            return created;
+        }();
+        return *buffer;
+    }
+
+    static std::string escape(const std::string& text) {
+        std::string escaped;
+        for (char c : text) {
+            if (c == '"' || c == '\\') {
+                escaped += '\\';
+                escaped += c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                escaped += format("\\u%04x", c);
+            } else {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    template <typename... Args>
+    static std::string format(const char* pattern, Args... args) {
+        char buffer[64];
+        std::snprintf(buffer, sizeof(buffer), pattern, args...);
+        return buffer;
+    }
+
+    static std::string milliseconds(uint64_t microseconds) { return format("%.3f", microseconds / 1000.0); }
+
+    static std::string row(const std::string& name, const std::string& count, const std::string& total, const std::string& average,
+                           const std::string& longest, const std::string& share) {
+        std::string line = name.size() < 32 ? name + std::string(32 - name.size(), ' ') : name;
+        for (const std::string* column : {&count, &total, &average, &longest, &share}) {
+            line += std::string(column->size() < 11 ? 11 - column->size() : 1, ' ') + *column;
+        }
+        return line;
+    }
+};
+
+// Times the enclosing block; the detail names the function or module being worked on
+class TimeScope {
+public:
+    explicit TimeScope(const char* name) : name(name), active(TimeTrace::enabled()) {
+        if (active) {
+            start = TimeTrace::now();
+        }
+    }
+
+    TimeScope(const char* name, const std::string& detail) : TimeScope(name) {
+        if (active) {
+            this->detail = detail;
+        }
+    }
+
+    ~TimeScope() {
+        if (active) {
+            TimeTrace::record(name, std::move(detail), start, TimeTrace::now() - start);
+        }
+    }
+
+    TimeScope(const TimeScope&) = delete;
+    TimeScope& operator=(const TimeScope&) = delete;
+
+private:
+    const char* name;
+    std::string detail;
+    bool active;
+    uint64_t start = 0;
+};
+
+} // namespace xec
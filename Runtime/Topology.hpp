@@ -0,0 +1,294 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+// NUMA topology and thread placement.
+//
+// Topology lists the cores of each NUMA node as read from /sys/devices/system/node. Setting
+// XEC_TOPOLOGY=<nodes>x<cores per node>, or calling Topology::setCurrent(Topology::fake(...))
+// before any placed thread starts, substitutes a made-up machine so placement can be exercised on
+// a single-node box. Threads are then still pinned, folded onto the cores that exist, but no
+// memory is bound to the fake nodes; bytesPlacedOn() still counts where it would have gone.
+//
+// A Placement policy maps a pipeline's or the task scheduler's threads to cores:
+//   COMPACT  fill one node before using the next, so neighbouring stages share a node and its caches
+//   SPREAD   alternate between nodes, for memory bandwidth when the threads are independent
+// A pinned thread remembers its node. Buffers it consumes from (its input ring, its arena) are
+// placed on that node with mbind.
+
+namespace xec {
+
+enum class Placement { NONE, COMPACT, SPREAD };
+
+// "compact" or "spread"; anything else is NONE
+inline Placement parsePlacement(const char* name) {
+    if (name && std::strcmp(name, "compact") == 0) {
+        return Placement::COMPACT;
+    }
+    if (name && std::strcmp(name, "spread") == 0) {
+        return Placement::SPREAD;
+    }
+    return Placement::NONE;
+}
+
+class Topology {
+public:
+    struct Node {
+        unsigned id = 0;                 // Kernel node number, for mbind
+        std::vector<unsigned> cores;
+    };
+
+    std::vector<Node> nodes;
+    bool simulated = false;
+
+    static Topology fake(unsigned nodeCount, unsigned coresPerNode) {
+        Topology topology;
+        topology.simulated = true;
+        for (unsigned n = 0; n < std::max(1u, nodeCount); n++) {
+            Node node;
+            node.id = n;
+            for (unsigned c = 0; c < std::max(1u, coresPerNode); c++) {
+                node.cores.push_back(n * coresPerNode + c);
+            }
+            topology.nodes.push_back(std::move(node));
+        }
+        return topology;
+    }
+
+    static Topology detect() {
+        Topology topology;
+        for (unsigned id : readList("/sys/devices/system/node/online")) {
+            Node node;
+            node.id = id;
+            node.cores = readList("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+            if (!node.cores.empty()) {
+                topology.nodes.push_back(std::move(node));
+            }
+        }
+        if (topology.nodes.empty()) {
+            Node node;
+            for (unsigned c = 0; c < std::max(1u, std::thread::hardware_concurrency()); c++) {
+                node.cores.push_back(c);
+            }
+            topology.nodes.push_back(std::move(node));
+        }
+        return topology;
+    }
+
+    // XEC_TOPOLOGY if set, else the machine's
+    static const Topology& current() {
+        return slot();
+    }
+
+    static void setCurrent(Topology topology) {
+        slot() = std::move(topology);
+    }
+
+    size_t coreCount() const {
+        size_t count = 0;
+        for (const Node& node : nodes) {
+            count += node.cores.size();
+        }
+        return count;
+    }
+
+    // Index into `nodes` of the node holding `core`
+    int nodeOf(unsigned core) const {
+        for (size_t n = 0; n < nodes.size(); n++) {
+            if (std::find(nodes[n].cores.begin(), nodes[n].cores.end(), core) != nodes[n].cores.end()) {
+                return static_cast<int>(n);
+            }
+        }
+        return -1;
+    }
+
+    // Core for each of `threads` threads; empty for NONE. Wraps around when there are more threads
+    // than cores.
+    std::vector<unsigned> assign(Placement policy, size_t threads) const {
+        std::vector<unsigned> cores;
+        if (policy == Placement::NONE || nodes.empty()) {
+            return cores;
+        }
+        if (policy == Placement::COMPACT) {
+            std::vector<unsigned> order;
+            for (const Node& node : nodes) {
+                order.insert(order.end(), node.cores.begin(), node.cores.end());
+            }
+            for (size_t i = 0; i < threads; i++) {
+                cores.push_back(order[i % order.size()]);
+            }
+        } else {
+            for (size_t i = 0; i < threads; i++) {
+                const Node& node = nodes[i % nodes.size()];
+                cores.push_back(node.cores[(i / nodes.size()) % node.cores.size()]);
+            }
+        }
+        return cores;
+    }
+
+private:
+    static Topology& slot() {
+        static Topology topology = fromEnvironment();
+        return topology;
+    }
+
+    static Topology fromEnvironment() {
+        if (const char* spec = std::getenv("XEC_TOPOLOGY")) {
+            unsigned nodeCount = 0, coresPerNode = 0;
+            char separator = 0;
+            if (std::sscanf(spec, "%u%c%u", &nodeCount, &separator, &coresPerNode) == 3 && separator == 'x') {
+                return fake(nodeCount, coresPerNode);
+            }
+        }
+        return detect();
+    }
+
+    // Kernel list format: "0-3,8-11"
+    static std::vector<unsigned> readList(const std::string& path) {
+        std::vector<unsigned> values;
+        std::ifstream file(path);
+        std::string text;
+        if (!std::getline(file, text)) {
+            return values;
+        }
+        size_t position = 0;
+        while (position < text.size()) {
+            size_t end = text.find(',', position);
+            std::string range = text.substr(position, end == std::string::npos ? std::string::npos : end - position);
+            unsigned first = 0, last = 0;
+            int fields = std::sscanf(range.c_str(), "%u-%u", &first, &last);
+            if (fields >= 1) {
+                for (unsigned value = first; value <= (fields == 2 ? last : first); value++) {
+                    values.push_back(value);
+                }
+            }
+            if (end == std::string::npos) {
+                break;
+            }
+            position = end + 1;
+        }
+        return values;
+    }
+};
+
+namespace detail {
+
+inline int& threadNode() {
+    thread_local int node = -1;
+    return node;
+}
+
+inline std::array<std::atomic<uint64_t>, 64>& placedBytes() {
+    static std::array<std::atomic<uint64_t>, 64> bytes{};
+    return bytes;
+}
+
+} // namespace detail
+
+// Node the calling thread was pinned to, or -1
+inline int currentNode() {
+    return detail::threadNode();
+}
+
+// Pin the calling thread to `core` of the current topology. Best effort: a failing
+// sched_setaffinity (a restricted cpuset, say) leaves the thread where it is but its node is still
+// recorded for memory placement.
+inline void pinThread(unsigned core) {
+    const Topology& topology = Topology::current();
+    unsigned real = topology.simulated ? core % std::max(1u, std::thread::hardware_concurrency()) : core;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(real, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    detail::threadNode() = topology.nodeOf(core);
+}
+
+// Bytes allocateOnNode() has placed on node index `node` (bound, or counted only when simulated)
+inline uint64_t bytesPlacedOn(int node) {
+    return node >= 0 && node < 64 ? detail::placedBytes()[node].load(std::memory_order_relaxed) : 0;
+}
+
+// Page-granular memory preferring node index `node`; node < 0 leaves placement to first touch.
+// For buffers such as ring slots and arena blocks, not for small objects.
+inline void* allocateOnNode(size_t bytes, int node) {
+    void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    const Topology& topology = Topology::current();
+    if (node < 0 || static_cast<size_t>(node) >= topology.nodes.size()) {
+        return memory;
+    }
+    if (!topology.simulated && topology.nodes.size() > 1) {
+        constexpr int MPOL_PREFERRED_MODE = 1;   // linux/mempolicy.h
+        unsigned id = topology.nodes[node].id;
+        unsigned long mask[4] = {};
+        if (id < sizeof(mask) * 8) {
+            mask[id / (sizeof(unsigned long) * 8)] = 1ul << (id % (sizeof(unsigned long) * 8));
+            syscall(SYS_mbind, memory, bytes, MPOL_PREFERRED_MODE, mask, sizeof(mask) * 8, 0);
+        }
+    }
+    if (node < 64) {
+        detail::placedBytes()[node].fetch_add(bytes, std::memory_order_relaxed);
+    }
+    return memory;
+}
+
+inline void freeOnNode(void* memory, size_t bytes) {
+    munmap(memory, bytes);
+}
+
+// Fixed array of T on a node (see allocateOnNode), or on the heap when node < 0
+template <typename T>
+class NodeArray {
+public:
+    NodeArray(size_t count, int node) : count(count), mapped(node >= 0) {
+        size_t bytes = std::max<size_t>(count * sizeof(T), 1);
+        void* memory = mapped ? allocateOnNode(bytes, node) : ::operator new(bytes, std::align_val_t(alignof(T)));
+        items = static_cast<T*>(memory);
+        for (size_t i = 0; i < count; i++) {
+            new (items + i) T();
+        }
+    }
+
+    ~NodeArray() {
+        for (size_t i = 0; i < count; i++) {
+            items[i].~T();
+        }
+        if (mapped) {
+            freeOnNode(items, std::max<size_t>(count * sizeof(T), 1));
+        } else {
+            ::operator delete(items, std::align_val_t(alignof(T)));
+        }
+    }
+
+    NodeArray(const NodeArray&) = delete;
+    NodeArray& operator=(const NodeArray&) = delete;
+
+    T& operator[](size_t i) { return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+
+private:
+    size_t count;
+    bool mapped;
+    T* items;
+};
+
+} // namespace xec
@@ -0,0 +1,355 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+
+#include "Pipeline.hpp"
+
+// Load shedding for `truncate(...)` pipeline stages.
+//
+// A TruncationBuffer sits in front of the stage that follows it. Producers offer() chunks and never
+// block: when the buffer is over its limits it drops data according to its policy and counts the
+// drop. The buffer is a bounded lock-free multi-producer/multi-consumer ring (one sequence number
+// per cell), so neither side takes a lock.
+//
+//   FIFO       drop the oldest buffered chunks to make room for the new one
+//   LIFO       drop the incoming chunk
+//   THRESHOLD  like LIFO, and also drop incoming chunks while the process is over its RSS or CPU
+//              budget; both are sampled every few milliseconds, not on every offer
+
+namespace xec {
+
+enum class TruncationPolicy { FIFO, LIFO, THRESHOLD };
+
+struct TruncationLimits {
+    TruncationPolicy policy = TruncationPolicy::FIFO;
+    size_t maxChunks = 20;
+    size_t maxBytes = 0;       // 0: no byte limit
+    size_t maxRssBytes = 0;    // THRESHOLD only; 0: ignore memory
+    double maxCpuLoad = 0;     // THRESHOLD only; fraction of all cores, 0: ignore CPU
+    std::chrono::milliseconds sampleInterval{10};
+};
+
+// Data chunks only; checkpoint barriers are never dropped and not counted. Every offered chunk
+// ends up in exactly one of accepted, a drop counter or the buffer.
+struct TruncationStats {
+    uint64_t accepted = 0;      // Handed to the consumer
+
+    uint64_t droppedOldest = 0;
+    uint64_t droppedNewest = 0;
+    uint64_t droppedOverThreshold = 0;
+    size_t bufferedBytes = 0;
+
+    uint64_t dropped() const {
+        return droppedOldest + droppedNewest + droppedOverThreshold;
+    }
+};
+
+// Process-wide RSS and CPU load, refreshed at most once per interval by whichever thread notices
+// the sample is stale. Readers only load two relaxed atomics.
+class ResourceSampler {
+public:
+    static ResourceSampler& instance() {
+        static ResourceSampler sampler;
+        return sampler;
+    }
+
+    bool overloaded(size_t maxRssBytes, double maxCpuLoad, std::chrono::milliseconds interval) {
+        // Only every 64th call on a thread even looks at the clock
+        thread_local unsigned calls = 0;
+        if ((calls++ & 63) == 0) {
+            refresh(interval);
+        }
+        if (maxRssBytes && rssBytes.load(std::memory_order_relaxed) > maxRssBytes) {
+            return true;
+        }
+        return maxCpuLoad > 0 && cpuPermille.load(std::memory_order_relaxed) > maxCpuLoad * 1000;
+    }
+
+    size_t rss() const {
+        return rssBytes.load(std::memory_order_relaxed);
+    }
+
+    double cpuLoad() const {
+        return cpuPermille.load(std::memory_order_relaxed) / 1000.0;
+    }
+
+    void refresh(std::chrono::milliseconds interval) {
+        int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now().time_since_epoch()).count();
+        if (now < nextSample.load(std::memory_order_relaxed)) {
+            return;
+        }
+        bool expected = false;
+        if (!sampling.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return;
+        }
+        sample(now);
+        nextSample.store(now + std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count(),
+                         std::memory_order_relaxed);
+        sampling.store(false, std::memory_order_release);
+    }
+
+    ~ResourceSampler() {
+        if (statm >= 0) {
+            ::close(statm);
+        }
+    }
+
+private:
+    std::atomic<size_t> rssBytes{0};
+    std::atomic<uint32_t> cpuPermille{0};
+    std::atomic<int64_t> nextSample{0};
+    std::atomic<bool> sampling{false};
+    int statm = -1;
+    int64_t lastWall = 0;
+    int64_t lastCpu = 0;
+    long pageSize = sysconf(_SC_PAGESIZE);
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+
+    ResourceSampler() {
+        statm = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    }
+
+    void sample(int64_t now) {
+        // statm: size resident shared ...; pread on a kept-open descriptor avoids reopening
+        if (statm >= 0) {
+            char text[128];
+            ssize_t length = pread(statm, text, sizeof(text) - 1, 0);
+            if (length > 0) {
+                text[length] = '\0';
+                unsigned long size = 0, resident = 0;
+                if (std::sscanf(text, "%lu %lu", &size, &resident) == 2) {
+                    rssBytes.store(resident * pageSize, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        int64_t cpu = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000LL +
+                      (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000LL;
+        if (lastWall != 0 && now > lastWall) {
+            double load = static_cast<double>(cpu - lastCpu) / (now - lastWall) / cores;
+            cpuPermille.store(static_cast<uint32_t>(std::max(0.0, load) * 1000), std::memory_order_relaxed);
+        }
+        lastWall = now;
+        lastCpu = cpu;
+    }
+};
+
+class TruncationBuffer : public Inbox {
+public:
+    explicit TruncationBuffer(TruncationLimits limits)
+        : limits(limits), capacity(std::max<size_t>(1, limits.maxChunks)), cells(new Cell[capacity]) {
+        for (size_t i = 0; i < capacity; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Never blocks on data; the chunk is either buffered or dropped and counted. A checkpoint
+    // barrier is never dropped: under FIFO the oldest data makes room for it, otherwise it waits
+    // for the consumer to free a cell.
+    void offer(Chunk chunk) override {
+        if (chunk.isBarrier()) {
+            Chunk evicted;
+            while (!enqueue(chunk)) {
+                if (limits.policy == TruncationPolicy::FIFO && dequeue(evicted, true)) {
+                    bytes.fetch_sub(evicted.size, std::memory_order_relaxed);
+                    drops.oldest.fetch_add(1, std::memory_order_relaxed);
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+            return;
+        }
+        if (limits.maxBytes && chunk.size > limits.maxBytes) {
+            drops.newest.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (limits.policy == TruncationPolicy::THRESHOLD &&
+            (limits.maxRssBytes || limits.maxCpuLoad > 0) &&
+            ResourceSampler::instance().overloaded(limits.maxRssBytes, limits.maxCpuLoad, limits.sampleInterval)) {
+            drops.overThreshold.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        if (limits.policy == TruncationPolicy::FIFO) {
+            offerDroppingOldest(std::move(chunk));
+        } else {
+            offerDroppingNewest(std::move(chunk));
+        }
+    }
+
+    bool tryTake(Chunk& chunk) override {
+        if (!dequeue(chunk)) {
+            return false;
+        }
+        bytes.fetch_sub(chunk.size, std::memory_order_relaxed);
+        if (!chunk.isBarrier()) {
+            accepted.fetch_add(1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    void close() override {
+        closed.store(true, std::memory_order_release);
+    }
+
+    bool isClosed() const override {
+        return closed.load(std::memory_order_acquire);
+    }
+
+    TruncationStats stats() const {
+        TruncationStats stats;
+        stats.accepted = accepted.load(std::memory_order_relaxed);
+        stats.droppedOldest = drops.oldest.load(std::memory_order_relaxed);
+        stats.droppedNewest = drops.newest.load(std::memory_order_relaxed);
+        stats.droppedOverThreshold = drops.overThreshold.load(std::memory_order_relaxed);
+        stats.bufferedBytes = bytes.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    struct alignas(CACHE_LINE) Cell {
+        std::atomic<size_t> sequence;
+        std::atomic<bool> barrier{false};  // Lets eviction skip barriers without touching the chunk
+        Chunk chunk;
+    };
+
+    struct alignas(CACHE_LINE) DropCounters {
+        std::atomic<uint64_t> oldest{0};
+        std::atomic<uint64_t> newest{0};
+        std::atomic<uint64_t> overThreshold{0};
+    };
+
+    TruncationLimits limits;
+    size_t capacity;
+    std::unique_ptr<Cell[]> cells;
+    alignas(CACHE_LINE) std::atomic<size_t> head{0};
+    alignas(CACHE_LINE) std::atomic<size_t> tail{0};
+    alignas(CACHE_LINE) std::atomic<size_t> bytes{0};
+    alignas(CACHE_LINE) std::atomic<uint64_t> accepted{0};  // Bumped by consumers only
+    std::atomic<bool> closed{false};
+    DropCounters drops;
+
+    void offerDroppingOldest(Chunk chunk) {
+        size_t size = chunk.size;
+        size_t total = bytes.fetch_add(size, std::memory_order_relaxed) + size;
+        Chunk evicted;
+        while (limits.maxBytes && total > limits.maxBytes && dequeue(evicted, true)) {
+            total = bytes.fetch_sub(evicted.size, std::memory_order_relaxed) - evicted.size;
+            drops.oldest.fetch_add(1, std::memory_order_relaxed);
+        }
+        // A full ring always has something to evict unless consumers emptied it meanwhile, in which
+        // case the retry succeeds, or a checkpoint barrier is oldest, in which case this chunk goes
+        while (!enqueue(chunk)) {
+            if (dequeue(evicted, true)) {
+                bytes.fetch_sub(evicted.size, std::memory_order_relaxed);
+                drops.oldest.fetch_add(1, std::memory_order_relaxed);
+            } else if (!enqueue(chunk)) {
+                bytes.fetch_sub(size, std::memory_order_relaxed);
+                drops.newest.fetch_add(1, std::memory_order_relaxed);
+                return;
+            } else {
+                return;
+            }
+        }
+    }
+
+    void offerDroppingNewest(Chunk chunk) {
+        size_t size = chunk.size;
+        size_t current = bytes.load(std::memory_order_relaxed);
+        do {
+            if (limits.maxBytes && current + size > limits.maxBytes) {
+                drops.newest.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        } while (!bytes.compare_exchange_weak(current, current + size, std::memory_order_relaxed));
+
+        if (!enqueue(chunk)) {
+            bytes.fetch_sub(size, std::memory_order_relaxed);
+            drops.newest.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Leaves `chunk` untouched when the ring is full
+    bool enqueue(Chunk& chunk) {
+        size_t position = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[position % capacity];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0) {
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.barrier.store(chunk.isBarrier(), std::memory_order_relaxed);
+                    cell.chunk = std::move(chunk);
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // With `evicting`, fails rather than take a checkpoint barrier
+    bool dequeue(Chunk& chunk, bool evicting = false) {
+        size_t position = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[position % capacity];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+            if (difference == 0) {
+                if (evicting && cell.barrier.load(std::memory_order_relaxed)) {
+                    return false;
+                }
+                if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    chunk = std::move(cell.chunk);
+                    cell.sequence.store(position + capacity, std::memory_order_release);
+                    return true;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+// `truncate(...)` in a pipeline. The stage itself passes chunks through; the shedding happens in
+// its buffer, which the pipeline uses as this stage's input instead of a blocking ring.
+class TruncateStage : public Stage {
+public:
+    explicit TruncateStage(TruncationLimits limits) : buffer(limits) {}
+
+    std::string name() const override { return "truncate"; }
+
+    void process(Chunk chunk, Emitter& out) override {
+        out.emit(std::move(chunk));
+    }
+
+    Inbox* inbox() override { return &buffer; }
+
+    TruncationStats stats() const {
+        return buffer.stats();
+    }
+
+private:
+    TruncationBuffer buffer;
+};
+
+} // namespace xec